@@ -0,0 +1,73 @@
+# Copyright (c) 2017 Robert Wolterman
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy of
+# this software and associated documentation files (the "Software"), to deal in
+# the Software without restriction, including without limitation the rights to
+# use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+# of the Software, and to permit persons to whom the Software is furnished to do
+# so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+# CHIP_IO GPIOAsync
+# Takes GPIO edges on an asyncio event loop instead of the callback thread
+# The edges still need add_event_detect(), without a callback
+# Python 3 only
+
+import asyncio
+import CHIP_IO.GPIO as GPIO
+
+class EventReader(object):
+    """Watches GPIO.event_fileno() on an event loop and hands every queued
+    edge to handler(channel, edge, timestamp, level, count) on the loop thread"""
+
+    def __init__(self, handler, loop=None):
+        self.handler = handler
+        self.loop = loop if loop is not None else asyncio.get_event_loop()
+        self.fd = GPIO.event_fileno()
+        self.loop.add_reader(self.fd, self._ready)
+        # edges queued before the reader was added
+        self.loop.call_soon(self._ready)
+
+    def _ready(self):
+        for event in GPIO.read_events():
+            self.handler(*event)
+
+    def close(self):
+        if self.fd is not None:
+            self.loop.remove_reader(self.fd)
+            self.fd = None
+
+def add_event_reader(handler, loop=None):
+    """Start taking edges on the loop, returns the EventReader, close() it to stop"""
+    return EventReader(handler, loop)
+
+class EventQueue(EventReader):
+    """Edges as an asyncio.Queue of (channel, edge, timestamp, level, count) tuples
+    events = EventQueue()
+    channel, edge, timestamp, level, count = await events.get()"""
+
+    def __init__(self, loop=None, maxsize=0):
+        self.queue = asyncio.Queue(maxsize)
+        EventReader.__init__(self, self._put, loop)
+
+    def _put(self, *event):
+        try:
+            self.queue.put_nowait(event)
+        except asyncio.QueueFull:
+            # full, read_events() already took it so it is dropped
+            pass
+
+    def get(self):
+        return self.queue.get()
+
+    def get_nowait(self):
+        return self.queue.get_nowait()
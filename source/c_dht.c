@@ -0,0 +1,382 @@
+/*
+Copyright (c) 2017 Robert Wolterman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "c_dht.h"
+#include "common.h"
+#include "event_gpio.h"
+#include "cdev_gpio.h"
+
+// DHT11/DHT22 single wire sensor reader
+// The master holds the line low to wake the sensor and releases it.  The
+// sensor answers 80 us low and 80 us high, then sends 40 bits, each a 50 us
+// low followed by a high of 26-28 us for a 0 or 70 us for a 1.  Python
+// callbacks cannot tell those apart, so the line is sampled in a tight loop
+// in C with a CLOCK_MONOTONIC timestamp on every level change, and only the
+// high times are decoded afterwards.  The loop runs without the GIL and in
+// PIO mode every sample is one register load.  A capture that was preempted
+// loses edges, it fails the bit count or the checksum and is read again.
+
+// Start pulse, the DHT11 needs 18 ms, the DHT22 1 ms
+#define DHT11_START_NS  20000000ULL
+#define DHT22_START_NS  2000000ULL
+// The sensors answer at most once every 1 s (DHT11) or 2 s (DHT22)
+#define DHT11_REST_NS   1000000000ULL
+#define DHT22_REST_NS   2000000000ULL
+// A high longer than this is a 1 bit
+#define DHT_BIT_NS      48000ULL
+// The line stays released this long after the last bit, or with no sensor
+#define DHT_IDLE_NS     500000ULL
+// The whole answer takes about 5 ms
+#define DHT_CAPTURE_NS  10000000ULL
+
+struct dht_edge
+{
+    uint64_t timestamp;
+    unsigned int level;        /* level after the edge */
+};
+
+// One capture at a time, two in parallel would only disturb each other
+static pthread_mutex_t dht_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// How the line is driven and read and how time passes, the selftest swaps
+// in a simulated sensor on a virtual clock
+static int (*line_release)(const struct fast_pin *fp, int release) = fast_pin_release;
+static int (*line_get)(const struct fast_pin *fp, unsigned int *value) = fast_pin_get;
+static uint64_t (*dht_now)(void) = monotonic_ns;
+static void (*dht_wait)(uint64_t deadline) = wait_until_ns;
+
+// Wakes the sensor and records the level changes of its answer.  Returns
+// the number of edges.
+static int capture(const struct fast_pin *fp, int type, struct dht_edge *edges)
+{
+    unsigned int level, value;
+    uint64_t start, now, last;
+    int count = 0;
+
+    start = dht_now();
+    if (line_release(fp, 0) < 0)
+        return -1;
+    dht_wait(start + (type == DHT11 ? DHT11_START_NS : DHT22_START_NS));
+    if (line_release(fp, 1) < 0)
+        return -1;
+
+    level = 1;
+    start = last = dht_now();
+    for (;;) {
+        if (line_get(fp, &value) < 0)
+            return -1;
+        now = dht_now();
+        if (value != level) {
+            if (count < DHT_EDGES) {
+                edges[count].timestamp = now;
+                edges[count].level = value;
+                count++;
+            }
+            level = value;
+            last = now;
+        } else if (level && now - last > DHT_IDLE_NS) {
+            break;
+        }
+        if (now - start > DHT_CAPTURE_NS)
+            break;
+    }
+
+    return count;
+}
+
+// Decodes the last 40 high times, the ones before are the response
+static int decode(const struct dht_edge *edges, int count, uint8_t *data)
+{
+    char err[256];
+    uint64_t widths[DHT_EDGES];
+    int highs = 0, i;
+
+    for (i = 0; i + 1 < count; i++)
+        if (edges[i].level && !edges[i + 1].level)
+            widths[highs++] = edges[i + 1].timestamp - edges[i].timestamp;
+
+    if (highs < 40) {
+        snprintf(err, sizeof(err), "dht_read: %s, got %d bits of 40", count ? "answer cut short" : "no answer", highs > 0 ? highs - 1 : 0);
+        add_error_msg(err);
+        return -1;
+    }
+
+    memset(data, 0, 5);
+    for (i = 0; i < 40; i++)
+        if (widths[highs - 40 + i] > DHT_BIT_NS)
+            data[i / 8] |= 0x80 >> (i % 8);
+
+    if (((data[0] + data[1] + data[2] + data[3]) & 0xff) != data[4]) {
+        snprintf(err, sizeof(err), "dht_read: checksum %02x does not match %02x %02x %02x %02x",
+                 data[4], data[0], data[1], data[2], data[3]);
+        add_error_msg(err);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void convert(int type, const uint8_t *data, struct dht_reading *reading)
+{
+    if (type == DHT11) {
+        // integral and decimal bytes, bit 7 of the decimal is the sign on newer parts
+        reading->humidity = (data[0] * 10 + data[1]) / 10.0;
+        reading->temperature = (data[2] * 10 + (data[3] & 0x7f)) / 10.0;
+        if (data[3] & 0x80)
+            reading->temperature = -reading->temperature;
+    } else {
+        // tenths, sign and magnitude
+        reading->humidity = ((data[0] << 8) | data[1]) / 10.0;
+        reading->temperature = (((data[2] & 0x7f) << 8) | data[3]) / 10.0;
+        if (data[2] & 0x80)
+            reading->temperature = -reading->temperature;
+    }
+}
+
+// Reads a DHT11 or DHT22 on gpio, trying up to retries more times when an
+// answer is missing or fails its checksum.  Blocks for a second or two per
+// retry, the sensors do not answer more often.
+int dht_read(int gpio, int type, int retries, struct dht_reading *reading)
+{
+    char err[256];
+    struct dht_edge edges[DHT_EDGES];
+    struct fast_pin fp;
+    uint8_t data[5];
+    unsigned int value;
+    int attempt, count, ret = -1;
+
+    if (DEBUG)
+        printf(" ** dht_read: gpio %d, DHT%d, %d retries **\n", gpio, type, retries);
+
+    if (type != DHT11 && type != DHT22) {
+        snprintf(err, sizeof(err), "dht_read: unknown sensor type %d", type);
+        add_error_msg(err);
+        return -1;
+    }
+
+    pthread_mutex_lock(&dht_lock);
+    if (fast_pin_open_drain(&fp, gpio) < 0) {
+        fast_pin_close(&fp);
+        pthread_mutex_unlock(&dht_lock);
+        return -1;
+    }
+
+    for (attempt = 0; attempt <= retries; attempt++) {
+        if (attempt > 0) {
+            dht_wait(dht_now() + (type == DHT11 ? DHT11_REST_NS : DHT22_REST_NS));
+            clear_error_msg();
+        }
+        if (line_get(&fp, &value) < 0)
+            break;
+        if (!value) {
+            snprintf(err, sizeof(err), "dht_read: the line (gpio %d) is held low", gpio);
+            add_error_msg(err);
+            continue;
+        }
+        if ((count = capture(&fp, type, edges)) < 0)
+            break;
+        if (decode(edges, count, data) == 0) {
+            convert(type, data, reading);
+            reading->retries = attempt;
+            ret = 0;
+            break;
+        }
+        if (DEBUG)
+            printf(" ** dht_read: attempt %d failed (%s) **\n", attempt + 1, get_error_msg());
+    }
+
+    fast_pin_close(&fp);
+    pthread_mutex_unlock(&dht_lock);
+
+    return ret;
+}
+
+// A simulated sensor on a virtual clock for the selftest.  Its answer is
+// laid out as level changes relative to the release of the start pulse,
+// and every sample of the line moves the clock on by sample_ns.
+static struct
+{
+    uint64_t now;
+    uint64_t sample_ns;
+    uint64_t fall;
+    uint64_t release;
+    uint64_t min_start;        /* shorter start pulses get no answer */
+    int answering;
+    int bad_answers;           /* answers sent with a bit flipped */
+    int flip;
+    int held_low;
+    uint8_t data[5];
+    uint64_t edge[84];         /* times of the level changes, starting high */
+    int edges;
+} sim;
+
+static void sim_answer(void)
+{
+    uint64_t t = sim.release + 30000;
+    int i, bit;
+
+    sim.edges = 0;
+    sim.edge[sim.edges++] = t;             /* low 80 us */
+    sim.edge[sim.edges++] = t += 80000;    /* high 80 us */
+    t += 80000;
+    for (i = 0; i < 40; i++) {
+        bit = (sim.data[i / 8] >> (7 - i % 8)) & 1;
+        if (i == 17 && sim.flip)
+            bit = !bit;
+        sim.edge[sim.edges++] = t;         /* low 50 us */
+        sim.edge[sim.edges++] = t += 50000;
+        t += bit ? 70000 : 27000;
+    }
+    sim.edge[sim.edges++] = t;             /* low 50 us and released */
+    sim.edge[sim.edges++] = t + 50000;
+}
+
+static int sim_release(const struct fast_pin *fp, int release)
+{
+    if (!release) {
+        sim.fall = sim.now;
+        sim.answering = 0;
+        return 0;
+    }
+    sim.release = sim.now;
+    if (sim.release - sim.fall >= sim.min_start && !sim.held_low) {
+        sim.flip = sim.bad_answers > 0;
+        if (sim.bad_answers > 0)
+            sim.bad_answers--;
+        sim_answer();
+        sim.answering = 1;
+    }
+    return 0;
+}
+
+static int sim_get(const struct fast_pin *fp, unsigned int *value)
+{
+    int i;
+
+    *value = !sim.held_low;
+    if (sim.answering)
+        for (i = 0; i < sim.edges && sim.edge[i] <= sim.now; i++)
+            *value = !*value;
+    sim.now += sim.sample_ns;
+    return 0;
+}
+
+static uint64_t sim_now(void)
+{
+    return sim.now;
+}
+
+static void sim_wait(uint64_t deadline)
+{
+    if (deadline > sim.now)
+        sim.now = deadline;
+}
+
+static void sim_set(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3)
+{
+    sim.data[0] = b0;
+    sim.data[1] = b1;
+    sim.data[2] = b2;
+    sim.data[3] = b3;
+    sim.data[4] = b0 + b1 + b2 + b3;
+}
+
+int dht_selftest(void)
+{
+    uint8_t *saved_memmap = memmap;
+    int saved_mode = gpio_get_pio_mode();
+    struct dht_reading r;
+    uint64_t start;
+
+    ASSRT(0 == map_pio_anonymous());
+    ASSRT(0 == gpio_set_pio_mode(1));
+    // CSID0 is PE4
+    gpio_set_pio_capable(132, 1);
+    memset(&sim, 0, sizeof(sim));
+    sim.now = 1000000000ULL;
+    sim.sample_ns = 2000;
+    line_release = sim_release;
+    line_get = sim_get;
+    dht_now = sim_now;
+    dht_wait = sim_wait;
+
+    printf("Testing DHT22 read\n");
+    sim.min_start = 1000000ULL;
+    sim_set(0x02, 0x8c, 0x01, 0x5f);  /* 65.2 %RH, 35.1 C, the datasheet example */
+    ASSRT(0 == dht_read(132, DHT22, 0, &r));
+    ASSRT(65.2 == r.humidity && 35.1 == r.temperature && 0 == r.retries);
+    sim_set(0x01, 0x90, 0x80, 0x65);  /* 40.0 %RH, -10.1 C */
+    ASSRT(0 == dht_read(132, DHT22, 0, &r));
+    ASSRT(40.0 == r.humidity && -10.1 == r.temperature);
+    // a coarse sample of the line still tells 27 from 70 us
+    sim.sample_ns = 15000;
+    ASSRT(0 == dht_read(132, DHT22, 0, &r));
+    ASSRT(40.0 == r.humidity && -10.1 == r.temperature);
+    sim.sample_ns = 2000;
+
+    printf("Testing DHT11 read\n");
+    sim.min_start = 18000000ULL;
+    sim_set(45, 0, 23, 4);  /* 45 %RH, 23.4 C */
+    ASSRT(-1 == dht_read(132, DHT22, 0, &r));  /* start pulse too short to wake it */
+    ASSRT(0 == dht_read(132, DHT11, 0, &r));
+    ASSRT(45.0 == r.humidity && 23.4 == r.temperature);
+
+    printf("Testing DHT retries\n");
+    sim.bad_answers = 2;
+    start = sim.now;
+    ASSRT(0 == dht_read(132, DHT11, 3, &r));
+    ASSRT(45.0 == r.humidity && 2 == r.retries);
+    ASSRT(sim.now - start >= 2 * DHT11_REST_NS);
+    sim.bad_answers = 2;
+    ASSRT(-1 == dht_read(132, DHT11, 1, &r));
+    ASSRT(strstr(get_error_msg(), "checksum"));
+    sim.held_low = 1;
+    ASSRT(-1 == dht_read(132, DHT11, 0, &r));
+    sim.held_low = 0;
+    ASSRT(-1 == dht_read(132, 12, 0, &r));
+
+    line_release = fast_pin_release;
+    line_get = fast_pin_get;
+    dht_now = monotonic_ns;
+    dht_wait = wait_until_ns;
+    gpio_set_pio_capable(132, 0);
+    unmap_pio_anonymous();
+    memmap = saved_memmap;
+
+    printf("Testing DHT outside PIO mode\n");
+    // a chardev line on a stub chip with a pull-up and no sensor
+    ASSRT(0 == gpio_set_pio_mode(0));
+    ASSRT(0 == cdev_selftest_chip(1000));
+    clear_error_msg();
+    ASSRT(-1 == dht_read(1004, DHT22, 0, &r));
+    ASSRT(strstr(get_error_msg(), "no answer"));
+    cdev_selftest_chip_remove();
+    clear_error_msg();
+    gpio_set_pio_mode(saved_mode);
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+/*
+Copyright (c) 2017 Robert Wolterman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <stdint.h>
+
+// Sensor types, the number on the part.  The AM2302 is a DHT22.
+#define DHT11 11
+#define DHT22 22
+
+// Edges captured in one read: the response and 40 bits take 82
+#define DHT_EDGES 100
+
+struct dht_reading
+{
+    double humidity;           /* %RH */
+    double temperature;        /* degrees C */
+    int retries;               /* failed attempts before this reading */
+};
+
+int dht_read(int gpio, int type, int retries, struct dht_reading *reading);
+int dht_selftest(void);
@@ -0,0 +1,856 @@
+/*
+Copyright (c) 2017 Robert Wolterman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "c_onewire.h"
+#include "common.h"
+#include "event_gpio.h"
+#include "cdev_gpio.h"
+
+// 1-Wire bus master
+// The bus is one open drain pin, driven low as an output and released as an
+// input, with the usual 4.7k pull-up.  Slots use the standard speed timings
+// of Maxim AN126, each placed against the time the slot started; the gaps
+// are a few us and are spun by wait_until_ns().  A read slot samples 12 us
+// after it starts, which only the PIO register path reliably makes, so
+// GPIO.set_pio_mode(True) is a must for anything but the slowest pins.
+// Everything runs under the bus lock without the GIL.  A slot a preemption
+// stretched corrupts a bit; the CRCs catch that and the transfer is retried.
+
+// Standard speed slot timings, ns
+#define OW_RESET_LOW   480000ULL
+#define OW_PRESENCE    70000ULL    /* after the reset pulse */
+#define OW_RESET_SLOT  960000ULL
+#define OW_WRITE1_LOW  6000ULL
+#define OW_WRITE0_LOW  60000ULL
+#define OW_READ_LOW    3000ULL
+#define OW_READ_SAMPLE 12000ULL
+#define OW_SLOT        70000ULL
+
+// DS18x20 commands
+#define OW_SEARCH_ROM  0xF0
+#define OW_MATCH_ROM   0x55
+#define OW_SKIP_ROM    0xCC
+#define OW_CONVERT_T   0x44
+#define OW_READ_SCRATCHPAD 0xBE
+#define OW_FAMILY_DS18S20 0x10
+
+// A 12 bit conversion takes up to 750 ms
+#define OW_CONVERT_NS  750000000ULL
+
+struct onewire_bus
+{
+    int in_use;
+    struct fast_pin pin;
+    pthread_mutex_t lock;      /* held for a whole slot sequence */
+};
+
+static struct onewire_bus buses[ONEWIRE_MAX];
+static pthread_mutex_t onewire_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// How the line is driven and read and how time passes, the selftest swaps
+// in simulated devices on a virtual clock
+static int (*line_release)(const struct fast_pin *fp, int release) = fast_pin_release;
+static int (*line_get)(const struct fast_pin *fp, unsigned int *value) = fast_pin_get;
+static uint64_t (*ow_now)(void) = monotonic_ns;
+static void (*ow_wait)(uint64_t deadline) = wait_until_ns;
+
+uint8_t onewire_crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0, in;
+    size_t i;
+    int b;
+
+    for (i = 0; i < len; i++) {
+        in = data[i];
+        for (b = 0; b < 8; b++) {
+            int mix = (crc ^ in) & 1;
+            crc >>= 1;
+            if (mix)
+                crc ^= 0x8C;
+            in >>= 1;
+        }
+    }
+    return crc;
+}
+
+// Returns 1 if a device answered with a presence pulse, 0 if not
+static int reset_locked(struct onewire_bus *bus)
+{
+    char err[256];
+    unsigned int value;
+    uint64_t t = ow_now();
+
+    if (line_get(&bus->pin, &value) < 0)
+        return -1;
+    if (!value) {
+        snprintf(err, sizeof(err), "onewire: the bus (gpio %d) is held low", bus->pin.gpio);
+        add_error_msg(err);
+        return -1;
+    }
+    if (line_release(&bus->pin, 0) < 0)
+        return -1;
+    ow_wait(t + OW_RESET_LOW);
+    if (line_release(&bus->pin, 1) < 0)
+        return -1;
+    ow_wait(t + OW_RESET_LOW + OW_PRESENCE);
+    if (line_get(&bus->pin, &value) < 0)
+        return -1;
+    ow_wait(t + OW_RESET_SLOT);
+
+    return !value;
+}
+
+static int write_bit(struct onewire_bus *bus, unsigned int bit)
+{
+    uint64_t t = ow_now();
+
+    if (line_release(&bus->pin, 0) < 0)
+        return -1;
+    ow_wait(t + (bit ? OW_WRITE1_LOW : OW_WRITE0_LOW));
+    if (line_release(&bus->pin, 1) < 0)
+        return -1;
+    ow_wait(t + OW_SLOT);
+    return 0;
+}
+
+static int read_bit(struct onewire_bus *bus, unsigned int *bit)
+{
+    uint64_t t = ow_now();
+
+    if (line_release(&bus->pin, 0) < 0)
+        return -1;
+    ow_wait(t + OW_READ_LOW);
+    if (line_release(&bus->pin, 1) < 0)
+        return -1;
+    ow_wait(t + OW_READ_SAMPLE);
+    if (line_get(&bus->pin, bit) < 0)
+        return -1;
+    ow_wait(t + OW_SLOT);
+    return 0;
+}
+
+// Bytes go out least significant bit first
+static int write_locked(struct onewire_bus *bus, const uint8_t *data, size_t len)
+{
+    size_t i;
+    int b;
+
+    for (i = 0; i < len; i++)
+        for (b = 0; b < 8; b++)
+            if (write_bit(bus, (data[i] >> b) & 1) < 0)
+                return -1;
+    return 0;
+}
+
+static int read_locked(struct onewire_bus *bus, uint8_t *data, size_t len)
+{
+    unsigned int bit;
+    size_t i;
+    int b;
+
+    for (i = 0; i < len; i++) {
+        data[i] = 0;
+        for (b = 0; b < 8; b++) {
+            if (read_bit(bus, &bit) < 0)
+                return -1;
+            data[i] |= bit << b;
+        }
+    }
+    return 0;
+}
+
+// Reset, then match rom or skip the ROM with rom NULL
+static int select_locked(struct onewire_bus *bus, const uint64_t *rom)
+{
+    uint8_t cmd[9];
+    int i, present;
+
+    if ((present = reset_locked(bus)) < 0)
+        return -1;
+    if (!present) {
+        add_error_msg("onewire: no device answered the reset");
+        return -1;
+    }
+    if (rom == NULL) {
+        cmd[0] = OW_SKIP_ROM;
+        return write_locked(bus, cmd, 1);
+    }
+    cmd[0] = OW_MATCH_ROM;
+    for (i = 0; i < 8; i++)
+        cmd[1 + i] = (*rom >> (8 * i)) & 0xff;
+    return write_locked(bus, cmd, 9);
+}
+
+// One pass of the ROM search of Maxim AN187.  Returns 1 with the next ROM,
+// 0 when the bus has no devices and -1 on a bad bit or CRC
+static int search_next(struct onewire_bus *bus, uint64_t *rom, int *last_discrepancy)
+{
+    const uint8_t cmd = OW_SEARCH_ROM;
+    unsigned int id_bit, cmp_bit, dir;
+    uint8_t bytes[8];
+    int n, present, last_zero = 0;
+
+    if ((present = reset_locked(bus)) <= 0)
+        return present;
+    if (write_locked(bus, &cmd, 1) < 0)
+        return -1;
+
+    for (n = 1; n <= 64; n++) {
+        if (read_bit(bus, &id_bit) < 0 || read_bit(bus, &cmp_bit) < 0)
+            return -1;
+        if (id_bit && cmp_bit) {
+            add_error_msg("onewire: search lost every device");
+            return -1;
+        }
+        if (id_bit != cmp_bit) {
+            dir = id_bit;
+        } else {
+            // both a 0 and a 1 out there, take the branch for this pass
+            if (n < *last_discrepancy)
+                dir = (*rom >> (n - 1)) & 1;
+            else
+                dir = (n == *last_discrepancy);
+            if (!dir)
+                last_zero = n;
+        }
+        if (dir)
+            *rom |= 1ULL << (n - 1);
+        else
+            *rom &= ~(1ULL << (n - 1));
+        if (write_bit(bus, dir) < 0)
+            return -1;
+    }
+
+    for (n = 0; n < 8; n++)
+        bytes[n] = (*rom >> (8 * n)) & 0xff;
+    if (onewire_crc8(bytes, 8) != 0) {
+        add_error_msg("onewire: search found a ROM with a bad CRC");
+        return -1;
+    }
+    *last_discrepancy = last_zero;
+
+    return 1;
+}
+
+static int search_locked(struct onewire_bus *bus, uint64_t *roms, int max)
+{
+    uint64_t rom;
+    int count, last_discrepancy, ret, attempt;
+
+    for (attempt = 0; attempt < ONEWIRE_RETRIES; attempt++) {
+        rom = 0;
+        count = 0;
+        last_discrepancy = 0;
+        do {
+            if ((ret = search_next(bus, &rom, &last_discrepancy)) <= 0)
+                break;
+            if (count < max)
+                roms[count] = rom;
+            count++;
+        } while (last_discrepancy != 0);
+        if (ret >= 0)
+            return count;
+    }
+    return -1;
+}
+
+static int convert_locked(struct onewire_bus *bus, int poll)
+{
+    const uint8_t cmd = OW_CONVERT_T;
+    unsigned int done = 0;
+    uint64_t start;
+
+    if (select_locked(bus, NULL) < 0 || write_locked(bus, &cmd, 1) < 0)
+        return -1;
+    start = ow_now();
+
+    // Parasite powered devices cannot answer read slots while converting
+    if (!poll) {
+        ow_wait(start + OW_CONVERT_NS);
+        return 0;
+    }
+    while (!done) {
+        if (read_bit(bus, &done) < 0)
+            return -1;
+        if (!done && ow_now() - start > OW_CONVERT_NS + OW_CONVERT_NS / 4) {
+            add_error_msg("onewire: temperature conversion did not finish");
+            return -1;
+        }
+        if (!done)
+            ow_wait(ow_now() + 1000000ULL);
+    }
+    return 0;
+}
+
+static double scratchpad_temperature(uint64_t rom, const uint8_t *s)
+{
+    int16_t raw = (int16_t)(s[0] | (s[1] << 8));
+
+    // DS18S20: 0.5 degree steps, COUNT_REMAIN and COUNT_PER_C give the rest
+    if ((rom & 0xff) == OW_FAMILY_DS18S20) {
+        if (s[7] == 0)
+            return raw / 2.0;
+        return (raw >> 1) - 0.25 + (double)(s[7] - s[6]) / s[7];
+    }
+    // DS18B20, DS1822, DS1825: 1/16 degree
+    return raw / 16.0;
+}
+
+static int read_temperature_locked(struct onewire_bus *bus, uint64_t rom, double *temp)
+{
+    const uint8_t cmd = OW_READ_SCRATCHPAD;
+    uint8_t s[9];
+    int attempt, i;
+
+    for (attempt = 0; attempt < ONEWIRE_RETRIES; attempt++) {
+        if (select_locked(bus, &rom) < 0 || write_locked(bus, &cmd, 1) < 0 || read_locked(bus, s, 9) < 0)
+            return -1;
+        // a missing device reads all ones, which passes no CRC
+        for (i = 0; i < 9 && s[i] == 0xff; i++)
+            ;
+        if (i < 9 && onewire_crc8(s, 9) == 0) {
+            *temp = scratchpad_temperature(rom, s);
+            return 0;
+        }
+        if (DEBUG)
+            printf(" ** onewire: bad scratchpad CRC from %016llx, attempt %d **\n", (unsigned long long)rom, attempt + 1);
+    }
+    return -1;
+}
+
+int onewire_open(int gpio)
+{
+    char err[256];
+    struct onewire_bus *bus;
+    int id;
+
+    if (DEBUG)
+        printf(" ** onewire_open: gpio %d **\n", gpio);
+
+    pthread_mutex_lock(&onewire_table_lock);
+    for (id = 0; id < ONEWIRE_MAX; id++)
+        if (!buses[id].in_use)
+            break;
+    if (id == ONEWIRE_MAX) {
+        pthread_mutex_unlock(&onewire_table_lock);
+        snprintf(err, sizeof(err), "onewire_open: all %d buses are in use", ONEWIRE_MAX);
+        add_error_msg(err);
+        return -1;
+    }
+    bus = &buses[id];
+    if (fast_pin_open_drain(&bus->pin, gpio) < 0) {
+        fast_pin_close(&bus->pin);
+        pthread_mutex_unlock(&onewire_table_lock);
+        return -1;
+    }
+    pthread_mutex_init(&bus->lock, NULL);
+    bus->in_use = 1;
+    pthread_mutex_unlock(&onewire_table_lock);
+
+    return id;
+}
+
+// Returns the bus locked, or NULL with an error if id is not open
+static struct onewire_bus *bus_acquire(const char *func, int id)
+{
+    char err[256];
+    struct onewire_bus *bus;
+
+    pthread_mutex_lock(&onewire_table_lock);
+    if (id < 0 || id >= ONEWIRE_MAX || !buses[id].in_use) {
+        pthread_mutex_unlock(&onewire_table_lock);
+        snprintf(err, sizeof(err), "%s: bus %d is not open", func, id);
+        add_error_msg(err);
+        return NULL;
+    }
+    bus = &buses[id];
+    pthread_mutex_lock(&bus->lock);
+    pthread_mutex_unlock(&onewire_table_lock);
+
+    return bus;
+}
+
+int onewire_close(int id)
+{
+    char err[256];
+    struct onewire_bus *bus;
+
+    if (DEBUG)
+        printf(" ** onewire_close: %d **\n", id);
+
+    pthread_mutex_lock(&onewire_table_lock);
+    if (id < 0 || id >= ONEWIRE_MAX || !buses[id].in_use) {
+        pthread_mutex_unlock(&onewire_table_lock);
+        snprintf(err, sizeof(err), "onewire_close: bus %d is not open", id);
+        add_error_msg(err);
+        return -1;
+    }
+    bus = &buses[id];
+    // Waits for a running slot sequence to finish
+    pthread_mutex_lock(&bus->lock);
+    bus->in_use = 0;
+    fast_pin_close(&bus->pin);
+    pthread_mutex_unlock(&bus->lock);
+    pthread_mutex_destroy(&bus->lock);
+    pthread_mutex_unlock(&onewire_table_lock);
+
+    return 0;
+}
+
+// Returns 1 if a device answered with a presence pulse, 0 if not
+int onewire_reset(int id)
+{
+    struct onewire_bus *bus = bus_acquire("onewire_reset", id);
+    int ret;
+
+    if (bus == NULL)
+        return -1;
+    ret = reset_locked(bus);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Resets the bus and addresses the device with the given ROM, or all of
+// them with rom NULL, for the function command that follows
+int onewire_select(int id, const uint64_t *rom)
+{
+    struct onewire_bus *bus = bus_acquire("onewire_select", id);
+    int ret;
+
+    if (bus == NULL)
+        return -1;
+    ret = select_locked(bus, rom);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+int onewire_write(int id, const uint8_t *data, size_t len)
+{
+    struct onewire_bus *bus = bus_acquire("onewire_write", id);
+    int ret;
+
+    if (bus == NULL)
+        return -1;
+    ret = write_locked(bus, data, len);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+int onewire_read(int id, uint8_t *data, size_t len)
+{
+    struct onewire_bus *bus = bus_acquire("onewire_read", id);
+    int ret;
+
+    if (bus == NULL)
+        return -1;
+    ret = read_locked(bus, data, len);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Finds the ROMs of all devices on the bus, up to max are stored.  Returns
+// how many there are.
+int onewire_search(int id, uint64_t *roms, int max)
+{
+    struct onewire_bus *bus = bus_acquire("onewire_search", id);
+    int ret;
+
+    if (DEBUG)
+        printf(" ** onewire_search: %d **\n", id);
+    if (bus == NULL)
+        return -1;
+    ret = search_locked(bus, roms, max);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Starts a temperature conversion on every device at once and waits for it,
+// by polling read slots or for parasite powered devices the full 750 ms
+int onewire_convert_all(int id, int poll)
+{
+    struct onewire_bus *bus = bus_acquire("onewire_convert_all", id);
+    int ret;
+
+    if (DEBUG)
+        printf(" ** onewire_convert_all: %d **\n", id);
+    if (bus == NULL)
+        return -1;
+    ret = convert_locked(bus, poll);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Reads the scratchpads of count devices after onewire_convert_all().
+// valid[i] is 0 where the device kept failing its CRC.
+int onewire_read_temperatures(int id, const uint64_t *roms, int count, double *temps, int *valid)
+{
+    struct onewire_bus *bus = bus_acquire("onewire_read_temperatures", id);
+    int i;
+
+    if (bus == NULL)
+        return -1;
+    for (i = 0; i < count; i++)
+        valid[i] = (read_temperature_locked(bus, roms[i], &temps[i]) == 0);
+    pthread_mutex_unlock(&bus->lock);
+
+    return 0;
+}
+
+void onewire_cleanup(void)
+{
+    int id;
+
+    for (id = 0; id < ONEWIRE_MAX; id++)
+        if (buses[id].in_use)
+            onewire_close(id);
+}
+
+// Simulated DS18x20 devices on a virtual clock for the selftest.  The line
+// level at any time comes from the master, the presence pulse and the
+// devices sending a 0 bit, which hold the line for 30 us from the start of
+// the slot.  A device takes a slot as a 0 when the master held the line
+// for 15 us or more.
+#define SIM_DEVICES 3
+
+enum { DEV_IDLE, DEV_ROMCMD, DEV_SEARCH, DEV_MATCH, DEV_FUNC, DEV_CONVERT, DEV_SCRATCHPAD };
+
+struct sim_device
+{
+    uint64_t rom;
+    int16_t raw;               /* temperature register after a conversion */
+    uint8_t count_remain;      /* DS18S20 */
+    uint8_t scratchpad[9];
+    int state;
+    int pos;
+    int phase;                 /* search: bit, complement, direction */
+    uint8_t byte;
+    int busy;                  /* read slots a conversion answers 0 to */
+};
+
+static struct
+{
+    uint64_t now;
+    int master_low;
+    uint64_t fall;
+    int any_zero;              /* a device sends 0 in the current slot */
+    uint64_t presence_from;
+    uint64_t presence_until;
+    int held_low;              /* shorted bus */
+    int glitch;                /* next read slot a device answering 1 reads as 0 */
+    int convert_slots;
+    struct sim_device dev[SIM_DEVICES];
+} sim;
+
+static unsigned int sim_out(const struct sim_device *d)
+{
+    switch (d->state) {
+    case DEV_SEARCH:
+        if (d->phase == 2)
+            return 1;
+        return ((d->rom >> d->pos) & 1) ^ d->phase;
+    case DEV_CONVERT:
+        return d->busy == 0;
+    case DEV_SCRATCHPAD:
+        return (d->scratchpad[d->pos / 8] >> (d->pos % 8)) & 1;
+    }
+    return 1;
+}
+
+static void sim_function(struct sim_device *d)
+{
+    d->state = DEV_IDLE;
+    if (d->byte == OW_CONVERT_T) {
+        memset(d->scratchpad, 0, sizeof(d->scratchpad));
+        d->scratchpad[0] = d->raw & 0xff;
+        d->scratchpad[1] = (d->raw >> 8) & 0xff;
+        d->scratchpad[4] = 0x7f;
+        d->scratchpad[6] = d->count_remain;
+        d->scratchpad[7] = 0x10;
+        d->scratchpad[8] = onewire_crc8(d->scratchpad, 8);
+        d->busy = sim.convert_slots;
+        d->state = DEV_CONVERT;
+    } else if (d->byte == OW_READ_SCRATCHPAD) {
+        d->state = DEV_SCRATCHPAD;
+    }
+    d->pos = 0;
+}
+
+static void sim_slot(struct sim_device *d, unsigned int bit)
+{
+    switch (d->state) {
+    case DEV_ROMCMD:
+    case DEV_FUNC:
+        d->byte |= bit << d->pos;
+        if (++d->pos < 8)
+            return;
+        d->pos = 0;
+        if (d->state == DEV_FUNC) {
+            sim_function(d);
+        } else if (d->byte == OW_SEARCH_ROM) {
+            d->state = DEV_SEARCH;
+            d->phase = 0;
+        } else if (d->byte == OW_MATCH_ROM) {
+            d->state = DEV_MATCH;
+        } else if (d->byte == OW_SKIP_ROM) {
+            d->state = DEV_FUNC;
+            d->byte = 0;
+        } else {
+            d->state = DEV_IDLE;
+        }
+        break;
+    case DEV_SEARCH:
+        if (d->phase < 2) {
+            d->phase++;
+            return;
+        }
+        d->phase = 0;
+        if (bit != ((d->rom >> d->pos) & 1))
+            d->state = DEV_IDLE;
+        else if (++d->pos == 64)
+            d->state = DEV_IDLE;
+        break;
+    case DEV_MATCH:
+        if (bit != ((d->rom >> d->pos) & 1)) {
+            d->state = DEV_IDLE;
+        } else if (++d->pos == 64) {
+            d->state = DEV_FUNC;
+            d->pos = 0;
+            d->byte = 0;
+        }
+        break;
+    case DEV_CONVERT:
+        if (d->busy > 0)
+            d->busy--;
+        break;
+    case DEV_SCRATCHPAD:
+        if (++d->pos == 72)
+            d->state = DEV_IDLE;
+        break;
+    }
+}
+
+static int sim_release(const struct fast_pin *fp, int release)
+{
+    uint64_t held;
+    int i;
+
+    if (!release) {
+        if (!sim.master_low) {
+            sim.master_low = 1;
+            sim.fall = sim.now;
+            sim.any_zero = 0;
+            for (i = 0; i < SIM_DEVICES; i++)
+                if (sim.dev[i].rom && !sim_out(&sim.dev[i]))
+                    sim.any_zero = 1;
+        }
+        return 0;
+    }
+    if (!sim.master_low)
+        return 0;
+
+    sim.master_low = 0;
+    held = sim.now - sim.fall;
+    if (held >= OW_RESET_LOW) {
+        sim.any_zero = 0;
+        sim.presence_from = sim.presence_until = 0;
+        for (i = 0; i < SIM_DEVICES; i++) {
+            if (!sim.dev[i].rom)
+                continue;
+            sim.dev[i].state = DEV_ROMCMD;
+            sim.dev[i].pos = 0;
+            sim.dev[i].byte = 0;
+            sim.presence_from = sim.now + 30000;
+            sim.presence_until = sim.now + 150000;
+        }
+    } else {
+        unsigned int bit = held < 15000 && !sim.any_zero;
+        for (i = 0; i < SIM_DEVICES; i++)
+            if (sim.dev[i].rom)
+                sim_slot(&sim.dev[i], bit);
+    }
+    return 0;
+}
+
+static int sim_get(const struct fast_pin *fp, unsigned int *value)
+{
+    *value = !(sim.held_low || sim.master_low ||
+               (sim.any_zero && sim.now < sim.fall + 30000) ||
+               (sim.now >= sim.presence_from && sim.now < sim.presence_until));
+    if (*value && sim.glitch && sim.now > sim.fall && sim.now < sim.fall + 30000) {
+        sim.glitch--;
+        *value = 0;
+    }
+    return 0;
+}
+
+static uint64_t sim_now(void)
+{
+    return sim.now;
+}
+
+static void sim_wait(uint64_t deadline)
+{
+    if (deadline > sim.now)
+        sim.now = deadline;
+}
+
+// Family code in the low byte, CRC in the high byte
+static uint64_t sim_rom(uint8_t family, uint64_t serial)
+{
+    uint8_t bytes[8];
+    uint64_t rom = family | ((serial & 0xffffffffffffULL) << 8);
+    int i;
+
+    for (i = 0; i < 7; i++)
+        bytes[i] = (rom >> (8 * i)) & 0xff;
+    return rom | ((uint64_t)onewire_crc8(bytes, 7) << 56);
+}
+
+int onewire_selftest(void)
+{
+    uint8_t *saved_memmap = memmap;
+    int saved_mode = gpio_get_pio_mode();
+    const uint8_t check[8] = { 0x02, 0x1c, 0xb8, 0x01, 0x00, 0x00, 0x00, 0xa2 };
+    uint64_t roms[4], expect[SIM_DEVICES];
+    double temps[SIM_DEVICES];
+    int valid[SIM_DEVICES];
+    uint8_t cmd[2], s[9];
+    uint64_t start;
+    int i, j, id;
+
+    ASSRT(0 == map_pio_anonymous());
+    ASSRT(0 == gpio_set_pio_mode(1));
+    // CSID0 is PE4
+    gpio_set_pio_capable(132, 1);
+    memset(&sim, 0, sizeof(sim));
+    sim.now = 1000000000ULL;
+    line_release = sim_release;
+    line_get = sim_get;
+    ow_now = sim_now;
+    ow_wait = sim_wait;
+
+    printf("Testing 1-Wire CRC\n");
+    ASSRT(0 == onewire_crc8(check, 8));  /* the ROM of Maxim AN27 */
+    ASSRT(0xa2 == onewire_crc8(check, 7));
+
+    printf("Testing 1-Wire reset and presence\n");
+    ASSRT(-1 == onewire_reset(ONEWIRE_MAX));
+    ASSRT(0 <= (id = onewire_open(132)));
+    start = sim.now;
+    ASSRT(0 == onewire_reset(id));  /* nobody there */
+    ASSRT(sim.now - start == OW_RESET_SLOT);
+    sim.dev[0].rom = sim_rom(0x28, 0x0316a2794affULL);
+    sim.dev[0].raw = 0x0191;  /* 25.0625 */
+    sim.dev[1].rom = sim_rom(0x28, 0x0316a2794a00ULL);
+    sim.dev[1].raw = (int16_t)0xff5e;  /* -10.125 */
+    sim.dev[2].rom = sim_rom(OW_FAMILY_DS18S20, 0x000802b4c1d2ULL);
+    sim.dev[2].raw = 0x0032;  /* 25.0 */
+    sim.dev[2].count_remain = 0x0c;  /* +0.25 - 0.25 */
+    for (i = 0; i < SIM_DEVICES; i++)
+        expect[i] = sim.dev[i].rom;
+    ASSRT(1 == onewire_reset(id));
+    sim.held_low = 1;
+    ASSRT(-1 == onewire_reset(id));
+    sim.held_low = 0;
+
+    printf("Testing 1-Wire ROM search\n");
+    ASSRT(SIM_DEVICES == onewire_search(id, roms, 4));
+    for (i = 0; i < SIM_DEVICES; i++) {
+        for (j = 0; j < SIM_DEVICES && roms[j] != expect[i]; j++)
+            ;
+        ASSRT(j < SIM_DEVICES);
+    }
+    ASSRT(SIM_DEVICES == onewire_search(id, roms, 1));  /* counts past max */
+    sim.glitch = 1;  /* a phantom branch, the pass down it loses every device */
+    ASSRT(SIM_DEVICES == onewire_search(id, roms, 4));  /* CRC failed, searched again */
+
+    printf("Testing 1-Wire convert all and read all\n");
+    sim.convert_slots = 5;
+    start = sim.now;
+    ASSRT(0 == onewire_convert_all(id, 1));
+    ASSRT(sim.now - start < 10000000ULL);  /* polled, not the full 750 ms */
+    for (i = 0; i < SIM_DEVICES; i++)
+        ASSRT(0 == sim.dev[i].busy);
+    ASSRT(0 == onewire_read_temperatures(id, expect, SIM_DEVICES, temps, valid));
+    ASSRT(valid[0] && temps[0] == 25.0625);
+    ASSRT(valid[1] && temps[1] == -10.125);
+    ASSRT(valid[2] && temps[2] == 25.0);
+    start = sim.now;
+    ASSRT(0 == onewire_convert_all(id, 0));
+    ASSRT(sim.now - start >= OW_CONVERT_NS);
+    sim.convert_slots = 0x7fffffff;
+    ASSRT(-1 == onewire_convert_all(id, 1));
+    sim.convert_slots = 0;
+
+    printf("Testing 1-Wire match ROM\n");
+    ASSRT(0 == onewire_select(id, &expect[1]));
+    cmd[0] = OW_READ_SCRATCHPAD;
+    ASSRT(0 == onewire_write(id, cmd, 1));
+    ASSRT(0 == onewire_read(id, s, 9));
+    ASSRT(0 == onewire_crc8(s, 9) && 0x5e == s[0] && 0xff == s[1]);
+    ASSRT(DEV_SCRATCHPAD != sim.dev[0].state && DEV_SCRATCHPAD != sim.dev[2].state);
+    roms[0] = sim_rom(0x28, 0x123456ULL);  /* nobody answers, reads all ones */
+    ASSRT(0 == onewire_read_temperatures(id, roms, 1, temps, valid));
+    ASSRT(0 == valid[0]);
+    sim.glitch = 1;  /* a bad scratchpad is read again */
+    ASSRT(0 == onewire_read_temperatures(id, expect, 1, temps, valid));
+    ASSRT(valid[0] && temps[0] == 25.0625);
+
+    printf("Testing 1-Wire table\n");
+    for (i = 1; i < ONEWIRE_MAX; i++)
+        ASSRT(0 <= onewire_open(132));
+    ASSRT(-1 == onewire_open(132));
+    onewire_cleanup();
+    ASSRT(-1 == onewire_search(id, roms, 4));
+
+    line_release = fast_pin_release;
+    line_get = fast_pin_get;
+    ow_now = monotonic_ns;
+    ow_wait = wait_until_ns;
+    gpio_set_pio_capable(132, 0);
+    unmap_pio_anonymous();
+    memmap = saved_memmap;
+
+    printf("Testing 1-Wire outside PIO mode\n");
+    // a chardev line on a stub chip with a pull-up and nothing on the bus
+    ASSRT(0 == gpio_set_pio_mode(0));
+    ASSRT(0 == cdev_selftest_chip(1000));
+    ASSRT(0 <= (id = onewire_open(1002)));
+    ASSRT(0 == onewire_reset(id));
+    ASSRT(0 == onewire_close(id));
+    cdev_selftest_chip_remove();
+    clear_error_msg();
+    gpio_set_pio_mode(saved_mode);
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+/*
+Copyright (c) 2017 Robert Wolterman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of 1-Wire buses that can be open at once
+#define ONEWIRE_MAX 4
+// Attempts at a search or a scratchpad read that fails its CRC
+#define ONEWIRE_RETRIES 3
+// Most ROMs the Python functions handle on one bus
+#define ONEWIRE_SEARCH_MAX 64
+
+int onewire_open(int gpio);
+int onewire_close(int id);
+int onewire_reset(int id);
+int onewire_select(int id, const uint64_t *rom);
+int onewire_write(int id, const uint8_t *data, size_t len);
+int onewire_read(int id, uint8_t *data, size_t len);
+int onewire_search(int id, uint64_t *roms, int max);
+int onewire_convert_all(int id, int poll);
+int onewire_read_temperatures(int id, const uint64_t *roms, int count, double *temps, int *valid);
+uint8_t onewire_crc8(const uint8_t *data, size_t len);
+void onewire_cleanup(void);
+int onewire_selftest(void);
@@ -29,6 +29,7 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#define _GNU_SOURCE  /* PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP */
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -36,6 +37,7 @@ SOFTWARE.
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "c_pwm.h"
 #include "common.h"
 
@@ -65,6 +67,9 @@ struct pwm_exp
     struct pwm_exp *next;
 };
 struct pwm_exp *exported_pwms = NULL;
+// The public calls below run without the GIL, this serialises them.  It is
+// recursive because pwm_start() goes through the setters.
+static pthread_mutex_t pwm_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
 struct pwm_exp *lookup_exported_pwm(const char *key)
 {
@@ -120,7 +125,7 @@ int initialize_pwm(int *initialized, int gpio)
     return 0;
 }
 
-int pwm_set_frequency(const char *key, float freq) {
+static int pwm_set_frequency_locked(const char *key, float freq) {
     int len, e_no;
     int rtnval = -1;
     char buffer[80];
@@ -167,7 +172,17 @@ int pwm_set_frequency(const char *key, float freq) {
     return rtnval;
 }
 
-int pwm_set_period_ns(const char *key, unsigned long period_ns) {
+int pwm_set_frequency(const char *key, float freq)
+{
+    int ret;
+
+    pthread_mutex_lock(&pwm_lock);
+    ret = pwm_set_frequency_locked(key, freq);
+    pthread_mutex_unlock(&pwm_lock);
+    return ret;
+}
+
+static int pwm_set_period_ns_locked(const char *key, unsigned long period_ns) {
     int len, e_no;
     int rtnval = -1;
     char buffer[80];
@@ -210,7 +225,17 @@ int pwm_set_period_ns(const char *key, unsigned long period_ns) {
     return rtnval;
 }
 
-int pwm_get_period_ns(const char *key, unsigned long *period_ns) {
+int pwm_set_period_ns(const char *key, unsigned long period_ns)
+{
+    int ret;
+
+    pthread_mutex_lock(&pwm_lock);
+    ret = pwm_set_period_ns_locked(key, period_ns);
+    pthread_mutex_unlock(&pwm_lock);
+    return ret;
+}
+
+static int pwm_get_period_ns_locked(const char *key, unsigned long *period_ns) {
     int rtnval = -1;
     struct pwm_exp *pwm;
     
@@ -230,7 +255,17 @@ int pwm_get_period_ns(const char *key, unsigned long *period_ns) {
     return rtnval;
 }
 
-int pwm_set_polarity(const char *key, int polarity) {
+int pwm_get_period_ns(const char *key, unsigned long *period_ns)
+{
+    int ret;
+
+    pthread_mutex_lock(&pwm_lock);
+    ret = pwm_get_period_ns_locked(key, period_ns);
+    pthread_mutex_unlock(&pwm_lock);
+    return ret;
+}
+
+static int pwm_set_polarity_locked(const char *key, int polarity) {
     int len, e_no;
     int rtnval = -1;
     char buffer[80];
@@ -276,7 +311,17 @@ int pwm_set_polarity(const char *key, int polarity) {
     return rtnval;
 }
 
-int pwm_set_duty_cycle(const char *key, float duty) {
+int pwm_set_polarity(const char *key, int polarity)
+{
+    int ret;
+
+    pthread_mutex_lock(&pwm_lock);
+    ret = pwm_set_polarity_locked(key, polarity);
+    pthread_mutex_unlock(&pwm_lock);
+    return ret;
+}
+
+static int pwm_set_duty_cycle_locked(const char *key, float duty) {
     int len, e_no;
     int rtnval = -1;
     char buffer[80];
@@ -317,7 +362,17 @@ int pwm_set_duty_cycle(const char *key, float duty) {
     return rtnval;
 }
 
-int pwm_set_pulse_width_ns(const char *key, unsigned long pulse_width_ns) {
+int pwm_set_duty_cycle(const char *key, float duty)
+{
+    int ret;
+
+    pthread_mutex_lock(&pwm_lock);
+    ret = pwm_set_duty_cycle_locked(key, duty);
+    pthread_mutex_unlock(&pwm_lock);
+    return ret;
+}
+
+static int pwm_set_pulse_width_ns_locked(const char *key, unsigned long pulse_width_ns) {
     int len, e_no;
     int rtnval = -1;
     char buffer[80];
@@ -358,7 +413,17 @@ int pwm_set_pulse_width_ns(const char *key, unsigned long pulse_width_ns) {
        
 }
 
-int pwm_set_enable(const char *key, int enable)
+int pwm_set_pulse_width_ns(const char *key, unsigned long pulse_width_ns)
+{
+    int ret;
+
+    pthread_mutex_lock(&pwm_lock);
+    ret = pwm_set_pulse_width_ns_locked(key, pulse_width_ns);
+    pthread_mutex_unlock(&pwm_lock);
+    return ret;
+}
+
+static int pwm_set_enable_locked(const char *key, int enable)
 {
     int len, e_no;
     int rtnval = -1;
@@ -404,7 +469,17 @@ int pwm_set_enable(const char *key, int enable)
     return rtnval;
 }
 
-int pwm_start(const char *key, float duty, float freq, int polarity)
+int pwm_set_enable(const char *key, int enable)
+{
+    int ret;
+
+    pthread_mutex_lock(&pwm_lock);
+    ret = pwm_set_enable_locked(key, enable);
+    pthread_mutex_unlock(&pwm_lock);
+    return ret;
+}
+
+static int pwm_start_locked(const char *key, float duty, float freq, int polarity)
 {
     char pwm_base_path[80];
     char period_path[80];
@@ -547,7 +622,17 @@ int pwm_start(const char *key, float duty, float freq, int polarity)
     return rtnval;
 }
 
-int pwm_disable(const char *key)
+int pwm_start(const char *key, float duty, float freq, int polarity)
+{
+    int ret;
+
+    pthread_mutex_lock(&pwm_lock);
+    ret = pwm_start_locked(key, duty, freq, polarity);
+    pthread_mutex_unlock(&pwm_lock);
+    return ret;
+}
+
+static int pwm_disable_locked(const char *key)
 {
     struct pwm_exp *pwm, *temp, *prev_pwm = NULL;
 
@@ -618,10 +703,27 @@ int pwm_disable(const char *key)
     return 0;
 }
 
-void pwm_cleanup(void)
+int pwm_disable(const char *key)
+{
+    int ret;
+
+    pthread_mutex_lock(&pwm_lock);
+    ret = pwm_disable_locked(key);
+    pthread_mutex_unlock(&pwm_lock);
+    return ret;
+}
+
+static void pwm_cleanup_locked(void)
 {
     while (exported_pwms != NULL) {
         pwm_disable(exported_pwms->key);
     }
 }
 
+void pwm_cleanup(void)
+{
+    pthread_mutex_lock(&pwm_lock);
+    pwm_cleanup_locked();
+    pthread_mutex_unlock(&pwm_lock);
+}
+
@@ -0,0 +1,612 @@
+/*
+Copyright (c) 2017 Robert Wolterman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "c_softi2c.h"
+#include "common.h"
+#include "event_gpio.h"
+#include "cdev_gpio.h"
+
+// Bit-banged I2C master
+// The lines are open drain: a pin is only ever driven low, releasing it
+// switches it to an input and lets the pull-up take it high.  After every
+// release of SCL the clock is read back until it is high, a slave may hold
+// it low (clock stretching) for up to timeout_us.  Like the SPI engine the
+// half periods are CLOCK_MONOTONIC deadlines and a transaction runs without
+// the GIL under the bus lock.
+
+// SMBus allows a slave 25 ms of clock stretching
+#define SOFTI2C_TIMEOUT_US 25000
+
+struct softi2c_bus
+{
+    int in_use;
+    struct softi2c_config cfg;
+    struct fast_pin scl;
+    struct fast_pin sda;
+    uint64_t half;             /* ns */
+    uint64_t deadline;         /* of the next line change */
+    pthread_mutex_t lock;      /* held for a whole transaction */
+};
+
+static struct softi2c_bus buses[SOFTI2C_MAX];
+static pthread_mutex_t softi2c_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// How the lines are driven and read, the selftest swaps in a simulated slave
+static int (*line_release)(const struct fast_pin *fp, int release) = fast_pin_release;
+static int (*line_get)(const struct fast_pin *fp, unsigned int *value) = fast_pin_get;
+
+static void hold(struct softi2c_bus *bus)
+{
+    bus->deadline += bus->half;
+    wait_until_ns(bus->deadline);
+}
+
+// Releases SCL and waits for it to go high
+static int release_scl(struct softi2c_bus *bus)
+{
+    char err[256];
+    unsigned int value;
+    uint64_t now, start = 0;
+
+    if (line_release(&bus->scl, 1) < 0)
+        return -1;
+    for (;;) {
+        if (line_get(&bus->scl, &value) < 0)
+            return -1;
+        if (value)
+            break;
+        now = monotonic_ns();
+        if (start == 0) {
+            start = now;
+        } else if (now - start > bus->cfg.timeout_us * 1000ULL) {
+            snprintf(err, sizeof(err), "softi2c: SCL (gpio %d) held low for more than %u us", bus->cfg.scl, bus->cfg.timeout_us);
+            add_error_msg(err);
+            return -1;
+        }
+    }
+
+    // a stretched clock restarts the timing
+    now = monotonic_ns();
+    if (now > bus->deadline)
+        bus->deadline = now;
+    return 0;
+}
+
+// Called with SCL low, leaves SCL low
+static int write_bit(struct softi2c_bus *bus, unsigned int bit)
+{
+    if (line_release(&bus->sda, bit) < 0)
+        return -1;
+    hold(bus);
+    if (release_scl(bus) < 0)
+        return -1;
+    hold(bus);
+    return line_release(&bus->scl, 0);
+}
+
+static int read_bit(struct softi2c_bus *bus, unsigned int *bit)
+{
+    if (line_release(&bus->sda, 1) < 0)
+        return -1;
+    hold(bus);
+    if (release_scl(bus) < 0 || line_get(&bus->sda, bit) < 0)
+        return -1;
+    hold(bus);
+    return line_release(&bus->scl, 0);
+}
+
+// Start or repeated start, leaves SCL low
+static int send_start(struct softi2c_bus *bus)
+{
+    char err[256];
+    unsigned int value;
+
+    if (line_release(&bus->sda, 1) < 0)
+        return -1;
+    hold(bus);
+    if (release_scl(bus) < 0)
+        return -1;
+    hold(bus);
+    if (line_get(&bus->sda, &value) < 0)
+        return -1;
+    if (!value) {
+        snprintf(err, sizeof(err), "softi2c: SDA (gpio %d) is held low, the bus is busy", bus->cfg.sda);
+        add_error_msg(err);
+        return -1;
+    }
+    if (line_release(&bus->sda, 0) < 0)
+        return -1;
+    hold(bus);
+    return line_release(&bus->scl, 0);
+}
+
+static int send_stop(struct softi2c_bus *bus)
+{
+    if (line_release(&bus->sda, 0) < 0)
+        return -1;
+    hold(bus);
+    if (release_scl(bus) < 0)
+        return -1;
+    hold(bus);
+    if (line_release(&bus->sda, 1) < 0)
+        return -1;
+    hold(bus);
+    return 0;
+}
+
+// Returns 1 when the slave acknowledged, 0 when it did not
+static int write_byte(struct softi2c_bus *bus, uint8_t byte)
+{
+    unsigned int nack;
+    int i;
+
+    for (i = 7; i >= 0; i--)
+        if (write_bit(bus, (byte >> i) & 1) < 0)
+            return -1;
+    if (read_bit(bus, &nack) < 0)
+        return -1;
+    return !nack;
+}
+
+static int read_byte(struct softi2c_bus *bus, uint8_t *byte, int ack)
+{
+    unsigned int bit;
+    int i;
+
+    *byte = 0;
+    for (i = 0; i < 8; i++) {
+        if (read_bit(bus, &bit) < 0)
+            return -1;
+        *byte = (*byte << 1) | bit;
+    }
+    return write_bit(bus, !ack);
+}
+
+// A slave reset in the middle of a read can hold SDA low, nine clocks and a
+// stop get it back to idle
+static int clear_bus(struct softi2c_bus *bus)
+{
+    unsigned int value;
+    int i;
+
+    bus->deadline = monotonic_ns();
+    if (line_release(&bus->sda, 1) < 0 || release_scl(bus) < 0 || line_get(&bus->sda, &value) < 0)
+        return -1;
+    for (i = 0; value == 0 && i < 9; i++) {
+        if (line_release(&bus->scl, 0) < 0)
+            return -1;
+        hold(bus);
+        if (release_scl(bus) < 0 || line_get(&bus->sda, &value) < 0)
+            return -1;
+        hold(bus);
+    }
+    if (i == 0)
+        return 0;
+    if (DEBUG)
+        printf(" ** softi2c clear_bus: %d clocks **\n", i);
+    if (line_release(&bus->scl, 0) < 0)
+        return -1;
+    hold(bus);
+    return send_stop(bus);
+}
+
+int softi2c_open(const struct softi2c_config *cfg)
+{
+    char err[256];
+    struct softi2c_bus *bus;
+    int id;
+
+    if (DEBUG)
+        printf(" ** softi2c_open: scl %d sda %d %u Hz **\n", cfg->scl, cfg->sda, cfg->speed_hz);
+
+    if (cfg->scl < 0 || cfg->sda < 0) {
+        add_error_msg("softi2c_open: both scl and sda are required");
+        return -1;
+    }
+    if (cfg->scl == cfg->sda) {
+        add_error_msg("softi2c_open: scl and sda must be different pins");
+        return -1;
+    }
+    if (cfg->speed_hz > 1000000) {
+        snprintf(err, sizeof(err), "softi2c_open: speed %u Hz is too high", cfg->speed_hz);
+        add_error_msg(err);
+        return -1;
+    }
+
+    pthread_mutex_lock(&softi2c_table_lock);
+    for (id = 0; id < SOFTI2C_MAX; id++)
+        if (!buses[id].in_use)
+            break;
+    if (id == SOFTI2C_MAX) {
+        pthread_mutex_unlock(&softi2c_table_lock);
+        snprintf(err, sizeof(err), "softi2c_open: all %d buses are in use", SOFTI2C_MAX);
+        add_error_msg(err);
+        return -1;
+    }
+    bus = &buses[id];
+    bus->cfg = *cfg;
+    if (bus->cfg.timeout_us == 0)
+        bus->cfg.timeout_us = SOFTI2C_TIMEOUT_US;
+    bus->half = cfg->speed_hz ? 500000000ULL / cfg->speed_hz : 0;
+    bus->sda.gpio = -1;
+
+    if (fast_pin_open_drain(&bus->scl, cfg->scl) < 0 || fast_pin_open_drain(&bus->sda, cfg->sda) < 0 ||
+        clear_bus(bus) < 0) {
+        fast_pin_close(&bus->sda);
+        fast_pin_close(&bus->scl);
+        pthread_mutex_unlock(&softi2c_table_lock);
+        return -1;
+    }
+    pthread_mutex_init(&bus->lock, NULL);
+    bus->in_use = 1;
+    pthread_mutex_unlock(&softi2c_table_lock);
+
+    return id;
+}
+
+int softi2c_close(int id)
+{
+    char err[256];
+    struct softi2c_bus *bus;
+
+    if (DEBUG)
+        printf(" ** softi2c_close: %d **\n", id);
+
+    pthread_mutex_lock(&softi2c_table_lock);
+    if (id < 0 || id >= SOFTI2C_MAX || !buses[id].in_use) {
+        pthread_mutex_unlock(&softi2c_table_lock);
+        snprintf(err, sizeof(err), "softi2c_close: bus %d is not open", id);
+        add_error_msg(err);
+        return -1;
+    }
+    bus = &buses[id];
+    // Waits for a running transaction to finish
+    pthread_mutex_lock(&bus->lock);
+    bus->in_use = 0;
+    fast_pin_close(&bus->sda);
+    fast_pin_close(&bus->scl);
+    pthread_mutex_unlock(&bus->lock);
+    pthread_mutex_destroy(&bus->lock);
+    pthread_mutex_unlock(&softi2c_table_lock);
+
+    return 0;
+}
+
+static int run_transaction(struct softi2c_bus *bus, int addr, const uint8_t *wr, size_t wlen, uint8_t *rd, size_t rlen)
+{
+    char err[256];
+    size_t i;
+    int ack;
+
+    // With nothing to read the address goes out as a write, so an empty
+    // transaction probes for the device
+    if (wlen > 0 || rlen == 0) {
+        if (send_start(bus) < 0 || (ack = write_byte(bus, addr << 1)) < 0)
+            return -1;
+        if (!ack) {
+            snprintf(err, sizeof(err), "softi2c: no acknowledge from address 0x%02x", addr);
+            add_error_msg(err);
+            return -1;
+        }
+        for (i = 0; i < wlen; i++) {
+            if ((ack = write_byte(bus, wr[i])) < 0)
+                return -1;
+            if (!ack) {
+                snprintf(err, sizeof(err), "softi2c: address 0x%02x did not acknowledge byte %zu", addr, i);
+                add_error_msg(err);
+                return -1;
+            }
+        }
+    }
+
+    if (rlen > 0) {
+        // a repeated start when something was written
+        if (send_start(bus) < 0 || (ack = write_byte(bus, (addr << 1) | 1)) < 0)
+            return -1;
+        if (!ack) {
+            snprintf(err, sizeof(err), "softi2c: no acknowledge from address 0x%02x", addr);
+            add_error_msg(err);
+            return -1;
+        }
+        for (i = 0; i < rlen; i++)
+            if (read_byte(bus, &rd[i], i + 1 < rlen) < 0)
+                return -1;
+    }
+
+    return 0;
+}
+
+// Writes wlen bytes to the 7 bit address addr then, after a repeated start,
+// reads rlen bytes, both under one start/stop.  Either length may be 0.
+int softi2c_transfer(int id, int addr, const uint8_t *wr, size_t wlen, uint8_t *rd, size_t rlen)
+{
+    char err[256];
+    struct softi2c_bus *bus;
+    int ret;
+
+    if (DEBUG)
+        printf(" ** softi2c_transfer: %d, address 0x%02x, write %zu, read %zu **\n", id, addr, wlen, rlen);
+
+    if (addr < 0 || addr > 0x7f) {
+        snprintf(err, sizeof(err), "softi2c_transfer: invalid address 0x%x, must be 7 bit", addr);
+        add_error_msg(err);
+        return -1;
+    }
+
+    pthread_mutex_lock(&softi2c_table_lock);
+    if (id < 0 || id >= SOFTI2C_MAX || !buses[id].in_use) {
+        pthread_mutex_unlock(&softi2c_table_lock);
+        snprintf(err, sizeof(err), "softi2c_transfer: bus %d is not open", id);
+        add_error_msg(err);
+        return -1;
+    }
+    bus = &buses[id];
+    pthread_mutex_lock(&bus->lock);
+    pthread_mutex_unlock(&softi2c_table_lock);
+
+    bus->deadline = monotonic_ns();
+    ret = run_transaction(bus, addr, wr, wlen, rd, rlen);
+    // The bus is left idle whatever went wrong
+    if (send_stop(bus) < 0)
+        ret = -1;
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+void softi2c_cleanup(void)
+{
+    int id;
+
+    for (id = 0; id < SOFTI2C_MAX; id++)
+        if (buses[id].in_use)
+            softi2c_close(id);
+}
+
+// Simulated 24C02 style memory at SIM_ADDRESS for the selftest: writes set
+// the address pointer then store at it, reads return from it
+#define SIM_SCL 132
+#define SIM_ADDRESS 0x50
+
+enum { SIM_IDLE, SIM_ADDR, SIM_WRITE, SIM_READ };
+
+static struct
+{
+    int m_scl, m_sda;          /* master has released the line */
+    int s_sda;                 /* slave has released SDA */
+    int stretch_each;          /* reads of SCL held low after each release */
+    int stretch;
+    int mode, bit, rw, ack, first;
+    uint8_t byte, ptr;
+    uint8_t mem[256];
+    int starts, stops;
+} sim;
+
+static int sim_scl(void)
+{
+    return sim.m_scl && sim.stretch == 0;
+}
+
+static int sim_sda(void)
+{
+    return sim.m_sda && sim.s_sda;
+}
+
+static void sim_rise(void)
+{
+    if (sim.bit < 8 && (sim.mode == SIM_ADDR || sim.mode == SIM_WRITE))
+        sim.byte = (sim.byte << 1) | sim_sda();
+    else if (sim.bit == 8 && sim.mode == SIM_READ)
+        sim.ack = !sim_sda();
+}
+
+static void sim_fall(void)
+{
+    if (sim.mode == SIM_IDLE)
+        return;
+
+    sim.bit++;
+    if (sim.bit == 8) {
+        if (sim.mode == SIM_ADDR) {
+            if ((sim.byte >> 1) != SIM_ADDRESS) {
+                sim.mode = SIM_IDLE;
+                return;
+            }
+            sim.rw = sim.byte & 1;
+            sim.s_sda = 0;
+        } else if (sim.mode == SIM_WRITE) {
+            if (sim.first)
+                sim.ptr = sim.byte;
+            else
+                sim.mem[sim.ptr++] = sim.byte;
+            sim.first = 0;
+            sim.s_sda = 0;
+        } else {
+            sim.s_sda = 1;
+        }
+    } else if (sim.bit == 9) {
+        sim.bit = 0;
+        sim.s_sda = 1;
+        if (sim.mode == SIM_ADDR) {
+            sim.mode = sim.rw ? SIM_READ : SIM_WRITE;
+            sim.first = 1;
+            sim.ack = 1;
+        }
+        sim.byte = 0;
+        if (sim.mode == SIM_READ) {
+            if (!sim.ack) {
+                sim.mode = SIM_IDLE;
+                return;
+            }
+            sim.byte = sim.mem[sim.ptr++];
+            sim.s_sda = (sim.byte >> 7) & 1;
+        }
+    } else if (sim.mode == SIM_READ) {
+        sim.s_sda = (sim.byte >> (7 - sim.bit)) & 1;
+    }
+}
+
+static int sim_release(const struct fast_pin *fp, int release)
+{
+    int scl = sim_scl();
+    int sda = sim_sda();
+
+    if (fp->gpio == SIM_SCL) {
+        sim.m_scl = release;
+        if (release)
+            sim.stretch = sim.stretch_each;
+    } else {
+        sim.m_sda = release;
+    }
+
+    if (scl && !sim_scl())
+        sim_fall();
+    else if (!scl && sim_scl())
+        sim_rise();
+    else if (scl && sim_scl() && sda && !sim_sda()) {
+        sim.mode = SIM_ADDR;
+        sim.bit = -1;          /* the clock falling after the start */
+        sim.byte = 0;
+        sim.s_sda = 1;
+        sim.starts++;
+    } else if (scl && sim_scl() && !sda && sim_sda()) {
+        sim.mode = SIM_IDLE;
+        sim.stops++;
+    }
+
+    return 0;
+}
+
+static int sim_get(const struct fast_pin *fp, unsigned int *value)
+{
+    if (fp->gpio == SIM_SCL) {
+        if (sim.m_scl && sim.stretch > 0 && --sim.stretch == 0)
+            sim_rise();
+        *value = sim_scl();
+    } else {
+        *value = sim_sda();
+    }
+    return 0;
+}
+
+int softi2c_selftest(void)
+{
+    uint8_t *saved_memmap = memmap;
+    int saved_mode = gpio_get_pio_mode();
+    struct softi2c_config cfg;
+    const uint8_t wr[3] = { 0x10, 0xAB, 0xCD };
+    uint8_t rd[3];
+    int i, id;
+
+    ASSRT(0 == map_pio_anonymous());
+    ASSRT(0 == gpio_set_pio_mode(1));
+    // CSID0 and CSID1 are PE4 and PE5
+    gpio_set_pio_capable(132, 1);
+    gpio_set_pio_capable(133, 1);
+    memset(&sim, 0, sizeof(sim));
+    sim.m_scl = sim.m_sda = sim.s_sda = 1;
+    line_release = sim_release;
+    line_get = sim_get;
+
+    printf("Testing software I2C argument checks\n");
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.scl = 132;  cfg.sda = 132;
+    ASSRT(-1 == softi2c_open(&cfg));
+    cfg.sda = -1;
+    ASSRT(-1 == softi2c_open(&cfg));
+    cfg.sda = 133;
+    ASSRT(-1 == softi2c_transfer(SOFTI2C_MAX, SIM_ADDRESS, wr, 1, NULL, 0));
+    ASSRT(0 <= (id = softi2c_open(&cfg)));
+    ASSRT(-1 == softi2c_transfer(id, 0x80, wr, 1, NULL, 0));
+
+    printf("Testing software I2C write and combined write/read\n");
+    ASSRT(0 == softi2c_transfer(id, SIM_ADDRESS, wr, 3, NULL, 0));
+    ASSRT(0xAB == sim.mem[0x10] && 0xCD == sim.mem[0x11]);
+    ASSRT(1 == sim.starts && 1 == sim.stops);
+    ASSRT(0 == softi2c_transfer(id, SIM_ADDRESS, wr, 1, rd, 2));
+    ASSRT(0xAB == rd[0] && 0xCD == rd[1]);
+    ASSRT(3 == sim.starts && 2 == sim.stops);  /* repeated start, one stop */
+    sim.mem[0x12] = 0x5A;
+    ASSRT(0 == softi2c_transfer(id, SIM_ADDRESS, NULL, 0, rd, 1));
+    ASSRT(0x5A == rd[0]);
+    ASSRT(1 == sim_scl() && 1 == sim_sda());
+
+    printf("Testing software I2C acknowledge errors\n");
+    ASSRT(0 == softi2c_transfer(id, SIM_ADDRESS, NULL, 0, NULL, 0));
+    ASSRT(-1 == softi2c_transfer(id, SIM_ADDRESS + 1, NULL, 0, NULL, 0));
+    ASSRT(-1 == softi2c_transfer(id, SIM_ADDRESS + 1, wr, 1, rd, 1));
+    ASSRT(6 == sim.stops);
+    ASSRT(1 == sim_scl() && 1 == sim_sda());
+
+    printf("Testing software I2C clock stretching\n");
+    sim.stretch_each = 3;
+    memset(rd, 0, sizeof(rd));
+    ASSRT(0 == softi2c_transfer(id, SIM_ADDRESS, wr, 1, rd, 2));
+    ASSRT(0xAB == rd[0] && 0xCD == rd[1]);
+    ASSRT(0 == softi2c_close(id));
+    cfg.timeout_us = 1000;
+    cfg.speed_hz = 100000;
+    sim.stretch_each = 0;
+    ASSRT(0 <= (id = softi2c_open(&cfg)));
+    sim.stretch_each = 0x7fffffff;
+    ASSRT(-1 == softi2c_transfer(id, SIM_ADDRESS, wr, 1, NULL, 0));
+    sim.stretch_each = 0;
+    sim.stretch = 0;
+    ASSRT(0 == softi2c_transfer(id, SIM_ADDRESS, wr, 3, NULL, 0));
+
+    printf("Testing software I2C table\n");
+    for (i = 1; i < SOFTI2C_MAX; i++)
+        ASSRT(0 <= softi2c_open(&cfg));
+    ASSRT(-1 == softi2c_open(&cfg));
+    softi2c_cleanup();
+    ASSRT(-1 == softi2c_transfer(id, SIM_ADDRESS, wr, 1, NULL, 0));
+
+    line_release = fast_pin_release;
+    line_get = fast_pin_get;
+    gpio_set_pio_capable(132, 0);
+    gpio_set_pio_capable(133, 0);
+    unmap_pio_anonymous();
+    memmap = saved_memmap;
+
+    printf("Testing software I2C outside PIO mode\n");
+    // chardev lines on a stub chip with pull-ups and nothing on the bus
+    ASSRT(0 == gpio_set_pio_mode(0));
+    ASSRT(0 == cdev_selftest_chip(1000));
+    cfg.scl = 1000;
+    cfg.sda = 1001;
+    cfg.speed_hz = 0;
+    ASSRT(0 <= (id = softi2c_open(&cfg)));
+    clear_error_msg();
+    ASSRT(-1 == softi2c_transfer(id, SIM_ADDRESS, NULL, 0, NULL, 0));
+    ASSRT(strstr(get_error_msg(), "acknowledge"));
+    ASSRT(0 == softi2c_close(id));
+    cdev_selftest_chip_remove();
+    clear_error_msg();
+    gpio_set_pio_mode(saved_mode);
+
+    return 0;
+}
@@ -0,0 +1,42 @@
+/*
+Copyright (c) 2017 Robert Wolterman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of software I2C buses that can be open at once
+#define SOFTI2C_MAX 8
+
+struct softi2c_config
+{
+    int scl;                   /* gpio numbers, both need a pull-up */
+    int sda;
+    unsigned int speed_hz;     /* 0 runs as fast as the pins allow */
+    unsigned int timeout_us;   /* longest clock stretch, 0 for the default */
+};
+
+int softi2c_open(const struct softi2c_config *cfg);
+int softi2c_close(int id);
+int softi2c_transfer(int id, int addr, const uint8_t *wr, size_t wlen, uint8_t *rd, size_t rlen);
+void softi2c_cleanup(void);
+int softi2c_selftest(void);
@@ -29,6 +29,7 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#define _GNU_SOURCE  /* PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -65,12 +66,16 @@ struct softpwm
     int gpio;
     struct pwm_params params;
     pthread_mutex_t* params_lock;
+    pthread_cond_t enable_cond;   /* signalled on enable and stop */
     pthread_t thread;
     struct softpwm *next;
 };
 struct softpwm *exported_pwms = NULL;
+// Guards the list, the Python layer calls in here without the GIL.  Setters
+// take it before a pwm's params_lock so the pwm cannot be freed under them.
+static pthread_mutex_t softpwm_list_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
-struct softpwm *lookup_exported_pwm(const char *key)
+static struct softpwm *find_pwm(const char *key)
 {
     struct softpwm *pwm = exported_pwms;
 
@@ -85,15 +90,28 @@ struct softpwm *lookup_exported_pwm(const char *key)
     return NULL; /* standard for pointers */
 }
 
+struct softpwm *lookup_exported_pwm(const char *key)
+{
+    struct softpwm *pwm;
+
+    pthread_mutex_lock(&softpwm_list_lock);
+    pwm = find_pwm(key);
+    pthread_mutex_unlock(&softpwm_list_lock);
+
+    return pwm;
+}
+
 int softpwm_set_frequency(const char *key, float freq) {
     struct softpwm *pwm;
 
     if (freq <= 0.0)
         return -1;
 
-    pwm = lookup_exported_pwm(key);
+    pthread_mutex_lock(&softpwm_list_lock);
+    pwm = find_pwm(key);
 
     if (pwm == NULL) {
+        pthread_mutex_unlock(&softpwm_list_lock);
         return -1;
     }
 
@@ -102,20 +120,50 @@ int softpwm_set_frequency(const char *key, float freq) {
     pthread_mutex_lock(pwm->params_lock);
     pwm->params.freq = freq;
     pthread_mutex_unlock(pwm->params_lock);
+    pthread_mutex_unlock(&softpwm_list_lock);
+
+    return 0;
+}
+
+// Pauses or resumes a running softpwm without stopping its thread.  While
+// paused the pin is held at its off level.  Safe to call from any thread,
+// edge rules in the event path use it on the pwm they keep.
+int softpwm_enable(struct softpwm *pwm, int enable)
+{
+    if (pwm == NULL)
+        return -1;
+
+    pthread_mutex_lock(pwm->params_lock);
+    pwm->params.enabled = enable ? true : false;
+    pthread_cond_broadcast(&pwm->enable_cond);
+    pthread_mutex_unlock(pwm->params_lock);
 
     return 0;
 }
 
+int softpwm_set_enable(const char *key, int enable)
+{
+    int ret;
+
+    pthread_mutex_lock(&softpwm_list_lock);
+    ret = softpwm_enable(find_pwm(key), enable);
+    pthread_mutex_unlock(&softpwm_list_lock);
+
+    return ret;
+}
+
 int softpwm_set_polarity(const char *key, int polarity) {
     struct softpwm *pwm;
 
-    pwm = lookup_exported_pwm(key);
-
-    if (pwm == NULL) {
+    if (polarity < 0 || polarity > 1) {
         return -1;
     }
 
-    if (polarity < 0 || polarity > 1) {
+    pthread_mutex_lock(&softpwm_list_lock);
+    pwm = find_pwm(key);
+
+    if (pwm == NULL) {
+        pthread_mutex_unlock(&softpwm_list_lock);
         return -1;
     }
 
@@ -124,6 +172,7 @@ int softpwm_set_polarity(const char *key, int polarity) {
     pthread_mutex_lock(pwm->params_lock);
     pwm->params.polarity = polarity;
     pthread_mutex_unlock(pwm->params_lock);
+    pthread_mutex_unlock(&softpwm_list_lock);
 
     return 0;
 }
@@ -134,9 +183,11 @@ int softpwm_set_duty_cycle(const char *key, float duty) {;
     if (duty < 0.0 || duty > 100.0)
         return -1;
 
-    pwm = lookup_exported_pwm(key);
+    pthread_mutex_lock(&softpwm_list_lock);
+    pwm = find_pwm(key);
 
     if (pwm == NULL) {
+        pthread_mutex_unlock(&softpwm_list_lock);
         return -1;
     }
 
@@ -145,6 +196,7 @@ int softpwm_set_duty_cycle(const char *key, float duty) {;
     pthread_mutex_lock(pwm->params_lock);
     pwm->params.duty = duty;
     pthread_mutex_unlock(pwm->params_lock);
+    pthread_mutex_unlock(&softpwm_list_lock);
 
     return 0;
 }
@@ -183,6 +235,19 @@ void *softpwm_thread_toggle(void *arg)
     polarity_local = pwm->params.polarity;
     pthread_mutex_unlock(pwm->params_lock);
 
+    /* Paused, hold the off level and sleep until enabled or stopped */
+    if (!enabled_local && !stop_flag_local) {
+      if (!polarity_local)
+        gpio_set_value(gpio, LOW);
+      else
+        gpio_set_value(gpio, HIGH);
+      pthread_mutex_lock(pwm->params_lock);
+      while (!pwm->params.enabled && !pwm->params.stop_flag)
+        pthread_cond_wait(&pwm->enable_cond, pwm->params_lock);
+      pthread_mutex_unlock(pwm->params_lock);
+      continue;
+    }
+
     /* If freq or duty has been changed, update the
      * sleep times
      */
@@ -236,7 +301,7 @@ void *softpwm_thread_toggle(void *arg)
   pthread_exit(NULL);
 }
 
-int softpwm_start(const char *key, float duty, float freq, int polarity)
+int softpwm_start(const char *key, float duty, float freq, int polarity, int enable)
 {
     struct softpwm *new_pwm, *pwm;
     pthread_t new_thread;
@@ -273,12 +338,14 @@ int softpwm_start(const char *key, float duty, float freq, int polarity)
         return -1; // out of memory
     }
     pthread_mutex_init(new_params_lock, NULL);
+    pthread_cond_init(&new_pwm->enable_cond, NULL);
+    pthread_mutex_lock(&softpwm_list_lock);
     pthread_mutex_lock(new_params_lock);
 
     strncpy(new_pwm->key, key, KEYLEN);  /* can leave string unterminated */
     new_pwm->key[KEYLEN] = '\0'; /* terminate string */
     new_pwm->gpio = gpio;
-    new_pwm->params.enabled = true;
+    new_pwm->params.enabled = enable ? true : false;
     new_pwm->params.stop_flag = false;
     new_pwm->params_lock = new_params_lock;
     new_pwm->next = NULL;
@@ -312,17 +379,20 @@ int softpwm_start(const char *key, float duty, float freq, int polarity)
     new_pwm->thread = new_thread;
 
     pthread_mutex_unlock(new_params_lock);
+    pthread_mutex_unlock(&softpwm_list_lock);
 
     return 1;
 }
 
 int softpwm_disable(const char *key)
 {
-    struct softpwm *pwm, *temp, *prev_pwm = NULL;
+    struct softpwm *pwm, *temp, *prev_pwm = NULL, *removed = NULL;
 
     if (DEBUG)
         printf(" ** in softpwm_disable **\n");
-    // remove from list
+    // remove from list, the join below can take a full period so it
+    // happens after the lock is dropped
+    pthread_mutex_lock(&softpwm_list_lock);
     pwm = exported_pwms;
     while (pwm != NULL)
     {
@@ -330,38 +400,56 @@ int softpwm_disable(const char *key)
         {
             if (DEBUG)
                 printf(" ** softpwm_disable: found pin **\n");
-            pthread_mutex_lock(pwm->params_lock);
-            pwm->params.stop_flag = true;
-            pthread_mutex_unlock(pwm->params_lock);
-            pthread_join(pwm->thread, NULL);  /* wait for thread to exit */
-
-            if (DEBUG)
-                printf(" ** softpwm_disable: unexporting %d **\n", pwm->gpio);
-            gpio_unexport(pwm->gpio);
-
             if (prev_pwm == NULL)
-            {
                 exported_pwms = pwm->next;
-                prev_pwm = pwm;
-            } else {
+            else
                 prev_pwm->next = pwm->next;
-            }
 
             temp = pwm;
             pwm = pwm->next;
-            free(temp->params_lock);
-            free(temp);
+            temp->next = removed;
+            removed = temp;
         } else {
             prev_pwm = pwm;
             pwm = pwm->next;
         }
     }
+    pthread_mutex_unlock(&softpwm_list_lock);
+
+    while (removed != NULL)
+    {
+        pwm = removed;
+        removed = pwm->next;
+
+        pthread_mutex_lock(pwm->params_lock);
+        pwm->params.stop_flag = true;
+        pthread_cond_broadcast(&pwm->enable_cond);
+        pthread_mutex_unlock(pwm->params_lock);
+        pthread_join(pwm->thread, NULL);  /* wait for thread to exit */
+
+        if (DEBUG)
+            printf(" ** softpwm_disable: unexporting %d **\n", pwm->gpio);
+        gpio_unexport(pwm->gpio);
+
+        pthread_cond_destroy(&pwm->enable_cond);
+        free(pwm->params_lock);
+        free(pwm);
+    }
     return 0;
 }
 
 void softpwm_cleanup(void)
 {
-    while (exported_pwms != NULL) {
-        softpwm_disable(exported_pwms->key);
+    char key[KEYLEN+1];
+
+    for (;;) {
+        pthread_mutex_lock(&softpwm_list_lock);
+        if (exported_pwms == NULL) {
+            pthread_mutex_unlock(&softpwm_list_lock);
+            break;
+        }
+        strcpy(key, exported_pwms->key);
+        pthread_mutex_unlock(&softpwm_list_lock);
+        softpwm_disable(key);
     }
 }
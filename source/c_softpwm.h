@@ -29,9 +29,11 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
-int softpwm_start(const char *key, float duty, float freq, int polarity);
+int softpwm_start(const char *key, float duty, float freq, int polarity, int enable);
 int softpwm_disable(const char *key);
 int softpwm_set_frequency(const char *key, float freq);
 int softpwm_set_duty_cycle(const char *key, float duty);
 int softpwm_set_enable(const char *key, int enable);
+struct softpwm *lookup_exported_pwm(const char *key);
+int softpwm_enable(struct softpwm *pwm, int enable);
 void softpwm_cleanup(void);
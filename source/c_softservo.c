@@ -33,6 +33,7 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#define _GNU_SOURCE  /* PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -83,8 +84,10 @@ struct servo
     struct servo *next;
 };
 struct servo *exported_servos = NULL;
+// Guards the list the same way softpwm_list_lock does, taken before params_lock
+static pthread_mutex_t servo_list_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
-struct servo *lookup_exported_servo(const char *key)
+static struct servo *find_servo(const char *key)
 {
     struct servo *srv = exported_servos;
 
@@ -99,6 +102,17 @@ struct servo *lookup_exported_servo(const char *key)
     return NULL; /* standard for pointers */
 }
 
+struct servo *lookup_exported_servo(const char *key)
+{
+    struct servo *srv;
+
+    pthread_mutex_lock(&servo_list_lock);
+    srv = find_servo(key);
+    pthread_mutex_unlock(&servo_list_lock);
+
+    return srv;
+}
+
 void *servo_thread_toggle(void *arg)
 {
     struct servo *srv = (struct servo *)arg;
@@ -206,6 +220,7 @@ int servo_start(const char *key, float angle, float range)
         return -1; // out of memory
     }
     pthread_mutex_init(new_params_lock, NULL);
+    pthread_mutex_lock(&servo_list_lock);
     pthread_mutex_lock(new_params_lock);
 
     strncpy(new_srv->key, key, KEYLEN);  /* can leave string unterminated */
@@ -244,17 +259,19 @@ int servo_start(const char *key, float angle, float range)
     new_srv->thread = new_thread;
 
     pthread_mutex_unlock(new_params_lock);
+    pthread_mutex_unlock(&servo_list_lock);
 
     return 1;
 }
 
 int servo_disable(const char *key)
 {
-    struct servo *srv, *temp, *prev_srv = NULL;
+    struct servo *srv, *temp, *prev_srv = NULL, *removed = NULL;
 
     if (DEBUG)
         printf(" ** in servo_disable **\n");
-    // remove from list
+    // remove from list, join outside the lock
+    pthread_mutex_lock(&servo_list_lock);
     srv = exported_servos;
     while (srv != NULL)
     {
@@ -262,32 +279,39 @@ int servo_disable(const char *key)
         {
             if (DEBUG)
                 printf(" ** servo_disable: found pin **\n");
-            pthread_mutex_lock(srv->params_lock);
-            srv->params.stop_flag = true;
-            pthread_mutex_unlock(srv->params_lock);
-            pthread_join(srv->thread, NULL);  /* wait for thread to exit */
-
-            if (DEBUG)
-                printf(" ** servo_disable: unexporting %d **\n", srv->gpio);
-            gpio_unexport(srv->gpio);
-
             if (prev_srv == NULL)
-            {
                 exported_servos = srv->next;
-                prev_srv = srv;
-            } else {
+            else
                 prev_srv->next = srv->next;
-            }
 
             temp = srv;
             srv = srv->next;
-            free(temp->params_lock);
-            free(temp);
+            temp->next = removed;
+            removed = temp;
         } else {
             prev_srv = srv;
             srv = srv->next;
         }
     }
+    pthread_mutex_unlock(&servo_list_lock);
+
+    while (removed != NULL)
+    {
+        srv = removed;
+        removed = srv->next;
+
+        pthread_mutex_lock(srv->params_lock);
+        srv->params.stop_flag = true;
+        pthread_mutex_unlock(srv->params_lock);
+        pthread_join(srv->thread, NULL);  /* wait for thread to exit */
+
+        if (DEBUG)
+            printf(" ** servo_disable: unexporting %d **\n", srv->gpio);
+        gpio_unexport(srv->gpio);
+
+        free(srv->params_lock);
+        free(srv);
+    }
     return 0;
 }
 
@@ -296,9 +320,11 @@ int servo_set_range(const char *key, float range)
     struct servo *srv;
     float min_angle, max_angle;
 
-    srv = lookup_exported_servo(key);
+    pthread_mutex_lock(&servo_list_lock);
+    srv = find_servo(key);
 
     if (srv == NULL) {
+        pthread_mutex_unlock(&servo_list_lock);
         return -1;
     }
 
@@ -313,6 +339,7 @@ int servo_set_range(const char *key, float range)
     srv->params.min_angle = min_angle;
     srv->params.max_angle = max_angle;
     pthread_mutex_unlock(srv->params_lock);
+    pthread_mutex_unlock(&servo_list_lock);
 
     return 0;
 }
@@ -321,9 +348,11 @@ int servo_set_angle(const char *key, float angle)
 {
     struct servo *srv;
 
-    srv = lookup_exported_servo(key);
+    pthread_mutex_lock(&servo_list_lock);
+    srv = find_servo(key);
 
     if (srv == NULL) {
+        pthread_mutex_unlock(&servo_list_lock);
         return -1;
     }
 
@@ -332,6 +361,7 @@ int servo_set_angle(const char *key, float angle)
        char err[2000];
        snprintf(err, sizeof(err), "Angle specified (%.2f) for pin %d, is outside allowable range (%.2f,%.2f)", angle, srv->gpio, srv->params.min_angle,srv->params.max_angle);
        add_error_msg(err);
+       pthread_mutex_unlock(&servo_list_lock);
        return -1;
     }
     
@@ -340,14 +370,24 @@ int servo_set_angle(const char *key, float angle)
     pthread_mutex_lock(srv->params_lock);
     srv->params.current_angle = angle;
     pthread_mutex_unlock(srv->params_lock);
+    pthread_mutex_unlock(&servo_list_lock);
 
     return 0;
 }
 
 void servo_cleanup(void)
 {
-    while (exported_servos != NULL) {
-        servo_disable(exported_servos->key);
+    char key[KEYLEN+1];
+
+    for (;;) {
+        pthread_mutex_lock(&servo_list_lock);
+        if (exported_servos == NULL) {
+            pthread_mutex_unlock(&servo_list_lock);
+            break;
+        }
+        strcpy(key, exported_servos->key);
+        pthread_mutex_unlock(&servo_list_lock);
+        servo_disable(key);
     }
 }
 
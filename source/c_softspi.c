@@ -0,0 +1,345 @@
+/*
+Copyright (c) 2017 Robert Wolterman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "c_softspi.h"
+#include "common.h"
+#include "event_gpio.h"
+
+// Bit-banged SPI master
+// Every bit edge is placed on an absolute CLOCK_MONOTONIC deadline so a late
+// wakeup shortens the next half period instead of stretching the whole
+// transfer.  Pins in PIO register mode toggle with a single register access,
+// the others go through the cached value fds.  A transfer holds its bus lock,
+// never the GIL, so other Python threads keep running while it clocks.
+
+struct softspi_bus
+{
+    int in_use;
+    struct softspi_config cfg;
+    struct fast_pin sclk;
+    struct fast_pin mosi;
+    struct fast_pin miso;
+    struct fast_pin cs;
+    pthread_mutex_t lock;      /* held for a whole transfer */
+};
+
+static struct softspi_bus buses[SOFTSPI_MAX];
+static pthread_mutex_t softspi_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void close_bus_pins(struct softspi_bus *bus)
+{
+    fast_pin_close(&bus->cs);
+    // miso shares the fast_pin of mosi when both are on one pin
+    if (bus->miso.exported)
+        fast_pin_close(&bus->miso);
+    fast_pin_close(&bus->mosi);
+    fast_pin_close(&bus->sclk);
+}
+
+static int open_bus_pins(struct softspi_bus *bus)
+{
+    const struct softspi_config *cfg = &bus->cfg;
+    int cpol = (cfg->mode >> 1) & 1;
+
+    bus->sclk.gpio = bus->mosi.gpio = bus->miso.gpio = bus->cs.gpio = -1;
+
+    if (fast_pin_open(&bus->sclk, cfg->sclk, OUTPUT) < 0 || fast_pin_set(&bus->sclk, cpol) < 0)
+        goto fail;
+    if (fast_pin_open(&bus->cs, cfg->cs, OUTPUT) < 0 || fast_pin_set(&bus->cs, !cfg->cs_high) < 0)
+        goto fail;
+    if (fast_pin_open(&bus->mosi, cfg->mosi, OUTPUT) < 0 || fast_pin_set(&bus->mosi, 0) < 0)
+        goto fail;
+    if (cfg->miso >= 0 && cfg->miso == cfg->mosi) {
+        // Loopback: reading back the pin we drive
+        bus->miso = bus->mosi;
+        bus->miso.exported = 0;
+    } else if (fast_pin_open(&bus->miso, cfg->miso, INPUT) < 0) {
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    close_bus_pins(bus);
+    return -1;
+}
+
+int softspi_open(const struct softspi_config *cfg)
+{
+    char err[256];
+    int id;
+
+    if (DEBUG)
+        printf(" ** softspi_open: sclk %d mosi %d miso %d cs %d mode %d %u Hz **\n",
+               cfg->sclk, cfg->mosi, cfg->miso, cfg->cs, cfg->mode, cfg->speed_hz);
+
+    if (cfg->sclk < 0) {
+        add_error_msg("softspi_open: a clock pin is required");
+        return -1;
+    }
+    if (cfg->mosi < 0 && cfg->miso < 0) {
+        add_error_msg("softspi_open: at least one of mosi and miso is required");
+        return -1;
+    }
+    if (cfg->mode < 0 || cfg->mode > 3) {
+        snprintf(err, sizeof(err), "softspi_open: invalid mode %d, must be 0..3", cfg->mode);
+        add_error_msg(err);
+        return -1;
+    }
+    if (cfg->sclk == cfg->mosi || cfg->sclk == cfg->miso || cfg->sclk == cfg->cs ||
+        (cfg->cs >= 0 && (cfg->cs == cfg->mosi || cfg->cs == cfg->miso))) {
+        add_error_msg("softspi_open: sclk and cs must not share a pin with another signal");
+        return -1;
+    }
+    if (cfg->speed_hz > 50000000) {
+        snprintf(err, sizeof(err), "softspi_open: speed %u Hz is too high", cfg->speed_hz);
+        add_error_msg(err);
+        return -1;
+    }
+
+    pthread_mutex_lock(&softspi_table_lock);
+    for (id = 0; id < SOFTSPI_MAX; id++)
+        if (!buses[id].in_use)
+            break;
+    if (id == SOFTSPI_MAX) {
+        pthread_mutex_unlock(&softspi_table_lock);
+        snprintf(err, sizeof(err), "softspi_open: all %d buses are in use", SOFTSPI_MAX);
+        add_error_msg(err);
+        return -1;
+    }
+    buses[id].cfg = *cfg;
+    if (open_bus_pins(&buses[id]) < 0) {
+        pthread_mutex_unlock(&softspi_table_lock);
+        return -1;
+    }
+    pthread_mutex_init(&buses[id].lock, NULL);
+    buses[id].in_use = 1;
+    pthread_mutex_unlock(&softspi_table_lock);
+
+    return id;
+}
+
+int softspi_close(int id)
+{
+    char err[256];
+    struct softspi_bus *bus;
+
+    if (DEBUG)
+        printf(" ** softspi_close: %d **\n", id);
+
+    pthread_mutex_lock(&softspi_table_lock);
+    if (id < 0 || id >= SOFTSPI_MAX || !buses[id].in_use) {
+        pthread_mutex_unlock(&softspi_table_lock);
+        snprintf(err, sizeof(err), "softspi_close: bus %d is not open", id);
+        add_error_msg(err);
+        return -1;
+    }
+    bus = &buses[id];
+    // Waits for a running transfer to finish
+    pthread_mutex_lock(&bus->lock);
+    bus->in_use = 0;
+    close_bus_pins(bus);
+    pthread_mutex_unlock(&bus->lock);
+    pthread_mutex_destroy(&bus->lock);
+    pthread_mutex_unlock(&softspi_table_lock);
+
+    return 0;
+}
+
+static int transfer_bits(struct softspi_bus *bus, const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    const struct softspi_config *cfg = &bus->cfg;
+    unsigned int cpol = (cfg->mode >> 1) & 1;
+    unsigned int cpha = cfg->mode & 1;
+    uint64_t half = cfg->speed_hz ? 500000000ULL / cfg->speed_hz : 0;
+    uint64_t deadline;
+    unsigned int in;
+    size_t i;
+    int bit, n;
+
+    if (fast_pin_set(&bus->cs, cfg->cs_high) < 0)
+        return -1;
+    deadline = monotonic_ns() + half;
+
+    for (i = 0; i < len; i++) {
+        uint8_t out = tx ? tx[i] : 0xFF;
+        uint8_t got = 0;
+
+        for (n = 0; n < 8; n++) {
+            bit = cfg->lsb_first ? n : 7 - n;
+            if (!cpha && fast_pin_set(&bus->mosi, (out >> bit) & 1) < 0)
+                return -1;
+            wait_until_ns(deadline);
+            if (fast_pin_set(&bus->sclk, !cpol) < 0)
+                return -1;
+            if (cpha && fast_pin_set(&bus->mosi, (out >> bit) & 1) < 0)
+                return -1;
+            if (!cpha) {
+                if (fast_pin_get(&bus->miso, &in) < 0)
+                    return -1;
+                got |= in << bit;
+            }
+            deadline += half;
+            wait_until_ns(deadline);
+            if (fast_pin_set(&bus->sclk, cpol) < 0)
+                return -1;
+            if (cpha) {
+                if (fast_pin_get(&bus->miso, &in) < 0)
+                    return -1;
+                got |= in << bit;
+            }
+            deadline += half;
+        }
+        if (rx)
+            rx[i] = got;
+    }
+
+    wait_until_ns(deadline);
+    return fast_pin_set(&bus->cs, !cfg->cs_high);
+}
+
+// Clocks len bytes out of tx while clocking len bytes into rx, either may be
+// NULL.  Without tx the bus sends 0xFF.
+int softspi_transfer(int id, const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    char err[256];
+    struct softspi_bus *bus;
+    int ret;
+
+    if (DEBUG)
+        printf(" ** softspi_transfer: %d, %zu bytes **\n", id, len);
+
+    pthread_mutex_lock(&softspi_table_lock);
+    if (id < 0 || id >= SOFTSPI_MAX || !buses[id].in_use) {
+        pthread_mutex_unlock(&softspi_table_lock);
+        snprintf(err, sizeof(err), "softspi_transfer: bus %d is not open", id);
+        add_error_msg(err);
+        return -1;
+    }
+    bus = &buses[id];
+    pthread_mutex_lock(&bus->lock);
+    pthread_mutex_unlock(&softspi_table_lock);
+
+    ret = transfer_bits(bus, tx, rx, len);
+    if (ret < 0) {
+        // Leave the slave deselected whatever went wrong
+        fast_pin_set(&bus->cs, !bus->cfg.cs_high);
+        snprintf(err, sizeof(err), "softspi_transfer: bus %d failed to drive its pins", id);
+        add_error_msg(err);
+    }
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+void softspi_cleanup(void)
+{
+    int id;
+
+    for (id = 0; id < SOFTSPI_MAX; id++)
+        if (buses[id].in_use)
+            softspi_close(id);
+}
+
+int softspi_selftest(void)
+{
+    uint8_t *saved_memmap = memmap;
+    int saved_mode = gpio_get_pio_mode();
+    struct softspi_config cfg;
+    const uint8_t tx[4] = { 0xA5, 0x01, 0x80, 0x3C };
+    uint8_t rx[4];
+    unsigned int value;
+    int i, id, mode;
+    uint64_t start;
+
+    ASSRT(0 == map_pio_anonymous());
+    ASSRT(0 == gpio_set_pio_mode(1));
+    // CSID0..CSID3 are PE4..PE7
+    for (i = 132; i <= 135; i++)
+        gpio_set_pio_capable(i, 1);
+
+    printf("Testing software SPI argument checks\n");
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.sclk = 132;  cfg.mosi = 133;  cfg.miso = 133;  cfg.cs = 135;
+    cfg.mode = 4;
+    ASSRT(-1 == softspi_open(&cfg));
+    cfg.mode = 0;  cfg.cs = 132;
+    ASSRT(-1 == softspi_open(&cfg));
+    cfg.cs = 135;  cfg.sclk = -1;
+    ASSRT(-1 == softspi_open(&cfg));
+    cfg.sclk = 132;
+    ASSRT(-1 == softspi_transfer(SOFTSPI_MAX, tx, rx, 1));
+    ASSRT(-1 == softspi_close(0));
+
+    printf("Testing software SPI loopback in all modes\n");
+    for (mode = 0; mode < 8; mode++) {
+        cfg.mode = mode & 3;
+        cfg.lsb_first = mode >> 2;
+        cfg.cs_high = mode & 1;
+        ASSRT(0 <= (id = softspi_open(&cfg)));
+        ASSRT(0 == gpio_get_value(132, &value));  ASSRT((unsigned int)(cfg.mode >> 1) == value);
+        ASSRT(0 == gpio_get_value(135, &value));  ASSRT((unsigned int)!cfg.cs_high == value);
+        memset(rx, 0, sizeof(rx));
+        ASSRT(0 == softspi_transfer(id, tx, rx, sizeof(tx)));
+        ASSRT(0 == memcmp(tx, rx, sizeof(tx)));
+        ASSRT(0 == gpio_get_value(132, &value));  ASSRT((unsigned int)(cfg.mode >> 1) == value);
+        ASSRT(0 == gpio_get_value(135, &value));  ASSRT((unsigned int)!cfg.cs_high == value);
+        ASSRT(0 == softspi_transfer(id, NULL, rx, 1));  ASSRT(0xFF == rx[0]);
+        ASSRT(0 == softspi_close(id));
+    }
+
+    printf("Testing software SPI write only and timing\n");
+    cfg.mode = 0;  cfg.lsb_first = 0;  cfg.cs_high = 0;
+    cfg.miso = -1;
+    cfg.speed_hz = 100000;
+    ASSRT(0 <= (id = softspi_open(&cfg)));
+    memset(rx, 0x55, sizeof(rx));
+    start = monotonic_ns();
+    ASSRT(0 == softspi_transfer(id, tx, rx, 2));
+    // 16 bits at 10 us plus the chip select guard
+    ASSRT(monotonic_ns() - start >= 165000ULL);
+    ASSRT(0 == rx[0] && 0 == rx[1]);
+    ASSRT(0 == softspi_transfer(id, tx, NULL, 1));
+
+    printf("Testing software SPI table\n");
+    cfg.speed_hz = 0;
+    for (i = 1; i < SOFTSPI_MAX; i++)
+        ASSRT(0 <= softspi_open(&cfg));
+    ASSRT(-1 == softspi_open(&cfg));
+    softspi_cleanup();
+    ASSRT(-1 == softspi_transfer(id, tx, rx, 1));
+    ASSRT(0 <= (id = softspi_open(&cfg)));
+    ASSRT(0 == softspi_close(id));
+
+    for (i = 132; i <= 135; i++)
+        gpio_set_pio_capable(i, 0);
+    unmap_pio_anonymous();
+    memmap = saved_memmap;
+    gpio_set_pio_mode(saved_mode);
+
+    return 0;
+}
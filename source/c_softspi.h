@@ -0,0 +1,46 @@
+/*
+Copyright (c) 2017 Robert Wolterman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of software SPI buses that can be open at once
+#define SOFTSPI_MAX 8
+
+struct softspi_config
+{
+    int sclk;                  /* gpio numbers, -1 leaves mosi/miso/cs out */
+    int mosi;
+    int miso;
+    int cs;
+    int mode;                  /* 0..3, CPOL is bit 1, CPHA is bit 0 */
+    int lsb_first;
+    int cs_high;               /* chip select is active high */
+    unsigned int speed_hz;     /* 0 runs as fast as the pins allow */
+};
+
+int softspi_open(const struct softspi_config *cfg);
+int softspi_close(int id);
+int softspi_transfer(int id, const uint8_t *tx, uint8_t *rx, size_t len);
+void softspi_cleanup(void);
+int softspi_selftest(void);
@@ -0,0 +1,703 @@
+/*
+Copyright (c) 2017 Robert Wolterman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "c_softuart.h"
+#include "common.h"
+#include "event_gpio.h"
+
+// Software UART
+// TX places every bit on a CLOCK_MONOTONIC deadline off the start of the
+// write, sleeping for the long waits and spinning the tail.  RX never polls
+// the pin: edge detection runs on it and the poll thread hands each edge
+// with its timestamp to rx_edge(), which samples the middle of every bit from
+// the timestamps.  The bits after the last edge of a frame (a byte ending in
+// ones) are sampled when the frame is old enough, by the next start bit or
+// by a read.
+
+// How long a frame is left for the poll thread to deliver its late edges
+// before a read samples the rest of it
+#define SOFTUART_SETTLE_NS 2000000ULL
+
+struct uart_rx
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;       /* signalled on a byte and on close */
+    int active;
+    uint64_t bit_ns;
+    int samples;               /* start, data, parity and the first stop bit */
+    int data_bits;
+    int parity;
+    // decoder
+    unsigned int level;        /* line level after the last edge */
+    int in_frame;
+    uint64_t start;            /* timestamp of the start bit edge */
+    int sampled;
+    unsigned int bits;         /* sampled bits, start bit is bit 0 */
+    // buffer
+    uint8_t ring[SOFTUART_RING];
+    unsigned int head;
+    unsigned int count;
+    struct softuart_stats stats;
+};
+
+struct softuart_bus
+{
+    int in_use;
+    unsigned int generation;   /* of the open, a read waiting across a close notices */
+    struct softuart_config cfg;
+    struct fast_pin tx;
+    int rx_exported;           /* softuart_open() exported the rx pin */
+    pthread_mutex_t tx_lock;   /* held for a whole write */
+    struct uart_rx rx;
+};
+
+static struct softuart_bus buses[SOFTUART_MAX];
+static pthread_mutex_t softuart_table_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t softuart_once = PTHREAD_ONCE_INIT;
+
+// How TX drives its pin and waits for a bit, the selftest records them instead
+static int (*tx_set)(const struct fast_pin *fp, unsigned int value) = fast_pin_set;
+static void (*tx_wait)(uint64_t deadline) = wait_until_ns;
+
+static void rx_init(struct uart_rx *rx)
+{
+    pthread_condattr_t attr;
+
+    pthread_mutex_init(&rx->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&rx->cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// The locks and condition variables live as long as the module, the poll
+// thread may still be in rx_edge() after a close
+static void softuart_init(void)
+{
+    int id;
+
+    for (id = 0; id < SOFTUART_MAX; id++) {
+        pthread_mutex_init(&buses[id].tx_lock, NULL);
+        rx_init(&buses[id].rx);
+    }
+}
+
+// Called with rx->lock held
+static void rx_setup(struct uart_rx *rx, const struct softuart_config *cfg, unsigned int level)
+{
+    rx->bit_ns = 1000000000ULL / cfg->baud;
+    rx->data_bits = cfg->data_bits;
+    rx->parity = cfg->parity;
+    rx->samples = 1 + cfg->data_bits + (cfg->parity != SOFTUART_PARITY_NONE) + 1;
+    rx->level = level;
+    rx->in_frame = 0;
+    rx->head = rx->count = 0;
+    memset(&rx->stats, 0, sizeof(rx->stats));
+}
+
+static void rx_frame(struct uart_rx *rx)
+{
+    unsigned int data = (rx->bits >> 1) & ((1u << rx->data_bits) - 1);
+    unsigned int ones = __builtin_popcount(data);
+
+    if (rx->parity != SOFTUART_PARITY_NONE) {
+        ones += (rx->bits >> (1 + rx->data_bits)) & 1;
+        if ((ones & 1) != (rx->parity == SOFTUART_PARITY_ODD)) {
+            rx->stats.parity++;
+            return;
+        }
+    }
+    if (!((rx->bits >> (rx->samples - 1)) & 1)) {
+        rx->stats.framing++;
+        return;
+    }
+    if (rx->count == SOFTUART_RING) {
+        rx->stats.overruns++;
+        return;
+    }
+    rx->ring[(rx->head + rx->count) % SOFTUART_RING] = data;
+    rx->count++;
+    rx->stats.received++;
+    pthread_cond_broadcast(&rx->cond);
+}
+
+// Samples the bits of the current frame whose middle is before until, the
+// line has been at rx->level since the last edge.  Called with rx->lock held
+static void rx_advance(struct uart_rx *rx, uint64_t until)
+{
+    while (rx->in_frame) {
+        uint64_t at = rx->start + rx->bit_ns * rx->sampled + rx->bit_ns / 2;
+
+        if (at >= until)
+            break;
+        if (rx->sampled == 0 && rx->level) {
+            // the start bit did not last to its middle
+            rx->stats.noise++;
+            rx->in_frame = 0;
+            break;
+        }
+        rx->bits |= rx->level << rx->sampled;
+        if (++rx->sampled == rx->samples) {
+            rx->in_frame = 0;
+            rx_frame(rx);
+        }
+    }
+}
+
+// Edge tap of the rx pin, runs on the poll thread
+static void rx_edge(int gpio, unsigned int level, uint64_t timestamp, void *data)
+{
+    struct uart_rx *rx = data;
+
+    pthread_mutex_lock(&rx->lock);
+    if (rx->active) {
+        rx_advance(rx, timestamp);
+        rx->level = level;
+        if (!rx->in_frame && level == 0) {
+            rx->in_frame = 1;
+            rx->start = timestamp;
+            rx->sampled = 0;
+            rx->bits = 0;
+        }
+    }
+    pthread_mutex_unlock(&rx->lock);
+}
+
+// Called with rx->lock held
+static size_t rx_take(struct uart_rx *rx, uint8_t *buf, size_t len)
+{
+    size_t n = 0;
+
+    while (n < len && rx->count > 0) {
+        buf[n++] = rx->ring[rx->head];
+        rx->head = (rx->head + 1) % SOFTUART_RING;
+        rx->count--;
+    }
+    return n;
+}
+
+static void close_bus_pins(struct softuart_bus *bus)
+{
+    if (bus->cfg.rx >= 0) {
+        gpio_set_edge_tap(bus->cfg.rx, NULL, NULL);
+        remove_edge_detect(bus->cfg.rx);
+        if (bus->rx_exported)
+            gpio_unexport(bus->cfg.rx);
+        bus->rx_exported = 0;
+    }
+    fast_pin_close(&bus->tx);
+}
+
+static int open_bus_pins(struct softuart_bus *bus)
+{
+    char err[256];
+    const struct softuart_config *cfg = &bus->cfg;
+    unsigned int level = 1;
+    int ret;
+
+    bus->rx_exported = 0;
+    if (fast_pin_open(&bus->tx, cfg->tx, OUTPUT) < 0 || tx_set(&bus->tx, 1) < 0) {
+        fast_pin_close(&bus->tx);
+        return -1;
+    }
+    if (cfg->rx < 0)
+        return 0;
+
+    // edge detection needs the sysfs files whatever drives the pins
+    if (!gpio_is_exported(cfg->rx)) {
+        if (gpio_export(cfg->rx) < 0)
+            goto fail;
+        bus->rx_exported = 1;
+    }
+    // tapped first so not a single edge is queued for read_events()
+    gpio_set_edge_tap(cfg->rx, rx_edge, &bus->rx);
+    if ((ret = add_edge_detect(cfg->rx, BOTH_EDGE)) != 0) {
+        gpio_set_edge_tap(cfg->rx, NULL, NULL);
+        if (ret == 1) {
+            snprintf(err, sizeof(err), "softuart_open: GPIO %d already has edge detection", cfg->rx);
+            add_error_msg(err);
+        }
+        goto fail;
+    }
+    gpio_get_value(cfg->rx, &level);
+
+    pthread_mutex_lock(&bus->rx.lock);
+    rx_setup(&bus->rx, cfg, level);
+    bus->rx.active = 1;
+    pthread_mutex_unlock(&bus->rx.lock);
+
+    return 0;
+
+fail:
+    if (bus->rx_exported)
+        gpio_unexport(cfg->rx);
+    bus->rx_exported = 0;
+    fast_pin_close(&bus->tx);
+    return -1;
+}
+
+int softuart_open(const struct softuart_config *cfg)
+{
+    char err[256];
+    int id;
+
+    pthread_once(&softuart_once, softuart_init);
+
+    if (DEBUG)
+        printf(" ** softuart_open: tx %d rx %d %u baud %d%c%d **\n", cfg->tx, cfg->rx, cfg->baud, cfg->data_bits,
+               "NOE"[cfg->parity >= 0 && cfg->parity <= 2 ? cfg->parity : 0], cfg->stop_bits);
+
+    if (cfg->tx < 0 && cfg->rx < 0) {
+        add_error_msg("softuart_open: at least one of tx and rx is required");
+        return -1;
+    }
+    if (cfg->tx == cfg->rx) {
+        add_error_msg("softuart_open: tx and rx must be different pins");
+        return -1;
+    }
+    if (cfg->baud == 0 || cfg->baud > 115200) {
+        snprintf(err, sizeof(err), "softuart_open: invalid baud rate %u, must be 1..115200", cfg->baud);
+        add_error_msg(err);
+        return -1;
+    }
+    if (cfg->data_bits < 5 || cfg->data_bits > 8) {
+        snprintf(err, sizeof(err), "softuart_open: invalid data bits %d, must be 5..8", cfg->data_bits);
+        add_error_msg(err);
+        return -1;
+    }
+    if (cfg->parity < SOFTUART_PARITY_NONE || cfg->parity > SOFTUART_PARITY_EVEN) {
+        snprintf(err, sizeof(err), "softuart_open: invalid parity %d", cfg->parity);
+        add_error_msg(err);
+        return -1;
+    }
+    if (cfg->stop_bits != 1 && cfg->stop_bits != 2) {
+        snprintf(err, sizeof(err), "softuart_open: invalid stop bits %d, must be 1 or 2", cfg->stop_bits);
+        add_error_msg(err);
+        return -1;
+    }
+
+    pthread_mutex_lock(&softuart_table_lock);
+    for (id = 0; id < SOFTUART_MAX; id++)
+        if (!buses[id].in_use)
+            break;
+    if (id == SOFTUART_MAX) {
+        pthread_mutex_unlock(&softuart_table_lock);
+        snprintf(err, sizeof(err), "softuart_open: all %d UARTs are in use", SOFTUART_MAX);
+        add_error_msg(err);
+        return -1;
+    }
+    buses[id].cfg = *cfg;
+    if (open_bus_pins(&buses[id]) < 0) {
+        pthread_mutex_unlock(&softuart_table_lock);
+        return -1;
+    }
+    buses[id].generation++;
+    buses[id].in_use = 1;
+    pthread_mutex_unlock(&softuart_table_lock);
+
+    return id;
+}
+
+// Called with softuart_table_lock held, returns NULL with an error if id is not open
+static struct softuart_bus *bus_lookup(const char *func, int id)
+{
+    char err[256];
+
+    if (id < 0 || id >= SOFTUART_MAX || !buses[id].in_use) {
+        snprintf(err, sizeof(err), "%s: UART %d is not open", func, id);
+        add_error_msg(err);
+        return NULL;
+    }
+    return &buses[id];
+}
+
+int softuart_close(int id)
+{
+    struct softuart_bus *bus;
+
+    if (DEBUG)
+        printf(" ** softuart_close: %d **\n", id);
+
+    pthread_mutex_lock(&softuart_table_lock);
+    if ((bus = bus_lookup("softuart_close", id)) == NULL) {
+        pthread_mutex_unlock(&softuart_table_lock);
+        return -1;
+    }
+    // Waits for a running write to finish
+    pthread_mutex_lock(&bus->tx_lock);
+    bus->in_use = 0;
+    close_bus_pins(bus);
+    pthread_mutex_unlock(&bus->tx_lock);
+
+    // and wakes up a read
+    pthread_mutex_lock(&bus->rx.lock);
+    bus->rx.active = 0;
+    pthread_cond_broadcast(&bus->rx.cond);
+    pthread_mutex_unlock(&bus->rx.lock);
+    pthread_mutex_unlock(&softuart_table_lock);
+
+    return 0;
+}
+
+int softuart_write(int id, const uint8_t *data, size_t len)
+{
+    struct softuart_bus *bus;
+    const struct softuart_config *cfg;
+    uint64_t bit_ns, t;
+    unsigned int frame, level = 1;
+    size_t i;
+    int nbits, n;
+    int ret = 0;
+
+    if (DEBUG)
+        printf(" ** softuart_write: %d, %zu bytes **\n", id, len);
+
+    pthread_mutex_lock(&softuart_table_lock);
+    if ((bus = bus_lookup("softuart_write", id)) == NULL) {
+        pthread_mutex_unlock(&softuart_table_lock);
+        return -1;
+    }
+    cfg = &bus->cfg;
+    if (cfg->tx < 0) {
+        pthread_mutex_unlock(&softuart_table_lock);
+        add_error_msg("softuart_write: the UART has no tx pin");
+        return -1;
+    }
+    pthread_mutex_lock(&bus->tx_lock);
+    pthread_mutex_unlock(&softuart_table_lock);
+
+    bit_ns = 1000000000ULL / cfg->baud;
+    nbits = 1 + cfg->data_bits + (cfg->parity != SOFTUART_PARITY_NONE) + cfg->stop_bits;
+    t = monotonic_ns();
+    for (i = 0; i < len && ret == 0; i++) {
+        // start bit 0, data LSB first, parity, stop bits 1
+        frame = (data[i] & ((1u << cfg->data_bits) - 1)) << 1;
+        n = 1 + cfg->data_bits;
+        if (cfg->parity != SOFTUART_PARITY_NONE)
+            frame |= ((__builtin_popcount(frame) & 1) ^ (cfg->parity == SOFTUART_PARITY_ODD)) << n++;
+        frame |= 3u << n;
+
+        for (n = 0; n < nbits; n++, t += bit_ns) {
+            if (((frame >> n) & 1) == level)
+                continue;
+            level = !level;
+            tx_wait(t);
+            if (tx_set(&bus->tx, level) < 0) {
+                ret = -1;
+                break;
+            }
+        }
+    }
+    // the last stop bit is only sent once it has lasted
+    tx_wait(t);
+    if (ret < 0) {
+        tx_set(&bus->tx, 1);
+        add_error_msg("softuart_write: could not drive the tx pin");
+    }
+    pthread_mutex_unlock(&bus->tx_lock);
+
+    return ret;
+}
+
+// Reads up to len bytes.  Waits for all of them up to timeout_ms, forever
+// when it is negative, and returns what came in.  Returns -1 if the UART
+// is or gets closed.
+int softuart_read(int id, uint8_t *buf, size_t len, int timeout_ms)
+{
+    struct softuart_bus *bus;
+    struct uart_rx *rx;
+    struct timespec ts;
+    unsigned int generation;
+    uint64_t now, deadline, wake, frame_ns;
+    size_t got = 0;
+
+    pthread_mutex_lock(&softuart_table_lock);
+    if ((bus = bus_lookup("softuart_read", id)) == NULL) {
+        pthread_mutex_unlock(&softuart_table_lock);
+        return -1;
+    }
+    if (bus->cfg.rx < 0) {
+        pthread_mutex_unlock(&softuart_table_lock);
+        add_error_msg("softuart_read: the UART has no rx pin");
+        return -1;
+    }
+    rx = &bus->rx;
+    generation = bus->generation;
+    pthread_mutex_lock(&rx->lock);
+    pthread_mutex_unlock(&softuart_table_lock);
+
+    frame_ns = rx->bit_ns * (rx->samples + 1);
+    deadline = monotonic_ns() + (uint64_t)(timeout_ms > 0 ? timeout_ms : 0) * 1000000ULL;
+    for (;;) {
+        now = monotonic_ns();
+        rx_advance(rx, now - SOFTUART_SETTLE_NS);
+        got += rx_take(rx, buf + got, len - got);
+        if (got == len || timeout_ms == 0 || (timeout_ms > 0 && now >= deadline))
+            break;
+
+        // a frame still open is finished by rx_advance() on a later round
+        wake = now + frame_ns + SOFTUART_SETTLE_NS;
+        if (timeout_ms > 0 && wake > deadline)
+            wake = deadline;
+        ts.tv_sec = wake / 1000000000ULL;
+        ts.tv_nsec = wake % 1000000000ULL;
+        pthread_cond_timedwait(&rx->cond, &rx->lock, &ts);
+        if (!rx->active || bus->generation != generation) {
+            pthread_mutex_unlock(&rx->lock);
+            add_error_msg("softuart_read: the UART was closed");
+            return -1;
+        }
+    }
+    pthread_mutex_unlock(&rx->lock);
+
+    return (int)got;
+}
+
+// Bytes that can be read without waiting
+int softuart_waiting(int id)
+{
+    struct softuart_bus *bus;
+    int count;
+
+    pthread_mutex_lock(&softuart_table_lock);
+    if ((bus = bus_lookup("softuart_waiting", id)) == NULL) {
+        pthread_mutex_unlock(&softuart_table_lock);
+        return -1;
+    }
+    pthread_mutex_lock(&bus->rx.lock);
+    if (bus->rx.active)
+        rx_advance(&bus->rx, monotonic_ns() - SOFTUART_SETTLE_NS);
+    count = bus->rx.count;
+    pthread_mutex_unlock(&bus->rx.lock);
+    pthread_mutex_unlock(&softuart_table_lock);
+
+    return count;
+}
+
+int softuart_get_stats(int id, struct softuart_stats *stats, int reset)
+{
+    struct softuart_bus *bus;
+
+    pthread_mutex_lock(&softuart_table_lock);
+    if ((bus = bus_lookup("softuart_get_stats", id)) == NULL) {
+        pthread_mutex_unlock(&softuart_table_lock);
+        return -1;
+    }
+    pthread_mutex_lock(&bus->rx.lock);
+    *stats = bus->rx.stats;
+    if (reset)
+        memset(&bus->rx.stats, 0, sizeof(bus->rx.stats));
+    pthread_mutex_unlock(&bus->rx.lock);
+    pthread_mutex_unlock(&softuart_table_lock);
+
+    return 0;
+}
+
+void softuart_cleanup(void)
+{
+    int id;
+
+    for (id = 0; id < SOFTUART_MAX; id++)
+        if (buses[id].in_use)
+            softuart_close(id);
+}
+
+// TX levels recorded by the selftest, fed back into a decoder.  On the
+// virtual clock the waits return at once and an edge is timestamped with
+// its deadline, so the decoding does not depend on how the test is scheduled
+static struct
+{
+    int count;
+    unsigned int level[256];
+    uint64_t ts[256];
+    int virtual_clock;
+    uint64_t now;
+} recorded;
+
+static int record_tx(const struct fast_pin *fp, unsigned int value)
+{
+    if (recorded.count < 256) {
+        recorded.level[recorded.count] = value;
+        recorded.ts[recorded.count] = recorded.virtual_clock ? recorded.now : monotonic_ns();
+        recorded.count++;
+    }
+    return 0;
+}
+
+static void record_wait(uint64_t deadline)
+{
+    if (recorded.virtual_clock)
+        recorded.now = deadline;
+    else
+        wait_until_ns(deadline);
+}
+
+// Plays the recorded TX edges into rx, skipping the idle level set on open
+static void replay_tx(struct uart_rx *rx)
+{
+    int i;
+
+    for (i = 1; i < recorded.count; i++)
+        rx_edge(-1, recorded.level[i], recorded.ts[i], rx);
+    rx_advance(rx, recorded.ts[recorded.count - 1] + 100 * rx->bit_ns);
+    recorded.count = 1;
+}
+
+int softuart_selftest(void)
+{
+    uint8_t *saved_memmap = memmap;
+    int saved_mode = gpio_get_pio_mode();
+    struct softuart_config cfg;
+    struct softuart_stats stats;
+    struct uart_rx *rx;
+    const uint8_t msg[4] = { 0x55, 0xA3, 0x00, 0xFF };
+    uint8_t buf[8];
+    uint64_t start, t;
+    int i, id;
+
+    pthread_once(&softuart_once, softuart_init);
+    ASSRT(0 == map_pio_anonymous());
+    ASSRT(0 == gpio_set_pio_mode(1));
+    // CSID0 is PE4
+    gpio_set_pio_capable(132, 1);
+    tx_set = record_tx;
+    tx_wait = record_wait;
+    memset(&recorded, 0, sizeof(recorded));
+
+    printf("Testing software UART argument checks\n");
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.tx = 132;  cfg.rx = -1;
+    cfg.baud = 9600;  cfg.data_bits = 8;  cfg.stop_bits = 1;
+    cfg.parity = 3;
+    ASSRT(-1 == softuart_open(&cfg));
+    cfg.parity = SOFTUART_PARITY_NONE;  cfg.data_bits = 9;
+    ASSRT(-1 == softuart_open(&cfg));
+    cfg.data_bits = 8;  cfg.baud = 0;
+    ASSRT(-1 == softuart_open(&cfg));
+    cfg.baud = 9600;  cfg.tx = -1;
+    ASSRT(-1 == softuart_open(&cfg));
+    cfg.tx = 132;
+    ASSRT(-1 == softuart_write(SOFTUART_MAX, msg, 1));
+
+    printf("Testing software UART transmit timing\n");
+    ASSRT(0 <= (id = softuart_open(&cfg)));
+    ASSRT(1 == recorded.count && 1 == recorded.level[0]);  /* idles high */
+    ASSRT(-1 == softuart_read(id, buf, 1, 0));  /* no rx pin */
+    start = monotonic_ns();
+    ASSRT(0 == softuart_write(id, msg, 1));
+    // the frame of 0x55 changes level on every bit, the stop bit included
+    ASSRT(11 == recorded.count);
+    for (i = 1; i < 11; i++) {
+        t = recorded.ts[i] - start;
+        ASSRT(recorded.level[i] == (i & 1 ? 0 : 1));
+        ASSRT(t >= (i - 1) * 104166ULL);
+    }
+    ASSRT(monotonic_ns() - start >= 10 * 104166ULL);  /* returns after the stop bit */
+
+    printf("Testing software UART receive from edge timestamps\n");
+    recorded.virtual_clock = 1;
+    recorded.count = 1;
+    rx = &buses[id].rx;
+    pthread_mutex_lock(&rx->lock);
+    rx_setup(rx, &cfg, 1);
+    rx->active = 1;
+    pthread_mutex_unlock(&rx->lock);
+    ASSRT(0 == softuart_write(id, msg, 1));
+    replay_tx(rx);
+    ASSRT(0 == softuart_write(id, msg + 1, 3));
+    replay_tx(rx);
+    ASSRT(4 == rx->count);
+    ASSRT(4 == rx_take(rx, buf, sizeof(buf)));
+    ASSRT(0 == memcmp(msg, buf, 4));
+
+    printf("Testing software UART parity and stop bits\n");
+    cfg.data_bits = 7;  cfg.parity = SOFTUART_PARITY_EVEN;  cfg.stop_bits = 2;
+    ASSRT(0 == softuart_close(id));
+    ASSRT(0 <= (id = softuart_open(&cfg)));
+    rx = &buses[id].rx;
+    rx_setup(rx, &cfg, 1);
+    rx->active = 1;
+    ASSRT(0 == softuart_write(id, msg, 4));
+    replay_tx(rx);
+    ASSRT(4 == rx_take(rx, buf, sizeof(buf)));
+    for (i = 0; i < 4; i++)
+        ASSRT((msg[i] & 0x7f) == buf[i]);
+    cfg.parity = SOFTUART_PARITY_ODD;
+    rx_setup(rx, &cfg, 1);
+    ASSRT(0 == softuart_write(id, msg, 2));  /* sent with even parity */
+    replay_tx(rx);
+    ASSRT(0 == rx->count && 2 == rx->stats.parity);
+    recorded.count = 1;
+    ASSRT(0 == softuart_write(id, msg, 1));
+    ASSRT(11 == recorded.count);  /* 7E2 0x55 changes on every bit up to the stop bits */
+    for (i = 1; i < 11; i++)
+        ASSRT(recorded.ts[i] - recorded.ts[1] == (uint64_t)(i - 1) * 104166ULL);  /* on the deadlines, not drifting */
+
+    printf("Testing software UART receive errors\n");
+    cfg.data_bits = 8;  cfg.parity = SOFTUART_PARITY_NONE;  cfg.stop_bits = 1;
+    rx_setup(rx, &cfg, 1);
+    t = monotonic_ns() - 100000000ULL;
+    rx_edge(-1, 0, t, rx);
+    rx_edge(-1, 1, t + 10000, rx);  /* 10 us glitch */
+    rx_edge(-1, 0, t + 1000000, rx);  /* a break, stop bit low */
+    rx_edge(-1, 1, t + 3000000, rx);
+    rx_edge(-1, 0, t + 4000000, rx);  /* 0x00 after a gap */
+    rx_edge(-1, 1, t + 4000000 + 9 * rx->bit_ns, rx);
+    ASSRT(1 == rx->stats.noise && 1 == rx->stats.framing);
+    ASSRT(1 == softuart_waiting(id));
+    ASSRT(0 == softuart_get_stats(id, &stats, 1));
+    ASSRT(1 == stats.received && 1 == stats.noise && 1 == stats.framing && 0 == stats.overruns);
+    ASSRT(0 == softuart_get_stats(id, &stats, 0));  ASSRT(0 == stats.received);
+    buses[id].cfg.rx = 133;  /* softuart_read() wants an rx pin */
+    ASSRT(1 == softuart_read(id, buf, sizeof(buf), 0));  ASSRT(0 == buf[0]);
+    start = monotonic_ns();
+    ASSRT(0 == softuart_read(id, buf, 1, 20));
+    ASSRT(monotonic_ns() - start >= 20000000ULL);
+    buses[id].cfg.rx = -1;
+
+    printf("Testing software UART buffer overrun\n");
+    for (i = 0; i < SOFTUART_RING + 2; i++) {
+        t += 2 * 10 * rx->bit_ns;
+        rx_edge(-1, 0, t, rx);
+        rx_edge(-1, 1, t + rx->bit_ns, rx);
+    }
+    rx_advance(rx, t + 100 * rx->bit_ns);
+    ASSRT(SOFTUART_RING == rx->count && 2 == rx->stats.overruns);
+    ASSRT(0 == softuart_close(id));
+    ASSRT(-1 == softuart_waiting(id));
+
+    tx_set = fast_pin_set;
+    tx_wait = wait_until_ns;
+    gpio_set_pio_capable(132, 0);
+    unmap_pio_anonymous();
+    memmap = saved_memmap;
+    gpio_set_pio_mode(saved_mode);
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*
+Copyright (c) 2017 Robert Wolterman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of software UARTs that can be open at once
+#define SOFTUART_MAX 4
+// Received bytes each UART buffers until they are read
+#define SOFTUART_RING 4096
+
+#define SOFTUART_PARITY_NONE 0
+#define SOFTUART_PARITY_ODD  1
+#define SOFTUART_PARITY_EVEN 2
+
+struct softuart_config
+{
+    int tx;                    /* gpio numbers, -1 for a receive or transmit only UART */
+    int rx;
+    unsigned int baud;
+    int data_bits;             /* 5..8 */
+    int parity;                /* SOFTUART_PARITY_* */
+    int stop_bits;             /* 1 or 2 */
+};
+
+struct softuart_stats
+{
+    unsigned long received;    /* bytes put in the buffer */
+    unsigned long framing;     /* stop bit was low */
+    unsigned long parity;      /* parity bit did not match */
+    unsigned long overruns;    /* bytes dropped on a full buffer */
+    unsigned long noise;       /* start bits gone by the middle of the bit */
+};
+
+int softuart_open(const struct softuart_config *cfg);
+int softuart_close(int id);
+int softuart_write(int id, const uint8_t *data, size_t len);
+int softuart_read(int id, uint8_t *buf, size_t len, int timeout_ms);
+int softuart_waiting(int id);
+int softuart_get_stats(int id, struct softuart_stats *stats, int reset);
+void softuart_cleanup(void);
+int softuart_selftest(void);
@@ -0,0 +1,619 @@
+/*
+Copyright (c) 2017 Robert Wolterman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include "cdev_gpio.h"
+#include "event_gpio.h"
+#include "common.h"
+
+// GPIO character device (/dev/gpiochipN) support
+// The kernel ABI below is the v1 line handle/line event interface that showed
+// up in Linux 4.8.  Older build hosts (the stock CHIP images ship 4.4 headers)
+// do not have <linux/gpio.h>, so a copy of the parts we use lives here.  On a
+// kernel without the character device the ioctls fail and the sysfs path is
+// used instead.
+#ifdef __has_include
+#  if __has_include(<linux/gpio.h>)
+#    include <linux/gpio.h>
+#  endif
+#endif
+
+#ifndef GPIO_GET_CHIPINFO_IOCTL
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+struct gpiochip_info {
+    char name[32];
+    char label[32];
+    __u32 lines;
+};
+
+#define GPIOLINE_FLAG_KERNEL     (1UL << 0)
+#define GPIOLINE_FLAG_IS_OUT     (1UL << 1)
+
+struct gpioline_info {
+    __u32 line_offset;
+    __u32 flags;
+    char name[32];
+    char consumer[32];
+};
+
+#define GPIOHANDLES_MAX 64
+#define GPIOHANDLE_REQUEST_INPUT  (1UL << 0)
+#define GPIOHANDLE_REQUEST_OUTPUT (1UL << 1)
+
+struct gpiohandle_request {
+    __u32 lineoffsets[GPIOHANDLES_MAX];
+    __u32 flags;
+    __u8 default_values[GPIOHANDLES_MAX];
+    char consumer_label[32];
+    __u32 lines;
+    int fd;
+};
+
+struct gpiohandle_data {
+    __u8 values[GPIOHANDLES_MAX];
+};
+
+#define GPIOHANDLE_GET_LINE_VALUES_IOCTL _IOWR(0xB4, 0x08, struct gpiohandle_data)
+#define GPIOHANDLE_SET_LINE_VALUES_IOCTL _IOWR(0xB4, 0x09, struct gpiohandle_data)
+
+#define GPIOEVENT_REQUEST_RISING_EDGE  (1UL << 0)
+#define GPIOEVENT_REQUEST_FALLING_EDGE (1UL << 1)
+#define GPIOEVENT_REQUEST_BOTH_EDGES   ((1UL << 0) | (1UL << 1))
+
+struct gpioevent_request {
+    __u32 lineoffset;
+    __u32 handleflags;
+    __u32 eventflags;
+    char consumer_label[32];
+    int fd;
+};
+
+#define GPIOEVENT_EVENT_RISING_EDGE  0x01
+#define GPIOEVENT_EVENT_FALLING_EDGE 0x02
+
+struct gpioevent_data {
+    __u64 timestamp;
+    __u32 id;
+};
+
+#define GPIO_GET_CHIPINFO_IOCTL    _IOR(0xB4, 0x01, struct gpiochip_info)
+#define GPIO_GET_LINEINFO_IOCTL    _IOWR(0xB4, 0x02, struct gpioline_info)
+#define GPIO_GET_LINEHANDLE_IOCTL  _IOWR(0xB4, 0x03, struct gpiohandle_request)
+#define GPIO_GET_LINEEVENT_IOCTL   _IOWR(0xB4, 0x04, struct gpioevent_request)
+#endif
+
+#define CONSUMER_LABEL "CHIP_IO"
+#define MAX_GPIOCHIPS 8
+
+// One entry per gpiochip, matched between /sys/class/gpio and /dev by label
+struct gpiochip
+{
+    int fd;
+    int base;
+    int ngpio;
+    char label[32];
+};
+static struct gpiochip chips[MAX_GPIOCHIPS];
+static int num_chips = -1;   // -1 until the chips have been scanned
+
+static int default_ioctl(int fd, unsigned long request, void *arg)
+{
+    return ioctl(fd, request, arg);
+}
+
+// All ioctls go through this pointer so the line handle code can be
+// exercised against a stub instead of a real /dev/gpiochipN
+static int (*cdev_ioctl)(int fd, unsigned long request, void *arg) = default_ioctl;
+
+void cdev_set_ioctl(int (*func)(int fd, unsigned long request, void *arg))
+{
+    if (func == NULL)
+        cdev_ioctl = default_ioctl;
+    else
+        cdev_ioctl = func;
+}
+
+static int read_sysfs_line(const char *filename, char *buf, size_t len)
+{
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL)
+        return -1;
+    char *s = fgets(buf, len, fp);
+    fclose(fp);
+    if (s == NULL)
+        return -1;
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static void scan_chips(void)
+{
+    DIR *dir;
+    struct dirent *ent;
+    // room for any directory entry name under /sys/class/gpio
+    char filename[sizeof("/sys/class/gpio/") + NAME_MAX + sizeof("/ngpio")];
+    char line[80];
+
+    num_chips = 0;
+    dir = opendir("/sys/class/gpio");
+    if (dir == NULL)
+        return;
+
+    while (num_chips < MAX_GPIOCHIPS && (ent = readdir(dir)) != NULL) {
+        struct gpiochip *c = &chips[num_chips];
+        if (strncmp(ent->d_name, "gpiochip", 8) != 0)
+            continue;
+        c->fd = -1;
+        c->base = atoi(ent->d_name + 8);
+
+        snprintf(filename, sizeof(filename), "/sys/class/gpio/%s/ngpio", ent->d_name); BUF2SMALL(filename);
+        if (read_sysfs_line(filename, line, sizeof(line)) < 0)
+            continue;
+        c->ngpio = atoi(line);
+
+        snprintf(filename, sizeof(filename), "/sys/class/gpio/%s/label", ent->d_name); BUF2SMALL(filename);
+        if (read_sysfs_line(filename, c->label, sizeof(c->label)) < 0)
+            continue;
+
+        // find the character device carrying the same label
+        int i;
+        for (i = 0; i < MAX_GPIOCHIPS * 2 && c->fd < 0; i++) {
+            struct gpiochip_info info;
+            int fd;
+            snprintf(filename, sizeof(filename), "/dev/gpiochip%d", i); BUF2SMALL(filename);
+            if ((fd = open(filename, O_RDWR | O_CLOEXEC)) < 0)
+                continue;
+            memset(&info, 0, sizeof(info));
+            if (cdev_ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info) == 0
+                && strncmp(info.label, c->label, sizeof(info.label)) == 0
+                && (int)info.lines == c->ngpio) {
+                c->fd = fd;
+            } else {
+                close(fd);
+            }
+        }
+
+        if (DEBUG)
+            printf(" ** cdev scan_chips: base %d, ngpio %d, label %s, fd %d **\n", c->base, c->ngpio, c->label, c->fd);
+        if (c->fd >= 0)
+            num_chips++;
+    }
+    closedir(dir);
+}
+
+int cdev_available(void)
+{
+    if (num_chips < 0)
+        scan_chips();
+    return num_chips > 0;
+}
+
+int cdev_line_lookup(int gpio, int *chip_fd, unsigned int *offset)
+{
+    int i;
+
+    if (num_chips < 0)
+        scan_chips();
+
+    for (i = 0; i < num_chips; i++) {
+        if (gpio >= chips[i].base && gpio < chips[i].base + chips[i].ngpio) {
+            *chip_fd = chips[i].fd;
+            *offset = gpio - chips[i].base;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int cdev_request_line(int gpio, unsigned int direction, unsigned int value)
+{
+    struct gpiohandle_request req;
+    int chip_fd;
+    unsigned int offset;
+
+    if (cdev_line_lookup(gpio, &chip_fd, &offset) < 0) {
+        char err[256];
+        snprintf(err, sizeof(err), "cdev_request_line: no gpiochip character device for GPIO %d", gpio);
+        add_error_msg(err);
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.lineoffsets[0] = offset;
+    req.lines = 1;
+    if (direction == OUTPUT)
+        req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+    else if (direction == INPUT)
+        req.flags = GPIOHANDLE_REQUEST_INPUT;
+    req.default_values[0] = value ? 1 : 0;
+    strncpy(req.consumer_label, CONSUMER_LABEL, sizeof(req.consumer_label) - 1);
+
+    if (DEBUG)
+        printf(" ** cdev_request_line: gpio %d, offset %u, direction %u **\n", gpio, offset, direction);
+
+    if (cdev_ioctl(chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0) {
+        char err[256];
+        snprintf(err, sizeof(err), "cdev_request_line: could not request GPIO %d (%s)", gpio, strerror(errno));
+        add_error_msg(err);
+        return -1;
+    }
+
+    return req.fd;
+}
+
+int cdev_request_events(int gpio, unsigned int edge)
+{
+    struct gpioevent_request req;
+    int chip_fd;
+    unsigned int offset;
+
+    if (cdev_line_lookup(gpio, &chip_fd, &offset) < 0) {
+        char err[256];
+        snprintf(err, sizeof(err), "cdev_request_events: no gpiochip character device for GPIO %d", gpio);
+        add_error_msg(err);
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.lineoffset = offset;
+    req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    if (edge == RISING_EDGE)
+        req.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+    else if (edge == FALLING_EDGE)
+        req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+    else
+        req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+    strncpy(req.consumer_label, CONSUMER_LABEL, sizeof(req.consumer_label) - 1);
+
+    if (DEBUG)
+        printf(" ** cdev_request_events: gpio %d, offset %u, edge %u **\n", gpio, offset, edge);
+
+    if (cdev_ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0) {
+        char err[256];
+        snprintf(err, sizeof(err), "cdev_request_events: could not request events for GPIO %d (%s)", gpio, strerror(errno));
+        add_error_msg(err);
+        return -1;
+    }
+
+    // the poll thread drains events until EAGAIN, so never block on a read
+    fcntl(req.fd, F_SETFL, fcntl(req.fd, F_GETFL) | O_NONBLOCK);
+
+    return req.fd;
+}
+
+int cdev_get_value(int fd, unsigned int *value)
+{
+    struct gpiohandle_data data;
+
+    memset(&data, 0, sizeof(data));
+    if (cdev_ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0) {
+        char err[256];
+        snprintf(err, sizeof(err), "cdev_get_value: could not read line handle %d (%s)", fd, strerror(errno));
+        add_error_msg(err);
+        return -1;
+    }
+    *value = data.values[0] ? 1 : 0;
+
+    return 0;
+}
+
+int cdev_set_value(int fd, unsigned int value)
+{
+    struct gpiohandle_data data;
+
+    memset(&data, 0, sizeof(data));
+    data.values[0] = value ? 1 : 0;
+    if (cdev_ioctl(fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) < 0) {
+        char err[256];
+        snprintf(err, sizeof(err), "cdev_set_value: could not write line handle %d (%s)", fd, strerror(errno));
+        add_error_msg(err);
+        return -1;
+    }
+
+    return 0;
+}
+
+int cdev_get_direction(int gpio, unsigned int *value)
+{
+    struct gpioline_info info;
+    int chip_fd;
+    unsigned int offset;
+
+    if (cdev_line_lookup(gpio, &chip_fd, &offset) < 0) {
+        char err[256];
+        snprintf(err, sizeof(err), "cdev_get_direction: no gpiochip character device for GPIO %d", gpio);
+        add_error_msg(err);
+        return -1;
+    }
+
+    memset(&info, 0, sizeof(info));
+    info.line_offset = offset;
+    if (cdev_ioctl(chip_fd, GPIO_GET_LINEINFO_IOCTL, &info) < 0) {
+        char err[256];
+        snprintf(err, sizeof(err), "cdev_get_direction: could not get line info for GPIO %d (%s)", gpio, strerror(errno));
+        add_error_msg(err);
+        return -1;
+    }
+    *value = (info.flags & GPIOLINE_FLAG_IS_OUT) ? OUTPUT : INPUT;
+
+    return 0;
+}
+
+// Reads one event record from a line event fd
+// return values:
+// 1 - event read into edge/timestamp
+// 0 - no event pending
+// -1 - error
+int cdev_read_event(int fd, unsigned int *edge, uint64_t *timestamp)
+{
+    struct gpioevent_data event;
+
+    ssize_t s = read(fd, &event, sizeof(event));
+    if (s < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (s != sizeof(event)) {
+        char err[256];
+        snprintf(err, sizeof(err), "cdev_read_event: could not read event from %d (%s)", fd, strerror(errno));
+        add_error_msg(err);
+        return -1;
+    }
+
+    if (event.id == GPIOEVENT_EVENT_RISING_EDGE)
+        *edge = RISING_EDGE;
+    else
+        *edge = FALLING_EDGE;
+    *timestamp = event.timestamp;
+
+    return 1;
+}
+
+void cdev_cleanup(void)
+{
+    int i;
+
+    if (DEBUG)
+        printf(" ** cdev_cleanup **\n");
+    for (i = 0; i < num_chips; i++)
+        close(chips[i].fd);
+    num_chips = -1;
+}
+
+// Internal unit tests, run against a stubbed ioctl layer and a pipe standing
+// in for a line event fd so no gpiochip is needed.  The stub chip's lines
+// have pull-ups: an input reads 1, an output what was written to it.
+#define SELFTEST_LINES 8
+
+static unsigned char selftest_line_value = 0;   /* last value written to any fd */
+static struct
+{
+    int fd;                    /* read end of a pipe handed out as the line's fd */
+    int writer;                /* write end, polls POLLERR once fd is closed */
+    int output;
+    unsigned char value;
+} selftest_lines[SELFTEST_LINES];
+static int selftest_requests = 0;
+static int selftest_fail_request = 0;
+static struct gpiochip selftest_saved_chip;
+static int selftest_saved_num_chips;
+static int selftest_saved_backend;
+
+static int selftest_request(unsigned int offset, int output, unsigned char value, int *fd)
+{
+    struct pollfd pfd;
+    int p[2];
+
+    if (offset >= SELFTEST_LINES) {
+        errno = EINVAL;
+        return -1;
+    }
+    // the kernel refuses a line that is still requested
+    if (selftest_lines[offset].writer >= 0) {
+        pfd.fd = selftest_lines[offset].writer;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, 0) == 1 && !(pfd.revents & POLLERR)) {
+            errno = EBUSY;
+            return -1;
+        }
+        close(selftest_lines[offset].writer);
+        selftest_lines[offset].writer = -1;
+        selftest_lines[offset].fd = -1;
+    }
+    if (selftest_fail_request) {
+        selftest_fail_request = 0;
+        errno = EINVAL;
+        return -1;
+    }
+    if (pipe(p) < 0)
+        return -1;
+    fcntl(p[0], F_SETFD, FD_CLOEXEC);
+    fcntl(p[1], F_SETFD, FD_CLOEXEC);
+    selftest_lines[offset].fd = p[0];
+    selftest_lines[offset].writer = p[1];
+    if (output >= 0)
+        selftest_lines[offset].output = output;
+    if (output == 1)
+        selftest_lines[offset].value = value;
+    selftest_requests++;
+    *fd = p[0];
+    return 0;
+}
+
+static int selftest_line(int fd)
+{
+    int i;
+
+    for (i = 0; i < SELFTEST_LINES; i++)
+        if (selftest_lines[i].writer >= 0 && selftest_lines[i].fd == fd)
+            return i;
+    return -1;
+}
+
+static int selftest_ioctl(int fd, unsigned long request, void *arg)
+{
+    struct gpiohandle_data *data = (struct gpiohandle_data *)arg;
+    struct gpiohandle_request *hreq = (struct gpiohandle_request *)arg;
+    struct gpioevent_request *ereq = (struct gpioevent_request *)arg;
+    int line = selftest_line(fd);
+
+    if (request == GPIO_GET_LINEHANDLE_IOCTL) {
+        return selftest_request(hreq->lineoffsets[0],
+                                (hreq->flags & GPIOHANDLE_REQUEST_OUTPUT) ? 1 : (hreq->flags & GPIOHANDLE_REQUEST_INPUT) ? 0 : -1,
+                                hreq->default_values[0], &hreq->fd);
+    } else if (request == GPIO_GET_LINEEVENT_IOCTL) {
+        return selftest_request(ereq->lineoffset, 0, 0, &ereq->fd);
+    } else if (request == GPIOHANDLE_SET_LINE_VALUES_IOCTL) {
+        // like the kernel, only an output takes a value
+        if (line >= 0 && !selftest_lines[line].output) {
+            errno = EPERM;
+            return -1;
+        }
+        selftest_line_value = data->values[0];
+        if (line >= 0)
+            selftest_lines[line].value = data->values[0];
+        return 0;
+    } else if (request == GPIOHANDLE_GET_LINE_VALUES_IOCTL) {
+        if (line < 0)
+            data->values[0] = selftest_line_value;
+        else
+            data->values[0] = selftest_lines[line].output ? selftest_lines[line].value : 1;
+        return 0;
+    }
+    errno = ENOTTY;
+    return -1;
+}
+
+// Puts a stub chip of SELFTEST_LINES lines at GPIO base in place of the real
+// ones and switches to the chardev backend, so the selftests of the buses can
+// run their pins outside PIO mode.  cdev_selftest_chip_remove() undoes it.
+int cdev_selftest_chip(int base)
+{
+    int i;
+
+    selftest_saved_chip = chips[0];
+    selftest_saved_num_chips = num_chips;
+    selftest_saved_backend = gpio_get_backend();
+    for (i = 0; i < SELFTEST_LINES; i++) {
+        selftest_lines[i].fd = -1;
+        selftest_lines[i].writer = -1;
+        selftest_lines[i].output = 0;
+    }
+    cdev_set_ioctl(selftest_ioctl);
+    chips[0].fd = -1;
+    chips[0].base = base;
+    chips[0].ngpio = SELFTEST_LINES;
+    num_chips = 1;
+
+    return gpio_set_backend(BACKEND_CDEV);
+}
+
+void cdev_selftest_chip_remove(void)
+{
+    int i;
+
+    for (i = 0; i < SELFTEST_LINES; i++) {
+        if (selftest_lines[i].writer >= 0)
+            close(selftest_lines[i].writer);
+        selftest_lines[i].writer = -1;
+    }
+    gpio_set_backend(selftest_saved_backend);
+    chips[0] = selftest_saved_chip;
+    num_chips = selftest_saved_num_chips;
+    cdev_set_ioctl(NULL);
+}
+
+int cdev_selftest(void)
+{
+    unsigned int value = 0;
+    unsigned int edge = 0;
+    uint64_t timestamp = 0;
+    int p[2];
+
+    printf("Testing cdev line handle values\n");
+    cdev_set_ioctl(selftest_ioctl);
+    ASSRT(0 == cdev_set_value(3, 1));  ASSRT(1 == selftest_line_value);
+    ASSRT(0 == cdev_get_value(3, &value));  ASSRT(1 == value);
+    ASSRT(0 == cdev_set_value(3, 0));  ASSRT(0 == selftest_line_value);
+    ASSRT(0 == cdev_get_value(3, &value));  ASSRT(0 == value);
+    ASSRT(0 == cdev_set_value(3, 5));  ASSRT(1 == selftest_line_value);
+    cdev_set_ioctl(NULL);
+
+    printf("Testing cdev line events\n");
+    ASSRT(0 == pipe(p));
+    fcntl(p[0], F_SETFL, fcntl(p[0], F_GETFL) | O_NONBLOCK);
+    struct gpioevent_data event;
+    memset(&event, 0, sizeof(event));
+    event.timestamp = 123456789ULL;
+    event.id = GPIOEVENT_EVENT_FALLING_EDGE;
+    ASSRT(sizeof(event) == write(p[1], &event, sizeof(event)));
+    event.timestamp = 123456999ULL;
+    event.id = GPIOEVENT_EVENT_RISING_EDGE;
+    ASSRT(sizeof(event) == write(p[1], &event, sizeof(event)));
+    ASSRT(1 == cdev_read_event(p[0], &edge, &timestamp));
+    ASSRT(FALLING_EDGE == edge);  ASSRT(123456789ULL == timestamp);
+    ASSRT(1 == cdev_read_event(p[0], &edge, &timestamp));
+    ASSRT(RISING_EDGE == edge);  ASSRT(123456999ULL == timestamp);
+    ASSRT(0 == cdev_read_event(p[0], &edge, &timestamp));
+    close(p[0]);
+    close(p[1]);
+    clear_error_msg();
+
+    printf("Testing cdev line requests\n");
+    ASSRT(0 == cdev_selftest_chip(1000));
+    ASSRT(0 == gpio_export(1003));
+    ASSRT(gpio_is_cdev(1003));
+    ASSRT(0 == gpio_set_direction(1003, 1));  /* 1 is out */
+    ASSRT(0 == gpio_set_value(1003, 1));  ASSRT(1 == selftest_lines[3].value);
+    ASSRT(0 == gpio_set_direction(1003, 0));
+    ASSRT(0 == gpio_get_value(1003, &value));  ASSRT(1 == value);  /* pulled up */
+    ASSRT(0 == gpio_set_edge(1003, BOTH_EDGE));
+    ASSRT(0 == gpio_set_edge(1003, NO_EDGE));
+    ASSRT(0 == gpio_set_direction(1003, 0));
+    ASSRT(0 == gpio_set_edge(1003, RISING_EDGE));
+    // a failed request puts the old one back
+    selftest_fail_request = 1;
+    selftest_requests = 0;
+    ASSRT(-1 == gpio_set_direction(1003, 1));
+    ASSRT(1 == selftest_requests);
+    ASSRT(0 <= fd_lookup(1003));
+    selftest_fail_request = 1;
+    ASSRT(-1 == gpio_set_edge(1003, FALLING_EDGE));
+    ASSRT(2 == selftest_requests);
+    ASSRT(0 == gpio_set_edge(1003, NO_EDGE));
+    ASSRT(0 == gpio_unexport(1003));
+    ASSRT(-1 == fd_lookup(1003));
+    cdev_selftest_chip_remove();
+    clear_error_msg();
+
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+Copyright (c) 2017 Robert Wolterman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdint.h>
+
+// Direction value for cdev_request_line() that leaves the line as configured
+#define CDEV_AS_IS 2
+
+int cdev_available(void);
+int cdev_line_lookup(int gpio, int *chip_fd, unsigned int *offset);
+int cdev_request_line(int gpio, unsigned int direction, unsigned int value);
+int cdev_request_events(int gpio, unsigned int edge);
+int cdev_get_value(int fd, unsigned int *value);
+int cdev_set_value(int fd, unsigned int value);
+int cdev_get_direction(int gpio, unsigned int *value);
+int cdev_read_event(int fd, unsigned int *edge, uint64_t *timestamp);
+void cdev_set_ioctl(int (*func)(int fd, unsigned long request, void *arg));
+void cdev_cleanup(void);
+int cdev_selftest_chip(int base);
+void cdev_selftest_chip_remove(void);
+int cdev_selftest(void);
@@ -325,6 +325,31 @@ void toggle_debug(void)
     }
 }
 
+uint64_t monotonic_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Waits until CLOCK_MONOTONIC reaches deadline.  Long waits sleep until
+// SPIN_NS before it, the rest is spun because a sleep wakes up tens of us
+// late, too late for the bit timing of the software buses.
+void wait_until_ns(uint64_t deadline)
+{
+  struct timespec ts;
+  uint64_t now = monotonic_ns();
+
+  if (deadline > now + 2 * SPIN_NS) {
+    ts.tv_sec = (deadline - SPIN_NS) / 1000000000ULL;
+    ts.tv_nsec = (deadline - SPIN_NS) % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+      ;
+  }
+  while (monotonic_ns() < deadline)
+    ;
+}
+
 int gpio_number(pins_t *pin)
 {
   int gpio_num = -1;
@@ -399,6 +424,18 @@ int lookup_gpio_by_altname(const char *altname)
   return -1;
 }
 
+// Name of the first pin using gpio, NULL if there is none
+const char *lookup_name_by_gpio(int gpio)
+{
+  pins_t *p;
+  for (p = pins_info; p->name != NULL; ++p) {
+      if (p->gpio >= 0 && gpio_number(p) == gpio) {
+          return p->name;
+      }
+  }
+  return NULL;
+}
+
 int lookup_pud_capable_by_key(const char *key)
 {
   pins_t *p;
@@ -729,7 +766,7 @@ void dyn_int_array_delete(dyn_int_array_t **in_array)
 }  /* dyn_int_array_delete */
 
 
-char error_msg_buff[1024];  /* written to when an error must be returned */
+__thread char error_msg_buff[1024];  /* written to when an error must be returned, one per thread */
 
 void clear_error_msg(void)
 {
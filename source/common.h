@@ -36,6 +36,8 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <stdint.h>
+
 #define ARRAY_SIZE(a)  (sizeof(a) / sizeof(a[0]))
 
 // See http://blog.geeky-boy.com/2016/06/of-compiler-warnings-and-asserts-in.html
@@ -86,6 +88,9 @@ typedef struct dyn_int_array_s dyn_int_array_t;
 
 #define FILENAME_BUFFER_SIZE 128
 
+// How much of a wait_until_ns() is spun instead of slept
+#define SPIN_NS 100000ULL
+
 int setup_error;
 int module_setup;
 int DEBUG;
@@ -97,6 +102,7 @@ int gpio_pud_capable(pins_t *pin);
 int lookup_gpio_by_key(const char *key);
 int lookup_gpio_by_name(const char *name);
 int lookup_gpio_by_altname(const char *altname);
+const char *lookup_name_by_gpio(int gpio);
 int lookup_pud_capable_by_key(const char *key);
 int lookup_pud_capable_by_name(const char *name);
 int lookup_pud_capable_by_altname(const char *altname);
@@ -118,6 +124,8 @@ void clear_error_msg(void);
 char *get_error_msg(void);
 void add_error_msg(char *msg);
 void toggle_debug(void);
+uint64_t monotonic_ns(void);
+void wait_until_ns(uint64_t deadline);
 int compute_port_pin(const char *key, int gpio, int *port, int *pin);
 int gpio_allowed(int gpio);
 int pwm_allowed(const char *key);
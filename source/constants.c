@@ -37,9 +37,11 @@ SOFTWARE.
 */
 
 #include "Python.h"
+#include <sched.h>
 #include "constants.h"
 #include "event_gpio.h"
 #include "common.h"
+#include "c_dht.h"
 
 void define_constants(PyObject *module)
 {
@@ -85,6 +87,78 @@ void define_constants(PyObject *module)
    bcm = Py_BuildValue("i", BCM);
    PyModule_AddObject(module, "BCM", bcm);
 
-   version = Py_BuildValue("s", "0.5.5");
+   backend_sysfs = Py_BuildValue("i", BACKEND_SYSFS);
+   PyModule_AddObject(module, "BACKEND_SYSFS", backend_sysfs);
+
+   backend_cdev = Py_BuildValue("i", BACKEND_CDEV);
+   PyModule_AddObject(module, "BACKEND_CDEV", backend_cdev);
+
+   policy_queue = Py_BuildValue("i", DISPATCH_QUEUE);
+   PyModule_AddObject(module, "DISPATCH_QUEUE", policy_queue);
+
+   policy_coalesce = Py_BuildValue("i", DISPATCH_COALESCE);
+   PyModule_AddObject(module, "DISPATCH_COALESCE", policy_coalesce);
+
+   policy_drop_oldest = Py_BuildValue("i", DISPATCH_DROP_OLDEST);
+   PyModule_AddObject(module, "DISPATCH_DROP_OLDEST", policy_drop_oldest);
+
+   encoder_x1 = Py_BuildValue("i", ENCODER_X1);
+   PyModule_AddObject(module, "X1", encoder_x1);
+
+   encoder_x2 = Py_BuildValue("i", ENCODER_X2);
+   PyModule_AddObject(module, "X2", encoder_x2);
+
+   encoder_x4 = Py_BuildValue("i", ENCODER_X4);
+   PyModule_AddObject(module, "X4", encoder_x4);
+
+   rule_set = Py_BuildValue("i", RULE_SET);
+   PyModule_AddObject(module, "RULE_SET", rule_set);
+
+   rule_clear = Py_BuildValue("i", RULE_CLEAR);
+   PyModule_AddObject(module, "RULE_CLEAR", rule_clear);
+
+   rule_toggle = Py_BuildValue("i", RULE_TOGGLE);
+   PyModule_AddObject(module, "RULE_TOGGLE", rule_toggle);
+
+   rule_pulse = Py_BuildValue("i", RULE_PULSE);
+   PyModule_AddObject(module, "RULE_PULSE", rule_pulse);
+
+   rule_spwm_start = Py_BuildValue("i", RULE_SPWM_START);
+   PyModule_AddObject(module, "RULE_SPWM_START", rule_spwm_start);
+
+   rule_spwm_stop = Py_BuildValue("i", RULE_SPWM_STOP);
+   PyModule_AddObject(module, "RULE_SPWM_STOP", rule_spwm_stop);
+
+   storm_coalesce = Py_BuildValue("i", STORM_COALESCE);
+   PyModule_AddObject(module, "STORM_COALESCE", storm_coalesce);
+
+   storm_disarm = Py_BuildValue("i", STORM_DISARM);
+   PyModule_AddObject(module, "STORM_DISARM", storm_disarm);
+
+   watchdog = Py_BuildValue("i", WATCHDOG_EDGE);
+   PyModule_AddObject(module, "WATCHDOG", watchdog);
+
+   watchdog_any = Py_BuildValue("i", WATCHDOG_ANY);
+   PyModule_AddObject(module, "WATCHDOG_ANY", watchdog_any);
+
+   sched_other = Py_BuildValue("i", SCHED_OTHER);
+   PyModule_AddObject(module, "SCHED_OTHER", sched_other);
+
+   sched_fifo = Py_BuildValue("i", SCHED_FIFO);
+   PyModule_AddObject(module, "SCHED_FIFO", sched_fifo);
+
+   sched_rr = Py_BuildValue("i", SCHED_RR);
+   PyModule_AddObject(module, "SCHED_RR", sched_rr);
+
+   dht11 = Py_BuildValue("i", DHT11);
+   PyModule_AddObject(module, "DHT11", dht11);
+
+   dht22 = Py_BuildValue("i", DHT22);
+   PyModule_AddObject(module, "DHT22", dht22);
+
+   am2302 = Py_BuildValue("i", DHT22);
+   PyModule_AddObject(module, "AM2302", am2302);
+
+   version = Py_BuildValue("s", "0.6.0");
    PyModule_AddObject(module, "VERSION", version);
 }
@@ -13,5 +13,29 @@ PyObject *version;
 PyObject *unknown;
 PyObject *board;
 PyObject *bcm;
+PyObject *backend_sysfs;
+PyObject *backend_cdev;
+PyObject *policy_queue;
+PyObject *policy_coalesce;
+PyObject *policy_drop_oldest;
+PyObject *encoder_x1;
+PyObject *encoder_x2;
+PyObject *encoder_x4;
+PyObject *rule_set;
+PyObject *rule_clear;
+PyObject *rule_toggle;
+PyObject *rule_pulse;
+PyObject *rule_spwm_start;
+PyObject *rule_spwm_stop;
+PyObject *storm_coalesce;
+PyObject *storm_disarm;
+PyObject *watchdog;
+PyObject *watchdog_any;
+PyObject *sched_other;
+PyObject *sched_fifo;
+PyObject *sched_rr;
+PyObject *dht11;
+PyObject *dht22;
+PyObject *am2302;
 
 void define_constants(PyObject *module);
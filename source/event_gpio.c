@@ -36,9 +36,13 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#define _GNU_SOURCE  /* pthread_setaffinity_np() and pthread_setname_np() */
 #include <pthread.h>
+#include <sched.h>
 #include <sys/epoll.h>
 #include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -48,6 +52,8 @@ SOFTWARE.
 #include <unistd.h>
 #include <stdint.h>
 #include "event_gpio.h"
+#include "cdev_gpio.h"
+#include "c_softpwm.h"
 #include "common.h"
 
 const char *stredge[4] = {"none", "rising", "falling", "both"};
@@ -55,41 +61,234 @@ const char *stredge[4] = {"none", "rising", "falling", "both"};
 // Memory Map for PUD
 uint8_t *memmap;
 
-// file descriptors
-struct fdx
+// Which interface new exports go through, see gpio_set_backend()
+int gpio_backend = BACKEND_SYSFS;
+
+// Memory mapped data/config register access for R8 pins, see gpio_set_pio_mode()
+int pio_mode = 0;
+pthread_mutex_t pio_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// What an epoll registration refers to, handed back in epoll_event.data.ptr
+#define EPOLL_SRC_GPIO   1
+#define EPOLL_SRC_FILTER 2   /* stable time timer of a GPIO */
+#define EPOLL_SRC_RULE   3   /* pulse timer of a rule, gpio is the rule id */
+#define EPOLL_SRC_STORM  4   /* storm limit timer of a GPIO */
+#define EPOLL_SRC_WATCHDOG 5 /* watchdog timer of a GPIO */
+struct epoll_source
 {
-    int fd;
+    int type;
     int gpio;
-    int initial;
-    unsigned int is_evented;
-    struct fdx *next;
 };
-struct fdx *fd_list = NULL;
 
 // event callbacks
 struct callback
 {
-    int fde;
-    int gpio;
     int edge;
     void* data;
     void (*func)(int gpio, void* data);
-    struct callback *next;
 };
-struct callback *callbacks = NULL;
 
-// gpio exports
-struct gpio_exp
+// Edges of one GPIO, written by the poll thread and read by read_events().
+// head and tail only ever grow, the slot is the index modulo the size.
+struct event_queue
+{
+    unsigned int head;         /* next slot to write, only the poll thread stores it */
+    unsigned int tail;         /* next slot to read, only the reader stores it */
+    unsigned long overflows;   /* edges dropped because the queue was full */
+    struct gpio_event events[EVENT_QUEUE_SIZE];
+};
+
+// Signal measurement of one GPIO.  The poll thread is the only writer, the
+// result is published under a sequence count so readers never block it.
+struct measure
+{
+    unsigned int active;
+    unsigned int generation;    /* bumped by every start, the poll thread restarts on a change */
+    unsigned int window_us;
+    /* poll thread only */
+    unsigned int seen_generation;
+    uint64_t window_start;
+    uint64_t last_rise;
+    uint64_t last_fall;
+    uint64_t sum_period;
+    uint64_t sum_high;
+    unsigned long periods;
+    unsigned long highs;
+    unsigned long edges;
+    /* published */
+    unsigned int seq;
+    unsigned int result_generation;
+    struct measure_info result;
+};
+
+// Edge counter of one GPIO, the poll thread is the only writer.  The rate
+// comes from COUNTER_BUCKETS buckets spanning the window, each tagged with
+// the bucket number it counts so readers can skip the stale ones.
+struct counter
+{
+    unsigned int active;
+    uint64_t count;
+    uint64_t bucket_ns;
+    struct {
+        unsigned int index;
+        unsigned int count;
+    } buckets[COUNTER_BUCKETS];
+};
+
+// Quadrature decoder for an A/B pin pair, stepped by the poll thread
+struct encoder
+{
+    int in_use;
+    int mode;
+    int gpio_a;
+    int gpio_b;
+    unsigned int state;         /* (A << 1) | B as of the last edge */
+    int64_t raw;                /* x4 counts, only the poll thread adds */
+    int64_t offset;             /* raw count of position 0 */
+    unsigned long errors;       /* edges that left their pin where it was */
+    /* poll thread only */
+    uint64_t window_start;
+    int64_t window_raw;
+    /* published velocity */
+    unsigned int seq;
+    double velocity;            /* x4 counts per second */
+    uint64_t updated;
+};
+
+// Everything known about one GPIO.  Entries are allocated the first time a
+// GPIO is used and are never freed, the poll thread may still hold a pointer
+// to one after the GPIO is unexported.
+struct gpio_state
 {
+    struct epoll_source src;
     int gpio;
-    struct gpio_exp *next;
+    pthread_mutex_t lock;  /* recursive, held while the pin's fds and sysfs files change */
+    int exported;
+    int cdev;              /* line is driven through /dev/gpiochipN */
+    int pio;               /* pin can use the PIO registers */
+    unsigned int edge;     /* edge requested on the chardev line */
+    int direction;         /* direction given to setup(), -1 if not set up */
+    int fd;                /* value file, line handle or line event, -1 if closed */
+    int fde;               /* edge file, -1 if closed */
+    int initial;           /* sysfs reports the current level on the first epoll */
+    int is_evented;
+    int event_count;       /* edges since the last event_detected(), atomic */
+    int dispatch_pending;  /* coalesced run queued, dispatch_lock */
+    unsigned int dispatch_value;  /* level for the coalesced run, dispatch_lock */
+    struct event_queue *queue;  /* timestamped edges, NULL until edge detection is added */
+    // debounce, settings are atomic, the rest is only used by the poll thread
+    unsigned int lockout_us;
+    unsigned int stable_us;
+    unsigned long bounced;      /* atomic */
+    unsigned long glitches;     /* atomic */
+    uint64_t last_accept;       /* timestamp of the last edge let through */
+    struct epoll_source timer_src;
+    int timer_fd;               /* timerfd for stable_us, -1 until first needed */
+    int timer_epfd;             /* epoll set timer_fd was added to */
+    int filter_pending;
+    unsigned int pending_edge;
+    uint64_t pending_ts;
+    unsigned int pending_level;
+    // storm limit, settings are atomic, the rest is only used by the poll thread
+    unsigned int storm_max;
+    unsigned int storm_interval_us;
+    int storm_action;
+    unsigned int storm_holdoff_us;
+    unsigned long storms;       /* atomic */
+    unsigned long suppressed;   /* atomic */
+    unsigned long disarms;      /* atomic */
+    int disarmed;               /* atomic */
+    uint64_t last_storm;        /* atomic */
+    uint64_t storm_window;      /* start of the current interval */
+    unsigned int storm_events;  /* edges in the current interval */
+    unsigned int storm_pending; /* edges held back for the coalesced record */
+    unsigned int storm_edge;
+    uint64_t storm_ts;
+    unsigned int storm_level;
+    struct epoll_source storm_src;
+    int storm_fd;               /* timerfd ending the interval or holdoff, -1 until first needed */
+    int storm_epfd;
+    // watchdog, settings are atomic, the timer is changed under the pin lock
+    unsigned int wd_timeout_us;
+    int wd_level;
+    int wd_repeat;
+    unsigned long wd_timeouts;  /* atomic */
+    int wd_expired;             /* atomic */
+    uint64_t wd_last;           /* atomic */
+    struct epoll_source wd_src;
+    int wd_fd;                  /* timerfd, -1 until first needed */
+    int wd_epfd;
+    struct event_hist *hists;   /* NUM_EVENT_STATS histograms, NULL until stats are on */
+    struct measure *measure;    /* NULL until gpio_start_measure() */
+    struct encoder *encoder;    /* encoder this is the A or B pin of */
+    int num_rules;              /* rules with this as their input */
+    struct counter *counter;    /* NULL until gpio_start_counter() */
+    edge_tap_func tap;          /* NULL unless gpio_set_edge_tap() */
+    void *tap_data;
+    int wait_epfd;              /* wait set fd is registered in, see blocking_wait_for_edges() */
+    int wait_fd;
+    int num_callbacks;
+    struct callback callbacks[MAX_PIN_CALLBACKS];
 };
-struct gpio_exp *exported_gpios = NULL;
+static struct gpio_state *gpio_states[GPIO_STATE_MAX];
+static int gpio_state_top = -1;   /* highest gpio with an entry */
+
+// GPIOs with an event queue, so read_events() does not scan the whole table
+static int queued_gpios[GPIO_STATE_MAX];
+static int num_queued_gpios = 0;
 
-pthread_t threads;
-dyn_int_array_t *event_occurred = NULL;
 int thread_running = 0;
+
+// Poll thread scheduling, poll_config_lock protects all of it.  The poll
+// thread applies the settings when it starts if any were given.
+static pthread_mutex_t poll_config_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct poll_thread_info poll_config = {SCHED_OTHER, 0, -1, 0, "", 0};
+static int poll_config_set = 0;
+static int memory_locked = 0;
+static pthread_t poll_tid;
+static int poll_tid_valid = 0;
+
+// poll thread counters, see gpio_get_poll_stats()
+static struct poll_stats poll_stats;
+
+// Edges waiting for the dispatcher thread to run their callbacks
+struct dispatch_item
+{
+    int gpio;
+    unsigned int value;
+    uint64_t timestamp;    /* when the edge happened */
+    int coalesced;         /* take the level from the gpio state instead */
+    int watchdog;          /* a watchdog timeout, not an edge */
+};
+static struct dispatch_item dispatch_queue[DISPATCH_QUEUE_SIZE];
+static unsigned int dispatch_head = 0;
+static unsigned int dispatch_tail = 0;
+static int dispatch_policy = DISPATCH_QUEUE;
+static int dispatch_running = 0;
+static pthread_mutex_t dispatch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dispatch_cond = PTHREAD_COND_INITIALIZER;
+static struct dispatch_stats dispatch_stats;
+// run around every batch, the Python module takes the GIL here
+static void (*dispatch_enter)(void) = NULL;
+static void (*dispatch_leave)(void) = NULL;
+
+// Latency histograms, see gpio_set_event_stats()
+static int event_stats_enabled = 0;
+static uint64_t poll_wake_ts = 0;        /* poll thread only */
+static uint64_t dispatch_edge_ts = 0;    /* dispatcher thread only, edge being dispatched */
 int epfd = -1;
+// Held while edge detection is added or removed, it covers is_evented, epfd,
+// the queued_gpios list and starting the dispatcher.  Recursive as
+// gpio_event_add() and gpio_event_remove() take it too.
+static pthread_mutex_t edge_detect_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+// blocking_wait_for_edges() keeps one epoll set per waiting thread, the key's
+// destructor closes it when the thread exits
+static __thread int wait_epfd = -1;
+static pthread_key_t wait_epfd_key;
+static pthread_once_t wait_epfd_once = PTHREAD_ONCE_INIT;
+// Readable while queued edges wait for the reader, see gpio_event_fileno()
+static int event_fd = -1;
+static int event_fd_armed = 0;
 
 // Thanks to WereCatf and Chippy-Gonzales for the Memory Mapping code/help
 int map_pio_memory()
@@ -108,10 +307,12 @@ int map_pio_memory()
 	if (DEBUG)
         printf(" ** map_pio_memory: mapping memory **\n");
 	memmap = (uint8_t *)mmap(NULL, getpagesize()*2, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0x01C20000);
-	if(memmap == NULL) {
+	if(memmap == MAP_FAILED) {
         char err[256];
         snprintf(err, sizeof(err), "map_pio_memory: mmap failed (%s)", strerror(errno));
         add_error_msg(err);
+        memmap = NULL;
+        close(fd);
         return -1;
 	}
 	close(fd);
@@ -119,7 +320,7 @@ int map_pio_memory()
 	//Set memmap to point to PIO-registers
 	if (DEBUG)
         printf(" ** map_pio_memory: moving to pio registers **\n");
-	memmap=memmap+0x800;
+	memmap=memmap+PIO_BASE_OFFSET;
 	
 	return 0;
 }
@@ -144,142 +345,424 @@ int gpio_set_pud(int port, int pin, uint8_t value)
 	pioMem32=(uint32_t *)(memmap+port*0x24+0x1c); //0x1c == pull-register
 	configRegister=pioMem32+(pin >> 4);
 	mask = ~(3 << ((pin & 15) * 2));
+	pthread_mutex_lock(&pio_lock);
 	*configRegister &= mask;
 	*configRegister |= value << ((pin & 15) * 2);
+	pthread_mutex_unlock(&pio_lock);
 	return 0;
 }
 
-int gpio_export(int gpio)
+// Points memmap at an anonymous buffer laid out like the PIO block so the
+// register code can be exercised without /dev/mem
+int map_pio_anonymous(void)
 {
-    int fd, len, e_no;
-    char filename[MAX_FILENAME];
-    char str_gpio[80];
-    struct gpio_exp *new_gpio, *g;
+    uint8_t *buf;
 
     if (DEBUG)
-        printf(" ** gpio_export **\n");
-
-    snprintf(filename, sizeof(filename), "/sys/class/gpio/export"); BUF2SMALL(filename);
-
-    if ((fd = open(filename, O_WRONLY)) < 0)
-    {
+        printf(" ** map_pio_anonymous **\n");
+    buf = (uint8_t *)mmap(NULL, getpagesize()*2, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
         char err[256];
-        snprintf(err, sizeof(err), "gpio_export: could not open '%s' (%s)", filename, strerror(errno));
+        snprintf(err, sizeof(err), "map_pio_anonymous: mmap failed (%s)", strerror(errno));
         add_error_msg(err);
         return -1;
     }
+    memmap = buf + PIO_BASE_OFFSET;
 
-    len = snprintf(str_gpio, sizeof(str_gpio), "%d", gpio); BUF2SMALL(str_gpio);
-    ssize_t s = write(fd, str_gpio, len);  e_no = errno;
-    close(fd);
-    if (s != len)
-    {
-        char err[256];
-        snprintf(err, sizeof(err), "gpio_export: could not write '%s' to %s (%s)", str_gpio, filename, strerror(e_no));
-        add_error_msg(err);
+    return 0;
+}
+
+void unmap_pio_anonymous(void)
+{
+    munmap(memmap - PIO_BASE_OFFSET, getpagesize()*2);
+    memmap = NULL;
+}
+
+static inline volatile uint32_t *pio_register(int port, int offset)
+{
+    return (volatile uint32_t *)(memmap + port*PIO_PORT_SIZE + offset);
+}
+
+int pio_set_value(int port, int pin, unsigned int value)
+{
+    volatile uint32_t *dat = pio_register(port, PIO_DAT_OFFSET);
+
+    pthread_mutex_lock(&pio_lock);
+    if (value)
+        *dat |= (1u << pin);
+    else
+        *dat &= ~(1u << pin);
+    pthread_mutex_unlock(&pio_lock);
+
+    return 0;
+}
+
+// Sets the bits of a port's data register selected by mask to bits, in one
+// store, so every pin in the mask changes together
+int pio_set_port(int port, uint32_t mask, uint32_t bits)
+{
+    volatile uint32_t *dat = pio_register(port, PIO_DAT_OFFSET);
+
+    pthread_mutex_lock(&pio_lock);
+    *dat = (*dat & ~mask) | (bits & mask);
+    pthread_mutex_unlock(&pio_lock);
+
+    return 0;
+}
+
+unsigned int pio_get_value(int port, int pin)
+{
+    return (*pio_register(port, PIO_DAT_OFFSET) >> pin) & 1;
+}
+
+// Config registers hold 4 bits per pin, 8 pins per register.  Function 0 is
+// input and 1 is output.
+int pio_set_direction(int port, int pin, unsigned int out_flag)
+{
+    volatile uint32_t *cfg = pio_register(port, PIO_CFG_OFFSET + (pin >> 3)*4);
+    int shift = (pin & 7) * 4;
+
+    pthread_mutex_lock(&pio_lock);
+    *cfg = (*cfg & ~(7u << shift)) | ((out_flag ? 1u : 0u) << shift);
+    pthread_mutex_unlock(&pio_lock);
+
+    return 0;
+}
+
+unsigned int pio_get_function(int port, int pin)
+{
+    return (*pio_register(port, PIO_CFG_OFFSET + (pin >> 3)*4) >> ((pin & 7) * 4)) & 7;
+}
+
+int gpio_set_pio_mode(int enable)
+{
+    if (DEBUG)
+        printf(" ** gpio_set_pio_mode: %d **\n", enable);
+
+    if (enable && memmap == NULL) {
+        add_error_msg("gpio_set_pio_mode: PIO registers are not mapped");
         return -1;
     }
+    pio_mode = enable ? 1 : 0;
+
+    return 0;
+}
+
+int gpio_get_pio_mode(void)
+{
+    return pio_mode;
+}
+
+// Returns the state of gpio, or NULL if it has none.  With create set a new
+// entry is made, NULL then means the gpio number is out of range.
+static struct gpio_state *gpio_state(int gpio, int create)
+{
+    struct gpio_state *st, *expected = NULL;
+    pthread_mutexattr_t attr;
+    int top;
+
+    if (gpio < 0 || gpio >= GPIO_STATE_MAX) {
+        if (create) {
+            char err[256];
+            snprintf(err, sizeof(err), "gpio_state: GPIO %d is out of range", gpio);
+            add_error_msg(err);
+        }
+        return NULL;
+    }
+
+    st = __atomic_load_n(&gpio_states[gpio], __ATOMIC_ACQUIRE);
+    if (st != NULL || !create)
+        return st;
+
+    st = calloc(1, sizeof(struct gpio_state));  ASSRT(st != NULL);
+    st->src.type = EPOLL_SRC_GPIO;
+    st->src.gpio = gpio;
+    st->gpio = gpio;
+    st->edge = NO_EDGE;
+    st->direction = -1;
+    st->fd = -1;
+    st->fde = -1;
+    st->initial = 1;
+    st->timer_src.type = EPOLL_SRC_FILTER;
+    st->timer_src.gpio = gpio;
+    st->timer_fd = -1;
+    st->timer_epfd = -1;
+    st->storm_src.type = EPOLL_SRC_STORM;
+    st->storm_src.gpio = gpio;
+    st->storm_fd = -1;
+    st->storm_epfd = -1;
+    st->wd_src.type = EPOLL_SRC_WATCHDOG;
+    st->wd_src.gpio = gpio;
+    st->wd_fd = -1;
+    st->wd_epfd = -1;
+    st->wait_epfd = -1;
+    st->wait_fd = -1;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&st->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    // softpwm threads can get here at the same time as the main thread
+    if (!__atomic_compare_exchange_n(&gpio_states[gpio], &expected, st, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_destroy(&st->lock);
+        free(st);
+        return expected;
+    }
+    while (gpio > (top = __atomic_load_n(&gpio_state_top, __ATOMIC_RELAXED))
+           && !__atomic_compare_exchange_n(&gpio_state_top, &top, gpio, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    return st;
+}
+
+// Serialises callers working on the fds or sysfs files of one pin, they run
+// without the GIL.  Returns the state to give to pin_unlock().
+static struct gpio_state *pin_lock(int gpio)
+{
+    struct gpio_state *st = gpio_state(gpio, 1);
+
+    if (st != NULL)
+        pthread_mutex_lock(&st->lock);
+    return st;
+}
+
+static void pin_unlock(struct gpio_state *st)
+{
+    if (st != NULL)
+        pthread_mutex_unlock(&st->lock);
+}
+
+// Called for pins compute_port_pin() says belong to the R8 PIO block
+void gpio_set_pio_capable(int gpio, int capable)
+{
+    struct gpio_state *st = gpio_state(gpio, capable);
+    if (st != NULL)
+        st->pio = capable;
+}
+
+int gpio_uses_pio(int gpio)
+{
+    struct gpio_state *st;
+
+    if (!pio_mode || memmap == NULL)
+        return 0;
+    st = gpio_state(gpio, 0);
+    return (st != NULL && st->pio);
+}
+
+// The direction setup() was called with, kept so the Python layer can check
+// a channel is set up without going to sysfs
+void gpio_set_setup_direction(int gpio, int direction)
+{
+    struct gpio_state *st = gpio_state(gpio, 1);
+    if (st != NULL)
+        st->direction = direction;
+}
+
+int gpio_get_setup_direction(int gpio)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    return (st != NULL) ? st->direction : -1;
+}
+
+int gpio_is_exported(int gpio)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    return (st != NULL && st->exported);
+}
 
-    // add to list
+int gpio_set_backend(int backend)
+{
     if (DEBUG)
-        printf(" ** gpio_export: creating data struct **\n");
-    new_gpio = malloc(sizeof(struct gpio_exp));  ASSRT(new_gpio != NULL);
+        printf(" ** gpio_set_backend: %d **\n", backend);
 
-    new_gpio->gpio = gpio;
-    new_gpio->next = NULL;
+    if (backend == BACKEND_CDEV && !cdev_available()) {
+        add_error_msg("gpio_set_backend: no usable /dev/gpiochip character devices found");
+        return -1;
+    }
+    gpio_backend = backend;
 
-    if (exported_gpios == NULL)
-    {
-        // create new list
-        exported_gpios = new_gpio;
+    return 0;
+}
+
+int gpio_get_backend(void)
+{
+    return gpio_backend;
+}
+
+int gpio_is_cdev(int gpio)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    return (st != NULL && st->cdev);
+}
+
+static int gpio_export_locked(int gpio)
+{
+    int fd, len, e_no;
+    int chip_fd;
+    unsigned int offset;
+    int cdev = 0;
+    char filename[MAX_FILENAME];
+    char str_gpio[80];
+    struct gpio_state *st;
+
+    if (DEBUG)
+        printf(" ** gpio_export **\n");
+
+    if ((st = gpio_state(gpio, 1)) == NULL)
+        return -1;
+
+    if (gpio_backend == BACKEND_CDEV && cdev_line_lookup(gpio, &chip_fd, &offset) == 0) {
+        // Nothing to export, the line is requested from the chip when the
+        // direction is set
+        if (DEBUG)
+            printf(" ** gpio_export: using gpiochip line %u for %d **\n", offset, gpio);
+        cdev = 1;
     } else {
-        // add to end of existing list
-        g = exported_gpios;
-        while (g->next != NULL)
-            g = g->next;
-        g->next = new_gpio;
+        if (gpio_backend == BACKEND_CDEV && DEBUG)
+            printf(" ** gpio_export: no gpiochip line for %d, falling back to sysfs **\n", gpio);
+
+        snprintf(filename, sizeof(filename), "/sys/class/gpio/export"); BUF2SMALL(filename);
+
+        if ((fd = open(filename, O_WRONLY)) < 0)
+        {
+            char err[256];
+            snprintf(err, sizeof(err), "gpio_export: could not open '%s' (%s)", filename, strerror(errno));
+            add_error_msg(err);
+            return -1;
+        }
+
+        len = snprintf(str_gpio, sizeof(str_gpio), "%d", gpio); BUF2SMALL(str_gpio);
+        ssize_t s = write(fd, str_gpio, len);  e_no = errno;
+        close(fd);
+        if (s != len)
+        {
+            char err[256];
+            snprintf(err, sizeof(err), "gpio_export: could not write '%s' to %s (%s)", str_gpio, filename, strerror(e_no));
+            add_error_msg(err);
+            return -1;
+        }
     }
 
+    st->exported = 1;
+    st->cdev = cdev;
+    st->edge = NO_EDGE;
+
     return 0;
 }  /* gpio_export */
 
+int gpio_export(int gpio)
+{
+    struct gpio_state *st = pin_lock(gpio);
+    int ret = gpio_export_locked(gpio);
+
+    pin_unlock(st);
+    return ret;
+}
+
 
 void close_value_fd(int gpio)
 {
-    struct fdx *f = fd_list;
-    struct fdx *temp;
-    struct fdx *prev = NULL;
+    struct gpio_state *st = pin_lock(gpio);
 
-    while (f != NULL)
-    {
-        if (f->gpio == gpio)
-        {
-            close(f->fd);
-            if (prev == NULL)
-                fd_list = f->next;
-            else
-                prev->next = f->next;
-            temp = f;
-            f = f->next;
-            free(temp);
-        } else {
-            prev = f;
-            f = f->next;
-        }
+    if (st != NULL && st->fd >= 0) {
+        close(st->fd);
+        st->fd = -1;
+        st->initial = 1;
+        st->wait_fd = -1;  // closing took it out of any wait set
     }
+    pin_unlock(st);
 }  /* close_value_fd */
 
+// Returns the cached value fd of gpio, -1 if there is none
 int fd_lookup(int gpio)
 {
-    struct fdx *f = fd_list;
-    while (f != NULL)
-    {
-        if (f->gpio == gpio)
-            return f->fd;
-        f = f->next;
-    }
-
-    return 0;
+    struct gpio_state *st = gpio_state(gpio, 0);
+    return (st != NULL) ? st->fd : -1;
 }
 
 int fde_lookup(int gpio)
 {
-    struct callback *cb = callbacks;
-    while (cb != NULL)
-    {
-        if (cb->gpio == gpio)
-            return cb->fde;
-        cb = cb->next;
-    }
+    struct gpio_state *st = gpio_state(gpio, 0);
+    return (st != NULL) ? st->fde : -1;
+}
+
+int add_fd_list(int gpio, int fd)
+{
+    struct gpio_state *st = pin_lock(gpio);
+
+    if (st == NULL)
+        return -1;
+    st->fd = fd;
+    st->initial = 1;
+    pin_unlock(st);
 
     return 0;
 }
 
-int add_fd_list(int gpio, int fd)
+// Swaps the fd used for a chardev line (line handle <-> line event) without
+// losing the rest of its state
+void replace_value_fd(int gpio, int fd)
 {
-    struct fdx *new_fd;
+    struct gpio_state *st = pin_lock(gpio);
 
-    new_fd = malloc(sizeof(struct fdx));  ASSRT(new_fd != NULL);
+    if (st == NULL) {
+        close(fd);
+        return;
+    }
+    if (st->fd >= 0)
+        close(st->fd);
+    st->fd = fd;
+    st->initial = 0;  // the chardev does not report the current level
+    st->wait_fd = -1;
+    pin_unlock(st);
+}
 
-    new_fd->fd = fd;
-    new_fd->gpio = gpio;
-    new_fd->initial = 1;
-    new_fd->is_evented = 0;
-    if (fd_list == NULL) {
-        new_fd->next = NULL;
-    } else {
-        new_fd->next = fd_list;
+// Requests a chardev line again as an input or output, or for edge events
+// with edge other than NO_EDGE.  The kernel refuses a second request of a
+// line that is still requested, so the old handle is closed first, and if
+// the new request fails the line is requested again as it was.
+static int cdev_rerequest(int gpio, unsigned int direction, unsigned int edge)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    unsigned int old_edge = st->edge;
+    int fd;
+
+    close_value_fd(gpio);
+    if (edge == NO_EDGE)
+        fd = cdev_request_line(gpio, direction, 0);
+    else
+        fd = cdev_request_events(gpio, edge);
+    if (fd < 0) {
+        if (old_edge == NO_EDGE)
+            fd = cdev_request_line(gpio, CDEV_AS_IS, 0);
+        else
+            fd = cdev_request_events(gpio, old_edge);
+        if (fd >= 0)
+            replace_value_fd(gpio, fd);
+        return -1;
     }
-    fd_list = new_fd;
+    replace_value_fd(gpio, fd);
+    st->edge = edge;
 
     return 0;
 }
 
-int open_value_file(int gpio)
+static int open_value_file_locked(int gpio)
 {
     int fd;
     char filename[MAX_FILENAME];
 
+    if (gpio_is_cdev(gpio)) {
+        if ((fd = cdev_request_line(gpio, CDEV_AS_IS, 0)) < 0)
+            return -1;
+        if (add_fd_list(gpio, fd) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
     // create file descriptor of value file
     snprintf(filename, sizeof(filename), "/sys/class/gpio/gpio%d/value", gpio); BUF2SMALL(filename);
 
@@ -293,11 +776,23 @@ int open_value_file(int gpio)
         add_error_msg(err);
         return -1;
     }
-    add_fd_list(gpio, fd);
+    if (add_fd_list(gpio, fd) < 0) {
+        close(fd);
+        return -1;
+    }
 
     return fd;
 }  /* open_value_file */
 
+int open_value_file(int gpio)
+{
+    struct gpio_state *st = pin_lock(gpio);
+    int fd = open_value_file_locked(gpio);
+
+    pin_unlock(st);
+    return fd;
+}
+
 int open_edge_file(int gpio)
 {
     int fd;
@@ -318,66 +813,95 @@ int open_edge_file(int gpio)
     return fd;
 }  /* open_edge_file */
 
-int gpio_unexport(int gpio)
+static int gpio_unexport_locked(int gpio)
 {
     int fd, len, e_no;
     char filename[MAX_FILENAME];
     char str_gpio[16];
-    struct gpio_exp *g, *temp, *prev_g = NULL;
+    struct gpio_state *st = gpio_state(gpio, 0);
 
     if (DEBUG)
         printf(" ** gpio_unexport **\n");
 
+    if (st != NULL) {
+        st->pio = 0;
+        st->direction = -1;
+    }
+
+    // closing the line handle is all the chardev needs
+    int cdev = gpio_is_cdev(gpio);
     close_value_fd(gpio);
 
-    snprintf(filename, sizeof(filename), "/sys/class/gpio/unexport"); BUF2SMALL(filename);
+    if (!cdev) {
+        snprintf(filename, sizeof(filename), "/sys/class/gpio/unexport"); BUF2SMALL(filename);
 
-    if ((fd = open(filename, O_WRONLY)) < 0) {
-        char err[256];
-        snprintf(err, sizeof(err), "gpio_unexport: could not open '%s' (%s)", filename, strerror(errno));
-        add_error_msg(err);
-        return -1;
-    }
+        if ((fd = open(filename, O_WRONLY)) < 0) {
+            char err[256];
+            snprintf(err, sizeof(err), "gpio_unexport: could not open '%s' (%s)", filename, strerror(errno));
+            add_error_msg(err);
+            return -1;
+        }
 
-    len = snprintf(str_gpio, sizeof(str_gpio), "%d", gpio); BUF2SMALL(str_gpio);
-    ssize_t s = write(fd, str_gpio, len);  e_no = errno;
-    close(fd);
-    if (s != len) {
-        char err[256];
-        snprintf(err, sizeof(err), "gpio_unexport: could not write '%s' (%s)", filename, strerror(e_no));
-        add_error_msg(err);
-        return -1;
+        len = snprintf(str_gpio, sizeof(str_gpio), "%d", gpio); BUF2SMALL(str_gpio);
+        ssize_t s = write(fd, str_gpio, len);  e_no = errno;
+        close(fd);
+        if (s != len) {
+            char err[256];
+            snprintf(err, sizeof(err), "gpio_unexport: could not write '%s' (%s)", filename, strerror(e_no));
+            add_error_msg(err);
+            return -1;
+        }
     }
 
-    if (DEBUG)
-        printf(" ** gpio_unexport: freeing memory **\n");
-    // remove from list
-    g = exported_gpios;
-    while (g != NULL)
-    {
-        if (g->gpio == gpio)
-        {
-            if (prev_g == NULL)
-                exported_gpios = g->next;
-            else
-                prev_g->next = g->next;
-            temp = g;
-            g = g->next;
-            free(temp);
-        } else {
-            prev_g = g;
-            g = g->next;
+    if (st != NULL) {
+        st->exported = 0;
+        st->cdev = 0;
+        st->edge = NO_EDGE;
+        gpio_set_debounce(gpio, 0, 0);
+        gpio_set_storm_limit(gpio, 0, 0, STORM_COALESCE, 0);
+        if (st->timer_fd >= 0) {
+            close(st->timer_fd);
+            st->timer_fd = -1;
+            st->timer_epfd = -1;
+        }
+        if (st->storm_fd >= 0) {
+            close(st->storm_fd);
+            st->storm_fd = -1;
+            st->storm_epfd = -1;
+        }
+        gpio_set_watchdog(gpio, 0, WATCHDOG_ANY, 0);
+        if (st->wd_fd >= 0) {
+            close(st->wd_fd);
+            st->wd_fd = -1;
+            st->wd_epfd = -1;
         }
     }
 
     return 0;
 }
 
-int gpio_set_direction(int gpio, unsigned int in_flag)
+int gpio_unexport(int gpio)
+{
+    struct gpio_state *st = pin_lock(gpio);
+    int ret = gpio_unexport_locked(gpio);
+
+    pin_unlock(st);
+    return ret;
+}
+
+static int gpio_set_direction_locked(int gpio, unsigned int in_flag)
 {
     int fd, e_no;
     char filename[MAX_FILENAME];  filename[0] = '\0';
 
+    if (gpio_is_cdev(gpio)) {
+        // re-request the line with the new direction, outputs start low
+        // just like writing "out" to sysfs
+        if (DEBUG)
+            printf(" ** gpio_set_direction: chardev %s **\n", in_flag ? "out" : "in");
+        return cdev_rerequest(gpio, in_flag ? OUTPUT : INPUT, NO_EDGE);
+    }
+
     snprintf(filename, sizeof(filename), "/sys/class/gpio/gpio%d/direction", gpio); BUF2SMALL(filename);
     if ((fd = open(filename, O_WRONLY)) < 0) {
         char err[256];
@@ -407,11 +931,39 @@ int gpio_set_direction(int gpio, unsigned int in_flag)
     return 0;
 }
 
+int gpio_set_direction(int gpio, unsigned int in_flag)
+{
+    struct gpio_state *st;
+    int ret;
+
+    if (gpio_uses_pio(gpio))
+        return pio_set_direction(gpio / 32, gpio % 32, in_flag);
+
+    st = pin_lock(gpio);
+    ret = gpio_set_direction_locked(gpio, in_flag);
+    pin_unlock(st);
+    return ret;
+}
+
 int gpio_get_direction(int gpio, unsigned int *value)
 {
     int fd, e_no;
     char filename[MAX_FILENAME];
 
+    if (gpio_uses_pio(gpio)) {
+        unsigned int func = pio_get_function(gpio / 32, gpio % 32);
+        if (func == 0)
+            *value = INPUT;
+        else if (func == 1)
+            *value = OUTPUT;
+        else
+            *value = ALT0;
+        return 0;
+    }
+
+    if (gpio_is_cdev(gpio))
+        return cdev_get_direction(gpio, value);
+
     snprintf(filename, sizeof(filename), "/sys/class/gpio/gpio%d/direction", gpio); BUF2SMALL(filename);
     if ((fd = open(filename, O_RDONLY | O_NONBLOCK)) < 0) {
         char err[256];
@@ -459,7 +1011,7 @@ int gpio_get_direction(int gpio, unsigned int *value)
 }  /* gpio_set_direction */
 
 
-int gpio_set_value(int gpio, unsigned int value)
+static int gpio_set_value_locked(int gpio, unsigned int value)
 {
     // This now uses the value file descriptor that is set in the other struct
     // in an effort to minimize opening/closing this
@@ -468,9 +1020,25 @@ int gpio_set_value(int gpio, unsigned int value)
     char filename[MAX_FILENAME];
     char vstr[16];
 
+    if (gpio_is_cdev(gpio)) {
+        if (fd < 0) {
+            // requesting the line as an output sets the value too
+            if ((fd = cdev_request_line(gpio, OUTPUT, value)) < 0)
+                return -1;
+            if (add_fd_list(gpio, fd) < 0) {
+                close(fd);
+                return -1;
+            }
+            return 0;
+        }
+        if (cdev_set_value(fd, value) < 0)
+            return -2;
+        return 0;
+    }
+
     snprintf(filename, sizeof(filename), "/sys/class/gpio/gpio%d/value", gpio); BUF2SMALL(filename);
 
-    if (!fd)
+    if (fd < 0)
     {
         if ((fd = open_value_file(gpio)) == -1) {
             char err[256];
@@ -501,12 +1069,27 @@ int gpio_set_value(int gpio, unsigned int value)
     return 0;
 }
 
-int gpio_get_value(int gpio, unsigned int *value)
+int gpio_set_value(int gpio, unsigned int value)
+{
+    struct gpio_state *st;
+    int ret;
+
+    // the registers have their own lock
+    if (gpio_uses_pio(gpio))
+        return pio_set_value(gpio / 32, gpio % 32, value);
+
+    st = pin_lock(gpio);
+    ret = gpio_set_value_locked(gpio, value);
+    pin_unlock(st);
+    return ret;
+}
+
+static int gpio_get_value_locked(int gpio, unsigned int *value)
 {
     int fd = fd_lookup(gpio);
     char ch;
 
-    if (!fd) {
+    if (fd < 0) {
         if ((fd = open_value_file(gpio)) == -1) {
             char err[256];
             snprintf(err, sizeof(err), "gpio_get_value: could not open GPIO %d value file", gpio);
@@ -515,6 +1098,9 @@ int gpio_get_value(int gpio, unsigned int *value)
         }
     }
 
+    if (gpio_is_cdev(gpio))
+        return cdev_get_value(fd, value);
+
     if (lseek(fd, 0, SEEK_SET) < 0) {
         char err[256];
         snprintf(err, sizeof(err), "gpio_get_value: could not seek GPIO %d (%s)", gpio, strerror(errno));
@@ -546,62 +1132,293 @@ int gpio_get_value(int gpio, unsigned int *value)
     return 0;
 }
 
-int gpio_get_more(int gpio, int bits, unsigned int *value)
+int gpio_get_value(int gpio, unsigned int *value)
 {
-    int fd = fd_lookup(gpio);
-    char ch;
-    
-    if (!fd) {
-        if ((fd = open_value_file(gpio)) == -1) {
-            char err[256];
-            snprintf(err, sizeof(err), "gpio_get_more: could not open GPIO %d value file", gpio);
-            add_error_msg(err);
-            return -1;
+    struct gpio_state *st;
+    int ret;
+
+    if (gpio_uses_pio(gpio)) {
+        *value = pio_get_value(gpio / 32, gpio % 32);
+        return 0;
+    }
+
+    st = pin_lock(gpio);
+    ret = gpio_get_value_locked(gpio, value);
+    pin_unlock(st);
+    return ret;
+}
+
+// Reads a set of pins as one integer, bit i of value comes from gpios[i].
+// When every pin goes through the PIO registers each port's data register is
+// read once, so pins sharing a port are sampled at the same instant.
+// Otherwise the cached value fds are read back to back.
+int gpio_get_bus(const int *gpios, int count, unsigned int *value)
+{
+    int i;
+    int all_pio = 1;
+    unsigned int result = 0;
+
+    if (count < 1 || count > 32) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_get_bus: %d bits requested, 1 to 32 allowed", count);
+        add_error_msg(err);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (!gpio_uses_pio(gpios[i]) || gpios[i] / 32 >= PIO_NUM_PORTS) {
+            all_pio = 0;
+            break;
+        }
+    }
+
+    if (all_pio) {
+        uint32_t port_data[PIO_NUM_PORTS];
+        uint32_t ports_read = 0;
+        for (i = 0; i < count; i++) {
+            int port = gpios[i] / 32;
+            if (!(ports_read & (1u << port))) {
+                port_data[port] = *pio_register(port, PIO_DAT_OFFSET);
+                ports_read |= (1u << port);
+            }
+            result |= ((port_data[port] >> (gpios[i] % 32)) & 1) << i;
+        }
+    } else {
+        for (i = 0; i < count; i++) {
+            unsigned int bit;
+            if (gpio_get_value(gpios[i], &bit) < 0) {
+                char err[256];
+                snprintf(err, sizeof(err), "gpio_get_bus: could not read GPIO %d (bit %d)", gpios[i], i);
+                add_error_msg(err);
+                return -1;
+            }
+            result |= (bit << i);
         }
     }
 
-    // Loop for our number of bits
+    if (DEBUG)
+        printf(" ** gpio_get_bus: %d bits, value: %u **\n", count, result);
+    *value = result;
+
+    return 0;
+}
+
+// Writes bit i of value to gpios[i] for every bit set in mask.  In PIO
+// register mode each port is updated with a single masked store, otherwise
+// the cached value fds are written back to back.
+int gpio_set_bus(const int *gpios, int count, unsigned int value, unsigned int mask)
+{
     int i;
-    for (i = 0; i < bits; i++) {
+    int all_pio = 1;
 
-        if (lseek(fd, 0, SEEK_SET) < 0) {
-            char err[256];
-            snprintf(err, sizeof(err), "gpio_get_more: could not seek GPIO %d (%s)", gpio, strerror(errno));
-            add_error_msg(err);
-            return -1;
+    if (count < 1 || count > 32) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_set_bus: %d bits requested, 1 to 32 allowed", count);
+        add_error_msg(err);
+        return -1;
+    }
+
+    if (DEBUG)
+        printf(" ** gpio_set_bus: %d bits, value: %u, mask: 0x%x **\n", count, value, mask);
+
+    for (i = 0; i < count; i++) {
+        if (!gpio_uses_pio(gpios[i]) || gpios[i] / 32 >= PIO_NUM_PORTS) {
+            all_pio = 0;
+            break;
         }
-        ssize_t s = read(fd, &ch, sizeof(ch));
-        if (s < 0) {
-            char err[256];
-            snprintf(err, sizeof(err), "gpio_get_more: could not read GPIO %d (%s)", gpio, strerror(errno));
-            add_error_msg(err);
-            return -1;
+    }
+
+    if (all_pio) {
+        uint32_t port_mask[PIO_NUM_PORTS] = { 0 };
+        uint32_t port_bits[PIO_NUM_PORTS] = { 0 };
+        int port;
+        for (i = 0; i < count; i++) {
+            if (!(mask & (1u << i)))
+                continue;
+            port = gpios[i] / 32;
+            port_mask[port] |= 1u << (gpios[i] % 32);
+            if (value & (1u << i))
+                port_bits[port] |= 1u << (gpios[i] % 32);
         }
-    
-        if (ch == '1') {
-            *value |= (1 << i);
-        } else if (ch == '0') {
-            *value |= (0 << i);
-        } else {
-            char err[256];
-            snprintf(err, sizeof(err), "gpio_get_more: unrecognized read GPIO %d (%c)", gpio, ch);
-            add_error_msg(err);
-            return -1;
+        for (port = 0; port < PIO_NUM_PORTS; port++) {
+            if (port_mask[port])
+                pio_set_port(port, port_mask[port], port_bits[port]);
         }
-        if (DEBUG) {
-            printf(" ** gpio_get_more: %c **\n", ch);
-            printf(" ** gpio_get_more: current value: %u **\n", *value);
+    } else {
+        for (i = 0; i < count; i++) {
+            if (!(mask & (1u << i)))
+                continue;
+            if (gpio_set_value(gpios[i], (value >> i) & 1) < 0) {
+                char err[256];
+                snprintf(err, sizeof(err), "gpio_set_bus: could not write GPIO %d (bit %d)", gpios[i], i);
+                add_error_msg(err);
+                return -1;
+            }
         }
     }
 
     return 0;
-    
 }
 
-int gpio_set_edge(int gpio, unsigned int edge)
+// Claims a pin for a bit-banged bus and sets its direction.  A pin in PIO
+// register mode needs nothing from sysfs, anything else is exported unless
+// setup() already did.  How the pin is driven is worked out once here so a
+// bit costs a register access or a write on the cached value fd.
+int fast_pin_open(struct fast_pin *fp, int gpio, unsigned int direction)
+{
+    struct gpio_state *st;
+
+    memset(fp, 0, sizeof(*fp));
+    fp->gpio = gpio;
+    fp->dir_fd = -1;
+    if (gpio < 0)
+        return 0;
+
+    if (gpio_uses_pio(gpio) && gpio / 32 < PIO_NUM_PORTS) {
+        fp->pio = 1;
+        fp->dat = pio_register(gpio / 32, PIO_DAT_OFFSET);
+        fp->mask = 1u << (gpio % 32);
+    } else if ((st = gpio_state(gpio, 0)) == NULL || !st->exported) {
+        if (gpio_export(gpio) < 0)
+            return -1;
+        fp->exported = 1;
+    }
+
+    if (fast_pin_direction(fp, direction) < 0) {
+        fast_pin_close(fp);
+        return -1;
+    }
+    if (DEBUG)
+        printf(" ** fast_pin_open: gpio %d %s, %s **\n", gpio, direction == OUTPUT ? "output" : "input", fp->pio ? "PIO" : "value fd");
+
+    return 0;
+}
+
+void fast_pin_close(struct fast_pin *fp)
+{
+    if (fp->gpio >= 0 && fp->dir_fd >= 0)
+        close(fp->dir_fd);
+    fp->dir_fd = -1;
+    if (fp->gpio >= 0 && fp->exported)
+        gpio_unexport(fp->gpio);
+    fp->exported = 0;
+    fp->gpio = -1;
+}
+
+int fast_pin_set(const struct fast_pin *fp, unsigned int value)
+{
+    if (fp->gpio < 0)
+        return 0;
+    if (fp->pio) {
+        pthread_mutex_lock(&pio_lock);
+        if (value)
+            *fp->dat |= fp->mask;
+        else
+            *fp->dat &= ~fp->mask;
+        pthread_mutex_unlock(&pio_lock);
+        return 0;
+    }
+    return gpio_set_value(fp->gpio, value);
+}
+
+int fast_pin_get(const struct fast_pin *fp, unsigned int *value)
+{
+    if (fp->gpio < 0) {
+        *value = 0;
+        return 0;
+    }
+    if (fp->pio) {
+        *value = (*fp->dat & fp->mask) ? 1 : 0;
+        return 0;
+    }
+    return gpio_get_value(fp->gpio, value);
+}
+
+int fast_pin_direction(const struct fast_pin *fp, unsigned int direction)
+{
+    if (fp->gpio < 0)
+        return 0;
+    if (fp->pio)
+        return pio_set_direction(fp->gpio / 32, fp->gpio % 32, direction);
+    return gpio_set_direction(fp->gpio, direction);
+}
+
+// Opens gpio released as one line of an open drain bus, fast_pin_release()
+// then switches it between an input and an output driving low.  Only the PIO
+// data latch has to be loaded with the low; on sysfs "low" is written to the
+// direction file, kept open here, and the chardev requests outputs low.
+int fast_pin_open_drain(struct fast_pin *fp, int gpio)
+{
+    char filename[MAX_FILENAME];
+
+    if (fast_pin_open(fp, gpio, INPUT) < 0)
+        return -1;
+    if (fp->pio)
+        return fast_pin_set(fp, 0);
+    if (gpio < 0 || gpio_is_cdev(gpio))
+        return 0;
+
+    snprintf(filename, sizeof(filename), "/sys/class/gpio/gpio%d/direction", gpio); BUF2SMALL(filename);
+    if ((fp->dir_fd = open(filename, O_WRONLY | O_CLOEXEC)) < 0) {
+        char err[256];
+        snprintf(err, sizeof(err), "fast_pin_open_drain: could not open '%s' (%s)", filename, strerror(errno));
+        add_error_msg(err);
+        fast_pin_close(fp);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Lets the pull-up take an open drain line high, or drives it low
+int fast_pin_release(const struct fast_pin *fp, int release)
+{
+    const char *direction = release ? "in" : "low";
+
+    if (fp->dir_fd < 0)
+        return fast_pin_direction(fp, release ? INPUT : OUTPUT);
+
+    if (pwrite(fp->dir_fd, direction, strlen(direction), 0) != (ssize_t)strlen(direction)) {
+        char err[256];
+        snprintf(err, sizeof(err), "fast_pin_release: could not write '%s' for GPIO %d (%s)", direction, fp->gpio, strerror(errno));
+        add_error_msg(err);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Reads bits consecutive GPIOs starting at gpio, gpio is bit 0
+int gpio_get_more(int gpio, int bits, unsigned int *value)
+{
+    int gpios[32];
+    int i;
+
+    if (bits < 1 || bits > 32) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_get_more: %d bits requested, 1 to 32 allowed", bits);
+        add_error_msg(err);
+        return -1;
+    }
+
+    for (i = 0; i < bits; i++)
+        gpios[i] = gpio + i;
+
+    return gpio_get_bus(gpios, bits, value);
+}
+
+static int gpio_set_edge_locked(int gpio, unsigned int edge)
 {
     int fd;
     char filename[MAX_FILENAME];
+    struct gpio_state *st = gpio_state(gpio, 0);
+
+    if (st != NULL && st->cdev) {
+        // edges come from a line event fd, so swap the line handle for one
+        if (DEBUG)
+            printf(" ** gpio_set_edge: chardev %s **\n", stredge[edge]);
+        return cdev_rerequest(gpio, INPUT, edge);
+    }
 
     snprintf(filename, sizeof(filename), "/sys/class/gpio/gpio%d/edge", gpio); BUF2SMALL(filename);
 
@@ -620,19 +1437,36 @@ int gpio_set_edge(int gpio, unsigned int edge)
         char err[256];
         snprintf(err, sizeof(err), "gpio_set_edge: could not write '%s' to %s (%s)", stredge[edge], filename, strerror(errno));
         add_error_msg(err);
+        close(fd);
         return -1;
     }
     close(fd);
+    if (st != NULL)
+        st->edge = edge;
 
     return 0;
 }
 
+int gpio_set_edge(int gpio, unsigned int edge)
+{
+    struct gpio_state *st = pin_lock(gpio);
+    int ret = gpio_set_edge_locked(gpio, edge);
+
+    pin_unlock(st);
+    return ret;
+}
+
 int gpio_get_edge(int gpio)
 {
     int fd = fde_lookup(gpio);
+    int cached = (fd >= 0);
     int rtnedge = -1;
+    struct gpio_state *st = gpio_state(gpio, 0);
 
-    if (!fd)
+    if (st != NULL && st->cdev)
+        return (st->edge == NO_EDGE) ? -1 : (int)st->edge;
+
+    if (!cached)
     {
         if ((fd = open_edge_file(gpio)) == -1) {
             char err[256];
@@ -651,7 +1485,8 @@ int gpio_get_edge(int gpio)
 
     char edge[16] = { 0 };  /* make sure read is null-terminated */
     ssize_t s = read(fd, &edge, sizeof(edge) - 1);
-    close(fd);
+    if (!cached)
+        close(fd);
     while (s > 0 && edge[s-1] == '\n') {  /* strip trailing newlines */
         edge[s-1] = '\0';
         s --;
@@ -683,238 +1518,2065 @@ int gpio_get_edge(int gpio)
     return rtnedge;
 }
 
-int gpio_lookup(int fd)
+void exports_cleanup(void)
+{
+    int gpio;
+
+    // unexport everything
+    if (DEBUG)
+        printf(" ** exports_cleanup **\n");
+    for (gpio = 0; gpio <= gpio_state_top; gpio++) {
+        struct gpio_state *st = gpio_state(gpio, 0);
+        if (st != NULL && st->exported)
+            gpio_unexport(gpio);
+    }
+}
+
+int add_edge_callback(int gpio, int edge, void (*func)(int gpio, void* data), void* data)
+{
+    struct gpio_state *st = gpio_state(gpio, 1);
+    struct callback *cb;
+
+    if (DEBUG)
+        printf(" ** add_edge_callback **\n");
+
+    if (st == NULL)
+        return -1;
+    if (st->num_callbacks >= MAX_PIN_CALLBACKS) {
+        char err[256];
+        snprintf(err, sizeof(err), "add_edge_callback: GPIO %d already has %d callbacks", gpio, MAX_PIN_CALLBACKS);
+        add_error_msg(err);
+        return -1;
+    }
+
+    if (st->fde < 0 && !st->cdev)
+        st->fde = open_edge_file(gpio);
+
+    cb = &st->callbacks[st->num_callbacks];
+    cb->edge = edge;
+    cb->data = data;
+    cb->func = func;
+    // publish the slot only once it is filled in, the poll thread may be
+    // walking the callbacks right now
+    __atomic_store_n(&st->num_callbacks, st->num_callbacks + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+// value is the level after the edge, read once by the poll thread
+void run_callbacks(int gpio, unsigned int value)
 {
-    struct fdx *f = fd_list;
-    while (f != NULL)
+    struct gpio_state *st = gpio_state(gpio, 0);
+    int i;
+
+    if (st == NULL)
+        return;
+
+    // the count is re-read every time round, a callback may remove the
+    // detection (count back to 0) and the later entries with it
+    for (i = 0; i < __atomic_load_n(&st->num_callbacks, __ATOMIC_ACQUIRE); i++)
     {
-        if (f->fd == fd)
-            return f->gpio;
-        f = f->next;
+        struct callback *cb = &st->callbacks[i];
+        int canrun = 0;
+        // Both Edge
+        if (cb->edge == 3)
+        {
+            canrun = 1;
+        }
+        // Rising Edge
+        else if ((cb->edge == 1) && (value == 1))
+        {
+            canrun = 1;
+        }
+        // Falling Edge
+        else if ((cb->edge == 2) && (value == 0))
+        {
+            canrun = 1;
+        }
+        // Only run if we are allowed
+        if (canrun)
+        {
+            if (DEBUG)
+                printf(" ** run_callbacks: gpio triggered: %d **\n", gpio);
+            cb->func(gpio, cb->data);
+        }
     }
+}
+
+// Callbacks added for WATCHDOG_EDGE, run_callbacks() never runs them
+static void run_watchdog_callbacks(int gpio)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    int i;
+
+    if (st == NULL)
+        return;
 
-    return -1;
+    // re-read like run_callbacks()
+    for (i = 0; i < __atomic_load_n(&st->num_callbacks, __ATOMIC_ACQUIRE); i++)
+    {
+        struct callback *cb = &st->callbacks[i];
+        if (cb->edge == WATCHDOG_EDGE)
+        {
+            if (DEBUG)
+                printf(" ** run_watchdog_callbacks: gpio timed out: %d **\n", gpio);
+            cb->func(gpio, cb->data);
+        }
+    }
 }
 
-void exports_cleanup(void)
+void remove_callbacks(int gpio)
 {
-    // unexport everything
+    struct gpio_state *st = gpio_state(gpio, 0);
+
+    if (st == NULL)
+        return;
+
     if (DEBUG)
-        printf(" ** exports_cleanup **\n");
-    while (exported_gpios != NULL)
-        gpio_unexport(exported_gpios->gpio);
+        printf(" ** remove_callbacks: gpio: %d **\n", gpio);
+    __atomic_store_n(&st->num_callbacks, 0, __ATOMIC_RELEASE);
+    if (st->fde >= 0) {
+        close(st->fde);
+        st->fde = -1;
+    }
 }
 
-int add_edge_callback(int gpio, int edge, void (*func)(int gpio, void* data), void* data)
+void set_initial_false(int gpio)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    if (st != NULL)
+        st->initial = 0;
+}
+
+int gpio_initial(int gpio)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    return (st != NULL && st->fd >= 0 && st->initial);
+}
+
+static struct event_queue *event_queue_create(struct gpio_state *st)
+{
+    struct event_queue *q;
+
+    if (st->queue != NULL)
+        return st->queue;
+
+    q = calloc(1, sizeof(struct event_queue));  ASSRT(q != NULL);
+    __atomic_store_n(&st->queue, q, __ATOMIC_RELEASE);
+    queued_gpios[num_queued_gpios] = st->gpio;
+    __atomic_store_n(&num_queued_gpios, num_queued_gpios + 1, __ATOMIC_RELEASE);
+
+    return q;
+}
+
+// Only called from the poll thread
+static void event_queue_push(struct gpio_state *st, unsigned int edge, uint64_t timestamp, unsigned int level, unsigned int count)
+{
+    struct event_queue *q = __atomic_load_n(&st->queue, __ATOMIC_ACQUIRE);
+    struct gpio_event *ev;
+    unsigned int head;
+
+    if (q == NULL)
+        return;
+
+    head = q->head;
+    if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) >= EVENT_QUEUE_SIZE) {
+        __atomic_add_fetch(&q->overflows, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    ev = &q->events[head & (EVENT_QUEUE_SIZE - 1)];
+    ev->gpio = st->gpio;
+    ev->edge = edge;
+    ev->timestamp = timestamp;
+    ev->level = level;
+    ev->count = count;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Returns the oldest queued edge without taking it, NULL if there is none
+static struct gpio_event *event_queue_peek(struct event_queue *q)
+{
+    unsigned int tail = q->tail;
+
+    if (tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &q->events[tail & (EVENT_QUEUE_SIZE - 1)];
+}
+
+static void event_queue_pop(struct event_queue *q)
+{
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+}
+
+static void event_queue_clear(struct event_queue *q)
+{
+    if (q != NULL)
+        __atomic_store_n(&q->tail, __atomic_load_n(&q->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+// Takes up to max queued edges of gpio, oldest first.  Returns the number
+// copied to events.
+int gpio_read_events(int gpio, struct gpio_event *events, int max)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    struct event_queue *q;
+    struct gpio_event *ev;
+    int n = 0;
+
+    if (st == NULL || (q = __atomic_load_n(&st->queue, __ATOMIC_ACQUIRE)) == NULL)
+        return 0;
+
+    while (n < max && (ev = event_queue_peek(q)) != NULL) {
+        events[n++] = *ev;
+        event_queue_pop(q);
+    }
+
+    return n;
+}
+
+// Takes up to max queued edges of every GPIO, merged into timestamp order.
+// Returns the number copied to events.
+int gpio_read_all_events(struct gpio_event *events, int max)
+{
+    int count = __atomic_load_n(&num_queued_gpios, __ATOMIC_ACQUIRE);
+    int n = 0;
+    int i;
+
+    while (n < max) {
+        struct event_queue *oldest = NULL;
+        struct gpio_event *ev, *first = NULL;
+
+        for (i = 0; i < count; i++) {
+            struct event_queue *q = gpio_state(queued_gpios[i], 0)->queue;
+            if ((ev = event_queue_peek(q)) != NULL && (first == NULL || ev->timestamp < first->timestamp)) {
+                first = ev;
+                oldest = q;
+            }
+        }
+        if (first == NULL)
+            break;
+        events[n++] = *first;
+        event_queue_pop(oldest);
+    }
+
+    return n;
+}
+
+// Edges dropped on a full queue, summed over every GPIO when gpio is -1
+unsigned long gpio_event_overflows(int gpio)
+{
+    int count = __atomic_load_n(&num_queued_gpios, __ATOMIC_ACQUIRE);
+    unsigned long total = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (gpio == -1 || gpio == queued_gpios[i])
+            total += __atomic_load_n(&gpio_state(queued_gpios[i], 0)->queue->overflows, __ATOMIC_RELAXED);
+    }
+
+    return total;
+}
+
+// Histograms are allocated when stats are turned on, so pins cost nothing
+// extra while they are off
+void gpio_set_event_stats(int enable)
+{
+    __atomic_store_n(&event_stats_enabled, enable ? 1 : 0, __ATOMIC_RELEASE);
+}
+
+int gpio_get_event_stats_enabled(void)
 {
-    struct callback *cb = callbacks;
-    struct callback *new_cb;
+    return event_stats_enabled;
+}
+
+static void event_hist_add(struct gpio_state *st, int stage, uint64_t start, uint64_t end)
+{
+    struct event_hist *hists, *expected = NULL, *h;
+    uint64_t ns;
+    int bucket = 0;
+
+    if (st == NULL || !__atomic_load_n(&event_stats_enabled, __ATOMIC_ACQUIRE) || start == 0 || end < start)
+        return;
+
+    hists = __atomic_load_n(&st->hists, __ATOMIC_ACQUIRE);
+    if (hists == NULL) {
+        // the poll and dispatcher threads can both get here first
+        hists = calloc(NUM_EVENT_STATS, sizeof(struct event_hist));
+        if (hists == NULL)
+            return;
+        if (!__atomic_compare_exchange_n(&st->hists, &expected, hists, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(hists);
+            hists = expected;
+        }
+    }
+
+    ns = end - start;
+    while (bucket < EVENT_STATS_BUCKETS - 1 && (ns >> bucket) != 0)
+        bucket++;
+
+    // each stage has a single writer thread
+    h = &hists[stage];
+    __atomic_add_fetch(&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+    h->sum += ns;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+// Called on the dispatcher thread by callbacks that want their own stage,
+// the Python module marks STAT_CALLBACK on entry to each Python callback
+void gpio_event_stats_mark(int gpio, int stage)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+
+    if (st != NULL && stage >= 0 && stage < NUM_EVENT_STATS)
+        event_hist_add(st, stage, dispatch_edge_ts, monotonic_ns());
+}
+
+// Copies the NUM_EVENT_STATS histograms of gpio, all zero if it has none
+int gpio_get_event_stats(int gpio, struct event_hist *hists, int reset)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    struct event_hist *h;
+
+    memset(hists, 0, NUM_EVENT_STATS * sizeof(struct event_hist));
+    if (st == NULL || (h = __atomic_load_n(&st->hists, __ATOMIC_ACQUIRE)) == NULL)
+        return 0;
+
+    memcpy(hists, h, NUM_EVENT_STATS * sizeof(struct event_hist));
+    if (reset)
+        memset(h, 0, NUM_EVENT_STATS * sizeof(struct event_hist));
+
+    return 0;
+}
+
+// Upper bound of the bucket holding the given fraction of the samples
+uint64_t event_hist_percentile(const struct event_hist *hist, double fraction)
+{
+    unsigned long seen = 0;
+    unsigned long want;
+    int i;
+
+    if (hist->count == 0)
+        return 0;
+
+    want = (unsigned long)(fraction * hist->count);
+    if (want < fraction * hist->count)
+        want++;
+    if (want < 1)
+        want = 1;
+    for (i = 0; i < EVENT_STATS_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= want)
+            return (i == EVENT_STATS_BUCKETS - 1) ? hist->max : (1ULL << i);
+    }
+
+    return hist->max;
+}
+
+int gpio_set_dispatch_policy(int policy)
+{
+    if (policy != DISPATCH_QUEUE && policy != DISPATCH_COALESCE && policy != DISPATCH_DROP_OLDEST) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_set_dispatch_policy: unknown policy %d", policy);
+        add_error_msg(err);
+        return -1;
+    }
+    pthread_mutex_lock(&dispatch_lock);
+    dispatch_policy = policy;
+    pthread_mutex_unlock(&dispatch_lock);
+
+    return 0;
+}
+
+int gpio_get_dispatch_policy(void)
+{
+    return dispatch_policy;
+}
+
+void gpio_set_dispatch_hooks(void (*enter)(void), void (*leave)(void))
+{
+    pthread_mutex_lock(&dispatch_lock);
+    dispatch_enter = enter;
+    dispatch_leave = leave;
+    pthread_mutex_unlock(&dispatch_lock);
+}
+
+void gpio_get_dispatch_stats(struct dispatch_stats *stats, int reset)
+{
+    pthread_mutex_lock(&dispatch_lock);
+    *stats = dispatch_stats;
+    if (reset)
+        memset(&dispatch_stats, 0, sizeof(dispatch_stats));
+    pthread_mutex_unlock(&dispatch_lock);
+}
+
+// Hands an edge of a GPIO with callbacks to the dispatcher thread.  Called
+// from the poll thread, it never waits on the callbacks themselves.
+// Watchdog timeouts are never coalesced with the edges.
+static void dispatch_add(struct gpio_state *st, unsigned int value, uint64_t timestamp, int watchdog)
+{
+    struct dispatch_item *item;
+    unsigned int depth;
+
+    if (__atomic_load_n(&st->num_callbacks, __ATOMIC_ACQUIRE) == 0)
+        return;
+
+    pthread_mutex_lock(&dispatch_lock);
+    dispatch_stats.queued++;
+
+    if (!watchdog && dispatch_policy == DISPATCH_COALESCE && st->dispatch_pending) {
+        // the timestamp stays the one of the first edge waiting
+        st->dispatch_value = value;
+        dispatch_stats.coalesced++;
+        pthread_mutex_unlock(&dispatch_lock);
+        return;
+    }
+
+    if (dispatch_head - dispatch_tail >= DISPATCH_QUEUE_SIZE) {
+        dispatch_stats.dropped++;
+        if (dispatch_policy != DISPATCH_DROP_OLDEST) {
+            pthread_mutex_unlock(&dispatch_lock);
+            return;
+        }
+        item = &dispatch_queue[dispatch_tail % DISPATCH_QUEUE_SIZE];
+        if (item->coalesced)
+            gpio_state(item->gpio, 0)->dispatch_pending = 0;
+        dispatch_tail++;
+    }
+
+    item = &dispatch_queue[dispatch_head % DISPATCH_QUEUE_SIZE];
+    item->gpio = st->gpio;
+    item->value = value;
+    item->timestamp = timestamp;
+    item->coalesced = (!watchdog && dispatch_policy == DISPATCH_COALESCE);
+    item->watchdog = watchdog;
+    if (item->coalesced) {
+        st->dispatch_pending = 1;
+        st->dispatch_value = value;
+    }
+    if (dispatch_head == dispatch_tail)
+        pthread_cond_signal(&dispatch_cond);
+    dispatch_head++;
+
+    depth = dispatch_head - dispatch_tail;
+    if (depth > dispatch_stats.max_depth)
+        dispatch_stats.max_depth = depth;
+    pthread_mutex_unlock(&dispatch_lock);
+}
+
+static void dispatch_push(struct gpio_state *st, unsigned int value, uint64_t timestamp)
+{
+    dispatch_add(st, value, timestamp, 0);
+}
+
+// Takes up to max queued edges, waiting for one when wait is set.  Returns
+// the number copied to items.
+static int dispatch_pop(struct dispatch_item *items, int max, int wait)
+{
+    int n = 0;
+
+    pthread_mutex_lock(&dispatch_lock);
+    while (wait && dispatch_running && dispatch_head == dispatch_tail)
+        pthread_cond_wait(&dispatch_cond, &dispatch_lock);
+
+    while (n < max && dispatch_tail != dispatch_head) {
+        struct dispatch_item *item = &dispatch_queue[dispatch_tail % DISPATCH_QUEUE_SIZE];
+        items[n] = *item;
+        if (item->coalesced) {
+            struct gpio_state *st = gpio_state(item->gpio, 0);
+            items[n].value = st->dispatch_value;
+            st->dispatch_pending = 0;
+        }
+        dispatch_tail++;
+        n++;
+    }
+    if (n > 0)
+        dispatch_stats.batches++;
+    pthread_mutex_unlock(&dispatch_lock);
+
+    return n;
+}
+
+// Runs the callbacks of one batch, enter/leave are called once around it
+static void dispatch_run(struct dispatch_item *items, int n)
+{
+    int i;
+
+    if (dispatch_enter != NULL)
+        dispatch_enter();
+    for (i = 0; i < n; i++) {
+        struct gpio_state *st = gpio_state(items[i].gpio, 0);
+        dispatch_edge_ts = items[i].timestamp;
+        event_hist_add(st, STAT_DISPATCH, items[i].timestamp, monotonic_ns());
+        if (items[i].watchdog)
+            run_watchdog_callbacks(items[i].gpio);
+        else
+            run_callbacks(items[i].gpio, items[i].value);
+    }
+    dispatch_edge_ts = 0;
+    if (dispatch_leave != NULL)
+        dispatch_leave();
+
+    pthread_mutex_lock(&dispatch_lock);
+    dispatch_stats.dispatched += n;
+    pthread_mutex_unlock(&dispatch_lock);
+}
+
+void *dispatch_thread(void *threadarg)
+{
+    struct dispatch_item items[DISPATCH_BATCH];
+    int n;
+
+    while (dispatch_running)
+    {
+        if ((n = dispatch_pop(items, DISPATCH_BATCH, 1)) > 0 && dispatch_running)
+            dispatch_run(items, n);
+    }
+    pthread_exit(NULL);
+}
+
+// lockout_us drops edges that come too soon after the last accepted one.
+// stable_us holds an edge back until the level has stayed put that long, any
+// edge in between restarts the wait.  Both are on CLOCK_MONOTONIC and are
+// applied before the event flag, the event queue and the callbacks.
+int gpio_set_debounce(int gpio, unsigned int lockout_us, unsigned int stable_us)
+{
+    struct gpio_state *st = gpio_state(gpio, 1);
+
+    if (st == NULL)
+        return -1;
+    if (DEBUG)
+        printf(" ** gpio_set_debounce: gpio %d lockout %u us stable %u us **\n", gpio, lockout_us, stable_us);
+
+    __atomic_store_n(&st->lockout_us, lockout_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->stable_us, stable_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->bounced, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->glitches, 0, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+int gpio_get_debounce(int gpio, struct debounce_info *info)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+
+    memset(info, 0, sizeof(*info));
+    if (st == NULL)
+        return 0;
+    info->lockout_us = __atomic_load_n(&st->lockout_us, __ATOMIC_RELAXED);
+    info->stable_us = __atomic_load_n(&st->stable_us, __ATOMIC_RELAXED);
+    info->bounced = __atomic_load_n(&st->bounced, __ATOMIC_RELAXED);
+    info->glitches = __atomic_load_n(&st->glitches, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+// Caps the edges of gpio delivered to the queue and callbacks at max_events
+// per interval_us, the rest are coalesced or the pin is disarmed, see action.
+// max_events 0 lifts the limit.
+int gpio_set_storm_limit(int gpio, unsigned int max_events, unsigned int interval_us, int action, unsigned int holdoff_us)
+{
+    struct gpio_state *st = gpio_state(gpio, 1);
+
+    if (st == NULL)
+        return -1;
+    if (max_events > 0 && (interval_us == 0 || (action != STORM_COALESCE && action != STORM_DISARM)
+                           || (action == STORM_DISARM && holdoff_us == 0))) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_set_storm_limit: invalid limit for GPIO %d", gpio);
+        add_error_msg(err);
+        return -1;
+    }
+    if (DEBUG)
+        printf(" ** gpio_set_storm_limit: gpio %d max %u per %u us action %d holdoff %u us **\n", gpio, max_events, interval_us, action, holdoff_us);
+
+    // the poll thread reads max last, so the rest is in place when it changes
+    __atomic_store_n(&st->storm_max, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&st->storm_interval_us, interval_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->storm_action, action, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->storm_holdoff_us, holdoff_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->storm_max, max_events, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int gpio_get_storm_stats(int gpio, struct storm_info *info, int reset)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+
+    memset(info, 0, sizeof(*info));
+    if (st == NULL)
+        return 0;
+    info->max_events = __atomic_load_n(&st->storm_max, __ATOMIC_ACQUIRE);
+    info->interval_us = __atomic_load_n(&st->storm_interval_us, __ATOMIC_RELAXED);
+    info->action = __atomic_load_n(&st->storm_action, __ATOMIC_RELAXED);
+    info->holdoff_us = __atomic_load_n(&st->storm_holdoff_us, __ATOMIC_RELAXED);
+    info->disarmed = __atomic_load_n(&st->disarmed, __ATOMIC_ACQUIRE);
+    if (reset) {
+        info->storms = __atomic_exchange_n(&st->storms, 0, __ATOMIC_RELAXED);
+        info->suppressed = __atomic_exchange_n(&st->suppressed, 0, __ATOMIC_RELAXED);
+        info->disarms = __atomic_exchange_n(&st->disarms, 0, __ATOMIC_RELAXED);
+    } else {
+        info->storms = __atomic_load_n(&st->storms, __ATOMIC_RELAXED);
+        info->suppressed = __atomic_load_n(&st->suppressed, __ATOMIC_RELAXED);
+        info->disarms = __atomic_load_n(&st->disarms, __ATOMIC_RELAXED);
+    }
+    info->last_storm = __atomic_load_n(&st->last_storm, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+// Measures period and high time from the edge timestamps and publishes the
+// means once per window.  window_us is how often the result changes, the
+// first window after a start ends at the first rising edge past it.
+int gpio_start_measure(int gpio, unsigned int window_us)
+{
+    struct gpio_state *st = gpio_state(gpio, 1);
+    struct measure *m, *expected = NULL;
+
+    if (st == NULL)
+        return -1;
+    if (window_us == 0) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_start_measure: window for GPIO %d must be more than 0 us", gpio);
+        add_error_msg(err);
+        return -1;
+    }
+    if (DEBUG)
+        printf(" ** gpio_start_measure: gpio %d window %u us **\n", gpio, window_us);
+
+    if ((m = __atomic_load_n(&st->measure, __ATOMIC_ACQUIRE)) == NULL) {
+        // never freed, the poll thread may be looking at it
+        m = calloc(1, sizeof(struct measure));  ASSRT(m != NULL);
+        if (!__atomic_compare_exchange_n(&st->measure, &expected, m, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(m);
+            m = expected;
+        }
+    }
+
+    __atomic_store_n(&m->window_us, window_us, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m->generation, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&m->active, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int gpio_stop_measure(int gpio)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+
+    if (st == NULL || st->measure == NULL)
+        return 0;
+    __atomic_store_n(&st->measure->active, 0, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static void measure_publish(struct measure *m, unsigned int generation, uint64_t timestamp)
+{
+    struct measure_info *r = &m->result;
+
+    __atomic_add_fetch(&m->seq, 1, __ATOMIC_RELAXED);  /* odd, readers retry */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    m->result_generation = generation;
+    r->window_us = m->window_us;
+    r->samples = m->periods;
+    r->edges = m->edges;
+    r->updated = timestamp;
+    r->period_ns = m->periods ? m->sum_period / m->periods : 0;
+    r->frequency = m->sum_period ? 1e9 * m->periods / m->sum_period : 0;
+    r->high_ns = m->highs ? m->sum_high / m->highs : 0;
+    r->duty = (m->highs && r->period_ns) ? (double)r->high_ns / r->period_ns : -1;
+    if (r->duty > 1)
+        r->duty = 1;
+    __atomic_add_fetch(&m->seq, 1, __ATOMIC_RELEASE);
+}
+
+static void measure_edge(struct measure *m, unsigned int edge, uint64_t timestamp)
+{
+    unsigned int generation = __atomic_load_n(&m->generation, __ATOMIC_ACQUIRE);
+
+    if (generation != m->seen_generation) {
+        m->seen_generation = generation;
+        m->window_start = timestamp;
+        m->last_rise = m->last_fall = 0;
+        m->sum_period = m->sum_high = 0;
+        m->periods = m->highs = m->edges = 0;
+    }
+
+    m->edges++;
+    if (edge == FALLING_EDGE) {
+        m->last_fall = timestamp;
+        return;
+    }
+
+    // a period runs from one rising edge to the next, the high time of it
+    // from the first rising edge to the falling edge in between
+    if (m->last_rise != 0 && timestamp > m->last_rise) {
+        m->sum_period += timestamp - m->last_rise;
+        m->periods++;
+        if (m->last_fall > m->last_rise) {
+            m->sum_high += m->last_fall - m->last_rise;
+            m->highs++;
+        }
+    }
+    m->last_rise = timestamp;
+
+    if (m->periods > 0 && timestamp - m->window_start >= (uint64_t)m->window_us * 1000) {
+        measure_publish(m, generation, timestamp);
+        m->window_start = timestamp;
+        m->sum_period = m->sum_high = 0;
+        m->periods = m->highs = 0;
+    }
+}
+
+// Copies the last published result.  Returns -1 if gpio is not measuring.
+// A result older than two windows plus two periods means the signal
+// stopped and reads as 0 Hz.
+int gpio_read_measure(int gpio, struct measure_info *info)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    struct measure *m;
+    unsigned int seq, generation;
+    uint64_t now;
+
+    memset(info, 0, sizeof(*info));
+    if (st == NULL || (m = __atomic_load_n(&st->measure, __ATOMIC_ACQUIRE)) == NULL
+        || !__atomic_load_n(&m->active, __ATOMIC_ACQUIRE))
+        return -1;
+
+    do {
+        while ((seq = __atomic_load_n(&m->seq, __ATOMIC_ACQUIRE)) & 1)
+            ;
+        generation = m->result_generation;
+        memcpy(info, &m->result, sizeof(*info));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (seq != __atomic_load_n(&m->seq, __ATOMIC_RELAXED));
+
+    if (generation != __atomic_load_n(&m->generation, __ATOMIC_ACQUIRE)) {
+        // nothing published since the last start
+        memset(info, 0, sizeof(*info));
+        info->duty = -1;
+    }
+    info->window_us = m->window_us;
+
+    now = monotonic_ns();
+    if (info->updated != 0 && now - info->updated > 2 * ((uint64_t)info->window_us * 1000 + info->period_ns)) {
+        info->frequency = 0;
+        info->period_ns = info->high_ns = 0;
+        info->duty = -1;
+        info->samples = 0;
+    }
+
+    return 0;
+}
+
+// Counts the edges of an evented pin instead of queueing and dispatching
+// them.  window_ms is the span the rate is taken over.
+int gpio_start_counter(int gpio, unsigned int window_ms)
+{
+    struct gpio_state *st = gpio_state(gpio, 1);
+    struct counter *c, *expected = NULL;
+
+    if (st == NULL)
+        return -1;
+    if (window_ms < COUNTER_BUCKETS) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_start_counter: window for GPIO %d must be at least %d ms", gpio, COUNTER_BUCKETS);
+        add_error_msg(err);
+        return -1;
+    }
+
+    if ((c = __atomic_load_n(&st->counter, __ATOMIC_ACQUIRE)) == NULL) {
+        // never freed, the poll thread may be looking at it
+        c = calloc(1, sizeof(struct counter));  ASSRT(c != NULL);
+        if (!__atomic_compare_exchange_n(&st->counter, &expected, c, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(c);
+            c = expected;
+        }
+    }
+
+    __atomic_store_n(&c->active, 0, __ATOMIC_RELEASE);
+    memset(c->buckets, 0, sizeof(c->buckets));
+    __atomic_store_n(&c->count, 0, __ATOMIC_RELAXED);
+    c->bucket_ns = (uint64_t)window_ms * 1000000ULL / COUNTER_BUCKETS;
+    __atomic_store_n(&c->active, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int gpio_stop_counter(int gpio)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+
+    if (st != NULL && st->counter != NULL)
+        __atomic_store_n(&st->counter->active, 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static struct counter *counter_lookup(int gpio)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    struct counter *c;
+
+    if (st == NULL || (c = __atomic_load_n(&st->counter, __ATOMIC_ACQUIRE)) == NULL
+        || !__atomic_load_n(&c->active, __ATOMIC_ACQUIRE))
+        return NULL;
+    return c;
+}
+
+int gpio_is_counter(int gpio)
+{
+    return counter_lookup(gpio) != NULL;
+}
+
+// Hands every edge of an evented pin, with the level after it, to func on
+// the poll thread instead of queueing and dispatching it.  data has to stay
+// valid after the tap is removed (func NULL), the poll thread may still be
+// in func.
+int gpio_set_edge_tap(int gpio, edge_tap_func func, void *data)
+{
+    struct gpio_state *st = gpio_state(gpio, func != NULL);
+
+    if (st == NULL)
+        return func == NULL ? 0 : -1;
+    if (DEBUG)
+        printf(" ** gpio_set_edge_tap: gpio %d %s **\n", gpio, func ? "on" : "off");
+
+    __atomic_store_n(&st->tap, NULL, __ATOMIC_RELEASE);
+    st->tap_data = data;
+    __atomic_store_n(&st->tap, func, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static void counter_edge(struct counter *c, uint64_t timestamp)
+{
+    unsigned int index = (unsigned int)(timestamp / c->bucket_ns);
+    int b = index % COUNTER_BUCKETS;
+
+    __atomic_add_fetch(&c->count, 1, __ATOMIC_RELAXED);
+    if (c->buckets[b].index != index) {
+        // the bucket held an older window, start it over
+        __atomic_store_n(&c->buckets[b].count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&c->buckets[b].index, index, __ATOMIC_RELEASE);
+    }
+    __atomic_add_fetch(&c->buckets[b].count, 1, __ATOMIC_RELAXED);
+}
+
+// Edges counted since the start or the last reset, 0 if gpio is not counting
+uint64_t gpio_read_counter(int gpio, int reset)
+{
+    struct counter *c = counter_lookup(gpio);
+
+    if (c == NULL)
+        return 0;
+    if (reset)
+        return __atomic_exchange_n(&c->count, 0, __ATOMIC_RELAXED);
+    return __atomic_load_n(&c->count, __ATOMIC_RELAXED);
+}
+
+// Edges per second over the last window, the bucket in progress counts for
+// the time it has run so far
+double gpio_counter_rate(int gpio)
+{
+    struct counter *c = counter_lookup(gpio);
+    uint64_t now = monotonic_ns();
+    unsigned int index, b_index;
+    unsigned long sum = 0;
+    uint64_t span;
+    int b;
+
+    if (c == NULL)
+        return 0;
+
+    index = (unsigned int)(now / c->bucket_ns);
+    for (b = 0; b < COUNTER_BUCKETS; b++) {
+        b_index = __atomic_load_n(&c->buckets[b].index, __ATOMIC_ACQUIRE);
+        if (index - b_index < COUNTER_BUCKETS)
+            sum += __atomic_load_n(&c->buckets[b].count, __ATOMIC_RELAXED);
+    }
+    span = (COUNTER_BUCKETS - 1) * c->bucket_ns + now % c->bucket_ns;
+
+    return span ? 1e9 * sum / span : 0;
+}
+
+// Edge rules.  The poll thread runs them under rule_lock, which adding and
+// removing rules only hold for a moment.
+struct rule
+{
+    int active;
+    struct rule_spec spec;
+    struct epoll_source timer_src;
+    int timer_fd;               /* RULE_PULSE */
+    int pulse_pending;
+    struct softpwm *pwm;        /* RULE_SPWM_START/STOP */
+    unsigned long fired;
+};
+
+static struct rule rules[MAX_RULES];
+static pthread_mutex_t rule_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void rule_action(struct rule *r)
+{
+    unsigned int value;
+    struct itimerspec its;
+
+    switch (r->spec.action) {
+    case RULE_SET:
+        gpio_set_value(r->spec.gpio_out, HIGH);
+        break;
+    case RULE_CLEAR:
+        gpio_set_value(r->spec.gpio_out, LOW);
+        break;
+    case RULE_TOGGLE:
+        if (gpio_get_value(r->spec.gpio_out, &value) == 0)
+            gpio_set_value(r->spec.gpio_out, !value);
+        break;
+    case RULE_PULSE:
+        // another edge during the pulse makes it longer
+        gpio_set_value(r->spec.gpio_out, r->spec.value);
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec = r->spec.pulse_us / 1000000;
+        its.it_value.tv_nsec = (r->spec.pulse_us % 1000000) * 1000;
+        r->pulse_pending = 1;
+        timerfd_settime(r->timer_fd, 0, &its, NULL);
+        break;
+    case RULE_SPWM_START:
+        softpwm_enable(r->pwm, 1);
+        break;
+    case RULE_SPWM_STOP:
+        softpwm_enable(r->pwm, 0);
+        break;
+    }
+}
+
+static void run_rules(int gpio, unsigned int edge)
+{
+    int i;
+
+    pthread_mutex_lock(&rule_lock);
+    for (i = 0; i < MAX_RULES; i++) {
+        struct rule *r = &rules[i];
+        if (r->active && r->spec.gpio_in == gpio && (r->spec.edge == BOTH_EDGE || r->spec.edge == edge)) {
+            rule_action(r);
+            r->fired++;
+        }
+    }
+    pthread_mutex_unlock(&rule_lock);
+}
+
+// A pulse ran out, puts the output back
+static void poll_rule(int id)
+{
+    struct rule *r = &rules[id];
+    uint64_t expirations;
+
+    pthread_mutex_lock(&rule_lock);
+    if (r->active && r->pulse_pending
+        && read(r->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        r->pulse_pending = 0;
+        gpio_set_value(r->spec.gpio_out, !r->spec.value);
+    }
+    pthread_mutex_unlock(&rule_lock);
+}
+
+// Adds a rule run on every edge of spec->gpio_in that matches spec->edge.
+// The input needs edge detection, an output for SET/CLEAR/TOGGLE/PULSE has
+// to be set up by the caller.  SPWM_START/STOP rules on the same output
+// share one softpwm, started paused here and stopped with the last of them.
+// Returns the rule id, -1 on error
+int gpio_add_rule(const struct rule_spec *spec)
+{
+    struct gpio_state *st = gpio_state(spec->gpio_in, 1);
+    struct rule *r = NULL;
+    struct softpwm *pwm = NULL;
+    struct epoll_event ev;
+    const char *key;
+    int i, id = -1;
+    int timer_fd = -1;
+    int pwm_started = 0;
+
+    if (st == NULL || gpio_state(spec->gpio_out, 1) == NULL)
+        return -1;
+    if (spec->action < RULE_SET || spec->action > RULE_SPWM_STOP
+        || (spec->action == RULE_PULSE && spec->pulse_us == 0)) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_add_rule: invalid action %d for GPIO %d", spec->action, spec->gpio_in);
+        add_error_msg(err);
+        return -1;
+    }
+    if (!st->is_evented || epfd == -1) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_add_rule: GPIO %d has no edge detection", spec->gpio_in);
+        add_error_msg(err);
+        return -1;
+    }
+
+    if (spec->action == RULE_PULSE) {
+        if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+            char err[256];
+            snprintf(err, sizeof(err), "gpio_add_rule: could not create pulse timer (%s)", strerror(errno));
+            add_error_msg(err);
+            return -1;
+        }
+    }
+
+    if (spec->action == RULE_SPWM_START || spec->action == RULE_SPWM_STOP) {
+        // softpwm keys are pin names
+        if ((key = lookup_name_by_gpio(spec->gpio_out)) == NULL) {
+            char err[256];
+            snprintf(err, sizeof(err), "gpio_add_rule: GPIO %d has no name for a softpwm", spec->gpio_out);
+            add_error_msg(err);
+            return -1;
+        }
+        if ((pwm = lookup_exported_pwm(key)) == NULL) {
+            // paused from the start, a STOP rule must never see it run
+            if (softpwm_start(key, spec->duty, spec->freq, 0, 0) < 0 || (pwm = lookup_exported_pwm(key)) == NULL)
+                return -1;
+            pwm_started = 1;
+        } else if (spec->action == RULE_SPWM_START) {
+            softpwm_set_duty_cycle(key, spec->duty);
+            softpwm_set_frequency(key, spec->freq);
+        }
+    }
+
+    pthread_mutex_lock(&rule_lock);
+    for (i = 0; i < MAX_RULES && r == NULL; i++)
+        if (!rules[i].active)
+            r = &rules[id = i];
+    if (r != NULL) {
+        memset(r, 0, sizeof(*r));
+        r->spec = *spec;
+        r->timer_fd = timer_fd;
+        r->timer_src.type = EPOLL_SRC_RULE;
+        r->timer_src.gpio = id;
+        r->pwm = pwm;
+        r->active = 1;
+        __atomic_add_fetch(&st->num_rules, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&rule_lock);
+
+    if (r == NULL) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_add_rule: all %d rules are in use", MAX_RULES);
+        add_error_msg(err);
+        if (timer_fd >= 0)
+            close(timer_fd);
+        if (pwm_started)
+            softpwm_disable(key);
+        return -1;
+    }
+
+    if (timer_fd >= 0) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &r->timer_src;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, timer_fd, &ev) == -1) {
+            char err[256];
+            snprintf(err, sizeof(err), "gpio_add_rule: could not add pulse timer (%s)", strerror(errno));
+            add_error_msg(err);
+            gpio_remove_rule(id);
+            return -1;
+        }
+    }
+
+    if (DEBUG)
+        printf(" ** gpio_add_rule: %d, GPIO %d edge %d -> GPIO %d action %d **\n", id, spec->gpio_in, spec->edge, spec->gpio_out, spec->action);
+
+    return id;
+}
+
+int gpio_remove_rule(int id)
+{
+    struct rule *r;
+    struct softpwm *pwm = NULL;
+    const char *key = NULL;
+    int i;
+
+    if (id < 0 || id >= MAX_RULES)
+        return -1;
+    r = &rules[id];
+
+    pthread_mutex_lock(&rule_lock);
+    if (!r->active) {
+        pthread_mutex_unlock(&rule_lock);
+        return -1;
+    }
+    r->active = 0;
+    __atomic_sub_fetch(&gpio_state(r->spec.gpio_in, 0)->num_rules, 1, __ATOMIC_RELEASE);
+    if (r->timer_fd >= 0) {
+        // a pulse still running is ended now
+        if (r->pulse_pending)
+            gpio_set_value(r->spec.gpio_out, !r->spec.value);
+        close(r->timer_fd);
+        r->timer_fd = -1;
+    }
+    if ((pwm = r->pwm) != NULL) {
+        for (i = 0; i < MAX_RULES; i++)
+            if (rules[i].active && rules[i].pwm == pwm)
+                pwm = NULL;
+        key = lookup_name_by_gpio(r->spec.gpio_out);
+    }
+    pthread_mutex_unlock(&rule_lock);
+
+    // no rule uses it any more, nothing on the poll thread can reach it
+    if (pwm != NULL && key != NULL)
+        softpwm_disable(key);
+
+    return 0;
+}
+
+// Times the rule has run
+unsigned long gpio_rule_fired(int id)
+{
+    unsigned long fired;
+
+    if (id < 0 || id >= MAX_RULES)
+        return 0;
+    pthread_mutex_lock(&rule_lock);
+    fired = rules[id].active ? rules[id].fired : 0;
+    pthread_mutex_unlock(&rule_lock);
+
+    return fired;
+}
+
+static struct encoder encoders[MAX_ENCODERS];
+static pthread_mutex_t encoder_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Steps of the (old state << 2) | new state transitions, state is (A << 1) | B.
+// A leading B counts up.  Every edge changes one pin, so the transitions
+// where both change never happen and stay 0.
+static const int encoder_steps[16] = {
+     0, -1,  1,  0,
+     1,  0,  0, -1,
+    -1,  0,  0,  1,
+     0,  1, -1,  0
+};
+
+// Velocity is taken over at least this long
+#define ENCODER_WINDOW_NS 50000000ULL
+
+static void encoder_edge(struct encoder *enc, int gpio, unsigned int level, uint64_t timestamp)
+{
+    unsigned int state;
+    int step;
+    int64_t raw;
+
+    level = level ? 1 : 0;
+    if (gpio == enc->gpio_a)
+        state = (level << 1) | (enc->state & 1);
+    else
+        state = (enc->state & 2) | level;
+
+    if (state == enc->state) {
+        // the pin is where it already was, the edge before this was missed
+        // and the direction is unknown
+        __atomic_add_fetch(&enc->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    step = encoder_steps[(enc->state << 2) | state];
+    enc->state = state;
+    raw = __atomic_add_fetch(&enc->raw, step, __ATOMIC_RELAXED);
+
+    if (enc->window_start == 0) {
+        enc->window_start = timestamp;
+        enc->window_raw = raw - step;
+    } else if (timestamp - enc->window_start >= ENCODER_WINDOW_NS) {
+        __atomic_add_fetch(&enc->seq, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        enc->velocity = 1e9 * (raw - enc->window_raw) / (timestamp - enc->window_start);
+        enc->updated = timestamp;
+        __atomic_add_fetch(&enc->seq, 1, __ATOMIC_RELEASE);
+        enc->window_start = timestamp;
+        enc->window_raw = raw;
+    }
+}
+
+static struct encoder *encoder_lookup(int gpio_a)
+{
+    struct gpio_state *st = gpio_state(gpio_a, 0);
+    struct encoder *enc;
+
+    if (st == NULL || (enc = __atomic_load_n(&st->encoder, __ATOMIC_ACQUIRE)) == NULL || enc->gpio_a != gpio_a)
+        return NULL;
+    return enc;
+}
+
+// Decodes the Gray code on gpio_a/gpio_b from their edges in the poll
+// thread, the caller enables edge detection on both pins for BOTH edges.
+// mode is ENCODER_X1, ENCODER_X2 or ENCODER_X4 counts per cycle.
+int gpio_add_encoder(int gpio_a, int gpio_b, int mode)
+{
+    struct gpio_state *sta = gpio_state(gpio_a, 1);
+    struct gpio_state *stb = gpio_state(gpio_b, 1);
+    struct encoder *enc = NULL;
+    unsigned int a = 0, b = 0;
+    int i;
+
+    if (sta == NULL || stb == NULL)
+        return -1;
+    if (gpio_a == gpio_b || (mode != ENCODER_X1 && mode != ENCODER_X2 && mode != ENCODER_X4)) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_add_encoder: invalid pins %d/%d or mode %d", gpio_a, gpio_b, mode);
+        add_error_msg(err);
+        return -1;
+    }
+
+    pthread_mutex_lock(&encoder_lock);
+    if (sta->encoder != NULL || stb->encoder != NULL) {
+        pthread_mutex_unlock(&encoder_lock);
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_add_encoder: GPIO %d or %d is already part of an encoder", gpio_a, gpio_b);
+        add_error_msg(err);
+        return -1;
+    }
+    for (i = 0; i < MAX_ENCODERS && enc == NULL; i++)
+        if (!encoders[i].in_use)
+            enc = &encoders[i];
+    if (enc == NULL) {
+        pthread_mutex_unlock(&encoder_lock);
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_add_encoder: all %d encoders are in use", MAX_ENCODERS);
+        add_error_msg(err);
+        return -1;
+    }
+
+    if (DEBUG)
+        printf(" ** gpio_add_encoder: A %d B %d x%d **\n", gpio_a, gpio_b, mode);
+
+    // where the pins are now, unreadable pins start low
+    if (gpio_get_value(gpio_a, &a) < 0 || gpio_get_value(gpio_b, &b) < 0)
+        clear_error_msg();
+
+    memset(enc, 0, sizeof(*enc));
+    enc->in_use = 1;
+    enc->mode = mode;
+    enc->gpio_a = gpio_a;
+    enc->gpio_b = gpio_b;
+    enc->state = ((a ? 1 : 0) << 1) | (b ? 1 : 0);
+    __atomic_store_n(&sta->encoder, enc, __ATOMIC_RELEASE);
+    __atomic_store_n(&stb->encoder, enc, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&encoder_lock);
+
+    return 0;
+}
+
+int gpio_remove_encoder(int gpio_a)
+{
+    struct encoder *enc;
+
+    pthread_mutex_lock(&encoder_lock);
+    if ((enc = encoder_lookup(gpio_a)) != NULL) {
+        __atomic_store_n(&gpio_state(enc->gpio_a, 0)->encoder, NULL, __ATOMIC_RELEASE);
+        __atomic_store_n(&gpio_state(enc->gpio_b, 0)->encoder, NULL, __ATOMIC_RELEASE);
+        enc->in_use = 0;
+    }
+    pthread_mutex_unlock(&encoder_lock);
+
+    return 0;
+}
+
+// Returns -1 if gpio_a is not the A pin of an encoder
+int gpio_read_encoder(int gpio_a, struct encoder_info *info)
+{
+    struct encoder *enc = encoder_lookup(gpio_a);
+    unsigned int seq;
+    double velocity;
+    uint64_t updated, now, idle;
+    int64_t counts;
+
+    memset(info, 0, sizeof(*info));
+    if (enc == NULL)
+        return -1;
+
+    do {
+        while ((seq = __atomic_load_n(&enc->seq, __ATOMIC_ACQUIRE)) & 1)
+            ;
+        velocity = enc->velocity;
+        updated = enc->updated;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (seq != __atomic_load_n(&enc->seq, __ATOMIC_RELAXED));
+
+    // without new counts the speed is below one count over the idle time
+    now = monotonic_ns();
+    if (updated != 0 && now > updated + 2 * ENCODER_WINDOW_NS) {
+        idle = now - updated;
+        if (velocity > 1e9 / idle)
+            velocity = 1e9 / idle;
+        else if (velocity < -1e9 / idle)
+            velocity = -1e9 / idle;
+    }
+
+    // x1 and x2 count every 4th or 2nd x4 step, rounding toward -infinity
+    counts = __atomic_load_n(&enc->raw, __ATOMIC_RELAXED) - __atomic_load_n(&enc->offset, __ATOMIC_RELAXED);
+    info->mode = enc->mode;
+    info->gpio_a = enc->gpio_a;
+    info->gpio_b = enc->gpio_b;
+    info->position = (counts >= 0) ? counts / (4 / enc->mode) : -((-counts + 4 / enc->mode - 1) / (4 / enc->mode));
+    info->errors = __atomic_load_n(&enc->errors, __ATOMIC_RELAXED);
+    info->velocity = velocity * enc->mode / 4;
+
+    return 0;
+}
+
+// Makes the current position read as position, the velocity carries on
+int gpio_reset_encoder(int gpio_a, int64_t position)
+{
+    struct encoder *enc = encoder_lookup(gpio_a);
+
+    if (enc == NULL)
+        return -1;
+    __atomic_store_n(&enc->offset, __atomic_load_n(&enc->raw, __ATOMIC_RELAXED) - position * (4 / enc->mode), __ATOMIC_RELAXED);
+    __atomic_store_n(&enc->errors, 0, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+// Wakes the event fd reader, once until it calls gpio_event_fd_ack() again
+static void event_fd_signal(void)
+{
+    uint64_t one = 1;
+
+    if (event_fd >= 0 && __atomic_exchange_n(&event_fd_armed, 0, __ATOMIC_ACQ_REL)) {
+        if (write(event_fd, &one, sizeof(one)) != sizeof(one) && DEBUG)
+            printf(" ** event_fd_signal: write failed (%s) **\n", strerror(errno));
+    }
+}
+
+// An eventfd that turns readable when edges are queued, so event loops can
+// take them with read_events() instead of callbacks.  It lives as long as
+// the process so a loop watching it never sees it closed under it.
+int gpio_event_fileno(void)
+{
+    int fd, expected = -1;
+
+    if (__atomic_load_n(&event_fd, __ATOMIC_ACQUIRE) >= 0)
+        return event_fd;
+
+    if ((fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_event_fileno: could not create eventfd (%s)", strerror(errno));
+        add_error_msg(err);
+        return -1;
+    }
+    if (!__atomic_compare_exchange_n(&event_fd, &expected, fd, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        close(fd);
+    gpio_event_fd_ack();
+
+    return event_fd;
+}
+
+// Clears the event fd and asks for the next wakeup.  Call it before taking
+// the queued edges, anything queued after that wakes the fd again.
+void gpio_event_fd_ack(void)
+{
+    uint64_t count;
+
+    if (event_fd < 0)
+        return;
+    if (read(event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN && DEBUG)
+        printf(" ** gpio_event_fd_ack: read failed (%s) **\n", strerror(errno));
+    __atomic_store_n(&event_fd_armed, 1, __ATOMIC_RELEASE);
+}
+
+// Hands an edge, or a coalesced run of count edges, to read_events() and callbacks
+static void deliver_edge(struct gpio_state *st, unsigned int edge, uint64_t timestamp, unsigned int level, unsigned int count)
+{
+    event_queue_push(st, edge, timestamp, level, count);
+    if (st->queue != NULL)
+        event_fd_signal();
+    __atomic_add_fetch(&st->event_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&poll_stats.events, 1, __ATOMIC_RELAXED);
+    dispatch_push(st, level, timestamp);
+}
+
+// Starts a pin timer of the poll thread, the timerfd joins its epoll set
+static int pin_timer_arm(int *fd, int *timer_epfd, struct epoll_source *src, uint64_t ns)
+{
+    struct itimerspec its;
+    struct epoll_event ev;
+
+    if (*fd < 0 && (*fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+        return -1;
+    if (*timer_epfd != epfd) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = src;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, *fd, &ev) == -1)
+            return -1;
+        *timer_epfd = epfd;
+    }
+
+    // a zero it_value would disarm the timer instead
+    if (ns == 0)
+        ns = 1;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ns / 1000000000ULL;
+    its.it_value.tv_nsec = ns % 1000000000ULL;
+    return timerfd_settime(*fd, 0, &its, NULL);
+}
+
+// Delivers the edges held back by the storm limit as one record
+static void storm_flush(struct gpio_state *st)
+{
+    if (st->storm_pending == 0)
+        return;
+    deliver_edge(st, st->storm_edge, st->storm_ts, st->storm_level, st->storm_pending);
+    st->storm_pending = 0;
+}
+
+// Stops watching a storming pin until the holdoff timer puts it back, on sysfs
+// the edge is set to none so the kernel stops taking the interrupts as well
+static void storm_disarm(struct gpio_state *st)
+{
+    unsigned int holdoff_us = __atomic_load_n(&st->storm_holdoff_us, __ATOMIC_RELAXED);
+    unsigned int edge = st->edge;
+    struct epoll_event ev;
+
+    if (st->disarmed)
+        return;
+    if (pin_timer_arm(&st->storm_fd, &st->storm_epfd, &st->storm_src, holdoff_us * 1000ULL) < 0)
+        return;  // no way back, keep coalescing instead
+    if (DEBUG)
+        printf(" ** storm_disarm: gpio %d for %u us **\n", st->gpio, holdoff_us);
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, st->fd, &ev);
+    if (!st->cdev) {
+        gpio_set_edge(st->gpio, NO_EDGE);
+        st->edge = edge;  // what to put back
+    }
+    __atomic_add_fetch(&st->disarms, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->disarmed, 1, __ATOMIC_RELEASE);
+}
+
+// Watches a disarmed pin again.  What happened meanwhile is read away, the
+// coalesced record takes the level the pin has now.
+static void storm_rearm(struct gpio_state *st)
+{
+    unsigned int edge, level;
+    uint64_t timestamp;
+    struct epoll_event ev;
+
+    __atomic_store_n(&st->disarmed, 0, __ATOMIC_RELEASE);
+    if (!st->is_evented || st->fd < 0)
+        return;
+    if (DEBUG)
+        printf(" ** storm_rearm: gpio %d **\n", st->gpio);
+
+    if (st->cdev) {
+        while (cdev_read_event(st->fd, &edge, &timestamp) > 0)
+            __atomic_add_fetch(&st->suppressed, 1, __ATOMIC_RELAXED);
+    } else if (gpio_set_edge(st->gpio, st->edge) < 0 && DEBUG) {
+        printf(" ** storm_rearm: could not set the edge of gpio %d **\n", st->gpio);
+    }
+    // sysfs: the value read clears the pending notification
+    if (gpio_get_value(st->gpio, &level) == 0 && st->storm_pending) {
+        st->storm_edge = level ? RISING_EDGE : FALLING_EDGE;
+        st->storm_ts = monotonic_ns();
+        st->storm_level = level;
+    }
+
+    ev.events = EPOLLIN | EPOLLET | EPOLLPRI;
+    ev.data.ptr = &st->src;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, st->fd, &ev) == -1 && errno != EEXIST && DEBUG)
+        printf(" ** storm_rearm: could not epoll_ctl gpio %d (%s) **\n", st->gpio, strerror(errno));
+    st->storm_window = 0;
+}
+
+// Counts an edge against the pin's storm limit.  Returns 1 when the edge is
+// held back for a coalesced record instead of being delivered.
+static int storm_limit(struct gpio_state *st, unsigned int edge, uint64_t timestamp, unsigned int level)
+{
+    unsigned int max = __atomic_load_n(&st->storm_max, __ATOMIC_ACQUIRE);
+    uint64_t interval_ns, now;
+
+    if (max == 0) {
+        // lifted while a run was held back
+        storm_flush(st);
+        return 0;
+    }
+
+    interval_ns = __atomic_load_n(&st->storm_interval_us, __ATOMIC_RELAXED) * 1000ULL;
+    if (st->storm_window == 0 || timestamp < st->storm_window || timestamp - st->storm_window >= interval_ns) {
+        storm_flush(st);
+        st->storm_window = timestamp;
+        st->storm_events = 0;
+    }
+    if (++st->storm_events <= max)
+        return 0;
+
+    if (st->storm_events == max + 1) {
+        __atomic_add_fetch(&st->storms, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&st->last_storm, timestamp, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&st->suppressed, 1, __ATOMIC_RELAXED);
+    st->storm_pending++;
+    st->storm_edge = edge;
+    st->storm_ts = timestamp;
+    st->storm_level = level;
+
+    if (__atomic_load_n(&st->storm_action, __ATOMIC_RELAXED) == STORM_DISARM) {
+        storm_disarm(st);
+    } else if (st->storm_pending == 1) {
+        // the record goes out when the interval ends, even if the pin goes quiet
+        now = monotonic_ns();
+        pin_timer_arm(&st->storm_fd, &st->storm_epfd, &st->storm_src,
+                      st->storm_window + interval_ns > now ? st->storm_window + interval_ns - now : 0);
+    }
+
+    return 1;
+}
+
+// The interval or holdoff of a storming pin is over
+static void poll_storm(struct gpio_state *st)
+{
+    uint64_t expirations;
+
+    if (read(st->storm_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;  // re-armed since it fired
+    if (!st->is_evented) {
+        // edge detection went away meanwhile
+        st->storm_pending = 0;
+        __atomic_store_n(&st->disarmed, 0, __ATOMIC_RELEASE);
+        return;
+    }
+    if (__atomic_load_n(&st->disarmed, __ATOMIC_ACQUIRE))
+        storm_rearm(st);
+    storm_flush(st);
+}
+
+// Restarts the watchdog timer if the pin is at a level it watches, stops it
+// otherwise.  Called with the pin lock held.
+static void watchdog_arm(struct gpio_state *st, unsigned int level)
+{
+    unsigned int timeout_us = __atomic_load_n(&st->wd_timeout_us, __ATOMIC_ACQUIRE);
+    int wd_level = __atomic_load_n(&st->wd_level, __ATOMIC_RELAXED);
+    struct itimerspec its;
+
+    if (timeout_us != 0 && (wd_level == WATCHDOG_ANY || (unsigned int)wd_level == level)) {
+        if (pin_timer_arm(&st->wd_fd, &st->wd_epfd, &st->wd_src, timeout_us * 1000ULL) < 0 && DEBUG)
+            printf(" ** watchdog_arm: no timer for gpio %d (%s) **\n", st->gpio, strerror(errno));
+    } else if (st->wd_fd >= 0) {
+        memset(&its, 0, sizeof(its));
+        timerfd_settime(st->wd_fd, 0, &its, NULL);
+    }
+}
+
+// Times out when the pin sees no edge for timeout_us, or with a level of 0
+// or 1 when it stays at that level for timeout_us.  A timeout is queued for
+// read_events() as a WATCHDOG_EDGE record and runs the callbacks added for
+// WATCHDOG_EDGE, once per silence unless repeat is set.  The pin needs edge
+// detection, the watchdog sees the edges it lets through.  A timeout_us of 0
+// turns the watchdog off.
+int gpio_set_watchdog(int gpio, unsigned int timeout_us, int level, int repeat)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    unsigned int value = 0;
+
+    if (level != WATCHDOG_ANY && level != 0 && level != 1) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_set_watchdog: invalid level %d for GPIO %d", level, gpio);
+        add_error_msg(err);
+        return -1;
+    }
+    if (timeout_us > 0 && (st == NULL || !st->is_evented || epfd < 0)) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_set_watchdog: GPIO %d has no edge detection", gpio);
+        add_error_msg(err);
+        return -1;
+    }
+    if (st == NULL)
+        return 0;
+    if (DEBUG)
+        printf(" ** gpio_set_watchdog: gpio %d timeout %u us level %d repeat %d **\n", gpio, timeout_us, level, repeat);
+
+    pthread_mutex_lock(&st->lock);
+    __atomic_store_n(&st->wd_timeout_us, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&st->wd_level, level, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->wd_repeat, repeat ? 1 : 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->wd_expired, 0, __ATOMIC_RELAXED);
+    if (timeout_us > 0 && level != WATCHDOG_ANY && gpio_get_value(gpio, &value) < 0) {
+        pthread_mutex_unlock(&st->lock);
+        return -1;
+    }
+    __atomic_store_n(&st->wd_timeout_us, timeout_us, __ATOMIC_RELEASE);
+    // the clock starts now, or when the pin gets to the level
+    watchdog_arm(st, value);
+    pthread_mutex_unlock(&st->lock);
+
+    return 0;
+}
+
+int gpio_get_watchdog(int gpio, struct watchdog_info *info, int reset)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+
+    memset(info, 0, sizeof(*info));
+    info->level = WATCHDOG_ANY;
+    if (st == NULL)
+        return 0;
+    info->timeout_us = __atomic_load_n(&st->wd_timeout_us, __ATOMIC_ACQUIRE);
+    info->level = __atomic_load_n(&st->wd_level, __ATOMIC_RELAXED);
+    info->repeat = __atomic_load_n(&st->wd_repeat, __ATOMIC_RELAXED);
+    info->expired = __atomic_load_n(&st->wd_expired, __ATOMIC_RELAXED);
+    if (reset)
+        info->timeouts = __atomic_exchange_n(&st->wd_timeouts, 0, __ATOMIC_RELAXED);
+    else
+        info->timeouts = __atomic_load_n(&st->wd_timeouts, __ATOMIC_RELAXED);
+    info->last_timeout = __atomic_load_n(&st->wd_last, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+// The pin is alive, the wait starts over
+static void watchdog_edge(struct gpio_state *st, unsigned int level)
+{
+    if (__atomic_load_n(&st->wd_timeout_us, __ATOMIC_RELAXED) == 0)
+        return;
+    pthread_mutex_lock(&st->lock);
+    __atomic_store_n(&st->wd_expired, 0, __ATOMIC_RELAXED);
+    watchdog_arm(st, level);
+    pthread_mutex_unlock(&st->lock);
+}
+
+// A watched pin had no edge, or stayed at its level, for the timeout
+static void poll_watchdog(struct gpio_state *st)
+{
+    uint64_t expirations, now;
+    unsigned int level;
+    int wd_level;
+
+    pthread_mutex_lock(&st->lock);
+    if (read(st->wd_fd, &expirations, sizeof(expirations)) != sizeof(expirations)
+        || __atomic_load_n(&st->wd_timeout_us, __ATOMIC_ACQUIRE) == 0 || !st->is_evented
+        || gpio_get_value(st->gpio, &level) < 0) {
+        // re-armed or turned off since it fired
+        pthread_mutex_unlock(&st->lock);
+        return;
+    }
+    wd_level = __atomic_load_n(&st->wd_level, __ATOMIC_RELAXED);
+    if (wd_level != WATCHDOG_ANY && (unsigned int)wd_level != level) {
+        // an edge that did not make it through took the pin off the level
+        pthread_mutex_unlock(&st->lock);
+        return;
+    }
+    if (__atomic_load_n(&st->disarmed, __ATOMIC_ACQUIRE)) {
+        // a storm disarmed pin is not quiet, it is not being listened to
+        watchdog_arm(st, level);
+        pthread_mutex_unlock(&st->lock);
+        return;
+    }
+    if (__atomic_load_n(&st->wd_repeat, __ATOMIC_RELAXED))
+        watchdog_arm(st, level);
+    pthread_mutex_unlock(&st->lock);
+
+    now = monotonic_ns();
+    if (DEBUG)
+        printf(" ** poll_watchdog: gpio %d timed out at level %u **\n", st->gpio, level);
+    __atomic_add_fetch(&st->wd_timeouts, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->wd_last, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->wd_expired, 1, __ATOMIC_RELAXED);
+    event_queue_push(st, WATCHDOG_EDGE, now, level, 1);
+    if (st->queue != NULL)
+        event_fd_signal();
+    dispatch_add(st, level, now, 1);
+}
+
+// An edge that made it through the filters
+static void emit_edge(struct gpio_state *st, unsigned int edge, uint64_t timestamp, unsigned int level)
+{
+    edge_tap_func tap = __atomic_load_n(&st->tap, __ATOMIC_ACQUIRE);
+    struct counter *c = __atomic_load_n(&st->counter, __ATOMIC_ACQUIRE);
+    struct measure *m = __atomic_load_n(&st->measure, __ATOMIC_ACQUIRE);
+    struct encoder *enc = __atomic_load_n(&st->encoder, __ATOMIC_ACQUIRE);
+
+    // rules first, they are the ones with a deadline
+    if (__atomic_load_n(&st->num_rules, __ATOMIC_ACQUIRE) > 0)
+        run_rules(st->gpio, edge);
+    watchdog_edge(st, level);
+
+    // the edges of a tapped pin only go to the tap
+    if (tap != NULL) {
+        tap(st->gpio, level, timestamp, st->tap_data);
+        return;
+    }
+
+    // a counter pin only counts, nothing is queued or dispatched
+    if (c != NULL && __atomic_load_n(&c->active, __ATOMIC_ACQUIRE)) {
+        counter_edge(c, timestamp);
+        return;
+    }
+
+    if (m != NULL && __atomic_load_n(&m->active, __ATOMIC_ACQUIRE))
+        measure_edge(m, edge, timestamp);
+    if (enc != NULL)
+        encoder_edge(enc, st->gpio, level, timestamp);
+
+    // the storm limit only spares the queue and the callbacks
+    if (storm_limit(st, edge, timestamp, level))
+        return;
+    deliver_edge(st, edge, timestamp, level, 1);
+}
+
+static void accept_edge(struct gpio_state *st, unsigned int edge, uint64_t timestamp, unsigned int level)
+{
+    unsigned int lockout_us = __atomic_load_n(&st->lockout_us, __ATOMIC_RELAXED);
+
+    if (lockout_us && st->last_accept && timestamp - st->last_accept < lockout_us * 1000ULL) {
+        __atomic_add_fetch(&st->bounced, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    st->last_accept = timestamp;
+    emit_edge(st, edge, timestamp, level);
+}
+
+// (Re)starts the stable time wait
+static int filter_timer_arm(struct gpio_state *st, unsigned int stable_us)
+{
+    return pin_timer_arm(&st->timer_fd, &st->timer_epfd, &st->timer_src, stable_us * 1000ULL);
+}
+
+static void filter_edge(struct gpio_state *st, unsigned int edge, uint64_t timestamp, unsigned int level)
+{
+    unsigned int stable_us = __atomic_load_n(&st->stable_us, __ATOMIC_RELAXED);
+
+    if (stable_us == 0) {
+        accept_edge(st, edge, timestamp, level);
+        return;
+    }
+
+    // the edge held back so far did not last
+    if (st->filter_pending)
+        __atomic_add_fetch(&st->glitches, 1, __ATOMIC_RELAXED);
+
+    st->filter_pending = 1;
+    st->pending_edge = edge;
+    st->pending_ts = timestamp;
+    st->pending_level = level;
+    if (filter_timer_arm(st, stable_us) < 0) {
+        // no timer, do without the glitch filter rather than lose the edge
+        st->filter_pending = 0;
+        accept_edge(st, edge, timestamp, level);
+    }
+}
+
+// The stable time after the last edge is up, let it through if the level
+// is still the one the edge left behind
+static void poll_filter(struct gpio_state *st)
+{
+    uint64_t expirations;
+    unsigned int level;
+
+    if (read(st->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;  // re-armed since it fired
+    if (!st->filter_pending)
+        return;
+    st->filter_pending = 0;
+
+    if (gpio_get_value(st->gpio, &level) < 0 || level != st->pending_level) {
+        __atomic_add_fetch(&st->glitches, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    accept_edge(st, st->pending_edge, st->pending_ts, level);
+}
+
+// Reads and dispatches whatever is pending on one ready GPIO.  Returns 0 when
+// done, -1 when the fd can no longer be read and the poll thread has to stop
+static int poll_gpio(struct gpio_state *st)
+{
+    char buf;
+    ssize_t n;
+    uint64_t timestamp;
+
+    if (st->cdev) {
+        // drain every queued line event, EPOLLET will not report them again
+        unsigned int edge;
+        uint64_t timestamp, now;
+        int n;
+        while ((n = cdev_read_event(st->fd, &edge, &timestamp)) > 0) {
+            // kernels before 5.7 stamp line events with the realtime clock
+            now = monotonic_ns();
+            if (timestamp > now || now - timestamp > 1000000000ULL)
+                timestamp = now;
+            else
+                event_hist_add(st, STAT_CAPTURE, timestamp, poll_wake_ts);
+            event_hist_add(st, STAT_READ, poll_wake_ts, now);
+            filter_edge(st, edge, timestamp, edge == RISING_EDGE);
+        }
+        return n;
+    }
 
-    if (DEBUG)
-        printf(" ** add_edge_callback **\n");
-    new_cb = malloc(sizeof(struct callback));  ASSRT(new_cb != NULL);
-
-    new_cb->fde  = open_edge_file(gpio);
-    new_cb->gpio = gpio;
-    new_cb->edge = edge;
-    new_cb->data = data;
-    new_cb->func = func;
-    new_cb->next = NULL;
-
-    if (callbacks == NULL) {
-        // start new list
-        callbacks = new_cb;
+    // the fd is shared with gpio_get_value() callers, so is its offset
+    pthread_mutex_lock(&st->lock);
+    lseek(st->fd, 0, SEEK_SET);
+    n = read(st->fd, &buf, 1);
+    pthread_mutex_unlock(&st->lock);
+    if (n != 1)
+        return -1;
+    timestamp = monotonic_ns();
+    // sysfs has no edge time, the value read is as close as it gets
+    event_hist_add(st, STAT_READ, poll_wake_ts, timestamp);
+    // The return value represents the ending level after the edge.
+    if (st->initial) {     // ignore first epoll trigger
+        st->initial = 0;
     } else {
-        // add to end of list
-        while (cb->next != NULL)
-            cb = cb->next;
-        cb->next = new_cb;
+        filter_edge(st, buf == '1' ? RISING_EDGE : FALLING_EDGE, timestamp, buf == '1');
     }
+
     return 0;
 }
 
-void run_callbacks(int gpio)
+// Applies poll_config to the poll thread, poll_config_lock held.  Returns -1
+// when the system refused a setting, with an error message for each one
+// when report is set.
+static int poll_thread_apply(pthread_t tid, int report)
 {
-    struct callback *cb = callbacks;
-    while (cb != NULL)
-    {
-        if (cb->gpio == gpio)
-        {
-            int canrun = 0;
-            unsigned int value = 0;
-            gpio_get_value(gpio, &value);
-            // Both Edge
-            if (cb->edge == 3)
-            {
-                canrun = 1;
-            }
-            // Rising Edge
-            else if ((cb->edge == 1) && (value == 1))
-            {
-                canrun = 1;
-            }
-            // Falling Edge
-            else if ((cb->edge == 2) && (value == 0))
-            {
-                canrun = 1;
-            }
-            // Only run if we are allowed
-            if (canrun)
-            {
-                if (DEBUG)
-                    printf(" ** run_callbacks: gpio triggered: %d **\n", gpio);
-                cb->func(cb->gpio, cb->data);
-            }
+    struct sched_param param;
+    cpu_set_t cpus;
+    char err[256];
+    int ret = 0;
+    int e, cpu;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = poll_config.priority;
+    if ((e = pthread_setschedparam(tid, poll_config.policy, &param)) != 0) {
+        snprintf(err, sizeof(err), "poll thread: could not set policy %d priority %d (%s)", poll_config.policy, poll_config.priority, strerror(e));
+        if (report)
+            add_error_msg(err);
+        ret = -1;
+    }
 
-        }
-        cb = cb->next;
+    CPU_ZERO(&cpus);
+    if (poll_config.cpu >= 0)
+        CPU_SET(poll_config.cpu, &cpus);
+    else
+        for (cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF) && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &cpus);
+    if ((e = pthread_setaffinity_np(tid, sizeof(cpus), &cpus)) != 0) {
+        snprintf(err, sizeof(err), "poll thread: could not pin to CPU %d (%s)", poll_config.cpu, strerror(e));
+        if (report)
+            add_error_msg(err);
+        ret = -1;
+    }
+
+    if (poll_config.name[0] != '\0' && (e = pthread_setname_np(tid, poll_config.name)) != 0) {
+        snprintf(err, sizeof(err), "poll thread: could not name it '%s' (%s)", poll_config.name, strerror(e));
+        if (report)
+            add_error_msg(err);
+        ret = -1;
     }
+
+    if (ret < 0 && DEBUG)
+        printf(" ** poll_thread_apply: %s **\n", err);
+    return ret;
 }
 
-void remove_callbacks(int gpio)
+// Sets how the poll thread is scheduled, before or after it started.  Memory
+// locking is for the whole process: mlockall() faults in everything mapped
+// now and keeps later mappings resident, so the poll thread does not take
+// page faults on its stack or the event queues.
+// return values:
+// 0 - Success, every setting is in effect
+// 1 - Saved, the poll thread takes the settings when add_edge_detect() starts it
+// 2 - The system refused a setting, the error message says which
+// -1 - Invalid settings
+int gpio_set_poll_thread(const struct poll_thread_info *want)
 {
-    struct callback *cb = callbacks;
-    struct callback *temp;
-    struct callback *prev = NULL;
+    int min, max;
+    int ret;
 
-    while (cb != NULL)
-    {
-        if (cb->gpio == gpio)
-        {
-            if (DEBUG)
-                printf(" ** remove_callbacks: gpio: %d **\n", gpio);
-            close(cb->fde);
-            if (prev == NULL)
-                callbacks = cb->next;
-            else
-                prev->next = cb->next;
-            temp = cb;
-            cb = cb->next;
-            free(temp);
+    if ((want->policy != SCHED_OTHER && want->policy != SCHED_FIFO && want->policy != SCHED_RR)
+        || (min = sched_get_priority_min(want->policy)) < 0 || (max = sched_get_priority_max(want->policy)) < 0
+        || want->priority < min || want->priority > max) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_set_poll_thread: invalid policy %d priority %d", want->policy, want->priority);
+        add_error_msg(err);
+        return -1;
+    }
+    if (want->cpu < -1 || want->cpu >= CPU_SETSIZE || want->cpu >= sysconf(_SC_NPROCESSORS_CONF)) {
+        char err[256];
+        snprintf(err, sizeof(err), "gpio_set_poll_thread: there is no CPU %d", want->cpu);
+        add_error_msg(err);
+        return -1;
+    }
+    if (DEBUG)
+        printf(" ** gpio_set_poll_thread: policy %d priority %d cpu %d lock %d name '%s' **\n",
+               want->policy, want->priority, want->cpu, want->lock_memory, want->name);
+
+    pthread_mutex_lock(&poll_config_lock);
+    poll_config.policy = want->policy;
+    poll_config.priority = want->priority;
+    poll_config.cpu = want->cpu;
+    poll_config.lock_memory = want->lock_memory;
+    if (want->name[0] != '\0')
+        snprintf(poll_config.name, sizeof(poll_config.name), "%s", want->name);
+    poll_config_set = 1;
+
+    ret = poll_tid_valid ? 0 : 1;
+    if (want->lock_memory && !memory_locked) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+            memory_locked = 1;
         } else {
-            prev = cb;
-            cb = cb->next;
+            char err[256];
+            snprintf(err, sizeof(err), "gpio_set_poll_thread: could not lock memory (%s)", strerror(errno));
+            add_error_msg(err);
+            ret = 2;
         }
+    } else if (!want->lock_memory && memory_locked) {
+        munlockall();
+        memory_locked = 0;
     }
+    if (poll_tid_valid && poll_thread_apply(poll_tid, 1) < 0)
+        ret = 2;
+    pthread_mutex_unlock(&poll_config_lock);
+
+    return ret;
 }
 
-void set_initial_false(int gpio)
+// What is in effect, read back from the poll thread while it runs and the
+// saved settings otherwise
+int gpio_get_poll_thread(struct poll_thread_info *info)
 {
-    struct fdx *f = fd_list;
-
-    while (f != NULL)
-    {
-        if (f->gpio == gpio)
-            f->initial = 0;
-        f = f->next;
+    struct sched_param param;
+    cpu_set_t cpus;
+    int cpu;
+
+    pthread_mutex_lock(&poll_config_lock);
+    *info = poll_config;
+    info->lock_memory = memory_locked;
+    info->running = poll_tid_valid;
+    if (poll_tid_valid) {
+        if (pthread_getschedparam(poll_tid, &info->policy, &param) == 0)
+            info->priority = param.sched_priority;
+        info->cpu = -1;
+        if (pthread_getaffinity_np(poll_tid, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) == 1)
+            for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                if (CPU_ISSET(cpu, &cpus))
+                    info->cpu = cpu;
+        if (pthread_getname_np(poll_tid, info->name, sizeof(info->name)) != 0)
+            info->name[0] = '\0';
     }
+    pthread_mutex_unlock(&poll_config_lock);
+
+    return 0;
 }
 
-int gpio_initial(int gpio)
+static void poll_thread_exit(void)
 {
-    struct fdx *f = fd_list;
-
-    while (f != NULL)
-    {
-        if ((f->gpio == gpio) && f->initial)
-            return 1;
-        f = f->next;
+    // a thread left behind by event_cleanup() must not stop its successor
+    pthread_mutex_lock(&poll_config_lock);
+    if (poll_tid_valid && pthread_equal(poll_tid, pthread_self())) {
+        poll_tid_valid = 0;
+        thread_running = 0;
     }
-    return 0;
+    pthread_mutex_unlock(&poll_config_lock);
+    pthread_exit(NULL);
 }
 
 void *poll_thread(void *threadarg)
 {
-    struct epoll_event events;
-    char buf;
-    int gpio;
-    int n;
+    struct epoll_event events[POLL_MAX_EVENTS];
+    struct epoll_source *src;
+    int i, n;
+
+    // settings given before add_edge_detect() started the thread
+    pthread_mutex_lock(&poll_config_lock);
+    if (poll_config_set)
+        poll_thread_apply(pthread_self(), 0);
+    pthread_mutex_unlock(&poll_config_lock);
 
-    thread_running = 1;
     while (thread_running)
     {
-        if ((n = epoll_wait(epfd, &events, 1, -1)) == -1)
+        // everything that is ready is handled before sleeping again
+        if ((n = epoll_wait(epfd, events, POLL_MAX_EVENTS, -1)) == -1)
         {
-            thread_running = 0;
-            pthread_exit(NULL);
+            if (errno == EINTR)
+                continue;
+            poll_thread_exit();
         }
-        if (n > 0) {
-            lseek(events.data.fd, 0, SEEK_SET);
-            if (read(events.data.fd, &buf, 1) != 1)
-            {
-                thread_running = 0;
-                pthread_exit(NULL);
-            }
-            // The return value represents the ending level after the edge.
-            gpio = gpio_lookup(events.data.fd);
-            if (gpio_initial(gpio)) {     // ignore first epoll trigger
-                set_initial_false(gpio);
-            } else {
-                dyn_int_array_set(&event_occurred, gpio, 1, 0);
-                run_callbacks(gpio);
+
+        poll_wake_ts = event_stats_enabled ? monotonic_ns() : 0;
+        __atomic_add_fetch(&poll_stats.wakeups, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&poll_stats.last_batch, n, __ATOMIC_RELAXED);
+        if ((unsigned int)n > __atomic_load_n(&poll_stats.max_batch, __ATOMIC_RELAXED))
+            __atomic_store_n(&poll_stats.max_batch, n, __ATOMIC_RELAXED);
+
+        for (i = 0; i < n; i++) {
+            src = events[i].data.ptr;
+            if (src->type == EPOLL_SRC_FILTER) {
+                poll_filter(gpio_state(src->gpio, 0));
+            } else if (src->type == EPOLL_SRC_RULE) {
+                poll_rule(src->gpio);
+            } else if (src->type == EPOLL_SRC_STORM) {
+                poll_storm(gpio_state(src->gpio, 0));
+            } else if (src->type == EPOLL_SRC_WATCHDOG) {
+                poll_watchdog(gpio_state(src->gpio, 0));
+            } else if (poll_gpio(gpio_state(src->gpio, 0)) < 0) {
+                poll_thread_exit();
             }
         }
     }
-    thread_running = 0;
-    pthread_exit(NULL);
+    poll_thread_exit();
+    return NULL;
 }
 
-int gpio_is_evented(int gpio)
+// Copies the poll thread counters, zeroing them afterwards when reset is set
+void gpio_get_poll_stats(struct poll_stats *stats, int reset)
 {
-    struct fdx *f = fd_list;
-    while (f != NULL)
-    {
-        if (f->gpio == gpio)
-            return 1;
-        f = f->next;
+    stats->wakeups = __atomic_load_n(&poll_stats.wakeups, __ATOMIC_RELAXED);
+    stats->events = __atomic_load_n(&poll_stats.events, __ATOMIC_RELAXED);
+    stats->last_batch = __atomic_load_n(&poll_stats.last_batch, __ATOMIC_RELAXED);
+    stats->max_batch = __atomic_load_n(&poll_stats.max_batch, __ATOMIC_RELAXED);
+    if (reset) {
+        __atomic_store_n(&poll_stats.wakeups, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&poll_stats.events, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&poll_stats.last_batch, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&poll_stats.max_batch, 0, __ATOMIC_RELAXED);
     }
-    return 0;
+}
+
+int gpio_is_evented(int gpio)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    return (st != NULL && st->is_evented);
 }
 
 int gpio_event_add(int gpio)
 {
-    struct fdx *f = fd_list;
-    while (f != NULL)
-    {
-        if (f->gpio == gpio)
-        {
-            if (f->is_evented)
-                return 1;
+    struct gpio_state *st = gpio_state(gpio, 1);
+    int ret = 1;
 
-            f->is_evented = 1;
-            return 0;
-        }
-        f = f->next;
+    if (st == NULL)
+        return 1;
+    pthread_mutex_lock(&edge_detect_lock);
+    if (!st->is_evented) {
+        st->is_evented = 1;
+        ret = 0;
     }
-    return 0;
+    pthread_mutex_unlock(&edge_detect_lock);
+
+    return ret;
 }
 
 int gpio_event_remove(int gpio)
 {
-    struct fdx *f = fd_list;
-    while (f != NULL)
-    {
-        if (f->gpio == gpio)
-        {
-            f->is_evented = 0;
-            return 0;
-        }
-        f = f->next;
-    }
+    struct gpio_state *st = gpio_state(gpio, 0);
+
+    pthread_mutex_lock(&edge_detect_lock);
+    if (st != NULL)
+        st->is_evented = 0;
+    pthread_mutex_unlock(&edge_detect_lock);
+
     return 0;
 }
 
-// add_edge_detect assumes the caller has ensured the GPIO is already exported.
-int add_edge_detect(int gpio, unsigned int edge)
-// return values:
-// 0 - Success
-// 1 - Edge detection already added
-// 2 - Other error
+static int add_edge_detect_locked(int gpio, unsigned int edge)
 {
-    int fd = fd_lookup(gpio);
-    pthread_t threads;
+    int fd, e;
+    pthread_t dispatch_tid;
     struct epoll_event ev;
-    long t = 0;
+    struct gpio_state *st;
 
     if (DEBUG)
         printf(" ** add_edge_detect: gpio: %d **\n", gpio);
@@ -937,7 +3599,9 @@ int add_edge_detect(int gpio, unsigned int edge)
         return 2;
     }
 
-    if (!fd)
+    // looked up after the edge is set as the chardev swaps in a line event fd
+    fd = fd_lookup(gpio);
+    if (fd < 0)
     {
         if ((fd = open_value_file(gpio)) == -1) {
             char err[256];
@@ -955,9 +3619,11 @@ int add_edge_detect(int gpio, unsigned int edge)
         return 2;
     }
 
-    // add to epoll fd
+    // add to epoll fd, the poll thread gets straight back to the state
+    st = gpio_state(gpio, 0);
+    event_queue_create(st);
     ev.events = EPOLLIN | EPOLLET | EPOLLPRI;
-    ev.data.fd = fd;
+    ev.data.ptr = &st->src;
     if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
         char err[256];
         snprintf(err, sizeof(err), "add_edge_detect: could not epoll_ctl GPIO %d (%s)", gpio, strerror(errno));
@@ -965,22 +3631,62 @@ int add_edge_detect(int gpio, unsigned int edge)
         return 2;
     }
 
-    // start poll thread if it is not already running
+    // callbacks run on their own thread so a slow one cannot hold up the poll thread
+    if (!dispatch_running)
+    {
+        dispatch_running = 1;
+        if ((e = pthread_create(&dispatch_tid, NULL, dispatch_thread, NULL)) != 0) {
+            char err[256];
+            dispatch_running = 0;
+            snprintf(err, sizeof(err), "add_edge_detect: could not start the dispatch thread (%s)", strerror(e));
+            add_error_msg(err);
+            return 2;
+        }
+        pthread_detach(dispatch_tid);
+    }
+
+    // start poll thread if it is not already running, its id is kept for
+    // gpio_set_poll_thread()
+    pthread_mutex_lock(&poll_config_lock);
     if (!thread_running)
     {
-        if (pthread_create(&threads, NULL, poll_thread, (void *)t) != 0) {
+        if ((e = pthread_create(&poll_tid, NULL, poll_thread, NULL)) != 0) {
             char err[256];
-            snprintf(err, sizeof(err), "add_edge_detect: could not pthread_create GPIO %d (%s)", gpio, strerror(errno));
+            pthread_mutex_unlock(&poll_config_lock);
+            snprintf(err, sizeof(err), "add_edge_detect: could not pthread_create GPIO %d (%s)", gpio, strerror(e));
             add_error_msg(err);
             return 2;
         }
+        pthread_detach(poll_tid);
+        poll_tid_valid = 1;
+        thread_running = 1;
     }
+    pthread_mutex_unlock(&poll_config_lock);
 
     return 0;
+}
+
+// add_edge_detect assumes the caller has ensured the GPIO is already exported.
+int add_edge_detect(int gpio, unsigned int edge)
+// return values:
+// 0 - Success
+// 1 - Edge detection already added
+// 2 - Other error
+{
+    int ret;
+
+    pthread_mutex_lock(&edge_detect_lock);
+    ret = add_edge_detect_locked(gpio, edge);
+    // a failed add leaves the pin free for the next try
+    if (ret == 2)
+        gpio_event_remove(gpio);
+    pthread_mutex_unlock(&edge_detect_lock);
+
+    return ret;
 }  /* add_edge_detect */
 
 
-void remove_edge_detect(int gpio)
+static void remove_edge_detect_locked(int gpio)
 {
     struct epoll_event ev;
     int fd = fd_lookup(gpio);
@@ -1000,122 +3706,1022 @@ void remove_edge_detect(int gpio)
     // unexport gpio
     gpio_event_remove(gpio);
 
-    // clear detected flag
-    dyn_int_array_set(&event_occurred, gpio, 0, 0);
+    gpio_stop_measure(gpio);
+    gpio_stop_counter(gpio);
+    gpio_set_edge_tap(gpio, NULL, NULL);
+    gpio_set_watchdog(gpio, 0, WATCHDOG_ANY, 0);
+
+    // clear detected flag and anything not read yet
+    event_detected(gpio);
+    if (gpio_state(gpio, 0) != NULL)
+        event_queue_clear(gpio_state(gpio, 0)->queue);
+}
+
+void remove_edge_detect(int gpio)
+{
+    pthread_mutex_lock(&edge_detect_lock);
+    remove_edge_detect_locked(gpio);
+    pthread_mutex_unlock(&edge_detect_lock);
 }
 
 
 int event_detected(int gpio)
 {
-    if (dyn_int_array_get(&event_occurred, gpio, 0)) {
-        dyn_int_array_set(&event_occurred, gpio, 0, 0);
-        return 1;
-    } else {
+    struct gpio_state *st = gpio_state(gpio, 0);
+
+    if (st == NULL)
         return 0;
-    }
+    return __atomic_exchange_n(&st->event_count, 0, __ATOMIC_ACQ_REL) != 0;
+}
+
+// Closes a thread's wait set, pins registered in it are registered again on
+// their next wait
+static void wait_set_close(int fd)
+{
+    struct gpio_state *st;
+    int gpio;
+
+    close(fd);
+    for (gpio = 0; gpio <= gpio_state_top; gpio++)
+        if ((st = gpio_state(gpio, 0)) != NULL && st->wait_epfd == fd)
+            st->wait_epfd = -1;
+}
+
+// The key holds the wait set fd + 1, NULL once it is closed
+static void wait_set_destroy(void *data)
+{
+    wait_set_close((int)(intptr_t)data - 1);
+}
+
+static void wait_set_key_create(void)
+{
+    pthread_key_create(&wait_epfd_key, wait_set_destroy);
 }
 
 void event_cleanup(void)
 {
+    int i;
+
+    pthread_mutex_lock(&edge_detect_lock);
     close(epfd);
+    epfd = -1;
+    pthread_mutex_lock(&poll_config_lock);
     thread_running = 0;
+    poll_tid_valid = 0;
+    pthread_mutex_unlock(&poll_config_lock);
+
+    for (i = 0; i < MAX_ENCODERS; i++)
+        if (encoders[i].in_use)
+            gpio_remove_encoder(encoders[i].gpio_a);
+    for (i = 0; i < MAX_RULES; i++)
+        gpio_remove_rule(i);
+
+    if (wait_epfd != -1) {
+        pthread_setspecific(wait_epfd_key, NULL);
+        wait_set_close(wait_epfd);
+        wait_epfd = -1;
+    }
+
+    pthread_mutex_lock(&dispatch_lock);
+    dispatch_running = 0;
+    dispatch_head = dispatch_tail = 0;
+    pthread_cond_broadcast(&dispatch_cond);
+    pthread_mutex_unlock(&dispatch_lock);
+
     exports_cleanup();
+    cdev_cleanup();
+    pthread_mutex_unlock(&edge_detect_lock);
 }
 
-// blocking_wait_for_edge assumes the caller has ensured the GPIO is already exported.
-int blocking_wait_for_edge(int gpio, unsigned int edge)
-// standalone from all the event functions above
+// Reads away whatever made a pin's fd ready so the next wait only sees new edges
+static void wait_clear(struct gpio_state *st)
 {
-    int fd = fd_lookup(gpio);
-    int epfd, n, i;
-    struct epoll_event events, ev;
     char buf;
+    unsigned int edge;
+    uint64_t timestamp;
 
-    if (DEBUG)
-        printf(" ** blocking_wait_for_edge: gpio: %d **\n", gpio);
-
-    if ((epfd = epoll_create(1)) == -1) {
-        char err[256];
-        snprintf(err, sizeof(err), "blocking_wait_for_edge: could not epoll_create GPIO %d (%s)", gpio, strerror(errno));
-        add_error_msg(err);
-        return 1;
+    if (st->cdev) {
+        while (cdev_read_event(st->fd, &edge, &timestamp) > 0)
+            ;
+        return;
     }
+    lseek(st->fd, 0, SEEK_SET);
+    if (read(st->fd, &buf, 1) != 1)
+        return;
+}
 
-    // check to see if this gpio has been added already, if not, mark as added
-    if (gpio_event_add(gpio) != 0) {
-        char err[256];
-        snprintf(err, sizeof(err), "blocking_wait_for_edge: could not add event for GPIO %d", gpio);
-        add_error_msg(err);
-        return 2;
-    }
+// Puts gpio in this thread's wait set, the edge, value fd and epoll
+// registration are kept for the next wait on the same pin
+static int wait_arm(int gpio, unsigned int edge)
+{
+    struct gpio_state *st = gpio_state(gpio, 0);
+    struct epoll_event ev;
+    int fd;
 
-    // export /sys/class/gpio interface
-    gpio_set_direction(gpio, 0); // 0=input
-    gpio_set_edge(gpio, edge);
+    if (st->edge != edge && gpio_set_edge(gpio, edge) < 0)
+        return 3;
 
-    if (!fd)
-    {
+    if ((fd = st->fd) < 0) {
         if ((fd = open_value_file(gpio)) == -1) {
             char err[256];
-            snprintf(err, sizeof(err), "blocking_wait_for_edge: could not open GPIO %d value file", gpio);
+            snprintf(err, sizeof(err), "blocking_wait_for_edges: could not open GPIO %d value file", gpio);
             add_error_msg(err);
             return 3;
         }
+        add_fd_list(gpio, fd);
     }
 
-    // add to epoll fd
-    ev.events = EPOLLIN | EPOLLET | EPOLLPRI;
-    ev.data.fd = fd;
-    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
-    {
-        char err[256];
-        snprintf(err, sizeof(err), "blocking_wait_for_edge: could not epoll_ctl GPIO %d (%s)", gpio, strerror(errno));
-        add_error_msg(err);
-        gpio_event_remove(gpio);
-        return 4;
+    if (st->wait_epfd != wait_epfd || st->wait_fd != fd) {
+        ev.events = EPOLLIN | EPOLLET | EPOLLPRI;
+        ev.data.ptr = &st->src;
+        if (epoll_ctl(wait_epfd, EPOLL_CTL_ADD, fd, &ev) == -1 && errno != EEXIST) {
+            char err[256];
+            snprintf(err, sizeof(err), "blocking_wait_for_edges: could not epoll_ctl GPIO %d (%s)", gpio, strerror(errno));
+            add_error_msg(err);
+            return 4;
+        }
+        st->wait_epfd = wait_epfd;
+        st->wait_fd = fd;
     }
 
-    // epoll for event
-    for (i = 0; i<2; i++)  // first time triggers with current state, so ignore
-    {
-       if ((n = epoll_wait(epfd, &events, 1, -1)) == -1)
-       {
-           gpio_event_remove(gpio);
-           return 5;
-       }
-    }
+    return 0;
+}
 
-    if (n > 0)
-    {
-        if (lseek(events.data.fd, 0, SEEK_SET) < 0)
-        {
+static int wait_requested(const int *gpios, int count, int gpio)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        if (gpios[i] == gpio)
+            return 1;
+    return 0;
+}
+
+// blocking_wait_for_edges assumes the caller has ensured the GPIOs are already exported.
+// Waits up to timeout_ms (-1 forever) for an edge on any of gpios, *fired is
+// the gpio that saw it or -1 on timeout
+// return values:
+// 0 - Success, edge or timeout
+// 1 - Could not create the wait epoll set
+// 2 - Edge detection already enabled on one of the GPIOs
+// 3 - Could not set the edge or open the value file
+// 4 - Could not add the GPIO to the wait set
+// 5 - epoll_wait failed
+int blocking_wait_for_edges(const int *gpios, int count, unsigned int edge, int timeout_ms, int *fired)
+{
+    struct epoll_event events[POLL_MAX_EVENTS];
+    struct epoll_source *src;
+    uint64_t deadline = 0, now;
+    int i, n, wait_ms, result = 0;
+
+    *fired = -1;
+
+    if (DEBUG)
+        printf(" ** blocking_wait_for_edges: %d gpios, first %d **\n", count, gpios[0]);
+
+    if (wait_epfd == -1) {
+        if ((wait_epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
             char err[256];
-            snprintf(err, sizeof(err), "blocking_wait_for_edge: could not seek GPIO %d (%s)", gpio, strerror(errno));
+            snprintf(err, sizeof(err), "blocking_wait_for_edges: could not epoll_create (%s)", strerror(errno));
             add_error_msg(err);
-            return 6;
+            return 1;
         }
-        if (read(events.data.fd, &buf, sizeof(buf)) != 1)
-        {
+        pthread_once(&wait_epfd_once, wait_set_key_create);
+        pthread_setspecific(wait_epfd_key, (void *)(intptr_t)(wait_epfd + 1));
+    }
+
+    // mark the pins as evented for the wait so add_event_detect() cannot take them
+    for (i = 0; i < count; i++) {
+        if (gpio_event_add(gpios[i]) != 0) {
             char err[256];
-            snprintf(err, sizeof(err), "blocking_wait_for_edge: could not read GPIO %d (%s)", gpio, strerror(errno));
+            snprintf(err, sizeof(err), "blocking_wait_for_edges: could not add event for GPIO %d", gpios[i]);
             add_error_msg(err);
-            gpio_event_remove(gpio);
-            return 6;
+            count = i;
+            result = 2;
+            goto done;
         }
-        if (events.data.fd != fd)
-        {
+        if ((result = wait_arm(gpios[i], edge)) != 0) {
+            count = i + 1;
+            goto done;
+        }
+        wait_clear(gpio_state(gpios[i], 0));
+    }
+
+    // edges from before this call (and the sysfs trigger on arming) are stale
+    do {
+        n = epoll_wait(wait_epfd, events, POLL_MAX_EVENTS, 0);
+        for (i = 0; i < n; i++) {
+            src = events[i].data.ptr;
+            if (wait_requested(gpios, count, src->gpio))
+                wait_clear(gpio_state(src->gpio, 0));
+        }
+    } while (n == POLL_MAX_EVENTS || (n < 0 && errno == EINTR));
+
+    if (timeout_ms >= 0)
+        deadline = monotonic_ns() + (uint64_t)timeout_ms * 1000000ULL;
+
+    while (*fired < 0) {
+        wait_ms = -1;
+        if (timeout_ms >= 0) {
+            now = monotonic_ns();
+            if (now >= deadline && timeout_ms > 0)
+                break;
+            wait_ms = (now >= deadline) ? 0 : (int)((deadline - now + 999999ULL) / 1000000ULL);
+        }
+
+        n = epoll_wait(wait_epfd, events, POLL_MAX_EVENTS, wait_ms);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
             char err[256];
-            snprintf(err, sizeof(err), "blocking_wait_for_edge: events.data.fd (%d) not equal to fd (%d) for GPIO %d", events.data.fd, fd, gpio);
+            snprintf(err, sizeof(err), "blocking_wait_for_edges: epoll_wait failed (%s)", strerror(errno));
             add_error_msg(err);
-            gpio_event_remove(gpio);
-            return 7;
+            result = 5;
+            break;
+        }
+
+        // pins armed by earlier waits stay in the set, skip their edges
+        for (i = 0; i < n; i++) {
+            src = events[i].data.ptr;
+            if (!wait_requested(gpios, count, src->gpio))
+                continue;
+            wait_clear(gpio_state(src->gpio, 0));
+            if (*fired < 0)
+                *fired = src->gpio;
         }
+
+        if (n == 0 && wait_ms == 0)
+            break;
     }
 
     if (DEBUG)
-        printf(" ** blocking_wait_for_edge: gpio triggered: %d **\n", gpio);
+        printf(" ** blocking_wait_for_edges: gpio triggered: %d **\n", *fired);
 
-    gpio_event_remove(gpio);
+done:
+    for (i = 0; i < count; i++)
+        gpio_event_remove(gpios[i]);
+    return result;
+}
+
+int blocking_wait_for_edge(int gpio, unsigned int edge)
+{
+    int fired;
+
+    return blocking_wait_for_edges(&gpio, 1, edge, -1, &fired);
+}
+
+// Internal unit tests for the PIO register paths, run against an anonymous
+// buffer instead of /dev/mem
+int pio_selftest(void)
+{
+    uint8_t *saved_memmap = memmap;
+    int saved_mode = pio_mode;
+    unsigned int value;
+    volatile uint32_t *dat, *cfg0;
+    int bus[3] = { 139, 132, 135 };
+    int gpios[8];
+    int i, id;
+    int saved_epfd = epfd;
+    struct rule_spec spec;
+    struct epoll_event ev;
+
+    ASSRT(0 == map_pio_anonymous());
+    ASSRT(0 == gpio_set_pio_mode(1));
+
+    // CSID0..CSID7 are PE4..PE11
+    for (i = 132; i <= 139; i++)
+        gpio_set_pio_capable(i, 1);
+    dat = pio_register(4, PIO_DAT_OFFSET);
+    cfg0 = pio_register(4, PIO_CFG_OFFSET);
+
+    printf("Testing PIO data register writes\n");
+    *dat = 0xA0000005;
+    ASSRT(0 == gpio_set_value(132, 1));  ASSRT(0xA0000015 == *dat);
+    ASSRT(0 == gpio_set_value(139, 1));  ASSRT(0xA0000815 == *dat);
+    ASSRT(0 == gpio_set_value(132, 0));  ASSRT(0xA0000805 == *dat);
+    ASSRT(0 == gpio_get_value(139, &value));  ASSRT(1 == value);
+    ASSRT(0 == gpio_get_value(132, &value));  ASSRT(0 == value);
+    ASSRT(0xA0000805 == *dat);  /* reads must not modify */
+
+    printf("Testing PIO bus reads\n");
+    *dat = 0x00000A50;  /* PE4..PE11 = 0xA5 */
+    ASSRT(0 == gpio_get_more(132, 8, &value));  ASSRT(0xA5 == value);
+    ASSRT(0 == gpio_get_bus(bus, 3, &value));  ASSRT(0x3 == value);
+    ASSRT(-1 == gpio_get_bus(bus, 0, &value));
+    *dat = 0xA0000805;
+
+    printf("Testing PIO bus writes\n");
+    *dat = 0xA0000005;
+    ASSRT(0 == gpio_set_bus(bus, 3, 0x5, 0x7));  ASSRT(0xA0000885 == *dat);
+    ASSRT(0 == gpio_set_bus(bus, 3, 0x2, 0x3));  ASSRT(0xA0000095 == *dat);
+    for (i = 0; i < 8; i++)
+        gpios[i] = 132 + i;
+    ASSRT(0 == gpio_set_bus(gpios, 8, 0x5A, 0xFF));  ASSRT(0xA00005A5 == *dat);
+    ASSRT(-1 == gpio_set_bus(gpios, 33, 0, 0xFF));
+    *dat = 0xA0000805;
+
+    printf("Testing PIO config register direction\n");
+    *cfg0 = 0x77777777;
+    ASSRT(0 == gpio_set_direction(132, OUTPUT));  ASSRT(0x77717777 == *cfg0);
+    ASSRT(0 == gpio_get_direction(132, &value));  ASSRT(OUTPUT == value);
+    ASSRT(0 == gpio_set_direction(132, INPUT));  ASSRT(0x77707777 == *cfg0);
+    ASSRT(0 == gpio_get_direction(132, &value));  ASSRT(INPUT == value);
+    ASSRT(0 == gpio_set_direction(139, OUTPUT));  ASSRT(0x00001000 == *pio_register(4, PIO_CFG_OFFSET + 4));
+    ASSRT(0x77707777 == *cfg0);
+
+    printf("Testing PIO pull register\n");
+    ASSRT(0 == gpio_set_pud(4, 4, PUD_UP));  ASSRT(PUD_UP == gpio_get_pud(4, 4));
+    ASSRT((PUD_UP << 8) == *pio_register(4, PIO_PUL_OFFSET));
+    ASSRT(0xA0000805 == *dat);
+
+    printf("Testing edge rules on a PIO output\n");
+    memset(&spec, 0, sizeof(spec));
+    spec.gpio_in = GPIO_STATE_MAX - 1;
+    spec.edge = RISING_EDGE;
+    spec.gpio_out = 132;
+    spec.action = RULE_SET;
+    ASSRT(-1 == gpio_add_rule(&spec));  /* no edge detection on the input */
+    ASSRT(0 == gpio_event_add(spec.gpio_in));
+    epfd = epoll_create1(EPOLL_CLOEXEC);  ASSRT(epfd >= 0);
+    spec.action = RULE_SPWM_STOP + 1;
+    ASSRT(-1 == gpio_add_rule(&spec));
+    spec.action = RULE_SET;
+    *dat = 0;
+    id = gpio_add_rule(&spec);  ASSRT(id >= 0);
+    run_rules(spec.gpio_in, FALLING_EDGE);  ASSRT(0 == *dat);
+    run_rules(spec.gpio_in, RISING_EDGE);  ASSRT(0x10 == *dat);
+    ASSRT(1 == gpio_rule_fired(id));
+    ASSRT(0 == gpio_remove_rule(id));  ASSRT(-1 == gpio_remove_rule(id));
+    ASSRT(0 == gpio_rule_fired(id));
+    spec.edge = BOTH_EDGE;
+    spec.action = RULE_TOGGLE;
+    id = gpio_add_rule(&spec);  ASSRT(id >= 0);
+    run_rules(spec.gpio_in, FALLING_EDGE);  ASSRT(0 == *dat);
+    run_rules(spec.gpio_in, RISING_EDGE);  ASSRT(0x10 == *dat);
+    ASSRT(0 == gpio_remove_rule(id));
+    spec.action = RULE_PULSE;
+    spec.value = LOW;
+    ASSRT(-1 == gpio_add_rule(&spec));  /* no length */
+    spec.pulse_us = 2000;
+    id = gpio_add_rule(&spec);  ASSRT(id >= 0);
+    run_rules(spec.gpio_in, RISING_EDGE);  ASSRT(0 == *dat);
+    ASSRT(1 == epoll_wait(epfd, &ev, 1, 1000));
+    ASSRT(EPOLL_SRC_RULE == ((struct epoll_source *)ev.data.ptr)->type);
+    poll_rule(((struct epoll_source *)ev.data.ptr)->gpio);  ASSRT(0x10 == *dat);
+    run_rules(spec.gpio_in, RISING_EDGE);  ASSRT(0 == *dat);
+    ASSRT(0 == gpio_remove_rule(id));  ASSRT(0x10 == *dat);  /* removing ends the pulse */
+    ASSRT(0 == gpio_state(spec.gpio_in, 0)->num_rules);
+    close(epfd);
+    epfd = saved_epfd;
+    gpio_event_remove(spec.gpio_in);
+    clear_error_msg();
+    *dat = 0xA0000805;
+
+    printf("Testing PIO mode off falls through\n");
+    ASSRT(0 == gpio_set_pio_mode(0));
+    ASSRT(0 == gpio_uses_pio(132));
+
+    for (i = 132; i <= 139; i++)
+        gpio_set_pio_capable(i, 0);
+    unmap_pio_anonymous();
+    memmap = saved_memmap;
+    pio_mode = saved_mode;
+
+    return 0;
+}
+
+static void selftest_callback(int gpio, void* data)
+{
+    (*(int *)data)++;
+}
+
+// Removes the channel's callbacks from inside run_callbacks()
+static void selftest_remover(int gpio, void* data)
+{
+    (*(int *)data)++;
+    remove_callbacks(gpio);
+}
+
+// Sums the levels handed to it and keeps the last timestamp
+static void selftest_tap(int gpio, unsigned int level, uint64_t timestamp, void *data)
+{
+    uint64_t *got = data;
+
+    got[0] += level;
+    got[1] = timestamp;
+}
+
+// Stands in for an edge arriving while blocking_wait_for_edges() sleeps
+static void *selftest_edge_writer(void *arg)
+{
+    usleep(20000);
+    if (write(*(int *)arg, "1", 1) != 1)
+        return NULL;
+    return NULL;
+}
+
+// Reads the shared value fd while other threads do the same, the lseek and
+// read pairs would interleave without the pin lock.  Also checks each thread
+// has its own error message.
+static void *selftest_value_reader(void *arg)
+{
+    unsigned int value;
+    int i, bad = 0;
+
+    clear_error_msg();
+    add_error_msg("selftest reader");
+    for (i = 0; i < 2000; i++)
+        if (gpio_get_value(*(int *)arg, &value) < 0 || value != 1)
+            bad++;
+    if (strcmp(get_error_msg(), "selftest reader") != 0)
+        bad++;
+    return (void *)(intptr_t)bad;
+}
+
+// Races the other adders for a run of pins no board uses, returns how many
+// it got
+#define SELFTEST_ADD_BASE (GPIO_STATE_MAX - 48)
+#define SELFTEST_ADD_PINS 32
+
+static void *selftest_event_adder(void *arg)
+{
+    int i, added = 0;
+
+    for (i = 0; i < SELFTEST_ADD_PINS; i++)
+        if (gpio_event_add(SELFTEST_ADD_BASE + i) == 0)
+            added++;
+    return (void *)(intptr_t)added;
+}
+
+// Exercises the per GPIO state table on a GPIO number no board uses, with a
+// temporary file standing in for the sysfs value file
+int event_selftest(void)
+{
+    int gpio = GPIO_STATE_MAX - 1;
+    int rising = 0, falling = 0, both = 0;
+    unsigned int value;
+    char path[] = "/tmp/chipio_selftest_XXXXXX";
+    int fd, i;
+    int pipefd[2];
+    struct poll_stats stats;
+    struct gpio_event evs[4];
+    struct gpio_state *st, *other;
+    unsigned long overflows;
+    struct dispatch_item items[DISPATCH_BATCH];
+    struct dispatch_stats dstats;
+    struct debounce_info dinfo;
+    struct epoll_event ev;
+    int saved_epfd;
+    struct event_hist hists[NUM_EVENT_STATS];
+    int waitfd[2][2];
+    int waitgpios[2] = {GPIO_STATE_MAX - 1, GPIO_STATE_MAX - 2};
+    int fired;
+    pthread_t writer;
+    uint64_t efd_count;
+    uint64_t tapped[2];
+    struct measure_info minfo;
+    struct encoder_info einfo;
+    struct encoder *enc;
+    struct storm_info sinfo;
+    struct watchdog_info winfo;
+    int timeouts = 0, edges = 0;
+    struct poll_thread_info pinfo, saved_pinfo;
+    char saved_name[16];
+    uint64_t base;
+
+    printf("Testing GPIO state table bounds\n");
+    ASSRT(-1 == fd_lookup(GPIO_STATE_MAX));
+    ASSRT(-1 == fd_lookup(-1));
+    ASSRT(-1 == add_fd_list(GPIO_STATE_MAX, 0));
+    ASSRT(-1 == gpio_get_setup_direction(GPIO_STATE_MAX));
+    ASSRT(1 == gpio_event_add(GPIO_STATE_MAX));
+    ASSRT(0 == event_detected(GPIO_STATE_MAX));
+
+    printf("Testing GPIO state setup direction\n");
+    ASSRT(-1 == gpio_get_setup_direction(gpio));
+    gpio_set_setup_direction(gpio, INPUT);
+    ASSRT(INPUT == gpio_get_setup_direction(gpio));
+
+    printf("Testing GPIO state value fd\n");
+    fd = mkstemp(path);  ASSRT(fd >= 0);
+    unlink(path);
+    ASSRT(1 == write(fd, "1", 1));
+    ASSRT(-1 == fd_lookup(gpio));
+    ASSRT(0 == add_fd_list(gpio, fd));
+    ASSRT(fd == fd_lookup(gpio));
+    ASSRT(1 == gpio_initial(gpio));
+    set_initial_false(gpio);
+    ASSRT(0 == gpio_initial(gpio));
+    ASSRT(0 == gpio_get_value(gpio, &value));  ASSRT(1 == value);
+
+    printf("Testing concurrent value reads\n");
+    {
+        pthread_t readers[4];
+        void *bad;
+
+        clear_error_msg();
+        for (i = 0; i < 4; i++)
+            ASSRT(0 == pthread_create(&readers[i], NULL, selftest_value_reader, &gpio));
+        for (i = 0; i < 4; i++) {
+            ASSRT(0 == pthread_join(readers[i], &bad));
+            ASSRT(NULL == bad);
+        }
+        ASSRT('\0' == get_error_msg()[0]);
+    }
+
+    printf("Testing GPIO state evented flag\n");
+    ASSRT(0 == gpio_is_evented(gpio));
+    ASSRT(0 == gpio_event_add(gpio));
+    ASSRT(1 == gpio_event_add(gpio));
+    ASSRT(1 == gpio_is_evented(gpio));
+    ASSRT(0 == gpio_event_remove(gpio));
+    ASSRT(0 == gpio_is_evented(gpio));
+    {
+        pthread_t adders[4];
+        void *added;
+        int total = 0;
+
+        // every pin goes to exactly one thread
+        for (i = 0; i < 4; i++)
+            ASSRT(0 == pthread_create(&adders[i], NULL, selftest_event_adder, NULL));
+        for (i = 0; i < 4; i++) {
+            ASSRT(0 == pthread_join(adders[i], &added));
+            total += (int)(intptr_t)added;
+        }
+        ASSRT(SELFTEST_ADD_PINS == total);
+        for (i = 0; i < SELFTEST_ADD_PINS; i++)
+            gpio_event_remove(SELFTEST_ADD_BASE + i);
+    }
+
+    printf("Testing GPIO state event counter\n");
+    ASSRT(0 == event_detected(gpio));
+    __atomic_add_fetch(&gpio_state(gpio, 0)->event_count, 2, __ATOMIC_RELAXED);
+    ASSRT(1 == event_detected(gpio));
+    ASSRT(0 == event_detected(gpio));
+
+    printf("Testing GPIO state callbacks\n");
+    ASSRT(0 == add_edge_callback(gpio, RISING_EDGE, selftest_callback, &rising));
+    ASSRT(0 == add_edge_callback(gpio, FALLING_EDGE, selftest_callback, &falling));
+    ASSRT(0 == add_edge_callback(gpio, BOTH_EDGE, selftest_callback, &both));
+    run_callbacks(gpio, 1);
+    ASSRT(1 == rising);  ASSRT(0 == falling);  ASSRT(1 == both);
+    run_callbacks(gpio, 0);
+    ASSRT(1 == rising);  ASSRT(1 == falling);  ASSRT(2 == both);
+    for (i = 3; i < MAX_PIN_CALLBACKS; i++)
+        ASSRT(0 == add_edge_callback(gpio, BOTH_EDGE, selftest_callback, &both));
+    ASSRT(-1 == add_edge_callback(gpio, BOTH_EDGE, selftest_callback, &both));
+    remove_callbacks(gpio);
+    run_callbacks(gpio, 1);
+    ASSRT(1 == rising);  ASSRT(2 == both);
+    ASSRT(0 == add_edge_callback(gpio, BOTH_EDGE, selftest_remover, &rising));
+    ASSRT(0 == add_edge_callback(gpio, BOTH_EDGE, selftest_callback, &both));
+    run_callbacks(gpio, 1);
+    ASSRT(2 == rising);  ASSRT(2 == both);  /* removed before the second ran */
+
+    printf("Testing poll dispatch\n");
+    close_value_fd(gpio);
+    ASSRT(0 == pipe(pipefd));
+    ASSRT(0 == add_fd_list(gpio, pipefd[0]));
+    ASSRT(0 == add_edge_callback(gpio, FALLING_EDGE, selftest_callback, &falling));
+    event_queue_create(gpio_state(gpio, 0));
+    gpio_get_poll_stats(&stats, 1);
+    ASSRT(2 == write(pipefd[1], "10", 2));
+    ASSRT(0 == poll_gpio(gpio_state(gpio, 0)));  /* first trigger is the current level */
+    ASSRT(0 == event_detected(gpio));  ASSRT(1 == falling);
+    ASSRT(0 == poll_gpio(gpio_state(gpio, 0)));
+    ASSRT(1 == event_detected(gpio));  ASSRT(1 == falling);  /* callbacks wait for the dispatcher */
+    ASSRT(1 == dispatch_pop(items, DISPATCH_BATCH, 0));
+    dispatch_run(items, 1);
+    ASSRT(2 == falling);
+    gpio_get_poll_stats(&stats, 0);
+    ASSRT(1 == stats.events);
+    ASSRT(1 == gpio_read_events(gpio, evs, 4));
+    ASSRT(gpio == evs[0].gpio);  ASSRT(FALLING_EDGE == evs[0].edge);  ASSRT(0 == evs[0].level);
+    ASSRT(evs[0].timestamp > 0 && evs[0].timestamp <= monotonic_ns());
+    ASSRT(0 == gpio_read_events(gpio, evs, 4));
+    close(pipefd[1]);
+    ASSRT(-1 == poll_gpio(gpio_state(gpio, 0)));
+    gpio_get_poll_stats(&stats, 1);
+
+    printf("Testing dispatch policies\n");
+    st = gpio_state(gpio, 0);
+    gpio_get_dispatch_stats(&dstats, 1);
+    ASSRT(-1 == gpio_set_dispatch_policy(3));
+    ASSRT(0 == gpio_set_dispatch_policy(DISPATCH_COALESCE));
+    dispatch_push(st, 1, 0);
+    dispatch_push(st, 0, 0);
+    dispatch_push(st, 0, 0);
+    ASSRT(1 == dispatch_pop(items, DISPATCH_BATCH, 0));  ASSRT(0 == items[0].value);
+    dispatch_run(items, 1);
+    ASSRT(3 == falling);
+    gpio_get_dispatch_stats(&dstats, 1);
+    ASSRT(3 == dstats.queued);  ASSRT(2 == dstats.coalesced);  ASSRT(1 == dstats.dispatched);
+    ASSRT(0 == gpio_set_dispatch_policy(DISPATCH_QUEUE));
+    for (i = 0; i < DISPATCH_QUEUE_SIZE + 2; i++)
+        dispatch_push(st, i & 1, 0);
+    ASSRT(1 == dispatch_pop(items, 1, 0));  ASSRT(0 == items[0].value);  /* newest were dropped */
+    ASSRT(0 == gpio_set_dispatch_policy(DISPATCH_DROP_OLDEST));
+    dispatch_push(st, 0, 0);
+    dispatch_push(st, 0, 0);
+    ASSRT(1 == dispatch_pop(items, 1, 0));  ASSRT(0 == items[0].value);  /* oldest was dropped */
+    gpio_get_dispatch_stats(&dstats, 0);
+    ASSRT(3 == dstats.dropped);  ASSRT(DISPATCH_QUEUE_SIZE == dstats.max_depth);
+    while (dispatch_pop(items, DISPATCH_BATCH, 0) > 0)
+        ;
+    ASSRT(0 == gpio_set_dispatch_policy(DISPATCH_QUEUE));
+    gpio_get_dispatch_stats(&dstats, 1);
+    remove_callbacks(gpio);
+    dispatch_push(st, 0, 0);  /* no callbacks, nothing to dispatch */
+    ASSRT(0 == dispatch_pop(items, DISPATCH_BATCH, 0));
+
+    printf("Testing debounce lockout and glitch filter\n");
+    st = gpio_state(gpio, 0);
+    close_value_fd(gpio);
+    strcpy(path, "/tmp/chipio_selftest_XXXXXX");
+    fd = mkstemp(path);  ASSRT(fd >= 0);
+    unlink(path);
+    ASSRT(1 == write(fd, "0", 1));
+    ASSRT(0 == add_fd_list(gpio, fd));
+    set_initial_false(gpio);
+    event_queue_clear(st->queue);
+    ASSRT(0 == gpio_set_debounce(gpio, 1000000, 0));
+    st->last_accept = 0;
+    ASSRT(0 == poll_gpio(st));  ASSRT(1 == gpio_read_events(gpio, evs, 4));
+    ASSRT(0 == poll_gpio(st));  ASSRT(0 == gpio_read_events(gpio, evs, 4));  /* inside the lockout */
+    ASSRT(0 == gpio_get_debounce(gpio, &dinfo));
+    ASSRT(1000000 == dinfo.lockout_us);  ASSRT(1 == dinfo.bounced);  ASSRT(0 == dinfo.glitches);
+
+    // a private epoll set, the timerfd must not reach a running poll thread
+    saved_epfd = epfd;
+    epfd = epoll_create(1);  ASSRT(epfd >= 0);
+    ASSRT(0 == gpio_set_debounce(gpio, 0, 2000));
+    ASSRT(0 == poll_gpio(st));  ASSRT(0 == gpio_read_events(gpio, evs, 4));  /* held back */
+    usleep(5000);
+    ASSRT(1 == epoll_wait(epfd, &ev, 1, 0));  ASSRT(&st->timer_src == ev.data.ptr);
+    poll_filter(st);
+    ASSRT(1 == gpio_read_events(gpio, evs, 4));  ASSRT(0 == evs[0].level);
+    ASSRT(0 == poll_gpio(st));
+    ASSRT(0 == poll_gpio(st));  /* restarts the wait, the first edge is a glitch */
+    ASSRT(1 == pwrite(fd, "1", 1, 0));  /* level went back before the stable time */
+    usleep(5000);
+    poll_filter(st);
+    ASSRT(0 == gpio_read_events(gpio, evs, 4));
+    ASSRT(0 == gpio_get_debounce(gpio, &dinfo));
+    ASSRT(2000 == dinfo.stable_us);  ASSRT(2 == dinfo.glitches);
+    ASSRT(0 == gpio_set_debounce(gpio, 0, 0));
+
+    printf("Testing event storm limit\n");
+    ASSRT(-1 == gpio_set_storm_limit(gpio, 2, 0, STORM_COALESCE, 0));
+    ASSRT(-1 == gpio_set_storm_limit(gpio, 2, 1000, 3, 0));
+    ASSRT(-1 == gpio_set_storm_limit(gpio, 2, 1000, STORM_DISARM, 0));
+    ASSRT(0 == gpio_set_storm_limit(gpio, 2, 2000, STORM_COALESCE, 0));
+    st->is_evented = 1;
+    base = monotonic_ns();
+    for (i = 0; i < 6; i++)
+        emit_edge(st, (i & 1) ? FALLING_EDGE : RISING_EDGE, base + i * 100000ULL, !(i & 1));
+    ASSRT(2 == gpio_read_events(gpio, evs, 4));  ASSRT(1 == evs[1].count);
+    usleep(5000);
+    ASSRT(1 == epoll_wait(epfd, &ev, 1, 0));  ASSRT(&st->storm_src == ev.data.ptr);
+    poll_storm(st);
+    ASSRT(1 == gpio_read_events(gpio, evs, 4));
+    ASSRT(4 == evs[0].count);  ASSRT(FALLING_EDGE == evs[0].edge);  ASSRT(0 == evs[0].level);
+    emit_edge(st, RISING_EDGE, base + 3000000ULL, 1);  /* next interval */
+    ASSRT(1 == gpio_read_events(gpio, evs, 4));  ASSRT(1 == evs[0].count);
+    ASSRT(0 == gpio_get_storm_stats(gpio, &sinfo, 1));
+    ASSRT(2 == sinfo.max_events);  ASSRT(1 == sinfo.storms);  ASSRT(4 == sinfo.suppressed);
+    ASSRT(0 == sinfo.disarms);  ASSRT(base + 200000ULL == sinfo.last_storm);
+    ASSRT(0 == gpio_get_storm_stats(gpio, &sinfo, 0));  ASSRT(0 == sinfo.storms);
+    ASSRT(0 == gpio_set_storm_limit(gpio, 1, 2000, STORM_DISARM, 2000));
+    emit_edge(st, RISING_EDGE, base + 10000000ULL, 1);
+    emit_edge(st, FALLING_EDGE, base + 10100000ULL, 0);  /* over the limit, disarms */
+    ASSRT(1 == gpio_read_events(gpio, evs, 4));
+    ASSRT(0 == gpio_get_storm_stats(gpio, &sinfo, 0));  ASSRT(1 == sinfo.disarmed);  ASSRT(1 == sinfo.disarms);
+    usleep(5000);
+    ASSRT(1 == epoll_wait(epfd, &ev, 1, 0));
+    poll_storm(st);
+    ASSRT(0 == gpio_get_storm_stats(gpio, &sinfo, 0));  ASSRT(0 == sinfo.disarmed);
+    ASSRT(1 == gpio_read_events(gpio, evs, 4));
+    ASSRT(1 == evs[0].count);  ASSRT(1 == evs[0].level);  /* the level after the holdoff */
+    ASSRT(0 == gpio_set_storm_limit(gpio, 0, 0, STORM_COALESCE, 0));
+
+    printf("Testing watchdog\n");
+    ASSRT(-1 == gpio_set_watchdog(gpio, 2000, 2, 0));
+    ASSRT(0 == add_edge_callback(gpio, WATCHDOG_EDGE, selftest_callback, &timeouts));
+    ASSRT(0 == add_edge_callback(gpio, BOTH_EDGE, selftest_callback, &edges));
+    ASSRT(0 == gpio_set_watchdog(gpio, 2000, WATCHDOG_ANY, 0));
+    usleep(5000);
+    ASSRT(1 == epoll_wait(epfd, &ev, 1, 0));  ASSRT(&st->wd_src == ev.data.ptr);
+    poll_watchdog(st);
+    ASSRT(0 == epoll_wait(epfd, &ev, 1, 0));  /* once, no repeat */
+    ASSRT(1 == gpio_read_events(gpio, evs, 4));
+    ASSRT(WATCHDOG_EDGE == evs[0].edge);  ASSRT(1 == evs[0].level);
+    ASSRT(1 == dispatch_pop(items, DISPATCH_BATCH, 0));  ASSRT(1 == items[0].watchdog);
+    dispatch_run(items, 1);
+    ASSRT(1 == timeouts);  ASSRT(0 == edges);
+    ASSRT(0 == gpio_get_watchdog(gpio, &winfo, 0));
+    ASSRT(2000 == winfo.timeout_us);  ASSRT(WATCHDOG_ANY == winfo.level);
+    ASSRT(1 == winfo.timeouts);  ASSRT(1 == winfo.expired);  ASSRT(0 < winfo.last_timeout);
+    emit_edge(st, RISING_EDGE, monotonic_ns(), 1);  /* alive, the wait starts over */
+    ASSRT(0 == gpio_get_watchdog(gpio, &winfo, 1));  ASSRT(0 == winfo.expired);
+    ASSRT(0 == gpio_get_watchdog(gpio, &winfo, 0));  ASSRT(0 == winfo.timeouts);
+    ASSRT(0 == epoll_wait(epfd, &ev, 1, 0));
+    usleep(5000);
+    ASSRT(1 == epoll_wait(epfd, &ev, 1, 0));
+    poll_watchdog(st);
+    ASSRT(2 == gpio_read_events(gpio, evs, 4));
+    ASSRT(RISING_EDGE == evs[0].edge);  ASSRT(WATCHDOG_EDGE == evs[1].edge);
+    ASSRT(2 == dispatch_pop(items, DISPATCH_BATCH, 0));
+    dispatch_run(items, 2);
+    ASSRT(2 == timeouts);  ASSRT(1 == edges);
+    // stuck low: the file reads 1, so the clock only starts on the falling edge
+    ASSRT(0 == gpio_set_watchdog(gpio, 2000, 0, 1));
+    usleep(5000);
+    ASSRT(0 == epoll_wait(epfd, &ev, 1, 0));
+    ASSRT(1 == pwrite(fd, "0", 1, 0));
+    emit_edge(st, FALLING_EDGE, monotonic_ns(), 0);
+    usleep(5000);
+    ASSRT(1 == epoll_wait(epfd, &ev, 1, 0));
+    poll_watchdog(st);
+    usleep(5000);
+    ASSRT(1 == epoll_wait(epfd, &ev, 1, 0));  /* repeats while it stays low */
+    poll_watchdog(st);
+    ASSRT(1 == pwrite(fd, "1", 1, 0));
+    emit_edge(st, RISING_EDGE, monotonic_ns(), 1);
+    usleep(5000);
+    ASSRT(0 == epoll_wait(epfd, &ev, 1, 0));
+    ASSRT(0 == gpio_get_watchdog(gpio, &winfo, 1));  ASSRT(3 == winfo.timeouts);  ASSRT(0 == winfo.expired);
+    ASSRT(4 == gpio_read_events(gpio, evs, 4));
+    ASSRT(WATCHDOG_EDGE == evs[1].edge);  ASSRT(0 == evs[1].level);  ASSRT(WATCHDOG_EDGE == evs[2].edge);
+    ASSRT(0 == gpio_set_watchdog(gpio, 0, WATCHDOG_ANY, 0));
+    ASSRT(0 == gpio_get_watchdog(gpio, &winfo, 0));  ASSRT(0 == winfo.timeout_us);
+    while (dispatch_pop(items, DISPATCH_BATCH, 0) > 0)
+        ;
+    remove_callbacks(gpio);
+    st->is_evented = 0;
+    ASSRT(-1 == gpio_set_watchdog(gpio, 2000, WATCHDOG_ANY, 0));  /* needs edge detection */
+    close(st->wd_fd);
+    st->wd_fd = -1;
+    st->wd_epfd = -1;
+    close(st->storm_fd);
+    st->storm_fd = -1;
+    st->storm_epfd = -1;
+    clear_error_msg();
+    close(st->timer_fd);
+    st->timer_fd = -1;
+    st->timer_epfd = -1;
     close(epfd);
+    epfd = saved_epfd;
+
+    printf("Testing event queue overflow and merge\n");
+    st = gpio_state(gpio, 0);
+    other = gpio_state(gpio - 1, 1);
+    event_queue_create(other);
+    overflows = gpio_event_overflows(-1);
+    for (i = 0; i < EVENT_QUEUE_SIZE + 3; i++)
+        event_queue_push(st, RISING_EDGE, 100 + 2*i, 1, 1);
+    ASSRT(3 == gpio_event_overflows(gpio));
+    ASSRT(overflows + 3 == gpio_event_overflows(-1));
+    ASSRT(0 == gpio_event_overflows(gpio - 1));
+    event_queue_push(other, FALLING_EDGE, 101, 0, 1);
+    event_queue_push(other, FALLING_EDGE, 104, 0, 1);
+    ASSRT(4 == gpio_read_all_events(evs, 4));
+    ASSRT(100 == evs[0].timestamp);  ASSRT(gpio == evs[0].gpio);
+    ASSRT(101 == evs[1].timestamp);  ASSRT(gpio - 1 == evs[1].gpio);  ASSRT(FALLING_EDGE == evs[1].edge);
+    ASSRT(102 == evs[2].timestamp);
+    ASSRT(104 == evs[3].timestamp);  ASSRT(gpio == evs[3].gpio);  /* ties keep queue order */
+    ASSRT(1 == gpio_read_events(gpio - 1, evs, 4));  ASSRT(104 == evs[0].timestamp);
+    ASSRT(4 == gpio_read_events(gpio, evs, 4));  ASSRT(106 == evs[0].timestamp);
+    event_queue_clear(st->queue);
+    ASSRT(0 == gpio_read_events(gpio, evs, 4));
+    event_queue_push(st, RISING_EDGE, 1, 1, 1);
+    ASSRT(1 == gpio_read_events(gpio, evs, 4));
+    st->queue->overflows = 0;
+
+    printf("Testing event fd\n");
+    st = gpio_state(gpio, 0);
+    ASSRT(0 <= gpio_event_fileno());
+    ASSRT(gpio_event_fileno() == gpio_event_fileno());
+    gpio_event_fd_ack();
+    ASSRT(-1 == read(gpio_event_fileno(), &efd_count, sizeof(efd_count)));  ASSRT(EAGAIN == errno);
+    emit_edge(st, RISING_EDGE, 1, 1);
+    emit_edge(st, FALLING_EDGE, 2, 0);
+    ASSRT(sizeof(uint64_t) == read(gpio_event_fileno(), &efd_count, sizeof(efd_count)));
+    ASSRT(-1 == read(gpio_event_fileno(), &efd_count, sizeof(efd_count)));  /* one wakeup per ack */
+    gpio_event_fd_ack();
+    emit_edge(st, RISING_EDGE, 3, 1);
+    gpio_event_fd_ack();
+    ASSRT(-1 == read(gpio_event_fileno(), &efd_count, sizeof(efd_count)));  /* ack cleared it */
+    ASSRT(3 == gpio_read_events(gpio, evs, 4));
+    event_detected(gpio);
+    while (dispatch_pop(items, DISPATCH_BATCH, 0) > 0)
+        ;
+    gpio_get_poll_stats(&stats, 1);
+
+    printf("Testing signal measurement\n");
+    st = gpio_state(gpio, 0);
+    ASSRT(-1 == gpio_read_measure(gpio, &minfo));
+    ASSRT(-1 == gpio_start_measure(gpio, 0));
+    ASSRT(0 == gpio_start_measure(gpio, 10000));
+    ASSRT(0 == gpio_read_measure(gpio, &minfo));
+    ASSRT(0 == minfo.frequency);  ASSRT(0 == minfo.updated);  ASSRT(10000 == minfo.window_us);
+    base = monotonic_ns() - 12000000;
+    for (i = 0; i <= 10; i++) {  /* 1 kHz, 25% duty, the rising edge at 10 ms ends the window */
+        measure_edge(st->measure, RISING_EDGE, base + i * 1000000ULL);
+        if (i < 10)
+            measure_edge(st->measure, FALLING_EDGE, base + i * 1000000ULL + 250000);
+    }
+    ASSRT(0 == gpio_read_measure(gpio, &minfo));
+    ASSRT(10 == minfo.samples);  ASSRT(21 == minfo.edges);
+    ASSRT(1000000 == minfo.period_ns);  ASSRT(250000 == minfo.high_ns);
+    ASSRT(minfo.frequency > 999.99 && minfo.frequency < 1000.01);
+    ASSRT(minfo.duty > 0.2499 && minfo.duty < 0.2501);
+    measure_edge(st->measure, RISING_EDGE, base + 12000000ULL);  /* next window, not published yet */
+    ASSRT(0 == gpio_read_measure(gpio, &minfo));  ASSRT(10 == minfo.samples);
+    st->measure->result.updated = 1;  /* long ago, the signal stopped */
+    ASSRT(0 == gpio_read_measure(gpio, &minfo));  ASSRT(0 == minfo.frequency);  ASSRT(-1 == minfo.duty);
+    ASSRT(0 == gpio_start_measure(gpio, 5000));  /* restart drops the old result */
+    ASSRT(0 == gpio_read_measure(gpio, &minfo));  ASSRT(0 == minfo.edges);  ASSRT(5000 == minfo.window_us);
+    measure_edge(st->measure, RISING_EDGE, base);
+    ASSRT(1 == st->measure->edges);  ASSRT(0 == st->measure->periods);
+    ASSRT(0 == gpio_stop_measure(gpio));
+    ASSRT(-1 == gpio_read_measure(gpio, &minfo));
+
+    printf("Testing quadrature encoder\n");
+    ASSRT(-1 == gpio_add_encoder(gpio, gpio - 1, 3));
+    ASSRT(-1 == gpio_add_encoder(gpio, gpio, ENCODER_X4));
+    ASSRT(0 == gpio_add_encoder(gpio, gpio - 1, ENCODER_X4));
+    ASSRT(-1 == gpio_add_encoder(gpio - 1, gpio, ENCODER_X4));  /* pins taken */
+    ASSRT(-1 == gpio_read_encoder(gpio - 1, &einfo));           /* B pin */
+    enc = encoder_lookup(gpio);  ASSRT(enc != NULL);
+    enc->state = 0;
+    base = monotonic_ns() - 200000000ULL;
+    for (i = 0; i < 10; i++) {  /* 10 cycles forward, A leading, 2 ms per edge */
+        encoder_edge(enc, gpio, 1, base + (4*i) * 2000000ULL);
+        encoder_edge(enc, gpio - 1, 1, base + (4*i + 1) * 2000000ULL);
+        encoder_edge(enc, gpio, 0, base + (4*i + 2) * 2000000ULL);
+        encoder_edge(enc, gpio - 1, 0, base + (4*i + 3) * 2000000ULL);
+    }
+    ASSRT(0 == gpio_read_encoder(gpio, &einfo));
+    ASSRT(40 == einfo.position);  ASSRT(0 == einfo.errors);  ASSRT(gpio - 1 == einfo.gpio_b);
+    ASSRT(einfo.velocity > 0 && einfo.velocity <= 500.1);  /* 500 counts/s, decayed when idle */
+    encoder_edge(enc, gpio - 1, 1, base + 81000000ULL);     /* one step back */
+    ASSRT(0 == gpio_read_encoder(gpio, &einfo));  ASSRT(39 == einfo.position);
+    encoder_edge(enc, gpio - 1, 1, base + 82000000ULL);     /* B again, an edge was missed */
+    ASSRT(0 == gpio_read_encoder(gpio, &einfo));  ASSRT(39 == einfo.position);  ASSRT(1 == einfo.errors);
+    enc->mode = ENCODER_X1;
+    ASSRT(0 == gpio_read_encoder(gpio, &einfo));  ASSRT(9 == einfo.position);
+    ASSRT(0 == gpio_reset_encoder(gpio, -2));
+    ASSRT(0 == gpio_read_encoder(gpio, &einfo));  ASSRT(-2 == einfo.position);  ASSRT(0 == einfo.errors);
+    encoder_edge(enc, gpio - 1, 0, base + 83000000ULL);     /* one x4 step forward */
+    ASSRT(0 == gpio_read_encoder(gpio, &einfo));  ASSRT(-2 == einfo.position);
+    encoder_edge(enc, gpio - 1, 1, base + 84000000ULL);     /* and two back */
+    encoder_edge(enc, gpio, 1, base + 85000000ULL);
+    ASSRT(0 == gpio_read_encoder(gpio, &einfo));  ASSRT(-3 == einfo.position);  /* x1 rounds down */
+    ASSRT(0 == gpio_reset_encoder(gpio, 3000000000LL));  /* past 32 bits in x4 counts */
+    encoder_edge(enc, gpio, 0, base + 86000000ULL);
+    encoder_edge(enc, gpio - 1, 0, base + 87000000ULL);
+    ASSRT(0 == gpio_read_encoder(gpio, &einfo));  ASSRT(3000000000LL == einfo.position);
+    ASSRT(0 == gpio_reset_encoder(gpio, -3000000000LL));
+    ASSRT(0 == gpio_read_encoder(gpio, &einfo));  ASSRT(-3000000000LL == einfo.position);
+    ASSRT(0 == gpio_remove_encoder(gpio));
+    ASSRT(-1 == gpio_read_encoder(gpio, &einfo));
+    ASSRT(NULL == gpio_state(gpio - 1, 0)->encoder);
+    clear_error_msg();
+
+    printf("Testing poll thread scheduling\n");
+    memset(&pinfo, 0, sizeof(pinfo));
+    pinfo.policy = 42;
+    ASSRT(-1 == gpio_set_poll_thread(&pinfo));
+    pinfo.policy = SCHED_FIFO;  /* priority 0 is not a real time priority */
+    ASSRT(-1 == gpio_set_poll_thread(&pinfo));
+    pinfo.policy = SCHED_OTHER;
+    pinfo.cpu = CPU_SETSIZE;
+    ASSRT(-1 == gpio_set_poll_thread(&pinfo));
+    pthread_mutex_lock(&poll_config_lock);
+    if (!poll_tid_valid) {
+        // this thread stands in for the poll thread
+        saved_pinfo = poll_config;
+        i = poll_config_set;
+        ASSRT(0 == pthread_getname_np(pthread_self(), saved_name, sizeof(saved_name)));
+        poll_tid = pthread_self();
+        poll_tid_valid = 1;
+        pthread_mutex_unlock(&poll_config_lock);
+        pinfo.cpu = 0;
+        strcpy(pinfo.name, "chipio-test");
+        ASSRT(0 == gpio_set_poll_thread(&pinfo));
+        ASSRT(0 == gpio_get_poll_thread(&pinfo));
+        ASSRT(1 == pinfo.running);  ASSRT(0 == pinfo.cpu);  ASSRT(SCHED_OTHER == pinfo.policy);
+        ASSRT(0 == strcmp("chipio-test", pinfo.name));
+        pinfo.cpu = -1;
+        strcpy(pinfo.name, saved_name);
+        ASSRT(0 == gpio_set_poll_thread(&pinfo));
+        ASSRT(0 == gpio_get_poll_thread(&pinfo));  ASSRT(0 == strcmp(saved_name, pinfo.name));
+        pthread_mutex_lock(&poll_config_lock);
+        poll_tid_valid = 0;
+        poll_config = saved_pinfo;
+        poll_config_set = i;
+    }
+    pthread_mutex_unlock(&poll_config_lock);
+    clear_error_msg();
+
+    printf("Testing edge counter\n");
+    ASSRT(0 == gpio_is_counter(gpio));
+    ASSRT(-1 == gpio_start_counter(gpio, COUNTER_BUCKETS - 1));
+    ASSRT(0 == gpio_start_counter(gpio, 1000));
+    ASSRT(1 == gpio_is_counter(gpio));
+    while (gpio_read_events(gpio, evs, 4) > 0);
+    base = monotonic_ns();
+    for (i = 0; i < 50; i++)
+        emit_edge(st, RISING_EDGE, base - i * 1000000ULL, 1);
+    ASSRT(50 == gpio_read_counter(gpio, 0));
+    ASSRT(0 == gpio_read_events(gpio, evs, 4));  /* counted, not queued */
+    ASSRT(gpio_counter_rate(gpio) > 0);
+    counter_edge(st->counter, base - 5000000000ULL);  /* outside the window */
+    ASSRT(51 == gpio_read_counter(gpio, 1));
+    ASSRT(0 == gpio_read_counter(gpio, 0));
+    for (i = 0; i < COUNTER_BUCKETS; i++)
+        st->counter->buckets[i].count = 0;
+    for (i = 0; i < 100; i++)
+        counter_edge(st->counter, base - i * 9000000ULL);
+    ASSRT(100 == gpio_read_counter(gpio, 0));
+    ASSRT(gpio_counter_rate(gpio) > 50 && gpio_counter_rate(gpio) < 200);  /* 100 over about 0.9 s */
+    ASSRT(0 == gpio_stop_counter(gpio));
+    ASSRT(0 == gpio_is_counter(gpio));
+    ASSRT(0 == gpio_read_counter(gpio, 0));
+    emit_edge(st, RISING_EDGE, base, 1);
+    ASSRT(1 == gpio_read_events(gpio, evs, 4));  /* queued again */
+
+    printf("Testing edge tap\n");
+    memset(tapped, 0, sizeof(tapped));
+    ASSRT(0 == gpio_set_edge_tap(gpio, selftest_tap, tapped));
+    emit_edge(st, RISING_EDGE, base + 1, 1);
+    emit_edge(st, FALLING_EDGE, base + 2, 0);
+    emit_edge(st, RISING_EDGE, base + 3, 1);
+    ASSRT(2 == tapped[0] && base + 3 == tapped[1]);
+    ASSRT(0 == gpio_read_events(gpio, evs, 4));  /* tapped, not queued */
+    ASSRT(0 == gpio_set_edge_tap(gpio, NULL, NULL));
+    emit_edge(st, RISING_EDGE, base + 4, 1);
+    ASSRT(2 == tapped[0]);
+    ASSRT(1 == gpio_read_events(gpio, evs, 4));
+
+    printf("Testing wait for edges\n");
+    close_value_fd(gpio);
+    for (i = 0; i < 2; i++) {
+        ASSRT(0 == pipe(waitfd[i]));
+        fcntl(waitfd[i][0], F_SETFL, fcntl(waitfd[i][0], F_GETFL) | O_NONBLOCK);
+        ASSRT(0 == add_fd_list(waitgpios[i], waitfd[i][0]));
+        gpio_state(waitgpios[i], 0)->edge = BOTH_EDGE;  /* nothing to write to sysfs */
+    }
+    ASSRT(1 == write(waitfd[0][1], "0", 1));  /* before the wait, stale */
+    ASSRT(0 == blocking_wait_for_edges(waitgpios, 1, BOTH_EDGE, 0, &fired));  ASSRT(-1 == fired);
+    ASSRT(0 == blocking_wait_for_edges(waitgpios, 2, BOTH_EDGE, 10, &fired));  ASSRT(-1 == fired);
+    ASSRT(0 == gpio_is_evented(gpio));  ASSRT(0 == gpio_is_evented(gpio - 1));
+    ASSRT(0 == pthread_create(&writer, NULL, selftest_edge_writer, &waitfd[1][1]));
+    ASSRT(0 == blocking_wait_for_edges(waitgpios, 2, BOTH_EDGE, 2000, &fired));
+    ASSRT(gpio - 1 == fired);
+    pthread_join(writer, NULL);
+    ASSRT(0 == pthread_create(&writer, NULL, selftest_edge_writer, &waitfd[1][1]));
+    ASSRT(0 == blocking_wait_for_edges(waitgpios, 1, BOTH_EDGE, 100, &fired));  /* gpio - 1 not asked for */
+    ASSRT(-1 == fired);
+    pthread_join(writer, NULL);
+    ASSRT(0 == gpio_event_add(gpio));
+    ASSRT(2 == blocking_wait_for_edges(waitgpios, 2, BOTH_EDGE, 0, &fired));
+    ASSRT(0 == gpio_is_evented(gpio - 1));
+    gpio_event_remove(gpio);
+    for (i = 0; i < 2; i++) {
+        close_value_fd(waitgpios[i]);
+        close(waitfd[i][1]);
+        gpio_state(waitgpios[i], 0)->edge = NO_EDGE;
+    }
+
+    printf("Testing event latency histograms\n");
+    st = gpio_state(gpio, 0);
+    event_hist_add(st, STAT_READ, 100, 200);  /* off, not counted */
+    gpio_set_event_stats(1);
+    ASSRT(1 == gpio_get_event_stats_enabled());
+    for (i = 0; i < 98; i++)
+        event_hist_add(st, STAT_READ, 100, 200);     /* 100 ns, bucket 7 */
+    event_hist_add(st, STAT_READ, 100, 5100);        /* 5 us, bucket 13 */
+    event_hist_add(st, STAT_READ, 100, 1000100);     /* 1 ms, bucket 20 */
+    event_hist_add(st, STAT_READ, 200, 100);         /* clock went backwards, ignored */
+    dispatch_edge_ts = monotonic_ns();
+    gpio_event_stats_mark(gpio, STAT_CALLBACK);
+    dispatch_edge_ts = 0;
+    ASSRT(0 == gpio_get_event_stats(gpio, hists, 1));
+    ASSRT(100 == hists[STAT_READ].count);  ASSRT(98 == hists[STAT_READ].buckets[7]);
+    ASSRT(1000000 == hists[STAT_READ].max);  ASSRT(98 * 100 + 5000 + 1000000 == hists[STAT_READ].sum);
+    ASSRT(128 == event_hist_percentile(&hists[STAT_READ], 0.5));
+    ASSRT(8192 == event_hist_percentile(&hists[STAT_READ], 0.99));
+    ASSRT(1 << 20 == event_hist_percentile(&hists[STAT_READ], 0.999));
+    ASSRT(1 == hists[STAT_CALLBACK].count);  ASSRT(0 == hists[STAT_CAPTURE].count);
+    ASSRT(0 == gpio_get_event_stats(gpio, hists, 0));
+    ASSRT(0 == hists[STAT_READ].count);  ASSRT(0 == event_hist_percentile(&hists[STAT_READ], 0.5));
+    gpio_set_event_stats(0);
+
+    close_value_fd(gpio);
+    ASSRT(-1 == fd_lookup(gpio));
+    gpio_set_setup_direction(gpio, -1);
+    clear_error_msg();
+
     return 0;
 }
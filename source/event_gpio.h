@@ -42,6 +42,7 @@ SOFTWARE.
 #define RISING_EDGE  1
 #define FALLING_EDGE 2
 #define BOTH_EDGE    3
+#define WATCHDOG_EDGE 4   /* queued and dispatched when a watchdog times out */
 
 #define INPUT  0
 #define OUTPUT 1
@@ -56,20 +57,238 @@ SOFTWARE.
 #define PUD_DOWN 1
 #define PUD_UP   2
 
+#define BACKEND_SYSFS 0
+#define BACKEND_CDEV  1
+
+// PIO register layout, relative to memmap
+#define PIO_BASE_OFFSET 0x800
+#define PIO_PORT_SIZE   0x24
+#define PIO_CFG_OFFSET  0x00
+#define PIO_DAT_OFFSET  0x10
+#define PIO_PUL_OFFSET  0x1c
+#define PIO_NUM_PORTS   9
+
+// Per GPIO state table size and callbacks allowed on one GPIO
+#define GPIO_STATE_MAX    2048
+#define MAX_PIN_CALLBACKS 8
+
+// Ready events the poll thread takes from one epoll_wait()
+#define POLL_MAX_EVENTS 32
+
+// Channels one wait_for_edge() call can wait on
+#define MAX_WAIT_GPIOS 32
+
+// Edges kept per GPIO until read_events() takes them, must be a power of two
+#define EVENT_QUEUE_SIZE 256
+
+struct gpio_event
+{
+    int gpio;
+    unsigned int edge;         /* RISING_EDGE, FALLING_EDGE or WATCHDOG_EDGE */
+    uint64_t timestamp;        /* CLOCK_MONOTONIC ns */
+    unsigned int level;        /* level after the edge */
+    unsigned int count;        /* edges the record stands for, more than 1 when a storm was coalesced */
+};
+
+// Callbacks run on a dispatcher thread fed by the poll thread.  What happens
+// when the dispatcher falls behind:
+#define DISPATCH_QUEUE       0   /* keep every edge, drop new ones when the queue is full */
+#define DISPATCH_COALESCE    1   /* one pending run per GPIO, with the latest level */
+#define DISPATCH_DROP_OLDEST 2   /* keep every edge, drop the oldest when the queue is full */
+
+#define DISPATCH_QUEUE_SIZE  1024
+#define DISPATCH_BATCH       64
+
+struct dispatch_stats
+{
+    unsigned long queued;      /* edges handed to the dispatcher */
+    unsigned long dispatched;  /* edges whose callbacks were run */
+    unsigned long dropped;     /* edges lost on a full queue */
+    unsigned long coalesced;   /* edges merged into one already pending */
+    unsigned long batches;     /* dispatcher wakeups */
+    unsigned int max_depth;    /* deepest the queue has been */
+};
+
+struct debounce_info
+{
+    unsigned int lockout_us;   /* edges this soon after an accepted one are dropped */
+    unsigned int stable_us;    /* the level must hold this long after an edge */
+    unsigned long bounced;     /* edges dropped by the lockout */
+    unsigned long glitches;    /* edges that did not hold for stable_us */
+};
+
+// What a pin does with the edges over its storm limit
+#define STORM_COALESCE 1   /* hold them back, deliver one record at the end of the interval */
+#define STORM_DISARM   2   /* also stop watching the pin for the holdoff time */
+
+struct storm_info
+{
+    unsigned int max_events;   /* edges delivered per interval, 0 when there is no limit */
+    unsigned int interval_us;
+    int action;                /* STORM_COALESCE or STORM_DISARM */
+    unsigned int holdoff_us;   /* how long STORM_DISARM leaves the pin alone */
+    unsigned long storms;      /* intervals that went over the limit */
+    unsigned long suppressed;  /* edges held back, or taken with the pin disarmed */
+    unsigned long disarms;
+    int disarmed;              /* the pin is not being watched right now */
+    uint64_t last_storm;       /* CLOCK_MONOTONIC ns the limit was last hit, 0 if never */
+};
+
+// Watchdog on the edges of a pin, see gpio_set_watchdog()
+#define WATCHDOG_ANY -1   /* level: time out when no edge comes for timeout_us */
+
+struct watchdog_info
+{
+    unsigned int timeout_us;   /* 0 when there is no watchdog */
+    int level;                 /* WATCHDOG_ANY, or the level the pin must not stay at */
+    int repeat;                /* time out again every timeout_us while it lasts */
+    unsigned long timeouts;
+    int expired;               /* timed out and no edge since */
+    uint64_t last_timeout;     /* CLOCK_MONOTONIC ns, 0 if never */
+};
+
+// Gets every edge of a pin in the poll thread, see gpio_set_edge_tap()
+typedef void (*edge_tap_func)(int gpio, unsigned int level, uint64_t timestamp, void *data);
+
+// A pin claimed by one of the bit-banged buses, see fast_pin_open()
+struct fast_pin
+{
+    int gpio;                  /* -1 when the bus does without the pin */
+    int pio;                   /* driven through the PIO data register */
+    int exported;              /* fast_pin_open() exported it */
+    int dir_fd;                /* sysfs direction file of an open drain pin, -1 if none */
+    volatile uint32_t *dat;
+    uint32_t mask;
+};
+
+struct measure_info
+{
+    unsigned int window_us;    /* averaging window */
+    double frequency;          /* Hz */
+    uint64_t period_ns;        /* mean period */
+    uint64_t high_ns;          /* mean high time, 0 without falling edges */
+    double duty;               /* high_ns / period_ns, -1 without falling edges */
+    unsigned long samples;     /* periods averaged in the last window */
+    unsigned long edges;       /* edges seen since start */
+    uint64_t updated;          /* CLOCK_MONOTONIC ns of the last window, 0 before the first */
+};
+
+// Quadrature encoder counting modes, counts per Gray code cycle
+#define ENCODER_X1 1
+#define ENCODER_X2 2
+#define ENCODER_X4 4
+#define MAX_ENCODERS 8
+
+struct encoder_info
+{
+    int mode;
+    int gpio_a;
+    int gpio_b;
+    int64_t position;          /* in mode counts */
+    unsigned long errors;      /* missed edges, an edge left its pin where it was */
+    double velocity;           /* mode counts per second, signed */
+};
+
+// Buckets of the edge counter rate window
+#define COUNTER_BUCKETS 10
+
+// Actions of edge rules, run by the poll thread without entering Python
+#define RULE_SET        0   /* drive the output high */
+#define RULE_CLEAR      1   /* drive the output low */
+#define RULE_TOGGLE     2   /* invert the output */
+#define RULE_PULSE      3   /* drive the output to value for pulse_us, then back */
+#define RULE_SPWM_START 4   /* run a softpwm on the output */
+#define RULE_SPWM_STOP  5   /* pause that softpwm, the output goes to its off level */
+#define MAX_RULES 32
+
+struct rule_spec
+{
+    int gpio_in;
+    unsigned int edge;         /* RISING_EDGE, FALLING_EDGE or BOTH_EDGE */
+    int gpio_out;
+    int action;
+    unsigned int value;        /* RULE_PULSE level */
+    unsigned int pulse_us;     /* RULE_PULSE length */
+    float duty;                /* RULE_SPWM_START, percent */
+    float freq;                /* RULE_SPWM_START, Hz */
+};
+
+// Event path latency histograms, bucket i counts latencies below 2^i ns
+#define STAT_CAPTURE   0   /* edge timestamp to poll thread wakeup */
+#define STAT_READ      1   /* poll thread wakeup to value read */
+#define STAT_DISPATCH  2   /* edge timestamp to C callback start */
+#define STAT_CALLBACK  3   /* edge timestamp to Python callback entry */
+#define NUM_EVENT_STATS 4
+#define EVENT_STATS_BUCKETS 32
+
+struct event_hist
+{
+    unsigned long count;
+    uint64_t sum;
+    uint64_t max;
+    unsigned long buckets[EVENT_STATS_BUCKETS];
+};
+
+struct poll_stats
+{
+    unsigned long wakeups;     /* epoll_wait() returns */
+    unsigned long events;      /* edges dispatched */
+    unsigned int last_batch;   /* ready fds on the last wakeup */
+    unsigned int max_batch;    /* most ready fds on one wakeup */
+};
+
+// Scheduling of the poll thread, see gpio_set_poll_thread()
+struct poll_thread_info
+{
+    int policy;        /* SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+    int priority;      /* 1 to 99 under SCHED_FIFO and SCHED_RR, 0 under SCHED_OTHER */
+    int cpu;           /* CPU the thread is pinned to, -1 for any */
+    int lock_memory;   /* the process memory is locked with mlockall() */
+    char name[16];     /* thread name, empty keeps the current one */
+    int running;
+};
+
 extern uint8_t *memmap;
 
 int map_pio_memory(void);
+int map_pio_anonymous(void);
+void unmap_pio_anonymous(void);
 int gpio_get_pud(int port, int pin);
 int gpio_set_pud(int port, int pin, uint8_t value);
+int pio_set_value(int port, int pin, unsigned int value);
+int pio_set_port(int port, uint32_t mask, uint32_t bits);
+unsigned int pio_get_value(int port, int pin);
+int pio_set_direction(int port, int pin, unsigned int out_flag);
+unsigned int pio_get_function(int port, int pin);
+int gpio_set_pio_mode(int enable);
+int gpio_get_pio_mode(void);
+void gpio_set_pio_capable(int gpio, int capable);
+int gpio_uses_pio(int gpio);
+void gpio_set_setup_direction(int gpio, int direction);
+int gpio_get_setup_direction(int gpio);
+int pio_selftest(void);
 
+int gpio_set_backend(int backend);
+int gpio_get_backend(void);
+int gpio_is_cdev(int gpio);
 int gpio_export(int gpio);
 int gpio_unexport(int gpio);
+int gpio_is_exported(int gpio);
 void exports_cleanup(void);
 int gpio_set_direction(int gpio, unsigned int in_flag);
 int gpio_get_direction(int gpio, unsigned int *value);
 int gpio_set_value(int gpio, unsigned int value);
 int gpio_get_value(int gpio, unsigned int *value);
+int gpio_get_bus(const int *gpios, int count, unsigned int *value);
 int gpio_get_more(int gpio, int bits, unsigned int *value);
+int gpio_set_bus(const int *gpios, int count, unsigned int value, unsigned int mask);
+int fast_pin_open(struct fast_pin *fp, int gpio, unsigned int direction);
+void fast_pin_close(struct fast_pin *fp);
+int fast_pin_set(const struct fast_pin *fp, unsigned int value);
+int fast_pin_get(const struct fast_pin *fp, unsigned int *value);
+int fast_pin_direction(const struct fast_pin *fp, unsigned int direction);
+int fast_pin_open_drain(struct fast_pin *fp, int gpio);
+int fast_pin_release(const struct fast_pin *fp, int release);
 int fd_lookup(int gpio);
 int open_value_file(int gpio);
 
@@ -87,3 +306,44 @@ int gpio_is_evented(int gpio);
 int event_initialise(void);
 void event_cleanup(void);
 int blocking_wait_for_edge(int gpio, unsigned int edge);
+int blocking_wait_for_edges(const int *gpios, int count, unsigned int edge, int timeout_ms, int *fired);
+void gpio_get_poll_stats(struct poll_stats *stats, int reset);
+int gpio_set_poll_thread(const struct poll_thread_info *want);
+int gpio_get_poll_thread(struct poll_thread_info *info);
+int gpio_read_events(int gpio, struct gpio_event *events, int max);
+int gpio_read_all_events(struct gpio_event *events, int max);
+int gpio_event_fileno(void);
+void gpio_event_fd_ack(void);
+unsigned long gpio_event_overflows(int gpio);
+int gpio_set_debounce(int gpio, unsigned int lockout_us, unsigned int stable_us);
+int gpio_get_debounce(int gpio, struct debounce_info *info);
+int gpio_set_storm_limit(int gpio, unsigned int max_events, unsigned int interval_us, int action, unsigned int holdoff_us);
+int gpio_get_storm_stats(int gpio, struct storm_info *info, int reset);
+int gpio_set_watchdog(int gpio, unsigned int timeout_us, int level, int repeat);
+int gpio_get_watchdog(int gpio, struct watchdog_info *info, int reset);
+int gpio_start_measure(int gpio, unsigned int window_us);
+int gpio_stop_measure(int gpio);
+int gpio_read_measure(int gpio, struct measure_info *info);
+int gpio_start_counter(int gpio, unsigned int window_ms);
+int gpio_stop_counter(int gpio);
+int gpio_is_counter(int gpio);
+int gpio_set_edge_tap(int gpio, edge_tap_func func, void *data);
+uint64_t gpio_read_counter(int gpio, int reset);
+double gpio_counter_rate(int gpio);
+int gpio_add_rule(const struct rule_spec *spec);
+int gpio_remove_rule(int id);
+unsigned long gpio_rule_fired(int id);
+int gpio_add_encoder(int gpio_a, int gpio_b, int mode);
+int gpio_remove_encoder(int gpio_a);
+int gpio_read_encoder(int gpio_a, struct encoder_info *info);
+int gpio_reset_encoder(int gpio_a, int64_t position);
+void gpio_set_event_stats(int enable);
+int gpio_get_event_stats_enabled(void);
+int gpio_get_event_stats(int gpio, struct event_hist *hists, int reset);
+void gpio_event_stats_mark(int gpio, int stage);
+uint64_t event_hist_percentile(const struct event_hist *hist, double fraction);
+int gpio_set_dispatch_policy(int policy);
+int gpio_get_dispatch_policy(void);
+void gpio_set_dispatch_hooks(void (*enter)(void), void (*leave)(void));
+void gpio_get_dispatch_stats(struct dispatch_stats *stats, int reset);
+int event_selftest(void);
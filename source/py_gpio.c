@@ -41,20 +41,24 @@ SOFTWARE.
 #include "constants.h"
 #include "common.h"
 #include "event_gpio.h"
+#include "cdev_gpio.h"
+#include "c_softspi.h"
+#include "c_softi2c.h"
+#include "c_softuart.h"
+#include "c_onewire.h"
+#include "c_dht.h"
 
 static int gpio_warnings = 1;
 static int r8_mem_setup = 0;
 
 int max_gpio = -1;
-dyn_int_array_t *gpio_direction = NULL;
 
 struct py_callback
 {
    char channel[32];
    int gpio;
+   int edge;
    PyObject *py_cb;
-   unsigned long long lastcall;
-   unsigned int bouncetime;
    struct py_callback *next;
 };
 static struct py_callback *py_callbacks = NULL;
@@ -114,7 +118,7 @@ static PyObject *py_is_chip_pro(PyObject *self, PyObject *args)
 
 static void remember_gpio_direction(int gpio, int direction)
 {
-    dyn_int_array_set(&gpio_direction, gpio, direction, -1);
+    gpio_set_setup_direction(gpio, direction);
 }
 
 // Dummy function to mimic RPi.GPIO for easier porting.
@@ -140,12 +144,22 @@ static PyObject *py_cleanup(PyObject *self, PyObject *args, PyObject *kwargs)
 
     // The !channel fixes issues #50
     if (channel == NULL || strcmp(channel, "\0") == 0) {
+        Py_BEGIN_ALLOW_THREADS // disable GIL
+        softspi_cleanup();
+        softi2c_cleanup();
+        softuart_cleanup();
+        onewire_cleanup();
         event_cleanup();
+        Py_END_ALLOW_THREADS   // enable GIL
     } else {
-        if (get_gpio_number(channel, &gpio) < 0) {
+        int valid = (get_gpio_number(channel, &gpio) == 0);
+        Py_BEGIN_ALLOW_THREADS // disable GIL
+        if (!valid) {
             event_cleanup();
+        } else {
+            gpio_unexport(gpio);
         }
-        gpio_unexport(gpio);
+        Py_END_ALLOW_THREADS   // enable GIL
     }
 
     Py_RETURN_NONE;
@@ -160,6 +174,7 @@ static PyObject *py_setup_channel(PyObject *self, PyObject *args, PyObject *kwar
     int direction;
     int pud = PUD_OFF;
     int initial = 0;
+    int result;
     static char *kwlist[] = {"channel", "direction", "pull_up_down", "initial", NULL};
  
     clear_error_msg();
@@ -215,13 +230,26 @@ static PyObject *py_setup_channel(PyObject *self, PyObject *args, PyObject *kwar
         init_r8_gpio_mem();
     }
  
-    if (gpio_export(gpio) < 0) {
+    // the sysfs writes below can sleep in the kernel, the C side locks the pin
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = gpio_export(gpio);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
         char err[2000];
         snprintf(err, sizeof(err), "Error setting up channel %s, maybe already exported? (%s)", channel, get_error_msg());
         PyErr_SetString(PyExc_RuntimeError, err);
         return NULL;
     }
-    if (gpio_set_direction(gpio, direction) < 0) {
+
+    // R8 owned pins (no XIO) can be driven through the PIO registers
+    int port, pin;
+    int pio_pin = (compute_port_pin(channel, gpio, &port, &pin) == 0);
+    gpio_set_pio_capable(gpio, pio_pin);
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = gpio_set_direction(gpio, direction);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
         char err[2000];
         snprintf(err, sizeof(err), "Error setting direction %d on channel %s. (%s)", direction, channel, get_error_msg());
         PyErr_SetString(PyExc_RuntimeError, err);
@@ -230,8 +258,7 @@ static PyObject *py_setup_channel(PyObject *self, PyObject *args, PyObject *kwar
     
     // Pull Up/Down
     // Only if the pin we want is able to use it (R8 Owned, no XIO)
-    int port, pin;
-    if (compute_port_pin(channel, gpio, &port, &pin) == 0) {
+    if (pio_pin) {
         // Set the PUD
         gpio_set_pud(port, pin, pud);
         // Check it was set properly
@@ -245,7 +272,10 @@ static PyObject *py_setup_channel(PyObject *self, PyObject *args, PyObject *kwar
     }
     
     if (direction == OUTPUT) {
-        if (gpio_set_value(gpio, initial) < 0) {
+        Py_BEGIN_ALLOW_THREADS // disable GIL
+        result = gpio_set_value(gpio, initial);
+        Py_END_ALLOW_THREADS   // enable GIL
+        if (result < 0) {
             char err[2000];
             snprintf(err, sizeof(err), "Error setting initial value %d on channel %s. (%s)", initial, channel, get_error_msg());
             PyErr_SetString(PyExc_RuntimeError, err);
@@ -292,7 +322,7 @@ static PyObject *py_output_gpio(PyObject *self, PyObject *args)
         return NULL;
     }
 
-    if (!module_setup || dyn_int_array_get(&gpio_direction, gpio, -1) != OUTPUT)
+    if (!module_setup || gpio_get_setup_direction(gpio) != OUTPUT)
     {
         char err[2000];
         snprintf(err, sizeof(err), "Channel %s not set up or is not an output", channel);
@@ -300,7 +330,15 @@ static PyObject *py_output_gpio(PyObject *self, PyObject *args)
         return NULL;
     }
 
-    int result = gpio_set_value(gpio, value);
+    // a PIO write is a few register accesses, not worth dropping the GIL for
+    int result;
+    if (gpio_uses_pio(gpio)) {
+        result = gpio_set_value(gpio, value);
+    } else {
+        Py_BEGIN_ALLOW_THREADS // disable GIL
+        result = gpio_set_value(gpio, value);
+        Py_END_ALLOW_THREADS   // enable GIL
+    }
     if (result < 0) {
         char err[2000];
         snprintf(err, sizeof(err), "Could no write %d on channel %s. (%s)", value, channel, get_error_msg());
@@ -347,13 +385,21 @@ static PyObject *py_input_gpio(PyObject *self, PyObject *args)
     }
 
    // check channel is set up as an input or output
-    if (!module_setup || (dyn_int_array_get(&gpio_direction, gpio, -1) == -1))
+    if (!module_setup || (gpio_get_setup_direction(gpio) == -1))
     {
         PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel first");
         return NULL;
     }
 
-    if (gpio_get_value(gpio, &value) < 0) {
+    int result;
+    if (gpio_uses_pio(gpio)) {
+        result = gpio_get_value(gpio, &value);
+    } else {
+        Py_BEGIN_ALLOW_THREADS // disable GIL
+        result = gpio_get_value(gpio, &value);
+        Py_END_ALLOW_THREADS   // enable GIL
+    }
+    if (result < 0) {
       char err[1024];
       snprintf(err, sizeof(err), "Could not get value ('%s')", get_error_msg());
       PyErr_SetString(PyExc_RuntimeError, err);
@@ -365,727 +411,2897 @@ static PyObject *py_input_gpio(PyObject *self, PyObject *args)
     return py_value;
 }
 
-//TODO: Come up with a way to merge py_read_byte_gpio and py_read_word_gpio
-// python function value = read_byte(channel)
-static PyObject *py_read_byte_gpio(PyObject *self, PyObject *args)
+// Resolves the channels of a bus into gpio numbers, bit i of the bus is gpios[i]
+// channels is either a start channel, in which case width consecutive GPIOs
+// are used, or a list/tuple of channel names
+// When output is set every channel must be set up as an output
+// Returns 0 on success, -1 with a Python exception set otherwise
+static int get_bus_gpios(PyObject *channels, int width, int output, int *gpios, int *count)
 {
     int gpio;
+    int allowed;
+    int i;
+    PyObject *seq = NULL;
     char *channel;
-    unsigned int value = 0;
-    PyObject *py_value;
-    int allowed = -1;
 
-    clear_error_msg();
+    if (PySequence_Check(channels) && !PyBytes_Check(channels)
+#if PY_MAJOR_VERSION > 2
+        && !PyUnicode_Check(channels)
+#endif
+       ) {
+        seq = PySequence_Fast(channels, "channels must be a channel name or a list of channel names");
+        if (seq == NULL)
+            return -1;
+        *count = (int)PySequence_Fast_GET_SIZE(seq);
+    } else {
+        *count = width;
+    }
 
-    if (!PyArg_ParseTuple(args, "s", &channel))
-        return NULL;
+    if (*count < 1 || *count > 32) {
+        Py_XDECREF(seq);
+        PyErr_SetString(PyExc_ValueError, "A bus must be between 1 and 32 channels wide");
+        return -1;
+    }
 
-    if (get_gpio_number(channel, &gpio)) {
-        PyErr_SetString(PyExc_ValueError, "Invalid channel");
-        return NULL;
+    for (i = 0; i < *count; i++) {
+        if (seq == NULL) {
+            if (i == 0) {
+#if PY_MAJOR_VERSION > 2
+                channel = PyUnicode_Check(channels) ? (char *)PyUnicode_AsUTF8(channels) : NULL;
+#else
+                channel = PyString_Check(channels) ? PyString_AsString(channels) : NULL;
+#endif
+                if (channel == NULL || get_gpio_number(channel, &gpio)) {
+                    PyErr_SetString(PyExc_ValueError, "Invalid channel");
+                    return -1;
+                }
+            } else {
+                gpio = gpios[0] + i;
+            }
+        } else {
+            PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+#if PY_MAJOR_VERSION > 2
+            channel = PyUnicode_Check(item) ? (char *)PyUnicode_AsUTF8(item) : NULL;
+#else
+            channel = PyString_Check(item) ? PyString_AsString(item) : NULL;
+#endif
+            if (channel == NULL || get_gpio_number(channel, &gpio)) {
+                Py_DECREF(seq);
+                PyErr_SetString(PyExc_ValueError, "Invalid channel");
+                return -1;
+            }
+        }
+        gpios[i] = gpio;
     }
+    Py_XDECREF(seq);
 
-    // Check to see if GPIO is allowed on the hardware
-    // A 1 means we're good to go
-    allowed = gpio_allowed(gpio);
-    if (allowed == -1) {
-        char err[2000];
-        snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
-        PyErr_SetString(PyExc_ValueError, err);
-        return NULL;
-    } else if (allowed == 0) {
-        char err[2000];
-        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
-        PyErr_SetString(PyExc_ValueError, err);
-        return NULL;
+    for (i = 0; i < *count; i++) {
+        gpio = gpios[i];
+
+        // Check to see if GPIO is allowed on the hardware
+        // A 1 means we're good to go
+        allowed = gpio_allowed(gpio);
+        if (allowed == -1) {
+            char err[2000];
+            snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
+            PyErr_SetString(PyExc_ValueError, err);
+            return -1;
+        } else if (allowed == 0) {
+            char err[2000];
+            snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
+            PyErr_SetString(PyExc_ValueError, err);
+            return -1;
+        }
+
+        // every pin of the bus has to be set up, not just the first one
+        if (!module_setup || (gpio_get_setup_direction(gpio) == -1))
+        {
+            char err[2000];
+            snprintf(err, sizeof(err), "You must setup() the GPIO channel first (GPIO %d, bit %d)", gpio, i);
+            PyErr_SetString(PyExc_RuntimeError, err);
+            return -1;
+        }
+
+        if (output && gpio_get_setup_direction(gpio) != OUTPUT)
+        {
+            char err[2000];
+            snprintf(err, sizeof(err), "GPIO %d (bit %d) is not an output", gpio, i);
+            PyErr_SetString(PyExc_RuntimeError, err);
+            return -1;
+        }
     }
 
-   // check channel is set up as an input or output
-    if (!module_setup || (dyn_int_array_get(&gpio_direction, gpio, -1) == -1))
-    {
-        PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel first");
+    return 0;
+}
+
+static PyObject *read_bus(PyObject *channels, int width)
+{
+    int gpios[32];
+    int count;
+    unsigned int value = 0;
+
+    clear_error_msg();
+
+    if (get_bus_gpios(channels, width, 0, gpios, &count) < 0)
         return NULL;
-    }
 
-    // We only want to get a 8 bits here
-    if (gpio_get_more(gpio, 8, &value) < 0) {
+    if (gpio_get_bus(gpios, count, &value) < 0) {
       char err[1024];
-      snprintf(err, sizeof(err), "Could not get 8 bits of data ('%s')", get_error_msg());
+      snprintf(err, sizeof(err), "Could not get %d bits of data ('%s')", count, get_error_msg());
       PyErr_SetString(PyExc_RuntimeError, err);
       return NULL;
     }
 
-    py_value = Py_BuildValue("i", value);
+    return Py_BuildValue("I", value);
+}
 
-    return py_value;
+// python function value = read_bus(channels, width=8)
+static PyObject *py_read_bus(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *channels;
+    int width = 8;
+    static char *kwlist[] = {"channels", "width", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i", kwlist, &channels, &width))
+        return NULL;
+
+    return read_bus(channels, width);
+}
+
+// python function value = read_byte(channel)
+static PyObject *py_read_byte_gpio(PyObject *self, PyObject *args)
+{
+    PyObject *channels;
+
+    if (!PyArg_ParseTuple(args, "O", &channels))
+        return NULL;
+
+    return read_bus(channels, 8);
 }
 
 // python function value = read_word(channel)
 static PyObject *py_read_word_gpio(PyObject *self, PyObject *args)
 {
-    int gpio;
-    char *channel;
-    unsigned int value = 0;
-    PyObject *py_value;
-    int allowed = -1;
-
-    clear_error_msg();
+    PyObject *channels;
 
-    if (!PyArg_ParseTuple(args, "s", &channel))
+    if (!PyArg_ParseTuple(args, "O", &channels))
         return NULL;
 
-    if (get_gpio_number(channel, &gpio)) {
-        PyErr_SetString(PyExc_ValueError, "Invalid channel");
-        return NULL;
-    }
-    
-    // Check to see if GPIO is allowed on the hardware
-    // A 1 means we're good to go
-    allowed = gpio_allowed(gpio);
-    if (allowed == -1) {
-        char err[2000];
-        snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
-        PyErr_SetString(PyExc_ValueError, err);
-        return NULL;
-    } else if (allowed == 0) {
-        char err[2000];
-        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
-        PyErr_SetString(PyExc_ValueError, err);
-        return NULL;
-    }
-    
-    // check channel is set up as an input or output
-    if (!module_setup || (dyn_int_array_get(&gpio_direction, gpio, -1) == -1))
-    {
-        PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel first");
+    return read_bus(channels, 16);
+}
+
+static PyObject *write_bus(PyObject *channels, int width, unsigned int value, unsigned int mask)
+{
+    int gpios[32];
+    int count;
+
+    clear_error_msg();
+
+    if (get_bus_gpios(channels, width, 1, gpios, &count) < 0)
         return NULL;
-    }
 
-    // We only want to get a 8 bits here
-    if (gpio_get_more(gpio, 16, &value) < 0) {
+    if (gpio_set_bus(gpios, count, value, mask) < 0) {
       char err[1024];
-      snprintf(err, sizeof(err), "Could not get 16 bits of data ('%s')", get_error_msg());
+      snprintf(err, sizeof(err), "Could not write %d bits of data ('%s')", count, get_error_msg());
       PyErr_SetString(PyExc_RuntimeError, err);
       return NULL;
     }
 
-    py_value = Py_BuildValue("i", value);
-
-    return py_value;
+    Py_RETURN_NONE;
 }
 
-static void run_py_callbacks(int gpio, void* data)
+// python function write_byte(channel, value)
+static PyObject *py_write_byte_gpio(PyObject *self, PyObject *args)
 {
-   PyObject *result;
-   PyGILState_STATE gstate;
-   struct py_callback *cb = py_callbacks;
-   struct timeval tv_timenow;
-   unsigned long long timenow;
+    PyObject *channels;
+    unsigned int value;
 
-   clear_error_msg();
+    if (!PyArg_ParseTuple(args, "OI", &channels, &value))
+        return NULL;
 
-   while (cb != NULL)
-   {
-      if (cb->gpio == gpio)
-      {
-         gettimeofday(&tv_timenow, NULL);
-         timenow = tv_timenow.tv_sec*1E6 + tv_timenow.tv_usec;
-         if (cb->bouncetime == 0 || timenow - cb->lastcall > cb->bouncetime*1000 || cb->lastcall == 0 || cb->lastcall > timenow) {
+    return write_bus(channels, 8, value, 0xff);
+}
 
-            // save lastcall before calling func to prevent reentrant bounce
-            cb->lastcall = timenow;
+// python function write_word(channel, value)
+static PyObject *py_write_word_gpio(PyObject *self, PyObject *args)
+{
+    PyObject *channels;
+    unsigned int value;
 
-            // run callback
-            gstate = PyGILState_Ensure();
-            result = PyObject_CallFunction(cb->py_cb, "s", cb->channel);
+    if (!PyArg_ParseTuple(args, "OI", &channels, &value))
+        return NULL;
 
-            if (result == NULL && PyErr_Occurred())
-            {
-               PyErr_Print();
-               PyErr_Clear();
-            }
-            Py_XDECREF(result);
-            PyGILState_Release(gstate);
-         }
-         cb->lastcall = timenow;
-      }
-      cb = cb->next;
-   }
+    return write_bus(channels, 16, value, 0xffff);
 }
 
-static int add_py_callback(char *channel, int gpio, int edge, unsigned int bouncetime, PyObject *cb_func)
+// python function write_mask(channels, value, mask=all, width=8)
+static PyObject *py_write_mask(PyObject *self, PyObject *args, PyObject *kwargs)
 {
-   struct py_callback *new_py_cb;
-   struct py_callback *cb = py_callbacks;
+    PyObject *channels;
+    unsigned int value;
+    unsigned int mask = 0xffffffff;
+    int width = 8;
+    static char *kwlist[] = {"channels", "value", "mask", "width", NULL};
 
-   clear_error_msg();
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OI|Ii", kwlist, &channels, &value, &mask, &width))
+        return NULL;
 
-   // add callback to py_callbacks list
-   new_py_cb = malloc(sizeof(struct py_callback));
-   if (new_py_cb == 0)
-   {
-      PyErr_NoMemory();
-      return -1;
-   }
-   new_py_cb->py_cb = cb_func;
-   Py_XINCREF(cb_func);         // Add a reference to new callback
-   memset(new_py_cb->channel, 0, sizeof(new_py_cb->channel));
-   strncpy(new_py_cb->channel, channel, sizeof(new_py_cb->channel) - 1);
-   new_py_cb->gpio = gpio;
-   new_py_cb->lastcall = 0;
-   new_py_cb->bouncetime = bouncetime;
-   new_py_cb->next = NULL;
-   if (py_callbacks == NULL) {
-      py_callbacks = new_py_cb;
-   } else {
-      // add to end of list
-      while (cb->next != NULL)
-         cb = cb->next;
-      cb->next = new_py_cb;
-   }
-   add_edge_callback(gpio, edge, run_py_callbacks, NULL);
-   return 0;
+    return write_bus(channels, width, value, mask);
 }
 
-// python function add_event_callback(gpio, callback, bouncetime=0)
-static PyObject *py_add_event_callback(PyObject *self, PyObject *args, PyObject *kwargs)
+// Edge detection is only available on the external interrupt pins and the
+// XIO expander
+static int gpio_edge_capable(int gpio)
 {
-   int gpio;
-   char *channel;
-   int allowed = -1;
-   unsigned int bouncetime = 0;
-   PyObject *cb_func;
-   char *kwlist[] = {"gpio", "callback", "bouncetime", NULL};
-
-   clear_error_msg();
+    return gpio == lookup_gpio_by_name("AP-EINT3")
+        || gpio == lookup_gpio_by_name("AP-EINT1")
+        || (gpio >= lookup_gpio_by_name("XIO-P0") && gpio <= lookup_gpio_by_name("XIO-P7"));
+}
 
-   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sO|i", kwlist, &channel, &cb_func, &bouncetime))
-      return NULL;
+// Resolves one pin of a software bus, channel NULL means the bus does without
+// it and gives -1.  Returns 0 on success, -1 with a Python exception set
+static int get_softbus_gpio(const char *channel, int *gpio)
+{
+    int allowed;
+    int port, pin;
 
-   if (!PyCallable_Check(cb_func))
-   {
-      PyErr_SetString(PyExc_TypeError, "Parameter must be callable");
-      return NULL;
-   }
+    *gpio = -1;
+    if (channel == NULL)
+        return 0;
 
-    if (get_gpio_number(channel, &gpio)) {
-        PyErr_SetString(PyExc_ValueError, "Invalid channel");
-        return NULL;
+    if (get_gpio_number((char *)channel, gpio) < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Invalid channel %s. (%s)", channel, get_error_msg());
+        PyErr_SetString(PyExc_ValueError, err);
+        return -1;
     }
 
     // Check to see if GPIO is allowed on the hardware
     // A 1 means we're good to go
-    allowed = gpio_allowed(gpio);
+    allowed = gpio_allowed(*gpio);
     if (allowed == -1) {
         char err[2000];
         snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
-        return NULL;
+        return -1;
     } else if (allowed == 0) {
         char err[2000];
-        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
+        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", *gpio);
         PyErr_SetString(PyExc_ValueError, err);
-        return NULL;
+        return -1;
     }
 
-   // check to ensure gpio is one of the allowed pins
-   if (gpio != lookup_gpio_by_name("AP-EINT3")
-       && gpio != lookup_gpio_by_name("AP-EINT1")
-       && !(gpio >= lookup_gpio_by_name("XIO-P0") && gpio <= lookup_gpio_by_name("XIO-P7"))) {
-     PyErr_SetString(PyExc_ValueError, "Callbacks currently available on AP-EINT1, AP-EINT3, and XIO-P0 to XIO-P7 only");
-     return NULL;
-   }
+    if (!module_setup) {
+        init_module();
+    }
 
-   // check channel is set up as an input
-   if (!module_setup || dyn_int_array_get(&gpio_direction, gpio, -1) != INPUT)
-   {
-      PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an input first");
-      return NULL;
-   }
+    // Only map /dev/mem if we're not an XIO
+    if (!r8_mem_setup && !(*gpio >= lookup_gpio_by_name("XIO-P0") && *gpio <= lookup_gpio_by_name("XIO-P7"))) {
+        init_r8_gpio_mem();
+    }
 
-   if (!gpio_is_evented(gpio))
-   {
-      PyErr_SetString(PyExc_RuntimeError, "Add event detection using add_event_detect first before adding a callback");
-      return NULL;
-   }
-   // Defaulting to Falling edge
-   if (add_py_callback(channel, gpio, 2, bouncetime, cb_func) != 0)
-      return NULL;
+    // R8 owned pins (no XIO) can be driven through the PIO registers
+    gpio_set_pio_capable(*gpio, compute_port_pin((char *)channel, *gpio, &port, &pin) == 0);
 
-   Py_RETURN_NONE;
+    return 0;
 }
 
-// python function add_event_detect(gpio, edge, callback=None, bouncetime=0
-static PyObject *py_add_event_detect(PyObject *self, PyObject *args, PyObject *kwargs)
+// python function handle = spi_open(sclk, mosi=None, miso=None, cs=None, mode=0, speed=100000, lsb_first=False, cs_high=False)
+static PyObject *py_spi_open(PyObject *self, PyObject *args, PyObject *kwargs)
 {
-   int gpio;
-   char *channel;
-   int edge, result;
-   unsigned int bouncetime = 0;
-   int allowed = -1;
-   PyObject *cb_func = NULL;
-   char *kwlist[] = {"gpio", "edge", "callback", "bouncetime", NULL};
+    char *sclk;
+    char *mosi = NULL;
+    char *miso = NULL;
+    char *cs = NULL;
+    int speed = 100000;
+    int id;
+    struct softspi_config cfg;
+    static char *kwlist[] = {"sclk", "mosi", "miso", "cs", "mode", "speed", "lsb_first", "cs_high", NULL};
 
-   clear_error_msg();
+    clear_error_msg();
 
-   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "si|Oi", kwlist, &channel, &edge, &cb_func, &bouncetime))
-      return NULL;
+    memset(&cfg, 0, sizeof(cfg));
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|zzziiii", kwlist, &sclk, &mosi, &miso, &cs,
+                                     &cfg.mode, &speed, &cfg.lsb_first, &cfg.cs_high))
+        return NULL;
 
-   if (cb_func != NULL && !PyCallable_Check(cb_func))
-   {
-      PyErr_SetString(PyExc_TypeError, "Parameter must be callable");
-      return NULL;
-   }
+    if (speed < 0) {
+        PyErr_SetString(PyExc_ValueError, "speed must be 0 (as fast as possible) or a clock rate in Hz");
+        return NULL;
+    }
+    cfg.speed_hz = (unsigned int)speed;
 
-   if (get_gpio_number(channel, &gpio)) {
-       PyErr_SetString(PyExc_ValueError, "Invalid channel");
-       return NULL;
-   }
+    if (get_softbus_gpio(sclk, &cfg.sclk) < 0 || get_softbus_gpio(mosi, &cfg.mosi) < 0 ||
+        get_softbus_gpio(miso, &cfg.miso) < 0 || get_softbus_gpio(cs, &cfg.cs) < 0)
+        return NULL;
 
-    // Check to see if GPIO is allowed on the hardware
-    // A 1 means we're good to go
-    allowed = gpio_allowed(gpio);
-    if (allowed == -1) {
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    id = softspi_open(&cfg);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (id < 0) {
         char err[2000];
-        snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
+        snprintf(err, sizeof(err), "Error opening software SPI bus (%s)", get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
         return NULL;
-    } else if (allowed == 0) {
+    }
+
+    return Py_BuildValue("i", id);
+}
+
+// python function rx = spi_transfer(handle, data)
+static PyObject *py_spi_transfer(PyObject *self, PyObject *args)
+{
+    int id;
+    int result;
+    Py_buffer tx;
+    PyObject *rx;
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTuple(args, "is*", &id, &tx))
+        return NULL;
+
+    rx = PyBytes_FromStringAndSize(NULL, tx.len);
+    if (rx == NULL) {
+        PyBuffer_Release(&tx);
+        return NULL;
+    }
+
+    // the whole transfer is clocked without the GIL
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = softspi_transfer(id, tx.buf, (uint8_t *)PyBytes_AS_STRING(rx), tx.len);
+    Py_END_ALLOW_THREADS   // enable GIL
+    PyBuffer_Release(&tx);
+    if (result < 0) {
         char err[2000];
-        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
+        Py_DECREF(rx);
+        snprintf(err, sizeof(err), "Error in software SPI transfer (%s)", get_error_msg());
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    return rx;
+}
+
+// python function spi_close(handle)
+static PyObject *py_spi_close(PyObject *self, PyObject *args)
+{
+    int id;
+    int result;
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTuple(args, "i", &id))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = softspi_close(id);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error closing software SPI bus (%s)", get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
         return NULL;
     }
 
-   // check to ensure gpio is one of the allowed pins
-   if (gpio != lookup_gpio_by_name("AP-EINT3")
-       && gpio != lookup_gpio_by_name("AP-EINT1")
-       && !(gpio >= lookup_gpio_by_name("XIO-P0") && gpio <= lookup_gpio_by_name("XIO-P7"))) {
-     PyErr_SetString(PyExc_ValueError, "Edge Detection currently available on AP-EINT1, AP-EINT3, and XIO-P0 to XIO-P7 only");
-     return NULL;
-   }
+    Py_RETURN_NONE;
+}
 
-   // is edge valid value
-   if (edge != RISING_EDGE && edge != FALLING_EDGE && edge != BOTH_EDGE)
-   {
-      PyErr_SetString(PyExc_ValueError, "The edge must be set to RISING, FALLING or BOTH");
-      return NULL;
-   }
+// python function handle = i2c_open(scl, sda, speed=100000, timeout=25)
+static PyObject *py_i2c_open(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    char *scl;
+    char *sda;
+    int speed = 100000;
+    int timeout = 25;
+    int id;
+    struct softi2c_config cfg;
+    static char *kwlist[] = {"scl", "sda", "speed", "timeout", NULL};
 
-   // check channel is set up as an input
-   if (!module_setup || dyn_int_array_get(&gpio_direction, gpio, -1) != INPUT)
-   {
-      PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an input first");
-      return NULL;
-   }
+    clear_error_msg();
 
-   if ((result = add_edge_detect(gpio, edge)) != 0)   // starts a thread
-   {
-      if (result == 1)
-      {
-         PyErr_SetString(PyExc_RuntimeError, "Edge detection already enabled for this GPIO channel");
-         return NULL;
-      } else {
-         PyErr_SetString(PyExc_RuntimeError, "Failed to add edge detection");
-         return NULL;
-      }
-   }
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ss|ii", kwlist, &scl, &sda, &speed, &timeout))
+        return NULL;
 
-   if (cb_func != NULL)
-      if (add_py_callback(channel, gpio, edge, bouncetime, cb_func) != 0)
-         return NULL;
+    if (speed < 0) {
+        PyErr_SetString(PyExc_ValueError, "speed must be 0 (as fast as possible) or a clock rate in Hz");
+        return NULL;
+    }
+    if (timeout <= 0) {
+        PyErr_SetString(PyExc_ValueError, "timeout must be a positive number of milliseconds");
+        return NULL;
+    }
 
-   Py_RETURN_NONE;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.speed_hz = (unsigned int)speed;
+    cfg.timeout_us = (unsigned int)timeout * 1000;
+    if (get_softbus_gpio(scl, &cfg.scl) < 0 || get_softbus_gpio(sda, &cfg.sda) < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    id = softi2c_open(&cfg);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (id < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error opening software I2C bus (%s)", get_error_msg());
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+
+    return Py_BuildValue("i", id);
 }
 
-// python function remove_event_detect(gpio)
-static PyObject *py_remove_event_detect(PyObject *self, PyObject *args)
+// python function rx = i2c_transfer(handle, address, write=b"", read=0)
+static PyObject *py_i2c_transfer(PyObject *self, PyObject *args, PyObject *kwargs)
 {
-   int gpio;
-   char *channel;
-   struct py_callback *cb = py_callbacks;
-   struct py_callback *temp;
-   struct py_callback *prev = NULL;
-   int allowed = -1;
+    int id;
+    int addr;
+    int rlen = 0;
+    int result;
+    Py_buffer wr = { NULL };
+    PyObject *rx;
+    static char *kwlist[] = {"handle", "address", "write", "read", NULL};
 
-   clear_error_msg();
+    clear_error_msg();
 
-   if (!PyArg_ParseTuple(args, "s", &channel))
-      return NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ii|s*i", kwlist, &id, &addr, &wr, &rlen))
+        return NULL;
 
-   if (get_gpio_number(channel, &gpio)) {
-       PyErr_SetString(PyExc_ValueError, "Invalid channel");
-       return NULL;
-   }
+    if (rlen < 0) {
+        PyBuffer_Release(&wr);
+        PyErr_SetString(PyExc_ValueError, "read must be a number of bytes");
+        return NULL;
+    }
 
-    // Check to see if GPIO is allowed on the hardware
-    // A 1 means we're good to go
-    allowed = gpio_allowed(gpio);
-    if (allowed == -1) {
+    rx = PyBytes_FromStringAndSize(NULL, rlen);
+    if (rx == NULL) {
+        PyBuffer_Release(&wr);
+        return NULL;
+    }
+
+    // the whole transaction is clocked without the GIL
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = softi2c_transfer(id, addr, wr.buf, wr.buf ? wr.len : 0, (uint8_t *)PyBytes_AS_STRING(rx), rlen);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (wr.buf != NULL)
+        PyBuffer_Release(&wr);
+    if (result < 0) {
         char err[2000];
-        snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
+        Py_DECREF(rx);
+        snprintf(err, sizeof(err), "Error in software I2C transfer (%s)", get_error_msg());
+        PyErr_SetString(PyExc_IOError, err);
+        return NULL;
+    }
+
+    return rx;
+}
+
+// python function i2c_close(handle)
+static PyObject *py_i2c_close(PyObject *self, PyObject *args)
+{
+    int id;
+    int result;
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTuple(args, "i", &id))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = softi2c_close(id);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error closing software I2C bus (%s)", get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
         return NULL;
-    } else if (allowed == 0) {
+    }
+
+    Py_RETURN_NONE;
+}
+
+// python function handle = uart_open(tx=None, rx=None, baudrate=9600, bytesize=8, parity='N', stopbits=1)
+static PyObject *py_uart_open(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    char *tx = NULL;
+    char *rx = NULL;
+    char *parity = "N";
+    int baud = 9600;
+    int id;
+    struct softuart_config cfg;
+    static char *kwlist[] = {"tx", "rx", "baudrate", "bytesize", "parity", "stopbits", NULL};
+
+    clear_error_msg();
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.data_bits = 8;
+    cfg.stop_bits = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|zziisi", kwlist, &tx, &rx, &baud, &cfg.data_bits, &parity, &cfg.stop_bits))
+        return NULL;
+
+    if (baud <= 0) {
+        PyErr_SetString(PyExc_ValueError, "baudrate must be positive");
+        return NULL;
+    }
+    cfg.baud = (unsigned int)baud;
+    if (strcmp(parity, "N") == 0) {
+        cfg.parity = SOFTUART_PARITY_NONE;
+    } else if (strcmp(parity, "O") == 0) {
+        cfg.parity = SOFTUART_PARITY_ODD;
+    } else if (strcmp(parity, "E") == 0) {
+        cfg.parity = SOFTUART_PARITY_EVEN;
+    } else {
+        PyErr_SetString(PyExc_ValueError, "parity must be 'N', 'E' or 'O'");
+        return NULL;
+    }
+
+    if (get_softbus_gpio(tx, &cfg.tx) < 0 || get_softbus_gpio(rx, &cfg.rx) < 0)
+        return NULL;
+    // the receiver decodes the rx channel's edges
+    if (rx != NULL && !gpio_edge_capable(cfg.rx)) {
+        PyErr_SetString(PyExc_ValueError, "rx must be AP-EINT1, AP-EINT3 or XIO-P0 to XIO-P7, edge detection is only available there");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    id = softuart_open(&cfg);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (id < 0) {
         char err[2000];
-        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
+        snprintf(err, sizeof(err), "Error opening software UART (%s)", get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
         return NULL;
     }
 
-   // check to ensure gpio is one of the allowed pins
-   if (gpio != lookup_gpio_by_name("AP-EINT3")
-       && gpio != lookup_gpio_by_name("AP-EINT1")
-       && !(gpio >= lookup_gpio_by_name("XIO-P0") && gpio <= lookup_gpio_by_name("XIO-P7"))) {
-     PyErr_SetString(PyExc_ValueError, "Edge Detection currently available on AP-EINT1, AP-EINT3, and XIO-P0 to XIO-P7 only");
-     return NULL;
-   }
+    return Py_BuildValue("i", id);
+}
 
-   // remove all python callbacks for gpio
-   while (cb != NULL)
-   {
-      if (cb->gpio == gpio)
-      {
-         Py_XDECREF(cb->py_cb);
-         if (prev == NULL)
-            py_callbacks = cb->next;
-         else
-            prev->next = cb->next;
-         temp = cb;
-         cb = cb->next;
-         free(temp);
-      } else {
-         prev = cb;
-         cb = cb->next;
-      }
-   }
+// python function count = uart_write(handle, data)
+static PyObject *py_uart_write(PyObject *self, PyObject *args)
+{
+    int id;
+    int result;
+    Py_buffer data;
 
-   remove_edge_detect(gpio);
+    clear_error_msg();
 
-   Py_RETURN_NONE;
+    if (!PyArg_ParseTuple(args, "is*", &id, &data))
+        return NULL;
+
+    // returns once the last stop bit is out
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = softuart_write(id, data.buf, data.len);
+    Py_END_ALLOW_THREADS   // enable GIL
+    PyBuffer_Release(&data);
+    if (result < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error writing to software UART (%s)", get_error_msg());
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    return Py_BuildValue("n", data.len);
 }
 
-// python function value = event_detected(channel)
-static PyObject *py_event_detected(PyObject *self, PyObject *args)
+// python function data = uart_read(handle, size=1, timeout=0)
+static PyObject *py_uart_read(PyObject *self, PyObject *args, PyObject *kwargs)
 {
-   int gpio;
-   char *channel;
-   int allowed = -1;
+    int id;
+    int size = 1;
+    int timeout = 0;
+    int result;
+    PyObject *data;
+    static char *kwlist[] = {"handle", "size", "timeout", NULL};
 
-   clear_error_msg();
+    clear_error_msg();
 
-   if (!PyArg_ParseTuple(args, "s", &channel))
-      return NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|ii", kwlist, &id, &size, &timeout))
+        return NULL;
 
-   if (get_gpio_number(channel, &gpio)) {
-       PyErr_SetString(PyExc_ValueError, "Invalid channel");
-       return NULL;
-   }
+    if (size < 0) {
+        PyErr_SetString(PyExc_ValueError, "size must be a number of bytes");
+        return NULL;
+    }
 
-    // Check to see if GPIO is allowed on the hardware
-    // A 1 means we're good to go
-    allowed = gpio_allowed(gpio);
-    if (allowed == -1) {
+    data = PyBytes_FromStringAndSize(NULL, size);
+    if (data == NULL)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = softuart_read(id, (uint8_t *)PyBytes_AS_STRING(data), size, timeout);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
         char err[2000];
-        snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
+        Py_DECREF(data);
+        snprintf(err, sizeof(err), "Error reading from software UART (%s)", get_error_msg());
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+    if (result < size && _PyBytes_Resize(&data, result) < 0)
+        return NULL;
+
+    return data;
+}
+
+// python function count = uart_in_waiting(handle)
+static PyObject *py_uart_in_waiting(PyObject *self, PyObject *args)
+{
+    int id;
+    int count;
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTuple(args, "i", &id))
+        return NULL;
+
+    if ((count = softuart_waiting(id)) < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error reading software UART (%s)", get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
         return NULL;
-    } else if (allowed == 0) {
+    }
+
+    return Py_BuildValue("i", count);
+}
+
+// python function stats = uart_get_stats(handle, reset=False)
+static PyObject *py_uart_get_stats(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int id;
+    int reset = 0;
+    struct softuart_stats stats;
+    static char *kwlist[] = {"handle", "reset", NULL};
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|i", kwlist, &id, &reset))
+        return NULL;
+
+    if (softuart_get_stats(id, &stats, reset) < 0) {
         char err[2000];
-        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
+        snprintf(err, sizeof(err), "Error reading software UART (%s)", get_error_msg());
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+
+    return Py_BuildValue("{s:k,s:k,s:k,s:k,s:k}",
+                         "received", stats.received,
+                         "framing", stats.framing,
+                         "parity", stats.parity,
+                         "overruns", stats.overruns,
+                         "noise", stats.noise);
+}
+
+// python function uart_close(handle)
+static PyObject *py_uart_close(PyObject *self, PyObject *args)
+{
+    int id;
+    int result;
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTuple(args, "i", &id))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = softuart_close(id);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error closing software UART (%s)", get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
         return NULL;
     }
 
-   if (event_detected(gpio))
-      Py_RETURN_TRUE;
-   else
-      Py_RETURN_FALSE;
+    Py_RETURN_NONE;
+}
+
+// python function handle = ow_open(channel)
+static PyObject *py_ow_open(PyObject *self, PyObject *args)
+{
+    char *channel;
+    int gpio;
+    int id;
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTuple(args, "s", &channel))
+        return NULL;
+
+    if (get_softbus_gpio(channel, &gpio) < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    id = onewire_open(gpio);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (id < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error opening 1-Wire bus (%s)", get_error_msg());
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+
+    return Py_BuildValue("i", id);
+}
+
+// python function present = ow_reset(handle)
+static PyObject *py_ow_reset(PyObject *self, PyObject *args)
+{
+    int id;
+    int result;
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTuple(args, "i", &id))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = onewire_reset(id);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error resetting 1-Wire bus (%s)", get_error_msg());
+        PyErr_SetString(PyExc_IOError, err);
+        return NULL;
+    }
+
+    return PyBool_FromLong(result);
+}
+
+// Fills roms from a sequence of ints.  Returns the count, -1 with a Python
+// exception set
+static int get_onewire_roms(PyObject *list, uint64_t *roms, int max)
+{
+    PyObject *seq;
+    Py_ssize_t i, count;
+
+    seq = PySequence_Fast(list, "roms must be a sequence of ints");
+    if (seq == NULL)
+        return -1;
+    count = PySequence_Fast_GET_SIZE(seq);
+    if (count > max) {
+        char err[2000];
+        Py_DECREF(seq);
+        snprintf(err, sizeof(err), "At most %d roms at a time", max);
+        PyErr_SetString(PyExc_ValueError, err);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        roms[i] = PyLong_AsUnsignedLongLong(PySequence_Fast_GET_ITEM(seq, i));
+        if (PyErr_Occurred()) {
+            Py_DECREF(seq);
+            return -1;
+        }
+    }
+    Py_DECREF(seq);
+
+    return (int)count;
+}
+
+// python function roms = ow_search(handle)
+static PyObject *py_ow_search(PyObject *self, PyObject *args)
+{
+    int id;
+    int i, count;
+    uint64_t roms[ONEWIRE_SEARCH_MAX];
+    PyObject *list;
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTuple(args, "i", &id))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    count = onewire_search(id, roms, ONEWIRE_SEARCH_MAX);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (count < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error searching 1-Wire bus (%s)", get_error_msg());
+        PyErr_SetString(PyExc_IOError, err);
+        return NULL;
+    }
+    if (count > ONEWIRE_SEARCH_MAX)
+        count = ONEWIRE_SEARCH_MAX;
+
+    list = PyList_New(count);
+    if (list == NULL)
+        return NULL;
+    for (i = 0; i < count; i++)
+        PyList_SET_ITEM(list, i, PyLong_FromUnsignedLongLong(roms[i]));
+
+    return list;
+}
+
+// python function ow_select(handle, rom=None)
+static PyObject *py_ow_select(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int id;
+    int result;
+    PyObject *romobj = Py_None;
+    uint64_t rom;
+    static char *kwlist[] = {"handle", "rom", NULL};
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|O", kwlist, &id, &romobj))
+        return NULL;
+
+    if (romobj != Py_None) {
+        rom = PyLong_AsUnsignedLongLong(romobj);
+        if (PyErr_Occurred())
+            return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = onewire_select(id, romobj == Py_None ? NULL : &rom);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error selecting on 1-Wire bus (%s)", get_error_msg());
+        PyErr_SetString(PyExc_IOError, err);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// python function ow_write(handle, data)
+static PyObject *py_ow_write(PyObject *self, PyObject *args)
+{
+    int id;
+    int result;
+    Py_buffer data;
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTuple(args, "is*", &id, &data))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = onewire_write(id, data.buf, data.len);
+    Py_END_ALLOW_THREADS   // enable GIL
+    PyBuffer_Release(&data);
+    if (result < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error writing to 1-Wire bus (%s)", get_error_msg());
+        PyErr_SetString(PyExc_IOError, err);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// python function data = ow_read(handle, size)
+static PyObject *py_ow_read(PyObject *self, PyObject *args)
+{
+    int id;
+    int size;
+    int result;
+    PyObject *data;
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTuple(args, "ii", &id, &size))
+        return NULL;
+
+    if (size < 0) {
+        PyErr_SetString(PyExc_ValueError, "size must be a number of bytes");
+        return NULL;
+    }
+
+    data = PyBytes_FromStringAndSize(NULL, size);
+    if (data == NULL)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = onewire_read(id, (uint8_t *)PyBytes_AS_STRING(data), size);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
+        char err[2000];
+        Py_DECREF(data);
+        snprintf(err, sizeof(err), "Error reading from 1-Wire bus (%s)", get_error_msg());
+        PyErr_SetString(PyExc_IOError, err);
+        return NULL;
+    }
+
+    return data;
+}
+
+// python function ow_convert_all(handle, poll=True)
+static PyObject *py_ow_convert_all(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int id;
+    int poll = 1;
+    int result;
+    static char *kwlist[] = {"handle", "poll", NULL};
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|i", kwlist, &id, &poll))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = onewire_convert_all(id, poll);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error converting on 1-Wire bus (%s)", get_error_msg());
+        PyErr_SetString(PyExc_IOError, err);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// python function temps = ow_read_temperatures(handle, roms=None, poll=True)
+static PyObject *py_ow_read_temperatures(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int id;
+    int poll = 1;
+    int i, count = 0;
+    int result = 0;
+    PyObject *list = Py_None;
+    PyObject *temps, *key, *value;
+    uint64_t roms[ONEWIRE_SEARCH_MAX];
+    double temp[ONEWIRE_SEARCH_MAX];
+    int valid[ONEWIRE_SEARCH_MAX];
+    static char *kwlist[] = {"handle", "roms", "poll", NULL};
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|Oi", kwlist, &id, &list, &poll))
+        return NULL;
+
+    if (list != Py_None && (count = get_onewire_roms(list, roms, ONEWIRE_SEARCH_MAX)) < 0)
+        return NULL;
+
+    // search, one conversion for the whole bus and the scratchpads in one go
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    if (list == Py_None) {
+        count = onewire_search(id, roms, ONEWIRE_SEARCH_MAX);
+        if (count > ONEWIRE_SEARCH_MAX)
+            count = ONEWIRE_SEARCH_MAX;
+    }
+    if (count < 0 || onewire_convert_all(id, poll) < 0 ||
+        onewire_read_temperatures(id, roms, count, temp, valid) < 0)
+        result = -1;
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error reading 1-Wire temperatures (%s)", get_error_msg());
+        PyErr_SetString(PyExc_IOError, err);
+        return NULL;
+    }
+
+    temps = PyDict_New();
+    if (temps == NULL)
+        return NULL;
+    for (i = 0; i < count; i++) {
+        key = PyLong_FromUnsignedLongLong(roms[i]);
+        if (valid[i]) {
+            value = PyFloat_FromDouble(temp[i]);
+        } else {
+            Py_INCREF(Py_None);
+            value = Py_None;
+        }
+        if (key == NULL || value == NULL || PyDict_SetItem(temps, key, value) < 0) {
+            Py_XDECREF(key);
+            Py_XDECREF(value);
+            Py_DECREF(temps);
+            return NULL;
+        }
+        Py_DECREF(key);
+        Py_DECREF(value);
+    }
+
+    return temps;
+}
+
+// python function ow_close(handle)
+static PyObject *py_ow_close(PyObject *self, PyObject *args)
+{
+    int id;
+    int result;
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTuple(args, "i", &id))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = onewire_close(id);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error closing 1-Wire bus (%s)", get_error_msg());
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// python function (humidity, temperature, retries) = dht_read(channel, sensor=DHT22, retries=3)
+static PyObject *py_dht_read(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    char *channel;
+    int sensor = DHT22;
+    int retries = 3;
+    int gpio;
+    int result;
+    struct dht_reading reading;
+    static char *kwlist[] = {"channel", "sensor", "retries", NULL};
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|ii", kwlist, &channel, &sensor, &retries))
+        return NULL;
+
+    if (sensor != DHT11 && sensor != DHT22) {
+        PyErr_SetString(PyExc_ValueError, "sensor must be DHT11, DHT22 or AM2302");
+        return NULL;
+    }
+    if (retries < 0) {
+        PyErr_SetString(PyExc_ValueError, "retries must be 0 or more");
+        return NULL;
+    }
+
+    if (get_softbus_gpio(channel, &gpio) < 0)
+        return NULL;
+
+    // start pulse, capture and any retries, up to a few seconds
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = dht_read(gpio, sensor, retries, &reading);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error reading DHT%d on %s (%s)", sensor, channel, get_error_msg());
+        PyErr_SetString(PyExc_IOError, err);
+        return NULL;
+    }
+
+    return Py_BuildValue("(ddi)", reading.humidity, reading.temperature, reading.retries);
+}
+
+// The dispatcher thread holds the GIL for a whole batch of callbacks
+static PyGILState_STATE dispatch_gstate;
+
+// py_callbacks removed while a batch runs, the batch may still be calling
+// them (a callback removing its own channel, or one that lets go of the GIL).
+// Only touched with the GIL held, freed when the batch is over.
+static int dispatch_busy = 0;
+static struct py_callback *py_callbacks_retired = NULL;
+
+static void free_py_callback(struct py_callback *cb)
+{
+   if (dispatch_busy) {
+      cb->next = py_callbacks_retired;
+      py_callbacks_retired = cb;
+      return;
+   }
+   Py_XDECREF(cb->py_cb);
+   free(cb);
+}
+
+static void dispatch_enter_python(void)
+{
+   dispatch_gstate = PyGILState_Ensure();
+   dispatch_busy = 1;
+}
+
+static void dispatch_leave_python(void)
+{
+   struct py_callback *cb;
+
+   dispatch_busy = 0;
+   while (py_callbacks_retired != NULL)
+   {
+      cb = py_callbacks_retired;
+      py_callbacks_retired = cb->next;
+      free_py_callback(cb);
+   }
+   PyGILState_Release(dispatch_gstate);
+}
+
+// data is the py_callback registered with add_edge_callback(), runs on the
+// dispatcher thread with the GIL held
+static void run_py_callback(int gpio, void* data)
+{
+   PyObject *result;
+   PyObject *func;
+   struct py_callback *cb = data;
+
+   clear_error_msg();
+   gpio_event_stats_mark(gpio, STAT_CALLBACK);
+
+   // set_watchdog() may swap cb->py_cb while it runs
+   func = cb->py_cb;
+   Py_INCREF(func);
+
+   // bouncing edges were already dropped by the C debounce
+   result = PyObject_CallFunction(func, "s", cb->channel);
+
+   if (result == NULL && PyErr_Occurred())
+   {
+      PyErr_Print();
+      PyErr_Clear();
+   }
+   Py_XDECREF(result);
+   Py_DECREF(func);
+}
+
+// bouncetime (ms) of add_event_detect()/add_event_callback() is the lockout
+// of the channel's C debounce, the stable time is left alone
+static int set_py_bouncetime(int gpio, unsigned int bouncetime)
+{
+   struct debounce_info info;
+
+   if (bouncetime == 0)
+      return 0;
+
+   gpio_get_debounce(gpio, &info);
+   if (gpio_set_debounce(gpio, bouncetime * 1000, info.stable_us) < 0)
+   {
+      char err[2000];
+      snprintf(err, sizeof(err), "Could not set bouncetime (%s)", get_error_msg());
+      PyErr_SetString(PyExc_RuntimeError, err);
+      return -1;
+   }
+   return 0;
+}
+
+static int add_py_callback(char *channel, int gpio, int edge, PyObject *cb_func)
+{
+   struct py_callback *new_py_cb;
+   struct py_callback *cb = py_callbacks;
+
+   clear_error_msg();
+
+   // add callback to py_callbacks list
+   new_py_cb = malloc(sizeof(struct py_callback));
+   if (new_py_cb == 0)
+   {
+      PyErr_NoMemory();
+      return -1;
+   }
+   new_py_cb->py_cb = cb_func;
+   Py_XINCREF(cb_func);         // Add a reference to new callback
+   memset(new_py_cb->channel, 0, sizeof(new_py_cb->channel));
+   strncpy(new_py_cb->channel, channel, sizeof(new_py_cb->channel) - 1);
+   new_py_cb->gpio = gpio;
+   new_py_cb->edge = edge;
+   new_py_cb->next = NULL;
+   if (add_edge_callback(gpio, edge, run_py_callback, new_py_cb) < 0)
+   {
+      char err[2000];
+      snprintf(err, sizeof(err), "Could not add callback (%s)", get_error_msg());
+      PyErr_SetString(PyExc_RuntimeError, err);
+      Py_XDECREF(cb_func);
+      free(new_py_cb);
+      return -1;
+   }
+   if (py_callbacks == NULL) {
+      py_callbacks = new_py_cb;
+   } else {
+      // add to end of list
+      while (cb->next != NULL)
+         cb = cb->next;
+      cb->next = new_py_cb;
+   }
+   return 0;
+}
+
+// python function add_event_callback(gpio, callback, bouncetime=0)
+static PyObject *py_add_event_callback(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   int gpio;
+   char *channel;
+   int allowed = -1;
+   unsigned int bouncetime = 0;
+   PyObject *cb_func;
+   char *kwlist[] = {"gpio", "callback", "bouncetime", NULL};
+
+   clear_error_msg();
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sO|i", kwlist, &channel, &cb_func, &bouncetime))
+      return NULL;
+
+   if (!PyCallable_Check(cb_func))
+   {
+      PyErr_SetString(PyExc_TypeError, "Parameter must be callable");
+      return NULL;
+   }
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    // Check to see if GPIO is allowed on the hardware
+    // A 1 means we're good to go
+    allowed = gpio_allowed(gpio);
+    if (allowed == -1) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    } else if (allowed == 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+
+   // check to ensure gpio is one of the allowed pins
+   if (gpio != lookup_gpio_by_name("AP-EINT3")
+       && gpio != lookup_gpio_by_name("AP-EINT1")
+       && !(gpio >= lookup_gpio_by_name("XIO-P0") && gpio <= lookup_gpio_by_name("XIO-P7"))) {
+     PyErr_SetString(PyExc_ValueError, "Callbacks currently available on AP-EINT1, AP-EINT3, and XIO-P0 to XIO-P7 only");
+     return NULL;
+   }
+
+   // check channel is set up as an input
+   if (!module_setup || gpio_get_setup_direction(gpio) != INPUT)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an input first");
+      return NULL;
+   }
+
+   if (!gpio_is_evented(gpio))
+   {
+      PyErr_SetString(PyExc_RuntimeError, "Add event detection using add_event_detect first before adding a callback");
+      return NULL;
+   }
+   if (set_py_bouncetime(gpio, bouncetime) < 0)
+      return NULL;
+
+   // Defaulting to Falling edge
+   if (add_py_callback(channel, gpio, 2, cb_func) != 0)
+      return NULL;
+
+   Py_RETURN_NONE;
+}
+
+// python function add_event_detect(gpio, edge, callback=None, bouncetime=0
+static PyObject *py_add_event_detect(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   int gpio;
+   char *channel;
+   int edge, result;
+   unsigned int bouncetime = 0;
+   int allowed = -1;
+   PyObject *cb_func = NULL;
+   char *kwlist[] = {"gpio", "edge", "callback", "bouncetime", NULL};
+
+   clear_error_msg();
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "si|Oi", kwlist, &channel, &edge, &cb_func, &bouncetime))
+      return NULL;
+
+   if (cb_func != NULL && !PyCallable_Check(cb_func))
+   {
+      PyErr_SetString(PyExc_TypeError, "Parameter must be callable");
+      return NULL;
+   }
+
+   if (get_gpio_number(channel, &gpio)) {
+       PyErr_SetString(PyExc_ValueError, "Invalid channel");
+       return NULL;
+   }
+
+    // Check to see if GPIO is allowed on the hardware
+    // A 1 means we're good to go
+    allowed = gpio_allowed(gpio);
+    if (allowed == -1) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    } else if (allowed == 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+
+   // check to ensure gpio is one of the allowed pins
+   if (gpio != lookup_gpio_by_name("AP-EINT3")
+       && gpio != lookup_gpio_by_name("AP-EINT1")
+       && !(gpio >= lookup_gpio_by_name("XIO-P0") && gpio <= lookup_gpio_by_name("XIO-P7"))) {
+     PyErr_SetString(PyExc_ValueError, "Edge Detection currently available on AP-EINT1, AP-EINT3, and XIO-P0 to XIO-P7 only");
+     return NULL;
+   }
+
+   // is edge valid value
+   if (edge != RISING_EDGE && edge != FALLING_EDGE && edge != BOTH_EDGE)
+   {
+      PyErr_SetString(PyExc_ValueError, "The edge must be set to RISING, FALLING or BOTH");
+      return NULL;
+   }
+
+   // check channel is set up as an input
+   if (!module_setup || gpio_get_setup_direction(gpio) != INPUT)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an input first");
+      return NULL;
+   }
+
+   Py_BEGIN_ALLOW_THREADS // disable GIL
+   result = add_edge_detect(gpio, edge);   // starts a thread
+   Py_END_ALLOW_THREADS   // enable GIL
+   if (result != 0)
+   {
+      if (result == 1)
+      {
+         PyErr_SetString(PyExc_RuntimeError, "Edge detection already enabled for this GPIO channel");
+         return NULL;
+      } else {
+         PyErr_SetString(PyExc_RuntimeError, "Failed to add edge detection");
+         return NULL;
+      }
+   }
+
+   if (set_py_bouncetime(gpio, bouncetime) < 0)
+      return NULL;
+
+   if (cb_func != NULL)
+      if (add_py_callback(channel, gpio, edge, cb_func) != 0)
+         return NULL;
+
+   Py_RETURN_NONE;
+}
+
+// python function remove_event_detect(gpio)
+static PyObject *py_remove_event_detect(PyObject *self, PyObject *args)
+{
+   int gpio;
+   char *channel;
+   struct py_callback *cb = py_callbacks;
+   struct py_callback *temp;
+   struct py_callback *prev = NULL;
+   int allowed = -1;
+
+   clear_error_msg();
+
+   if (!PyArg_ParseTuple(args, "s", &channel))
+      return NULL;
+
+   if (get_gpio_number(channel, &gpio)) {
+       PyErr_SetString(PyExc_ValueError, "Invalid channel");
+       return NULL;
+   }
+
+    // Check to see if GPIO is allowed on the hardware
+    // A 1 means we're good to go
+    allowed = gpio_allowed(gpio);
+    if (allowed == -1) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    } else if (allowed == 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+
+   // check to ensure gpio is one of the allowed pins
+   if (gpio != lookup_gpio_by_name("AP-EINT3")
+       && gpio != lookup_gpio_by_name("AP-EINT1")
+       && !(gpio >= lookup_gpio_by_name("XIO-P0") && gpio <= lookup_gpio_by_name("XIO-P7"))) {
+     PyErr_SetString(PyExc_ValueError, "Edge Detection currently available on AP-EINT1, AP-EINT3, and XIO-P0 to XIO-P7 only");
+     return NULL;
+   }
+
+   // stop the C callbacks first, they point at the python callbacks freed below
+   // (or retired until the dispatcher's batch is over)
+   Py_BEGIN_ALLOW_THREADS // disable GIL
+   remove_edge_detect(gpio);
+   Py_END_ALLOW_THREADS   // enable GIL
+
+   // remove all python callbacks for gpio, the list may have changed
+   // while the GIL was released
+   cb = py_callbacks;
+   while (cb != NULL)
+   {
+      if (cb->gpio == gpio)
+      {
+         if (prev == NULL)
+            py_callbacks = cb->next;
+         else
+            prev->next = cb->next;
+         temp = cb;
+         cb = cb->next;
+         free_py_callback(temp);
+      } else {
+         prev = cb;
+         cb = cb->next;
+      }
+   }
+
+   Py_RETURN_NONE;
+}
+
+// python function value = event_detected(channel)
+static PyObject *py_event_detected(PyObject *self, PyObject *args)
+{
+   int gpio;
+   char *channel;
+   int allowed = -1;
+
+   clear_error_msg();
+
+   if (!PyArg_ParseTuple(args, "s", &channel))
+      return NULL;
+
+   if (get_gpio_number(channel, &gpio)) {
+       PyErr_SetString(PyExc_ValueError, "Invalid channel");
+       return NULL;
+   }
+
+    // Check to see if GPIO is allowed on the hardware
+    // A 1 means we're good to go
+    allowed = gpio_allowed(gpio);
+    if (allowed == -1) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    } else if (allowed == 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+
+   if (event_detected(gpio))
+      Py_RETURN_TRUE;
+   else
+      Py_RETURN_FALSE;
+}
+
+// Checks that a channel can have edge detection for wait_for_edge() or
+// add_encoder(), sets a python exception and returns -1 if not
+static int check_edge_channel(char *channel, int *gpio)
+{
+    int allowed;
+
+    if (get_gpio_number(channel, gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return -1;
+    }
+
+    // Check to see if GPIO is allowed on the hardware
+    // A 1 means we're good to go
+    allowed = gpio_allowed(*gpio);
+    if (allowed == -1) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
+        PyErr_SetString(PyExc_ValueError, err);
+        return -1;
+    } else if (allowed == 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", *gpio);
+        PyErr_SetString(PyExc_ValueError, err);
+        return -1;
+    }
+
+    // check to ensure gpio is one of the allowed pins
+    if (!gpio_edge_capable(*gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Edge Detection currently available on AP-EINT1, AP-EINT3, and XIO-P0 to XIO-P7 only");
+        return -1;
+    }
+
+    // check channel is setup as an input
+    if (!module_setup || gpio_get_setup_direction(*gpio) != INPUT) {
+        PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an input first");
+        return -1;
+    }
+
+    return 0;
+}
+
+// python function channel = wait_for_edge(channels, edge, timeout=-1)
+static PyObject *py_wait_for_edge(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   int gpios[MAX_WAIT_GPIOS];
+   int edge, result, fired;
+   int timeout = -1;
+   int count, i;
+   char error[81];
+   PyObject *channels;
+   PyObject *items[MAX_WAIT_GPIOS];
+   static char *kwlist[] = {"channel", "edge", "timeout", NULL};
+
+   clear_error_msg();
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oi|i", kwlist, &channels, &edge, &timeout))
+      return NULL;
+
+   // a single channel name, or a list/tuple of them
+   if (PyList_Check(channels) || PyTuple_Check(channels)) {
+      count = PySequence_Size(channels);
+      if (count < 1 || count > MAX_WAIT_GPIOS) {
+         snprintf(error, sizeof(error), "Between 1 and %d channels can be waited on", MAX_WAIT_GPIOS); BUF2SMALL(error);
+         PyErr_SetString(PyExc_ValueError, error);
+         return NULL;
+      }
+      for (i = 0; i < count; i++)
+         items[i] = PySequence_Fast_GET_ITEM(channels, i);
+   } else {
+      count = 1;
+      items[0] = channels;
+   }
+
+   for (i = 0; i < count; i++) {
+      char *channel;
+#if PY_MAJOR_VERSION > 2
+      channel = PyUnicode_Check(items[i]) ? (char *)PyUnicode_AsUTF8(items[i]) : NULL;
+#else
+      channel = PyString_Check(items[i]) ? PyString_AsString(items[i]) : NULL;
+#endif
+      if (channel == NULL) {
+         PyErr_SetString(PyExc_ValueError, "Invalid channel");
+         return NULL;
+      }
+      if (check_edge_channel(channel, &gpios[i]) < 0)
+         return NULL;
+   }
+
+   // is edge a valid value?
+   if (edge != RISING_EDGE && edge != FALLING_EDGE && edge != BOTH_EDGE)
+   {
+      PyErr_SetString(PyExc_ValueError, "The edge must be set to RISING, FALLING or BOTH");
+      return NULL;
+   }
+
+   if (timeout < -1)
+   {
+      PyErr_SetString(PyExc_ValueError, "timeout must be -1 (wait forever) or a number of ms");
+      return NULL;
+   }
+
+   Py_BEGIN_ALLOW_THREADS // disable GIL
+   result = blocking_wait_for_edges(gpios, count, edge, timeout, &fired);
+   Py_END_ALLOW_THREADS   // enable GIL
+
+   if (result == 2) {
+      PyErr_SetString(PyExc_RuntimeError, "Edge detection events already enabled for this GPIO channel");
+      return NULL;
+   } else if (result != 0) {
+      snprintf(error, sizeof(error), "Error #%d waiting for edge", result); BUF2SMALL(error);
+      PyErr_SetString(PyExc_RuntimeError, error);
+      return NULL;
+   }
+
+   // hand back the channel object that fired, None on timeout
+   for (i = 0; i < count; i++) {
+      if (gpios[i] == fired) {
+         Py_INCREF(items[i]);
+         return items[i];
+      }
+   }
+
+   Py_RETURN_NONE;
+}
+
+// python function value = gpio_function(gpio)
+static PyObject *py_gpio_function(PyObject *self, PyObject *args)
+{
+    int gpio;
+    unsigned int value;
+    PyObject *func;
+    char *channel;
+    int allowed = -1;
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTuple(args, "s", &channel))
+       return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    // Check to see if GPIO is allowed on the hardware
+    // A 1 means we're good to go
+    allowed = gpio_allowed(gpio);
+    if (allowed == -1) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    } else if (allowed == 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+
+    if (setup_error)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Module not imported correctly!");
+        return NULL;
+    }
+
+    if (gpio_get_direction(gpio, &value) < 0) {
+      char err[1024];
+      snprintf(err, sizeof(err), "Could not get direction ('%s')", get_error_msg());
+      PyErr_SetString(PyExc_RuntimeError, err);
+      return NULL;
+    }
+    func = Py_BuildValue("i", value);
+    return func;
+}
+
+// python function setwarnings(state)
+static PyObject *py_setwarnings(PyObject *self, PyObject *args)
+{
+   clear_error_msg();
+
+   if (!PyArg_ParseTuple(args, "i", &gpio_warnings))
+      return NULL;
+
+   if (setup_error)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "Module not imported correctly!");
+      return NULL;
+   }
+
+   Py_RETURN_NONE;
+}
+
+// python function set_backend(backend)
+static PyObject *py_set_backend(PyObject *self, PyObject *args)
+{
+   int backend;
+
+   clear_error_msg();
+
+   if (!PyArg_ParseTuple(args, "i", &backend))
+      return NULL;
+
+   if (backend != BACKEND_SYSFS && backend != BACKEND_CDEV)
+   {
+      PyErr_SetString(PyExc_ValueError, "The backend must be set to BACKEND_SYSFS or BACKEND_CDEV");
+      return NULL;
+   }
+
+   if (gpio_set_backend(backend) < 0) {
+      char err[2000];
+      snprintf(err, sizeof(err), "Could not select GPIO backend (%s)", get_error_msg());
+      PyErr_SetString(PyExc_RuntimeError, err);
+      return NULL;
+   }
+
+   Py_RETURN_NONE;
+}
+
+// python function backend = get_backend()
+static PyObject *py_get_backend(PyObject *self, PyObject *args)
+{
+   return Py_BuildValue("i", gpio_get_backend());
+}
+
+// python function set_pio_mode(enable)
+static PyObject *py_set_pio_mode(PyObject *self, PyObject *args)
+{
+   int enable;
+
+   clear_error_msg();
+
+   if (!PyArg_ParseTuple(args, "i", &enable))
+      return NULL;
+
+   if (enable && !r8_mem_setup) {
+      init_r8_gpio_mem();
+      if (!r8_mem_setup)
+         return NULL;
+   }
+
+   if (gpio_set_pio_mode(enable) < 0) {
+      char err[2000];
+      snprintf(err, sizeof(err), "Could not change PIO mode (%s)", get_error_msg());
+      PyErr_SetString(PyExc_RuntimeError, err);
+      return NULL;
+   }
+
+   Py_RETURN_NONE;
+}
+
+// python function enabled = get_pio_mode()
+static PyObject *py_get_pio_mode(PyObject *self, PyObject *args)
+{
+   if (gpio_get_pio_mode())
+      Py_RETURN_TRUE;
+   else
+      Py_RETURN_FALSE;
+}
+
+// python function base = get_xio_base()
+static PyObject *py_gpio_base(PyObject *self, PyObject *args)
+{
+   unsigned int value;
+   PyObject *py_value;
+
+   clear_error_msg();
+
+   value = get_xio_base();
+   if (value <= 0) {
+      char err[1024];
+      snprintf(err, sizeof(err), "Could not get XIO base ('%s')", get_error_msg());
+      PyErr_SetString(PyExc_RuntimeError, err);
+      return NULL;
+   }
+   py_value = Py_BuildValue("i", value);
+
+   return py_value;
+}
+
+// Internal unit tests
+extern pins_t pins_info[];
+static PyObject *py_selftest(PyObject *self, PyObject *args)
+{
+  int input;
+
+  clear_error_msg();
+
+  if (!PyArg_ParseTuple(args, "i", &input))
+    return NULL;
+
+  printf("Testing get_xio_base\n");
+  int first_base = get_xio_base();  ASSRT(first_base > 0);
+  int second_base = get_xio_base();  ASSRT(second_base == first_base);
+  printf("base=%d\n", first_base);
+
+  printf("Testing lookup_gpio_by_key\n");
+  ASSRT(-1 == lookup_gpio_by_key("U13_1"));
+  ASSRT(48 == lookup_gpio_by_key("U13_9"));
+  ASSRT(47 == lookup_gpio_by_key("U13_11"));
+  ASSRT(first_base == lookup_gpio_by_key("U14_13"));
+  ASSRT((first_base+1) == lookup_gpio_by_key("U14_14"));
+  ASSRT((first_base+6) == lookup_gpio_by_key("U14_19"));
+  ASSRT((first_base+7) == lookup_gpio_by_key("U14_20"));
+  ASSRT(193 == lookup_gpio_by_key("U14_23"));
+  ASSRT(139 == lookup_gpio_by_key("U14_38"));
+  ASSRT(-1 == lookup_gpio_by_key("U14_40"));
+  ASSRT(-1 == lookup_gpio_by_key("NOTFOUND"));
+  ASSRT(-1 == lookup_gpio_by_key("U14_"));
+  ASSRT(-1 == lookup_gpio_by_key("U14_4000"));
+
+  printf("Testing lookup_gpio_by_name\n");
+  ASSRT(-1 == lookup_gpio_by_name("GND"));
+  ASSRT(48 == lookup_gpio_by_name("TWI1-SDA"));
+  ASSRT(47 == lookup_gpio_by_name("TWI1-SCK"));
+  ASSRT(first_base == lookup_gpio_by_name("XIO-P0"));
+  ASSRT((first_base+6) == lookup_gpio_by_name("XIO-P6"));
+  ASSRT((first_base+7) == lookup_gpio_by_name("XIO-P7"));
+  ASSRT(139 == lookup_gpio_by_name("CSID7"));
+  ASSRT(-1 == lookup_gpio_by_name("NOTFOUND"));
+  ASSRT(-1 == lookup_gpio_by_name("CSID"));
+  ASSRT(-1 == lookup_gpio_by_name("CSID777"));
+
+  printf("Testing lookup_ain_by_key\n");
+  ASSRT(-1 == lookup_ain_by_key("U14_1"));
+  ASSRT(0 == lookup_ain_by_key("U14_11"));
+  ASSRT(-1 == lookup_ain_by_key("NOTFOUND"));
+  ASSRT(-1 == lookup_ain_by_key("U14_"));
+  ASSRT(-1 == lookup_ain_by_key("U14_1111"));
+
+  printf("Testing lookup_ain_by_name\n");
+  ASSRT(-1 == lookup_ain_by_name("GND"));
+  ASSRT(0 == lookup_ain_by_name("LRADC"));
+  ASSRT(-1 == lookup_ain_by_name("NOTFOUND"));
+  ASSRT(-1 == lookup_ain_by_name("LR"));
+  ASSRT(-1 == lookup_ain_by_name("LRADCCC"));
+
+  char k[9];
+
+  printf("Testing copy_key_by_key\n");
+  ASSRT(1 == copy_key_by_key("U13_1", k)); BUF2SMALL(k); ASSRT(0 == strcmp("U13_1", k));
+  ASSRT(1 == copy_key_by_key("U14_40", k)); BUF2SMALL(k); ASSRT(0 == strcmp("U14_40", k));
+  ASSRT(0 == copy_key_by_key("NOTFOUND", k));
+  ASSRT(0 == copy_key_by_key("U14_", k));
+  ASSRT(0 == copy_key_by_key("U14_4000", k));
+
+  printf("Testing copy_pwm_key_by_key\n");
+  ASSRT(1 == copy_pwm_key_by_key("U13_18", k)); BUF2SMALL(k); ASSRT(0 == strcmp("U13_18", k));
+  ASSRT(0 == copy_pwm_key_by_key("U13_1", k));
+  ASSRT(0 == copy_pwm_key_by_key("U14_40", k));
+  ASSRT(0 == copy_pwm_key_by_key("NOTFOUND", k));
+  ASSRT(0 == copy_pwm_key_by_key("U13_", k));
+  ASSRT(0 == copy_pwm_key_by_key("U13_1888", k));
+
+  printf("Testing get_key_by_name\n");
+  ASSRT(1 == get_key_by_name("GND", k)); BUF2SMALL(k); ASSRT(0 == strcmp("U13_1", k));
+  ASSRT(1 == get_key_by_name("CSID7", k)); BUF2SMALL(k); ASSRT(0 == strcmp("U14_38", k));
+  ASSRT(0 == get_key_by_name("NOTFOUND", k));
+  ASSRT(0 == get_key_by_name("CSID", k));
+  ASSRT(0 == get_key_by_name("CSID777", k));
+
+  printf("Testing get_pwm_key_by_name\n");
+  ASSRT(1 == get_pwm_key_by_name("PWM0", k)); BUF2SMALL(k); ASSRT(0 == strcmp("U13_18", k));
+  ASSRT(0 == get_pwm_key_by_name("NOTFOUND", k));
+  ASSRT(0 == get_pwm_key_by_name("PWM", k));
+  ASSRT(0 == get_pwm_key_by_name("PWM000", k));
+
+  char fp[80];
+
+  printf("Testing build_path\n");
+  ASSRT(1 == build_path("/home", "ch", fp, sizeof(fp)));  ASSRT(0 == strcmp("/home/chip", fp));
+  ASSRT(1 == build_path("/home", "chip", fp, sizeof(fp)));  ASSRT(0 == strcmp("/home/chip", fp));
+  ASSRT(0 == build_path("/home", "NOTFOUND", fp, sizeof(fp)));
+  ASSRT(0 == build_path("/home", "chipp", fp, sizeof(fp)));
+  ASSRT(0 == build_path("/home", "ip", fp, sizeof(fp)));
+  ASSRT(0 == build_path("/NOTFOUND", "ch", fp, sizeof(fp)));
+
+  printf("Testing error message buffer\n");
+  clear_error_msg();
+  ASSRT(0 == strlen(get_error_msg()));
+  char *s100 = "1234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890";
+  add_error_msg(s100);  ASSRT(100 == strlen(get_error_msg()));
+  // Subsequent messages added include a newline separator.
+  add_error_msg(s100);  add_error_msg(s100);  add_error_msg(s100);  ASSRT(403 == strlen(get_error_msg()));
+  add_error_msg(s100);  add_error_msg(s100);  add_error_msg(s100);  ASSRT(706 == strlen(get_error_msg()));
+  add_error_msg(s100);  add_error_msg(s100);  add_error_msg(s100);  ASSRT(1009 == strlen(get_error_msg()));
+  add_error_msg(s100);  add_error_msg(s100);  add_error_msg(s100);  ASSRT(1023 == strlen(get_error_msg()));
+
+  printf("Testing dynamic integer array\n");
+  dyn_int_array_t *my_array = NULL;
+  ASSRT(-2 == dyn_int_array_get(&my_array, 29, -2));  ASSRT(my_array->num_elements == 45);
+  dyn_int_array_set(&my_array, 44, 3, -2);            ASSRT(my_array->num_elements == 45);
+  ASSRT(3 == dyn_int_array_get(&my_array, 44, -2));   ASSRT(my_array->num_elements == 45);
+  dyn_int_array_set(&my_array, 45, 6, -2);            ASSRT(my_array->num_elements == 69);
+  ASSRT(6 == dyn_int_array_get(&my_array, 45, -2));   ASSRT(my_array->num_elements == 69);
+  dyn_int_array_delete(&my_array);
+
+  int value = input;
+
+  PyObject *py_value = Py_BuildValue("i", value);
+  return py_value;
+}
+
+// Internal unit tests for the PIO register paths, needs no hardware
+static PyObject *py_selftest_pio(PyObject *self, PyObject *args)
+{
+  clear_error_msg();
+
+  pio_selftest();
+
+  Py_RETURN_NONE;
+}
+
+// python function events = read_events(channel=None, max=0)
+static PyObject *py_read_events(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int gpio = -1;
+    char *channel = NULL;
+    int max = 0;
+    int n, i;
+    struct gpio_event events[64];
+    PyObject *list, *item;
+    static char *kwlist[] = {"channel", "max", NULL};
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|zi", kwlist, &channel, &max))
+        return NULL;
+
+    if (max < 0) {
+        PyErr_SetString(PyExc_ValueError, "max must be 0 (everything queued) or more");
+        return NULL;
+    }
+
+    if (channel != NULL && get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    // a full drain re-arms event_fileno(), edges from here on wake it again
+    if (channel == NULL && max == 0)
+        gpio_event_fd_ack();
+
+    if ((list = PyList_New(0)) == NULL)
+        return NULL;
+
+    do {
+        int want = ARRAY_SIZE(events);
+        if (max > 0 && max - PyList_GET_SIZE(list) < want)
+            want = max - PyList_GET_SIZE(list);
+        if (channel != NULL)
+            n = gpio_read_events(gpio, events, want);
+        else
+            n = gpio_read_all_events(events, want);
+
+        for (i = 0; i < n; i++) {
+            const char *name = channel;
+            if (name == NULL && (name = lookup_name_by_gpio(events[i].gpio)) == NULL)
+                item = Py_BuildValue("(iIKII)", events[i].gpio, events[i].edge,
+                                     (unsigned long long)events[i].timestamp, events[i].level, events[i].count);
+            else
+                item = Py_BuildValue("(sIKII)", name, events[i].edge,
+                                     (unsigned long long)events[i].timestamp, events[i].level, events[i].count);
+            if (item == NULL || PyList_Append(list, item) < 0) {
+                Py_XDECREF(item);
+                Py_DECREF(list);
+                return NULL;
+            }
+            Py_DECREF(item);
+        }
+    } while (n == ARRAY_SIZE(events) && (max == 0 || PyList_GET_SIZE(list) < max));
+
+    return list;
+}
+
+// python function count = get_event_overflows(channel=None)
+static PyObject *py_get_event_overflows(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int gpio = -1;
+    char *channel = NULL;
+    static char *kwlist[] = {"channel", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|z", kwlist, &channel))
+        return NULL;
+
+    if (channel != NULL && get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    return Py_BuildValue("k", gpio_event_overflows(gpio));
+}
+
+// python function start_measure(channel, window=100)
+static PyObject *py_start_measure(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int gpio;
+    char *channel;
+    int window = 100;
+    static char *kwlist[] = {"channel", "window", NULL};
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|i", kwlist, &channel, &window))
+        return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    if (window <= 0 || window > 4000000) {
+        PyErr_SetString(PyExc_ValueError, "window must be between 1 and 4000000 ms");
+        return NULL;
+    }
+
+    if (!gpio_is_evented(gpio)) {
+        PyErr_SetString(PyExc_RuntimeError, "Add event detection using add_event_detect first before measuring");
+        return NULL;
+    }
+
+    if (gpio_start_measure(gpio, (unsigned int)window * 1000) < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Could not start measuring channel %s (%s)", channel, get_error_msg());
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// python function info = read_measure(channel)
+static PyObject *py_read_measure(PyObject *self, PyObject *args)
+{
+    int gpio;
+    char *channel;
+    struct measure_info info;
+    PyObject *duty;
+
+    if (!PyArg_ParseTuple(args, "s", &channel))
+        return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    if (gpio_read_measure(gpio, &info) < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Channel is not being measured, call start_measure first");
+        return NULL;
+    }
+
+    if (info.duty < 0) {
+        Py_INCREF(Py_None);
+        duty = Py_None;
+    } else {
+        duty = PyFloat_FromDouble(info.duty);
+    }
+
+    return Py_BuildValue("{s:d,s:K,s:K,s:N,s:k,s:k,s:I,s:K}",
+                         "frequency", info.frequency,
+                         "period", (unsigned long long)info.period_ns,
+                         "high", (unsigned long long)info.high_ns,
+                         "duty", duty,
+                         "samples", info.samples,
+                         "edges", info.edges,
+                         "window", info.window_us / 1000,
+                         "updated", (unsigned long long)info.updated);
+}
+
+// python function stop_measure(channel)
+static PyObject *py_stop_measure(PyObject *self, PyObject *args)
+{
+    int gpio;
+    char *channel;
+
+    if (!PyArg_ParseTuple(args, "s", &channel))
+        return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    gpio_stop_measure(gpio);
+
+    Py_RETURN_NONE;
+}
+
+// python function id = add_rule(channel, edge, output, action, value=HIGH, duration=0, duty=50.0, frequency=100.0)
+static PyObject *py_add_rule(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    char *channel, *output;
+    int edge, action, id;
+    int value = HIGH;
+    int duration = 0;
+    float duty = 50.0;
+    float frequency = 100.0;
+    struct rule_spec spec;
+    static char *kwlist[] = {"channel", "edge", "output", "action", "value", "duration", "duty", "frequency", NULL};
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sisi|iiff", kwlist, &channel, &edge, &output, &action,
+                                     &value, &duration, &duty, &frequency))
+        return NULL;
+
+    memset(&spec, 0, sizeof(spec));
+    if (get_gpio_number(channel, &spec.gpio_in) || get_gpio_number(output, &spec.gpio_out)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    if (edge != RISING_EDGE && edge != FALLING_EDGE && edge != BOTH_EDGE) {
+        PyErr_SetString(PyExc_ValueError, "The edge must be set to RISING, FALLING or BOTH");
+        return NULL;
+    }
+
+    if (action < RULE_SET || action > RULE_SPWM_STOP) {
+        PyErr_SetString(PyExc_ValueError, "The action must be RULE_SET, RULE_CLEAR, RULE_TOGGLE, RULE_PULSE, RULE_SPWM_START or RULE_SPWM_STOP");
+        return NULL;
+    }
+
+    if (action == RULE_PULSE && (duration <= 0 || (value != HIGH && value != LOW))) {
+        PyErr_SetString(PyExc_ValueError, "A RULE_PULSE needs a duration (us) and a value of HIGH or LOW");
+        return NULL;
+    }
+
+    if (action == RULE_SPWM_START && (duty < 0.0 || duty > 100.0 || frequency <= 0.0)) {
+        PyErr_SetString(PyExc_ValueError, "duty must be between 0.0 and 100.0 and frequency more than 0.0");
+        return NULL;
+    }
+
+    if (!gpio_is_evented(spec.gpio_in)) {
+        PyErr_SetString(PyExc_RuntimeError, "Add event detection using add_event_detect first before adding a rule");
+        return NULL;
+    }
+
+    // the softpwm sets up its own pin
+    if (action != RULE_SPWM_START && action != RULE_SPWM_STOP
+        && (!module_setup || gpio_get_setup_direction(spec.gpio_out) != OUTPUT)) {
+        PyErr_SetString(PyExc_RuntimeError, "You must setup() the output channel as an output first");
+        return NULL;
+    }
+
+    spec.edge = edge;
+    spec.action = action;
+    spec.value = value;
+    spec.pulse_us = duration;
+    spec.duty = duty;
+    spec.freq = frequency;
+
+    // may start a softpwm
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    id = gpio_add_rule(&spec);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (id < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Could not add the rule (%s)", get_error_msg());
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    return Py_BuildValue("i", id);
+}
+
+// python function remove_rule(id)
+static PyObject *py_remove_rule(PyObject *self, PyObject *args)
+{
+    int id;
+    int result;
+
+    if (!PyArg_ParseTuple(args, "i", &id))
+        return NULL;
+
+    // may stop a softpwm
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = gpio_remove_rule(id);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
+        PyErr_SetString(PyExc_ValueError, "No rule with this id");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// python function count = get_rule_fired(id)
+static PyObject *py_get_rule_fired(PyObject *self, PyObject *args)
+{
+    int id;
+
+    if (!PyArg_ParseTuple(args, "i", &id))
+        return NULL;
+
+    return Py_BuildValue("k", gpio_rule_fired(id));
+}
+
+// python function add_encoder(channel_a, channel_b, mode=X4)
+static PyObject *py_add_encoder(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int gpio_a, gpio_b;
+    char *channel_a, *channel_b;
+    int mode = ENCODER_X4;
+    int failed = 0;
+    static char *kwlist[] = {"channel_a", "channel_b", "mode", NULL};
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ss|i", kwlist, &channel_a, &channel_b, &mode))
+        return NULL;
+
+    if (check_edge_channel(channel_a, &gpio_a) < 0 || check_edge_channel(channel_b, &gpio_b) < 0)
+        return NULL;
+
+    if (mode != ENCODER_X1 && mode != ENCODER_X2 && mode != ENCODER_X4) {
+        PyErr_SetString(PyExc_ValueError, "The mode must be X1, X2 or X4");
+        return NULL;
+    }
+
+    if (gpio_a == gpio_b) {
+        PyErr_SetString(PyExc_ValueError, "The A and B channels must be different");
+        return NULL;
+    }
+
+    // the decoder needs every edge of both pins
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    if (add_edge_detect(gpio_a, BOTH_EDGE) != 0) {
+        failed = 1;
+    } else if (add_edge_detect(gpio_b, BOTH_EDGE) != 0) {
+        remove_edge_detect(gpio_a);
+        failed = 2;
+    } else if (gpio_add_encoder(gpio_a, gpio_b, mode) < 0) {
+        remove_edge_detect(gpio_a);
+        remove_edge_detect(gpio_b);
+        failed = 3;
+    }
+    Py_END_ALLOW_THREADS   // enable GIL
+
+    if (failed == 1) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to add edge detection to the A channel, is it already in use?");
+        return NULL;
+    }
+    if (failed == 2) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to add edge detection to the B channel, is it already in use?");
+        return NULL;
+    }
+    if (failed == 3) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Could not add the encoder (%s)", get_error_msg());
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// python function info = read_encoder(channel_a)
+static PyObject *py_read_encoder(PyObject *self, PyObject *args)
+{
+    int gpio;
+    char *channel;
+    struct encoder_info info;
+
+    if (!PyArg_ParseTuple(args, "s", &channel))
+        return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    if (gpio_read_encoder(gpio, &info) < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Channel is not the A channel of an encoder, call add_encoder first");
+        return NULL;
+    }
+
+    return Py_BuildValue("{s:L,s:d,s:k}",
+                         "position", (long long)info.position,
+                         "velocity", info.velocity,
+                         "errors", info.errors);
+}
+
+// python function reset_encoder(channel_a, position=0)
+static PyObject *py_reset_encoder(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int gpio;
+    char *channel;
+    long long position = 0;
+    static char *kwlist[] = {"channel_a", "position", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|L", kwlist, &channel, &position))
+        return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    if (gpio_reset_encoder(gpio, position) < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Channel is not the A channel of an encoder, call add_encoder first");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// python function remove_encoder(channel_a)
+static PyObject *py_remove_encoder(PyObject *self, PyObject *args)
+{
+    int gpio;
+    char *channel;
+    struct encoder_info info;
+
+    if (!PyArg_ParseTuple(args, "s", &channel))
+        return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    if (gpio_read_encoder(gpio, &info) < 0)
+        Py_RETURN_NONE;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    gpio_remove_encoder(gpio);
+    remove_edge_detect(info.gpio_a);
+    remove_edge_detect(info.gpio_b);
+    Py_END_ALLOW_THREADS   // enable GIL
+
+    Py_RETURN_NONE;
+}
+
+// python function add_edge_counter(channel, edge=RISING, window=1000, bouncetime=0)
+static PyObject *py_add_edge_counter(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int gpio;
+    char *channel;
+    int edge = RISING_EDGE;
+    int window = 1000;
+    unsigned int bouncetime = 0;
+    int result;
+    static char *kwlist[] = {"channel", "edge", "window", "bouncetime", NULL};
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|iiI", kwlist, &channel, &edge, &window, &bouncetime))
+        return NULL;
+
+    if (check_edge_channel(channel, &gpio) < 0)
+        return NULL;
+
+    if (edge != RISING_EDGE && edge != FALLING_EDGE && edge != BOTH_EDGE) {
+        PyErr_SetString(PyExc_ValueError, "The edge must be set to RISING, FALLING or BOTH");
+        return NULL;
+    }
+
+    if (window < COUNTER_BUCKETS || window > 4000000) {
+        char err[2000];
+        snprintf(err, sizeof(err), "window must be between %d and 4000000 ms", COUNTER_BUCKETS);
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = add_edge_detect(gpio, edge);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result != 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to add edge detection to the channel, is it already in use?");
+        return NULL;
+    }
+
+    if (set_py_bouncetime(gpio, bouncetime) < 0) {
+        Py_BEGIN_ALLOW_THREADS // disable GIL
+        remove_edge_detect(gpio);
+        Py_END_ALLOW_THREADS   // enable GIL
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    if ((result = gpio_start_counter(gpio, (unsigned int)window)) < 0)
+        remove_edge_detect(gpio);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Could not count channel %s (%s)", channel, get_error_msg());
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// python function info = read_counter(channel, reset=False)
+static PyObject *py_read_counter(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int gpio;
+    char *channel;
+    int reset = 0;
+    double rate;
+    uint64_t count;
+    static char *kwlist[] = {"channel", "reset", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|i", kwlist, &channel, &reset))
+        return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    if (!gpio_is_counter(gpio)) {
+        PyErr_SetString(PyExc_RuntimeError, "Channel is not counting, call add_edge_counter first");
+        return NULL;
+    }
+
+    // the rate first, so a reset does not lose the edges counted in between
+    rate = gpio_counter_rate(gpio);
+    count = gpio_read_counter(gpio, reset);
+
+    return Py_BuildValue("{s:K,s:d}",
+                         "count", (unsigned long long)count,
+                         "rate", rate);
+}
+
+// python function remove_edge_counter(channel)
+static PyObject *py_remove_edge_counter(PyObject *self, PyObject *args)
+{
+    int gpio;
+    char *channel;
+
+    if (!PyArg_ParseTuple(args, "s", &channel))
+        return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    if (!gpio_is_counter(gpio))
+        Py_RETURN_NONE;
+
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    gpio_stop_counter(gpio);
+    remove_edge_detect(gpio);
+    Py_END_ALLOW_THREADS   // enable GIL
+
+    Py_RETURN_NONE;
+}
+
+// python function fd = event_fileno()
+static PyObject *py_event_fileno(PyObject *self, PyObject *args)
+{
+    int fd;
+
+    clear_error_msg();
+
+    if ((fd = gpio_event_fileno()) < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Could not create the event fd (%s)", get_error_msg());
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    return Py_BuildValue("i", fd);
+}
+
+// python function set_debounce(channel, bouncetime=0, stabletime=0)
+static PyObject *py_set_debounce(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int gpio;
+    char *channel;
+    int bouncetime = 0;
+    int stabletime = 0;
+    static char *kwlist[] = {"channel", "bouncetime", "stabletime", NULL};
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|ii", kwlist, &channel, &bouncetime, &stabletime))
+        return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    if (bouncetime < 0 || bouncetime > 4000000 || stabletime < 0) {
+        PyErr_SetString(PyExc_ValueError, "bouncetime (ms) and stabletime (us) must be 0 or more");
+        return NULL;
+    }
+
+    if (gpio_set_debounce(gpio, (unsigned int)bouncetime * 1000, stabletime) < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Could not set debounce on channel %s (%s)", channel, get_error_msg());
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// python function info = get_debounce(channel)
+static PyObject *py_get_debounce(PyObject *self, PyObject *args)
+{
+    int gpio;
+    char *channel;
+    struct debounce_info info;
+
+    if (!PyArg_ParseTuple(args, "s", &channel))
+        return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    gpio_get_debounce(gpio, &info);
+
+    return Py_BuildValue("{s:I,s:I,s:k,s:k}",
+                         "bouncetime", info.lockout_us / 1000,
+                         "stabletime", info.stable_us,
+                         "bounced", info.bounced,
+                         "glitches", info.glitches);
+}
+
+// python function set_storm_limit(channel, max_events, interval=100, action=STORM_COALESCE, holdoff=1000)
+static PyObject *py_set_storm_limit(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int gpio;
+    char *channel;
+    int max_events;
+    int interval = 100;
+    int action = STORM_COALESCE;
+    int holdoff = 1000;
+    static char *kwlist[] = {"channel", "max_events", "interval", "action", "holdoff", NULL};
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "si|iii", kwlist, &channel, &max_events, &interval, &action, &holdoff))
+        return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    if (max_events < 0) {
+        PyErr_SetString(PyExc_ValueError, "max_events must be 0 (no limit) or more");
+        return NULL;
+    }
+
+    if (interval <= 0 || interval > 4000000 || holdoff <= 0 || holdoff > 4000000) {
+        PyErr_SetString(PyExc_ValueError, "interval and holdoff must be between 1 and 4000000 ms");
+        return NULL;
+    }
+
+    if (action != STORM_COALESCE && action != STORM_DISARM) {
+        PyErr_SetString(PyExc_ValueError, "The action must be STORM_COALESCE or STORM_DISARM");
+        return NULL;
+    }
+
+    if (gpio_set_storm_limit(gpio, max_events, (unsigned int)interval * 1000, action, (unsigned int)holdoff * 1000) < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Could not set the storm limit of channel %s (%s)", channel, get_error_msg());
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// python function info = get_storm_stats(channel, reset=False)
+static PyObject *py_get_storm_stats(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int gpio;
+    char *channel;
+    int reset = 0;
+    struct storm_info info;
+    static char *kwlist[] = {"channel", "reset", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|i", kwlist, &channel, &reset))
+        return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    gpio_get_storm_stats(gpio, &info, reset);
+
+    return Py_BuildValue("{s:I,s:I,s:i,s:I,s:k,s:k,s:k,s:O,s:K}",
+                         "max_events", info.max_events,
+                         "interval", info.interval_us / 1000,
+                         "action", info.action,
+                         "holdoff", info.holdoff_us / 1000,
+                         "storms", info.storms,
+                         "suppressed", info.suppressed,
+                         "disarms", info.disarms,
+                         "disarmed", info.disarmed ? Py_True : Py_False,
+                         "last_storm", (unsigned long long)info.last_storm);
+}
+
+// python function set_watchdog(channel, timeout, level=WATCHDOG_ANY, repeat=False, callback=None)
+static PyObject *py_set_watchdog(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int gpio;
+    char *channel;
+    int timeout;
+    int level = WATCHDOG_ANY;
+    int repeat = 0;
+    PyObject *cb_func = NULL;
+    static char *kwlist[] = {"channel", "timeout", "level", "repeat", "callback", NULL};
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "si|iiO", kwlist, &channel, &timeout, &level, &repeat, &cb_func))
+        return NULL;
+
+    if (cb_func == Py_None)
+        cb_func = NULL;
+    if (cb_func != NULL && !PyCallable_Check(cb_func)) {
+        PyErr_SetString(PyExc_TypeError, "Parameter must be callable");
+        return NULL;
+    }
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    if (timeout < 0 || timeout > 4000000) {
+        PyErr_SetString(PyExc_ValueError, "timeout must be between 0 (off) and 4000000 ms");
+        return NULL;
+    }
+
+    if (level != WATCHDOG_ANY && level != LOW && level != HIGH) {
+        PyErr_SetString(PyExc_ValueError, "The level must be WATCHDOG_ANY, LOW or HIGH");
+        return NULL;
+    }
+
+    if (timeout > 0 && !gpio_is_evented(gpio)) {
+        PyErr_SetString(PyExc_RuntimeError, "Add event detection using add_event_detect first before adding a watchdog");
+        return NULL;
+    }
+
+    if (gpio_set_watchdog(gpio, (unsigned int)timeout * 1000, level, repeat) < 0) {
+        char err[2000];
+        snprintf(err, sizeof(err), "Could not set the watchdog of channel %s (%s)", channel, get_error_msg());
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    // stays until remove_event_detect(), like the edge callbacks.  A channel
+    // has one, a new callback takes the place of the one before
+    if (cb_func != NULL && timeout > 0) {
+        struct py_callback *cb = py_callbacks;
+
+        while (cb != NULL && !(cb->gpio == gpio && cb->edge == WATCHDOG_EDGE))
+            cb = cb->next;
+        if (cb != NULL) {
+            PyObject *old = cb->py_cb;
+
+            Py_INCREF(cb_func);
+            cb->py_cb = cb_func;
+            Py_XDECREF(old);
+        } else if (add_py_callback(channel, gpio, WATCHDOG_EDGE, cb_func) != 0) {
+            return NULL;
+        }
+    }
+
+    Py_RETURN_NONE;
+}
+
+// python function info = get_watchdog(channel, reset=False)
+static PyObject *py_get_watchdog(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int gpio;
+    char *channel;
+    int reset = 0;
+    struct watchdog_info info;
+    static char *kwlist[] = {"channel", "reset", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|i", kwlist, &channel, &reset))
+        return NULL;
+
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
+
+    gpio_get_watchdog(gpio, &info, reset);
+
+    return Py_BuildValue("{s:I,s:i,s:O,s:k,s:O,s:K}",
+                         "timeout", info.timeout_us / 1000,
+                         "level", info.level,
+                         "repeat", info.repeat ? Py_True : Py_False,
+                         "timeouts", info.timeouts,
+                         "expired", info.expired ? Py_True : Py_False,
+                         "last_timeout", (unsigned long long)info.last_timeout);
+}
+
+// python function set_dispatch_policy(policy)
+static PyObject *py_set_dispatch_policy(PyObject *self, PyObject *args)
+{
+    int policy;
+
+    clear_error_msg();
+
+    if (!PyArg_ParseTuple(args, "i", &policy))
+        return NULL;
+
+    if (gpio_set_dispatch_policy(policy) < 0) {
+        PyErr_SetString(PyExc_ValueError, "Invalid dispatch policy, use DISPATCH_QUEUE, DISPATCH_COALESCE or DISPATCH_DROP_OLDEST");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
 }
 
-// python function py_wait_for_edge(gpio, edge)
-static PyObject *py_wait_for_edge(PyObject *self, PyObject *args)
+// python function policy = get_dispatch_policy()
+static PyObject *py_get_dispatch_policy(PyObject *self, PyObject *args)
 {
-   int gpio;
-   int edge, result;
-   char *channel;
-   char error[81];
-   int allowed = -1;
-
-   clear_error_msg();
-
-   if (!PyArg_ParseTuple(args, "si", &channel, &edge))
-      return NULL;
+    return Py_BuildValue("i", gpio_get_dispatch_policy());
+}
 
-   if (get_gpio_number(channel, &gpio)) {
-       PyErr_SetString(PyExc_ValueError, "Invalid channel");
-       return NULL;
-   }
+// python function stats = get_dispatch_stats(reset=False)
+static PyObject *py_get_dispatch_stats(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int reset = 0;
+    struct dispatch_stats stats;
+    static char *kwlist[] = {"reset", NULL};
 
-    // Check to see if GPIO is allowed on the hardware
-    // A 1 means we're good to go
-    allowed = gpio_allowed(gpio);
-    if (allowed == -1) {
-        char err[2000];
-        snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
-        PyErr_SetString(PyExc_ValueError, err);
-        return NULL;
-    } else if (allowed == 0) {
-        char err[2000];
-        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
-        PyErr_SetString(PyExc_ValueError, err);
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &reset))
         return NULL;
-    }
 
-   // check to ensure gpio is one of the allowed pins
-   if (gpio != lookup_gpio_by_name("AP-EINT3")
-       && gpio != lookup_gpio_by_name("AP-EINT1")
-       && !(gpio >= lookup_gpio_by_name("XIO-P0") && gpio <= lookup_gpio_by_name("XIO-P7"))) {
-     PyErr_SetString(PyExc_ValueError, "Edge Detection currently available on AP-EINT1, AP-EINT3, and XIO-P0 to XIO-P7 only");
-     return NULL;
-   }
+    gpio_get_dispatch_stats(&stats, reset);
 
-   // is edge a valid value?
-   if (edge != RISING_EDGE && edge != FALLING_EDGE && edge != BOTH_EDGE)
-   {
-      PyErr_SetString(PyExc_ValueError, "The edge must be set to RISING, FALLING or BOTH");
-      return NULL;
-   }
+    return Py_BuildValue("{s:k,s:k,s:k,s:k,s:k,s:I}",
+                         "queued", stats.queued,
+                         "dispatched", stats.dispatched,
+                         "dropped", stats.dropped,
+                         "coalesced", stats.coalesced,
+                         "batches", stats.batches,
+                         "max_depth", stats.max_depth);
+}
 
-   // check channel is setup as an input
-   if (!module_setup || dyn_int_array_get(&gpio_direction, gpio, -1) != INPUT)
-   {
-      PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an input first");
-      return NULL;
-   }
+// python function stats = get_poll_stats(reset=False)
+static PyObject *py_get_poll_stats(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int reset = 0;
+    struct poll_stats stats;
+    static char *kwlist[] = {"reset", NULL};
 
-   Py_BEGIN_ALLOW_THREADS // disable GIL
-   result = blocking_wait_for_edge(gpio, edge);
-   Py_END_ALLOW_THREADS   // enable GIL
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &reset))
+        return NULL;
 
-   if (result == 0) {
-      Py_INCREF(Py_None);
-      return Py_None;
-   } else if (result == 2) {
-      PyErr_SetString(PyExc_RuntimeError, "Edge detection events already enabled for this GPIO channel");
-      return NULL;
-   } else {
-      snprintf(error, sizeof(error), "Error #%d waiting for edge", result); BUF2SMALL(error);
-      PyErr_SetString(PyExc_RuntimeError, error);
-      return NULL;
-   }
+    gpio_get_poll_stats(&stats, reset);
 
-   Py_RETURN_NONE;
+    return Py_BuildValue("{s:k,s:k,s:I,s:I}",
+                         "wakeups", stats.wakeups,
+                         "events", stats.events,
+                         "last_batch", stats.last_batch,
+                         "max_batch", stats.max_batch);
 }
 
-// python function value = gpio_function(gpio)
-static PyObject *py_gpio_function(PyObject *self, PyObject *args)
+static PyObject *poll_thread_dict(const struct poll_thread_info *info)
 {
-    int gpio;
-    unsigned int value;
-    PyObject *func;
-    char *channel;
-    int allowed = -1;
+    return Py_BuildValue("{s:i,s:i,s:i,s:O,s:s,s:O}",
+                         "policy", info->policy,
+                         "priority", info->priority,
+                         "cpu", info->cpu,
+                         "lock_memory", info->lock_memory ? Py_True : Py_False,
+                         "name", info->name,
+                         "running", info->running ? Py_True : Py_False);
+}
 
-    clear_error_msg();
+// python function info = set_poll_thread(policy=SCHED_OTHER, priority=0, cpu=-1, lock_memory=False, name=None)
+static PyObject *py_set_poll_thread(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    struct poll_thread_info want, info;
+    char *name = NULL;
+    PyObject *dict, *honoured, *error;
+    int result;
+    static char *kwlist[] = {"policy", "priority", "cpu", "lock_memory", "name", NULL};
 
-    if (!PyArg_ParseTuple(args, "s", &channel))
-       return NULL;
+    clear_error_msg();
 
-    if (get_gpio_number(channel, &gpio)) {
-        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+    memset(&want, 0, sizeof(want));
+    want.policy = SCHED_OTHER;
+    want.cpu = -1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|iiiiz", kwlist, &want.policy, &want.priority, &want.cpu, &want.lock_memory, &name))
         return NULL;
+
+    if (name != NULL) {
+        if (name[0] == '\0' || strlen(name) >= sizeof(want.name)) {
+            PyErr_SetString(PyExc_ValueError, "name must be 1 to 15 characters");
+            return NULL;
+        }
+        strcpy(want.name, name);
     }
 
-    // Check to see if GPIO is allowed on the hardware
-    // A 1 means we're good to go
-    allowed = gpio_allowed(gpio);
-    if (allowed == -1) {
-        char err[2000];
-        snprintf(err, sizeof(err), "Error determining hardware. (%s)", get_error_msg());
-        PyErr_SetString(PyExc_ValueError, err);
-        return NULL;
-    } else if (allowed == 0) {
+    if ((result = gpio_set_poll_thread(&want)) < 0) {
         char err[2000];
-        snprintf(err, sizeof(err), "GPIO %d not available on current Hardware", gpio);
+        snprintf(err, sizeof(err), "Invalid poll thread settings (%s)", get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
         return NULL;
     }
 
-    if (setup_error)
-    {
-        PyErr_SetString(PyExc_RuntimeError, "Module not imported correctly!");
-        return NULL;
+    // True when in effect, None until add_event_detect() starts the thread
+    if (result == 0)
+        honoured = Py_True;
+    else if (result == 1)
+        honoured = Py_None;
+    else
+        honoured = Py_False;
+    Py_INCREF(honoured);
+
+    if (result == 2) {
+        error = Py_BuildValue("s", get_error_msg());
+    } else {
+        Py_INCREF(Py_None);
+        error = Py_None;
     }
 
-    if (gpio_get_direction(gpio, &value) < 0) {
-      char err[1024];
-      snprintf(err, sizeof(err), "Could not get direction ('%s')", get_error_msg());
-      PyErr_SetString(PyExc_RuntimeError, err);
-      return NULL;
+    gpio_get_poll_thread(&info);
+    if ((dict = poll_thread_dict(&info)) == NULL
+        || PyDict_SetItemString(dict, "honoured", honoured) < 0
+        || PyDict_SetItemString(dict, "error", error) < 0) {
+        Py_XDECREF(dict);
+        dict = NULL;
     }
-    func = Py_BuildValue("i", value);
-    return func;
+    Py_DECREF(honoured);
+    Py_XDECREF(error);
+
+    return dict;
 }
 
-// python function setwarnings(state)
-static PyObject *py_setwarnings(PyObject *self, PyObject *args)
+// python function info = get_poll_thread()
+static PyObject *py_get_poll_thread(PyObject *self, PyObject *args)
 {
-   clear_error_msg();
-
-   if (!PyArg_ParseTuple(args, "i", &gpio_warnings))
-      return NULL;
+    struct poll_thread_info info;
 
-   if (setup_error)
-   {
-      PyErr_SetString(PyExc_RuntimeError, "Module not imported correctly!");
-      return NULL;
-   }
+    gpio_get_poll_thread(&info);
 
-   Py_RETURN_NONE;
+    return poll_thread_dict(&info);
 }
 
-// python function base = get_xio_base()
-static PyObject *py_gpio_base(PyObject *self, PyObject *args)
+// python function set_event_stats(enable)
+static PyObject *py_set_event_stats(PyObject *self, PyObject *args)
 {
-   unsigned int value;
-   PyObject *py_value;
+    int enable;
 
-   clear_error_msg();
+    if (!PyArg_ParseTuple(args, "i", &enable))
+        return NULL;
 
-   value = get_xio_base();
-   if (value <= 0) {
-      char err[1024];
-      snprintf(err, sizeof(err), "Could not get XIO base ('%s')", get_error_msg());
-      PyErr_SetString(PyExc_RuntimeError, err);
-      return NULL;
-   }
-   py_value = Py_BuildValue("i", value);
+    gpio_set_event_stats(enable);
 
-   return py_value;
+    Py_RETURN_NONE;
 }
 
-// Internal unit tests
-extern pins_t pins_info[];
-static PyObject *py_selftest(PyObject *self, PyObject *args)
+static PyObject *build_event_hist(const struct event_hist *hist)
 {
-  int input;
-
-  clear_error_msg();
+    PyObject *buckets;
+    int i, last = 0;
 
-  if (!PyArg_ParseTuple(args, "i", &input))
-    return NULL;
+    // trailing empty buckets are left out
+    for (i = 0; i < EVENT_STATS_BUCKETS; i++)
+        if (hist->buckets[i])
+            last = i + 1;
 
-  printf("Testing get_xio_base\n");
-  int first_base = get_xio_base();  ASSRT(first_base > 0);
-  int second_base = get_xio_base();  ASSRT(second_base == first_base);
-  printf("base=%d\n", first_base);
+    if ((buckets = PyList_New(last)) == NULL)
+        return NULL;
+    for (i = 0; i < last; i++)
+        PyList_SET_ITEM(buckets, i, Py_BuildValue("k", hist->buckets[i]));
+
+    return Py_BuildValue("{s:k,s:K,s:K,s:K,s:K,s:K,s:N}",
+                         "count", hist->count,
+                         "mean", (unsigned long long)(hist->count ? hist->sum / hist->count : 0),
+                         "max", (unsigned long long)hist->max,
+                         "p50", (unsigned long long)event_hist_percentile(hist, 0.5),
+                         "p99", (unsigned long long)event_hist_percentile(hist, 0.99),
+                         "p999", (unsigned long long)event_hist_percentile(hist, 0.999),
+                         "buckets", buckets);
+}
 
-  printf("Testing lookup_gpio_by_key\n");
-  ASSRT(-1 == lookup_gpio_by_key("U13_1"));
-  ASSRT(48 == lookup_gpio_by_key("U13_9"));
-  ASSRT(47 == lookup_gpio_by_key("U13_11"));
-  ASSRT(first_base == lookup_gpio_by_key("U14_13"));
-  ASSRT((first_base+1) == lookup_gpio_by_key("U14_14"));
-  ASSRT((first_base+6) == lookup_gpio_by_key("U14_19"));
-  ASSRT((first_base+7) == lookup_gpio_by_key("U14_20"));
-  ASSRT(193 == lookup_gpio_by_key("U14_23"));
-  ASSRT(139 == lookup_gpio_by_key("U14_38"));
-  ASSRT(-1 == lookup_gpio_by_key("U14_40"));
-  ASSRT(-1 == lookup_gpio_by_key("NOTFOUND"));
-  ASSRT(-1 == lookup_gpio_by_key("U14_"));
-  ASSRT(-1 == lookup_gpio_by_key("U14_4000"));
+// python function stats = get_event_stats(channel, reset=False)
+static PyObject *py_get_event_stats(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int gpio;
+    char *channel;
+    int reset = 0;
+    struct event_hist hists[NUM_EVENT_STATS];
+    static char *kwlist[] = {"channel", "reset", NULL};
 
-  printf("Testing lookup_gpio_by_name\n");
-  ASSRT(-1 == lookup_gpio_by_name("GND"));
-  ASSRT(48 == lookup_gpio_by_name("TWI1-SDA"));
-  ASSRT(47 == lookup_gpio_by_name("TWI1-SCK"));
-  ASSRT(first_base == lookup_gpio_by_name("XIO-P0"));
-  ASSRT((first_base+6) == lookup_gpio_by_name("XIO-P6"));
-  ASSRT((first_base+7) == lookup_gpio_by_name("XIO-P7"));
-  ASSRT(139 == lookup_gpio_by_name("CSID7"));
-  ASSRT(-1 == lookup_gpio_by_name("NOTFOUND"));
-  ASSRT(-1 == lookup_gpio_by_name("CSID"));
-  ASSRT(-1 == lookup_gpio_by_name("CSID777"));
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|i", kwlist, &channel, &reset))
+        return NULL;
 
-  printf("Testing lookup_ain_by_key\n");
-  ASSRT(-1 == lookup_ain_by_key("U14_1"));
-  ASSRT(0 == lookup_ain_by_key("U14_11"));
-  ASSRT(-1 == lookup_ain_by_key("NOTFOUND"));
-  ASSRT(-1 == lookup_ain_by_key("U14_"));
-  ASSRT(-1 == lookup_ain_by_key("U14_1111"));
+    if (get_gpio_number(channel, &gpio)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return NULL;
+    }
 
-  printf("Testing lookup_ain_by_name\n");
-  ASSRT(-1 == lookup_ain_by_name("GND"));
-  ASSRT(0 == lookup_ain_by_name("LRADC"));
-  ASSRT(-1 == lookup_ain_by_name("NOTFOUND"));
-  ASSRT(-1 == lookup_ain_by_name("LR"));
-  ASSRT(-1 == lookup_ain_by_name("LRADCCC"));
+    gpio_get_event_stats(gpio, hists, reset);
 
-  char k[9];
+    return Py_BuildValue("{s:N,s:N,s:N,s:N}",
+                         "capture", build_event_hist(&hists[STAT_CAPTURE]),
+                         "read", build_event_hist(&hists[STAT_READ]),
+                         "dispatch", build_event_hist(&hists[STAT_DISPATCH]),
+                         "callback", build_event_hist(&hists[STAT_CALLBACK]));
+}
 
-  printf("Testing copy_key_by_key\n");
-  ASSRT(1 == copy_key_by_key("U13_1", k)); BUF2SMALL(k); ASSRT(0 == strcmp("U13_1", k));
-  ASSRT(1 == copy_key_by_key("U14_40", k)); BUF2SMALL(k); ASSRT(0 == strcmp("U14_40", k));
-  ASSRT(0 == copy_key_by_key("NOTFOUND", k));
-  ASSRT(0 == copy_key_by_key("U14_", k));
-  ASSRT(0 == copy_key_by_key("U14_4000", k));
+static PyObject *py_selftest_events(PyObject *self, PyObject *args)
+{
+  clear_error_msg();
 
-  printf("Testing copy_pwm_key_by_key\n");
-  ASSRT(1 == copy_pwm_key_by_key("U13_18", k)); BUF2SMALL(k); ASSRT(0 == strcmp("U13_18", k));
-  ASSRT(0 == copy_pwm_key_by_key("U13_1", k));
-  ASSRT(0 == copy_pwm_key_by_key("U14_40", k));
-  ASSRT(0 == copy_pwm_key_by_key("NOTFOUND", k));
-  ASSRT(0 == copy_pwm_key_by_key("U13_", k));
-  ASSRT(0 == copy_pwm_key_by_key("U13_1888", k));
+  event_selftest();
 
-  printf("Testing get_key_by_name\n");
-  ASSRT(1 == get_key_by_name("GND", k)); BUF2SMALL(k); ASSRT(0 == strcmp("U13_1", k));
-  ASSRT(1 == get_key_by_name("CSID7", k)); BUF2SMALL(k); ASSRT(0 == strcmp("U14_38", k));
-  ASSRT(0 == get_key_by_name("NOTFOUND", k));
-  ASSRT(0 == get_key_by_name("CSID", k));
-  ASSRT(0 == get_key_by_name("CSID777", k));
+  Py_RETURN_NONE;
+}
 
-  printf("Testing get_pwm_key_by_name\n");
-  ASSRT(1 == get_pwm_key_by_name("PWM0", k)); BUF2SMALL(k); ASSRT(0 == strcmp("U13_18", k));
-  ASSRT(0 == get_pwm_key_by_name("NOTFOUND", k));
-  ASSRT(0 == get_pwm_key_by_name("PWM", k));
-  ASSRT(0 == get_pwm_key_by_name("PWM000", k));
+// Internal unit tests for the GPIO character device layer, needs no hardware
+static PyObject *py_selftest_cdev(PyObject *self, PyObject *args)
+{
+  clear_error_msg();
 
-  char fp[80];
+  cdev_selftest();
 
-  printf("Testing build_path\n");
-  ASSRT(1 == build_path("/home", "ch", fp, sizeof(fp)));  ASSRT(0 == strcmp("/home/chip", fp));
-  ASSRT(1 == build_path("/home", "chip", fp, sizeof(fp)));  ASSRT(0 == strcmp("/home/chip", fp));
-  ASSRT(0 == build_path("/home", "NOTFOUND", fp, sizeof(fp)));
-  ASSRT(0 == build_path("/home", "chipp", fp, sizeof(fp)));
-  ASSRT(0 == build_path("/home", "ip", fp, sizeof(fp)));
-  ASSRT(0 == build_path("/NOTFOUND", "ch", fp, sizeof(fp)));
+  Py_RETURN_NONE;
+}
 
-  printf("Testing error message buffer\n");
+static PyObject *py_selftest_buses(PyObject *self, PyObject *args)
+{
   clear_error_msg();
-  ASSRT(0 == strlen(get_error_msg()));
-  char *s100 = "1234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890";
-  add_error_msg(s100);  ASSRT(100 == strlen(get_error_msg()));
-  // Subsequent messages added include a newline separator.
-  add_error_msg(s100);  add_error_msg(s100);  add_error_msg(s100);  ASSRT(403 == strlen(get_error_msg()));
-  add_error_msg(s100);  add_error_msg(s100);  add_error_msg(s100);  ASSRT(706 == strlen(get_error_msg()));
-  add_error_msg(s100);  add_error_msg(s100);  add_error_msg(s100);  ASSRT(1009 == strlen(get_error_msg()));
-  add_error_msg(s100);  add_error_msg(s100);  add_error_msg(s100);  ASSRT(1023 == strlen(get_error_msg()));
-
-  printf("Testing dynamic integer array\n");
-  dyn_int_array_t *my_array = NULL;
-  ASSRT(-2 == dyn_int_array_get(&my_array, 29, -2));  ASSRT(my_array->num_elements == 45);
-  dyn_int_array_set(&my_array, 44, 3, -2);            ASSRT(my_array->num_elements == 45);
-  ASSRT(3 == dyn_int_array_get(&my_array, 44, -2));   ASSRT(my_array->num_elements == 45);
-  dyn_int_array_set(&my_array, 45, 6, -2);            ASSRT(my_array->num_elements == 69);
-  ASSRT(6 == dyn_int_array_get(&my_array, 45, -2));   ASSRT(my_array->num_elements == 69);
-  dyn_int_array_delete(&my_array);
 
-  int value = input;
+  softspi_selftest();
+  softi2c_selftest();
+  softuart_selftest();
+  onewire_selftest();
+  dht_selftest();
 
-  PyObject *py_value = Py_BuildValue("i", value);
-  return py_value;
+  Py_RETURN_NONE;
 }
 
 static const char moduledocstring[] = "GPIO functionality of a CHIP using Python";
@@ -1100,6 +3316,7 @@ static PyObject *py_set_direction(PyObject *self, PyObject *args, PyObject *kwar
 	char *channel;
 	int direction;
 	int allowed = -1;
+	int result;
 	static char *kwlist[] = { "channel", "direction", NULL };
 
 	clear_error_msg();
@@ -1139,7 +3356,10 @@ static PyObject *py_set_direction(PyObject *self, PyObject *args, PyObject *kwar
         return NULL;
     }
 
-	if (gpio_set_direction(gpio, direction) < 0) {
+	Py_BEGIN_ALLOW_THREADS // disable GIL
+	result = gpio_set_direction(gpio, direction);
+	Py_END_ALLOW_THREADS   // enable GIL
+	if (result < 0) {
 		char err[2000];
 		snprintf(err, sizeof(err), "Error setting direction %d on channel %s. (%s)", direction, channel, get_error_msg());
 		PyErr_SetString(PyExc_RuntimeError, err);
@@ -1156,17 +3376,81 @@ PyMethodDef gpio_methods[] = {
    {"cleanup", (PyCFunction)py_cleanup, METH_VARARGS | METH_KEYWORDS, "Clean up by resetting all GPIO channels that have been used by this program to INPUT with no pullup/pulldown and no event detection"},
    {"output", py_output_gpio, METH_VARARGS, "Output to a GPIO channel\ngpio  - gpio channel\nvalue - 0/1 or False/True or LOW/HIGH"},
    {"input", py_input_gpio, METH_VARARGS, "Input from a GPIO channel.  Returns HIGH=1=True or LOW=0=False\ngpio - gpio channel"},
-   {"read_byte", py_read_byte_gpio, METH_VARARGS, "Read a byte (8 bits) from a set of GPIO channels. Returns 8-bits of integer data\ngpio - gpio channel."},
-   {"read_word", py_read_word_gpio, METH_VARARGS, "Read a word (16 bits) from a set of GPIO channels. Returns 16-bits of integer data\ngpio - gpio channel."},
-   {"add_event_detect", (PyCFunction)py_add_event_detect, METH_VARARGS | METH_KEYWORDS, "Enable edge detection events for a particular GPIO channel.\nchannel      - either board pin number or BCM number depending on which mode is set.\nedge         - RISING, FALLING or BOTH\n[callback]   - A callback function for the event (optional)\n[bouncetime] - Switch bounce timeout in ms for callback"},
+   {"read_byte", py_read_byte_gpio, METH_VARARGS, "Read a byte (8 bits) from a set of GPIO channels. Returns 8-bits of integer data\nchannel - first of 8 consecutive gpio channels, or a list of 8 channels (bit 0 first)"},
+   {"read_word", py_read_word_gpio, METH_VARARGS, "Read a word (16 bits) from a set of GPIO channels. Returns 16-bits of integer data\nchannel - first of 16 consecutive gpio channels, or a list of 16 channels (bit 0 first)"},
+   {"write_byte", py_write_byte_gpio, METH_VARARGS, "Write a byte (8 bits) to a set of GPIO channels at once\nchannel - first of 8 consecutive gpio channels, or a list of 8 channels (bit 0 first)\nvalue - bit i is written to channel i"},
+   {"write_word", py_write_word_gpio, METH_VARARGS, "Write a word (16 bits) to a set of GPIO channels at once\nchannel - first of 16 consecutive gpio channels, or a list of 16 channels (bit 0 first)\nvalue - bit i is written to channel i"},
+   {"write_mask", (PyCFunction)py_write_mask, METH_VARARGS | METH_KEYWORDS, "Write the masked bits of value to a set of GPIO channels at once\nchannels - first gpio channel of width consecutive channels, or a list of channels (bit 0 first)\nvalue - bit i is written to channel i\n[mask] - only channels whose mask bit is set are written, default all\n[width] - number of consecutive channels when a single channel is given, default 8"},
+   {"read_bus", (PyCFunction)py_read_bus, METH_VARARGS | METH_KEYWORDS, "Read a set of GPIO channels sampled together. Returns an integer, bit i is channel i\nchannels - first gpio channel of width consecutive channels, or a list of channels (bit 0 first)\n[width] - number of consecutive channels when a single channel is given, default 8"},
+   {"spi_open", (PyCFunction)py_spi_open, METH_VARARGS | METH_KEYWORDS, "Open a bit-banged SPI bus on any GPIO channels. Returns a handle for spi_transfer()\nsclk - clock channel\n[mosi] - data out channel, default None\n[miso] - data in channel, default None\n[cs] - chip select channel, default None\n[mode] - SPI mode 0..3, default 0\n[speed] - clock rate in Hz, 0 for as fast as possible, default 100000\n[lsb_first] - shift the least significant bit first, default False\n[cs_high] - chip select is active high, default False"},
+   {"spi_transfer", py_spi_transfer, METH_VARARGS, "Clock data out on a software SPI bus while reading the same number of bytes back. Returns bytes\nhandle - returned by spi_open()\ndata - bytes to send"},
+   {"spi_close", py_spi_close, METH_VARARGS, "Close a software SPI bus and release its channels\nhandle - returned by spi_open()"},
+   {"i2c_open", (PyCFunction)py_i2c_open, METH_VARARGS | METH_KEYWORDS, "Open a bit-banged I2C master on any two GPIO channels, both need a pull-up. Returns a handle for i2c_transfer()\nscl - clock channel\nsda - data channel\n[speed] - clock rate in Hz, 0 for as fast as possible, default 100000\n[timeout] - longest a slave may stretch the clock in ms, default 25"},
+   {"i2c_transfer", (PyCFunction)py_i2c_transfer, METH_VARARGS | METH_KEYWORDS, "Write to and/or read from an I2C device in one transaction, with a repeated start between the write and the read. Returns the bytes read\nhandle - returned by i2c_open()\naddress - 7 bit device address\n[write] - bytes to write, default none\n[read] - number of bytes to read, default 0"},
+   {"i2c_close", py_i2c_close, METH_VARARGS, "Close a software I2C bus and release its channels\nhandle - returned by i2c_open()"},
+   {"uart_open", (PyCFunction)py_uart_open, METH_VARARGS | METH_KEYWORDS, "Open a software UART on any GPIO channels. Returns a handle for the other uart_ functions\n[tx] - transmit channel, default None\n[rx] - receive channel, edge detection is added to it so AP-EINT1, AP-EINT3 or XIO-P0 to XIO-P7, default None\n[baudrate] - bits per second up to 115200, default 9600\n[bytesize] - data bits 5..8, default 8\n[parity] - 'N', 'E' or 'O', default 'N'\n[stopbits] - 1 or 2, default 1"},
+   {"uart_write", py_uart_write, METH_VARARGS, "Send bytes on a software UART, returns once the last stop bit is out. Returns the number of bytes sent\nhandle - returned by uart_open()\ndata - bytes to send"},
+   {"uart_read", (PyCFunction)py_uart_read, METH_VARARGS | METH_KEYWORDS, "Read received bytes from a software UART. Returns bytes, fewer than size if the timeout ran out\nhandle - returned by uart_open()\n[size] - number of bytes to read, default 1\n[timeout] - ms to wait for them, 0 returns what is there, negative waits forever, default 0"},
+   {"uart_in_waiting", py_uart_in_waiting, METH_VARARGS, "Number of received bytes uart_read() returns without waiting\nhandle - returned by uart_open()"},
+   {"uart_get_stats", (PyCFunction)py_uart_get_stats, METH_VARARGS | METH_KEYWORDS, "Get the receive counters of a software UART as a dict: received, framing, parity, overruns and noise\nhandle - returned by uart_open()\n[reset] - zero the counters after reading them, default False"},
+   {"uart_close", py_uart_close, METH_VARARGS, "Close a software UART and release its channels\nhandle - returned by uart_open()"},
+   {"ow_open", py_ow_open, METH_VARARGS, "Open a 1-Wire bus on a GPIO channel with an external pull-up, needs set_pio_mode(True) for its timing. Returns a handle for the other ow_ functions\nchannel - the bus channel"},
+   {"ow_reset", py_ow_reset, METH_VARARGS, "Send a 1-Wire reset pulse. Returns True if a device answered with a presence pulse\nhandle - returned by ow_open()"},
+   {"ow_search", py_ow_search, METH_VARARGS, "Find the ROM codes of all devices on a 1-Wire bus. Returns a list of 64 bit ints, family code in the low byte\nhandle - returned by ow_open()"},
+   {"ow_select", (PyCFunction)py_ow_select, METH_VARARGS | METH_KEYWORDS, "Reset a 1-Wire bus and address one device for the function command that follows\nhandle - returned by ow_open()\n[rom] - ROM code of the device, None addresses all of them, default None"},
+   {"ow_write", py_ow_write, METH_VARARGS, "Write bytes to a 1-Wire bus\nhandle - returned by ow_open()\ndata - bytes to write"},
+   {"ow_read", py_ow_read, METH_VARARGS, "Read bytes from a 1-Wire bus\nhandle - returned by ow_open()\nsize - number of bytes to read"},
+   {"ow_convert_all", (PyCFunction)py_ow_convert_all, METH_VARARGS | METH_KEYWORDS, "Start a temperature conversion on every device of a 1-Wire bus and wait for it\nhandle - returned by ow_open()\n[poll] - poll for the end, False waits 750 ms for parasite powered devices, default True"},
+   {"ow_read_temperatures", (PyCFunction)py_ow_read_temperatures, METH_VARARGS | METH_KEYWORDS, "Convert and read the temperature of DS18x20 devices on a 1-Wire bus. Returns a dict of ROM code to degrees C, None for a device that failed its CRC\nhandle - returned by ow_open()\n[roms] - ROM codes to read, None searches the bus, default None\n[poll] - as for ow_convert_all(), default True"},
+   {"ow_close", py_ow_close, METH_VARARGS, "Close a 1-Wire bus and release its channel\nhandle - returned by ow_open()"},
+   {"dht_read", (PyCFunction)py_dht_read, METH_VARARGS | METH_KEYWORDS, "Read a DHT11 or DHT22/AM2302 humidity and temperature sensor. Returns (humidity %RH, temperature C, retries), retries is how many reads failed first\nchannel - the sensor data channel, with a pull-up\n[sensor] - DHT11, DHT22 or AM2302, default DHT22\n[retries] - reads to try again after a missing answer or a bad checksum, 1 s (DHT11) or 2 s (DHT22) apart, default 3"},
+   {"add_event_detect", (PyCFunction)py_add_event_detect, METH_VARARGS | METH_KEYWORDS, "Enable edge detection events for a particular GPIO channel.\nchannel      - either board pin number or BCM number depending on which mode is set.\nedge         - RISING, FALLING or BOTH\n[callback]   - A callback function for the event (optional)\n[bouncetime] - Switch bounce timeout in ms, sets the channel's debounce bouncetime"},
    {"remove_event_detect", py_remove_event_detect, METH_VARARGS, "Remove edge detection for a particular GPIO channel\ngpio - gpio channel"},
    {"event_detected", py_event_detected, METH_VARARGS, "Returns True if an edge has occured on a given GPIO.  You need to enable edge detection using add_event_detect() first.\ngpio - gpio channel"},
-   {"add_event_callback", (PyCFunction)py_add_event_callback, METH_VARARGS | METH_KEYWORDS, "Add a callback for an event already defined using add_event_detect()\ngpio         - gpio channel\ncallback     - a callback function\n[bouncetime] - Switch bounce timeout in ms"},
-   {"wait_for_edge", py_wait_for_edge, METH_VARARGS, "Wait for an edge.\ngpio - gpio channel\nedge - RISING, FALLING or BOTH"},
+   {"add_event_callback", (PyCFunction)py_add_event_callback, METH_VARARGS | METH_KEYWORDS, "Add a callback for an event already defined using add_event_detect()\ngpio         - gpio channel\ncallback     - a callback function\n[bouncetime] - Switch bounce timeout in ms, sets the channel's debounce bouncetime"},
+   {"wait_for_edge", (PyCFunction)py_wait_for_edge, METH_VARARGS | METH_KEYWORDS, "Wait for an edge. Returns the channel that saw it, or None on timeout\nchannel - gpio channel, or a list of channels to wait on together\nedge - RISING, FALLING or BOTH\n[timeout] - ms to wait, default -1 waits forever"},
    {"gpio_function", py_gpio_function, METH_VARARGS, "Return the current GPIO function (IN, OUT, ALT0)\ngpio - gpio channel"},
    {"setwarnings", py_setwarnings, METH_VARARGS, "Enable or disable warning messages"},
    {"get_gpio_base", py_gpio_base, METH_VARARGS, "Get the XIO base number for sysfs"},
+   {"read_events", (PyCFunction)py_read_events, METH_VARARGS | METH_KEYWORDS, "Take the queued edges of channels with event detection. Returns a list of (channel, edge, timestamp, level, count) tuples, oldest first\n[channel] - only this channel, default every channel merged in timestamp order\n[max] - most edges to take, default 0 takes everything queued\ntimestamp is CLOCK_MONOTONIC in nanoseconds, level is the level after the edge, count is 1 unless a storm limit coalesced several edges"},
+   {"start_measure", (PyCFunction)py_start_measure, METH_VARARGS | METH_KEYWORDS, "Measure frequency, period and duty cycle of a channel in C from its edge timestamps. Needs add_event_detect() with BOTH for the duty cycle\nchannel - gpio channel\n[window] - ms the results are averaged over, default 100"},
+   {"read_measure", py_read_measure, METH_VARARGS, "Get the last measurement of a channel as a dict: frequency (Hz), period and high (mean ns), duty (0.0 to 1.0, None without falling edges), samples (periods averaged), edges, window (ms) and updated (CLOCK_MONOTONIC ns)\nA signal that stopped reads as 0 Hz"},
+   {"stop_measure", py_stop_measure, METH_VARARGS, "Stop measuring a channel\nchannel - gpio channel"},
+   {"add_rule", (PyCFunction)py_add_rule, METH_VARARGS | METH_KEYWORDS, "Run an action on an output straight from the C event path when an input sees an edge, no Python runs. Returns the rule id\nchannel - input channel, needs add_event_detect() first\nedge - RISING, FALLING or BOTH\noutput - output channel, setup() as an output except for the softpwm actions\naction - RULE_SET, RULE_CLEAR, RULE_TOGGLE, RULE_PULSE, RULE_SPWM_START or RULE_SPWM_STOP\n[value] - RULE_PULSE level, default HIGH\n[duration] - RULE_PULSE length in us\n[duty] - RULE_SPWM_START duty cycle in percent, default 50.0\n[frequency] - RULE_SPWM_START frequency in Hz, default 100.0"},
+   {"remove_rule", py_remove_rule, METH_VARARGS, "Remove a rule added with add_rule()\nid - rule id"},
+   {"get_rule_fired", py_get_rule_fired, METH_VARARGS, "Number of times a rule has run\nid - rule id"},
+   {"add_encoder", (PyCFunction)py_add_encoder, METH_VARARGS | METH_KEYWORDS, "Decode a quadrature encoder in C. Adds edge detection on both channels, which must be setup() as inputs\nchannel_a - A channel, counts up when A leads B\nchannel_b - B channel\n[mode] - X1, X2 or X4 (default) counts per Gray code cycle"},
+   {"read_encoder", py_read_encoder, METH_VARARGS, "Get an encoder as a dict: position (counts), velocity (counts per second) and errors (missed edges)\nchannel_a - A channel of the encoder"},
+   {"reset_encoder", (PyCFunction)py_reset_encoder, METH_VARARGS | METH_KEYWORDS, "Set the position of an encoder and zero its errors\nchannel_a - A channel of the encoder\n[position] - new position, default 0"},
+   {"remove_encoder", py_remove_encoder, METH_VARARGS, "Stop decoding an encoder and remove edge detection from both channels\nchannel_a - A channel of the encoder"},
+   {"add_edge_counter", (PyCFunction)py_add_edge_counter, METH_VARARGS | METH_KEYWORDS, "Count the edges of a channel in C without queueing events or running callbacks. Adds edge detection, the channel must be setup() as an input\nchannel - gpio channel\n[edge] - RISING (default), FALLING or BOTH\n[window] - ms the rate is taken over, default 1000\n[bouncetime] - ms, default 0"},
+   {"read_counter", (PyCFunction)py_read_counter, METH_VARARGS | METH_KEYWORDS, "Get an edge counter as a dict: count (edges since the start or the last reset) and rate (edges per second over the window)\nchannel - gpio channel\n[reset] - zero the count after reading it, default False"},
+   {"remove_edge_counter", py_remove_edge_counter, METH_VARARGS, "Stop counting a channel and remove its edge detection\nchannel - gpio channel"},
+   {"event_fileno", py_event_fileno, METH_VARARGS, "Returns a file descriptor that becomes readable when edges are queued, for select(), poll() or an event loop\nread_events() with no arguments takes the edges and re-arms it, do not read the fd yourself"},
+   {"get_event_overflows", (PyCFunction)py_get_event_overflows, METH_VARARGS | METH_KEYWORDS, "Number of edges dropped because a channel's event queue was full\n[channel] - only this channel, default the total of every channel"},
+   {"set_debounce", (PyCFunction)py_set_debounce, METH_VARARGS | METH_KEYWORDS, "Filter the edges of a channel before they reach event_detected(), read_events() and callbacks\nchannel - gpio channel\n[bouncetime] - ms after an accepted edge during which further edges are dropped, default 0 (off)\n[stabletime] - us the level must hold after an edge for it to count, default 0 (off)"},
+   {"get_debounce", py_get_debounce, METH_VARARGS, "Get the debounce settings and counters of a channel as a dict: bouncetime (ms), stabletime (us), bounced and glitches"},
+   {"set_storm_limit", (PyCFunction)py_set_storm_limit, METH_VARARGS | METH_KEYWORDS, "Limit the edges of a channel that reach event_detected(), read_events() and callbacks, so a chattering input cannot swamp the process\nchannel - gpio channel\nmax_events - edges delivered per interval, 0 removes the limit\n[interval] - ms, default 100\n[action] - STORM_COALESCE (default) delivers the edges over the limit as one record at the end of the interval, STORM_DISARM also stops watching the channel for holdoff ms\n[holdoff] - ms, default 1000"},
+   {"get_storm_stats", (PyCFunction)py_get_storm_stats, METH_VARARGS | METH_KEYWORDS, "Get the storm limit of a channel as a dict: max_events, interval (ms), action, holdoff (ms), storms (intervals over the limit), suppressed (edges held back), disarms, disarmed and last_storm (CLOCK_MONOTONIC ns, 0 if never)\nchannel - gpio channel\n[reset] - zero the counters after reading them, default False"},
+   {"set_watchdog", (PyCFunction)py_set_watchdog, METH_VARARGS | METH_KEYWORDS, "Watch a channel with event detection for a missing heartbeat or a stuck level. A timeout is queued for read_events() with edge WATCHDOG and runs the watchdog callback\nchannel - gpio channel\ntimeout - ms without an edge, 0 turns the watchdog off\n[level] - WATCHDOG_ANY (default) times out when no edge comes, LOW or HIGH when the channel stays at that level\n[repeat] - time out again every timeout ms while it lasts, default False\n[callback] - function called with the channel on a timeout, kept until remove_event_detect(), replaces the one set before"},
+   {"get_watchdog", (PyCFunction)py_get_watchdog, METH_VARARGS | METH_KEYWORDS, "Get the watchdog of a channel as a dict: timeout (ms), level, repeat, timeouts, expired (timed out and no edge since) and last_timeout (CLOCK_MONOTONIC ns, 0 if never)\nchannel - gpio channel\n[reset] - zero the timeout count after reading it, default False"},
+   {"set_dispatch_policy", py_set_dispatch_policy, METH_VARARGS, "Choose what happens when callbacks fall behind the edges\npolicy - DISPATCH_QUEUE (default) runs every edge and drops new edges on a full queue, DISPATCH_COALESCE runs a channel's callbacks once for all its pending edges, DISPATCH_DROP_OLDEST runs every edge and drops the oldest on a full queue"},
+   {"get_dispatch_policy", py_get_dispatch_policy, METH_VARARGS, "Get the callback dispatch policy"},
+   {"get_dispatch_stats", (PyCFunction)py_get_dispatch_stats, METH_VARARGS | METH_KEYWORDS, "Get the callback dispatcher counters as a dict: queued, dispatched, dropped, coalesced, batches and max_depth\n[reset] - zero the counters after reading them"},
+   {"get_poll_stats", (PyCFunction)py_get_poll_stats, METH_VARARGS | METH_KEYWORDS, "Get the event poll thread counters as a dict: wakeups, events, last_batch and max_batch\n[reset] - zero the counters after reading them"},
+   {"set_poll_thread", (PyCFunction)py_set_poll_thread, METH_VARARGS | METH_KEYWORDS, "Set how the event poll thread is scheduled, before or after add_event_detect(). Returns get_poll_thread() plus honoured (True, False if the system refused a setting, None until the thread starts) and error\n[policy] - SCHED_OTHER (default), SCHED_FIFO or SCHED_RR\n[priority] - 1 to 99 for SCHED_FIFO and SCHED_RR, default 0\n[cpu] - CPU to pin the thread to, default -1 for any\n[lock_memory] - mlockall() the whole process, default False\n[name] - thread name, up to 15 characters"},
+   {"get_poll_thread", py_get_poll_thread, METH_NOARGS, "Get the scheduling of the event poll thread as a dict: policy, priority, cpu (-1 when not pinned), lock_memory, name and running. Read back from the thread while it runs"},
+   {"set_event_stats", py_set_event_stats, METH_VARARGS, "Enable or disable the event latency histograms\nenable - True/False"},
+   {"get_event_stats", (PyCFunction)py_get_event_stats, METH_VARARGS | METH_KEYWORDS, "Get the event latency histograms of a channel as a dict of stages: capture (edge to poll wakeup, chardev only), read (wakeup to value read), dispatch (edge to C callback) and callback (edge to Python callback)\nEach stage is a dict of count, mean, max, p50, p99 and p999 in ns, and buckets where bucket i counts latencies below 2**i ns\nchannel - gpio channel\n[reset] - zero the histograms after reading them"},
    {"selftest", py_selftest, METH_VARARGS, "Internal unit tests"},
+   {"selftest_pio", py_selftest_pio, METH_VARARGS, "Internal unit tests for the memory mapped PIO register access"},
+   {"selftest_cdev", py_selftest_cdev, METH_VARARGS, "Internal unit tests for the GPIO character device backend"},
+   {"selftest_buses", py_selftest_buses, METH_VARARGS, "Internal unit tests for the bit-banged buses"},
+   {"selftest_events", py_selftest_events, METH_VARARGS, "Internal unit tests for the per GPIO state and event handling"},
+   {"set_backend", py_set_backend, METH_VARARGS, "Select how GPIO channels set up afterwards are accessed\nbackend - BACKEND_SYSFS (default, /sys/class/gpio) or BACKEND_CDEV (/dev/gpiochipN line handles, falls back to sysfs for lines without a chardev)"},
+   {"get_backend", py_get_backend, METH_VARARGS, "Return the GPIO backend in use, BACKEND_SYSFS or BACKEND_CDEV"},
+   {"set_pio_mode", py_set_pio_mode, METH_VARARGS, "Enable or disable direct PIO register access for output, input and direction changes on R8 pins (not XIO).  Needs /dev/mem\nenable - True/False"},
+   {"get_pio_mode", py_get_pio_mode, METH_VARARGS, "Returns True if direct PIO register access is enabled"},
    {"direction", (PyCFunction)py_set_direction, METH_VARARGS | METH_KEYWORDS, "Change direction of gpio channel. Either INPUT or OUTPUT\n" },
    {"setmode", (PyCFunction)py_setmode, METH_VARARGS, "Dummy function that does nothing but maintain compatibility with RPi.GPIO\n" },
    {"toggle_debug", py_toggle_debug, METH_VARARGS, "Toggles the enabling/disabling of Debug print output"},
@@ -1208,6 +3492,8 @@ PyMODINIT_FUNC initGPIO(void)
    if (!PyEval_ThreadsInitialized())
       PyEval_InitThreads();
 
+   gpio_set_dispatch_hooks(dispatch_enter_python, dispatch_leave_python);
+
    if (Py_AtExit(event_cleanup) != 0)
    {
       setup_error = 1;
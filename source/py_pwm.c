@@ -38,7 +38,9 @@ SOFTWARE.
 static PyObject *py_cleanup(PyObject *self, PyObject *args)
 {
     // unexport the PWM
+    Py_BEGIN_ALLOW_THREADS // disable GIL
     pwm_cleanup();
+    Py_END_ALLOW_THREADS   // enable GIL
 
     Py_RETURN_NONE;
 }
@@ -130,7 +132,11 @@ static PyObject *py_start_channel(PyObject *self, PyObject *args, PyObject *kwar
         return NULL;
     }
 
-    if (pwm_start(key, duty_cycle, frequency, polarity) < 0) {
+    int result;
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = pwm_start(key, duty_cycle, frequency, polarity);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
         char err[2000];
         snprintf(err, sizeof(err), "Unable to start PWM: %s (%s)", channel, get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
@@ -172,7 +178,11 @@ static PyObject *py_stop_channel(PyObject *self, PyObject *args, PyObject *kwarg
         return NULL;
     }
 
-    if (pwm_disable(key) < 0) {
+    int result;
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = pwm_disable(key);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
         char err[2000];
         snprintf(err, sizeof(err), "PWM: %s issue: (%s)", channel, get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
@@ -221,7 +231,11 @@ static PyObject *py_set_duty_cycle(PyObject *self, PyObject *args, PyObject *kwa
         return NULL;
     }
 
-    if (pwm_set_duty_cycle(key, duty_cycle) == -1) {
+    int result;
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = pwm_set_duty_cycle(key, duty_cycle);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result == -1) {
         char err[2000];
         snprintf(err, sizeof(err), "PWM: %s issue: (%s)", channel, get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
@@ -278,7 +292,11 @@ static PyObject *py_set_pulse_width_ns(PyObject *self, PyObject *args, PyObject
         return NULL;
     }
 
-    if (pwm_set_pulse_width_ns(key, pulse_width_ns) < 0) {
+    int result;
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = pwm_set_pulse_width_ns(key, pulse_width_ns);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
         char err[2000];
         snprintf(err, sizeof(err), "PWM: %s issue: (%s)", channel, get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
@@ -327,7 +345,11 @@ static PyObject *py_set_frequency(PyObject *self, PyObject *args, PyObject *kwar
         return NULL;
     }
 
-    if (pwm_set_frequency(key, frequency) < 0) {
+    int result;
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = pwm_set_frequency(key, frequency);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
         char err[2000];
         snprintf(err, sizeof(err), "PWM: %s issue: (%s)", channel, get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
@@ -376,7 +398,11 @@ static PyObject *py_set_period_ns(PyObject *self, PyObject *args, PyObject *kwar
         return NULL;
     }
 
-    if (pwm_set_period_ns(key, period_ns) < 0) {
+    int result;
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = pwm_set_period_ns(key, period_ns);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
         char err[2000];
         snprintf(err, sizeof(err), "PWM: %s issue: (%s)", channel, get_error_msg());
         PyErr_SetString(PyExc_ValueError, err);
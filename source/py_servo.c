@@ -51,7 +51,9 @@ static PyObject *py_toggle_debug(PyObject *self, PyObject *args)
 static PyObject *py_cleanup(PyObject *self, PyObject *args)
 {
     // unexport the Servo
+    Py_BEGIN_ALLOW_THREADS // disable GIL
     servo_cleanup();
+    Py_END_ALLOW_THREADS   // enable GIL
 
     Py_RETURN_NONE;
 }
@@ -128,7 +130,11 @@ static PyObject *py_start_channel(PyObject *self, PyObject *args, PyObject *kwar
         return NULL;
     }
 
-    if (servo_start(key, angle, range) < 0) {
+    int result;
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = servo_start(key, angle, range);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
        printf("servo_start failed");
        char err[2000];
        snprintf(err, sizeof(err), "Error starting servo on pin %s (%s)", key, get_error_msg());
@@ -180,7 +186,9 @@ static PyObject *py_stop_channel(PyObject *self, PyObject *args, PyObject *kwarg
         return NULL;
     }
 
+    Py_BEGIN_ALLOW_THREADS // disable GIL
     servo_disable(key);
+    Py_END_ALLOW_THREADS   // enable GIL
 
     Py_RETURN_NONE;
 }
@@ -233,7 +241,11 @@ static PyObject *py_set_range(PyObject *self, PyObject *args, PyObject *kwargs)
         return NULL;
     }
 
-    if (servo_set_range(key, range) == -1) {
+    int result;
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = servo_set_range(key, range);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result == -1) {
         PyErr_SetString(PyExc_RuntimeError, "You must start() the Servo channel first");
         return NULL;
     }
@@ -289,7 +301,11 @@ static PyObject *py_set_angle(PyObject *self, PyObject *args, PyObject *kwargs)
         return NULL;
     }
 
-    if (servo_set_angle(key, angle) == -1) {
+    int result;
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = servo_set_angle(key, angle);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result == -1) {
        char err[2000];
        snprintf(err, sizeof(err), "Error setting servo angle on pin %s (%s)", key, get_error_msg());
        PyErr_SetString(PyExc_RuntimeError, err);
@@ -47,7 +47,9 @@ static PyObject *py_toggle_debug(PyObject *self, PyObject *args)
 static PyObject *py_cleanup(PyObject *self, PyObject *args)
 {
     // unexport the PWM
+    Py_BEGIN_ALLOW_THREADS // disable GIL
     softpwm_cleanup();
+    Py_END_ALLOW_THREADS   // enable GIL
 
     Py_RETURN_NONE;
 }
@@ -136,7 +138,11 @@ static PyObject *py_start_channel(PyObject *self, PyObject *args, PyObject *kwar
         return NULL;
     }
 
-    if (softpwm_start(key, duty_cycle, frequency, polarity) < 0) {
+    int result;
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = softpwm_start(key, duty_cycle, frequency, polarity, 1);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result < 0) {
        printf("softpwm_start failed");
        char err[2000];
        snprintf(err, sizeof(err), "Error starting softpwm on pin %s (%s)", key, get_error_msg());
@@ -184,7 +190,9 @@ static PyObject *py_stop_channel(PyObject *self, PyObject *args, PyObject *kwarg
         return NULL;
     }
 
+    Py_BEGIN_ALLOW_THREADS // disable GIL
     softpwm_disable(key);
+    Py_END_ALLOW_THREADS   // enable GIL
 
     Py_RETURN_NONE;
 }
@@ -233,7 +241,11 @@ static PyObject *py_set_duty_cycle(PyObject *self, PyObject *args, PyObject *kwa
         return NULL;
     }
 
-    if (softpwm_set_duty_cycle(key, duty_cycle) == -1) {
+    int result;
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = softpwm_set_duty_cycle(key, duty_cycle);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result == -1) {
         PyErr_SetString(PyExc_RuntimeError, "You must start() the PWM channel first");
         return NULL;
     }
@@ -285,7 +297,11 @@ static PyObject *py_set_frequency(PyObject *self, PyObject *args, PyObject *kwar
         return NULL;
     }
 
-    if (softpwm_set_frequency(key, frequency) == -1) {
+    int result;
+    Py_BEGIN_ALLOW_THREADS // disable GIL
+    result = softpwm_set_frequency(key, frequency);
+    Py_END_ALLOW_THREADS   // enable GIL
+    if (result == -1) {
         PyErr_SetString(PyExc_RuntimeError, "You must start() the PWM channel first");
         return NULL;
     }
@@ -0,0 +1,79 @@
+#!/usr/bin/python
+
+# Edge to callback latency benchmark
+# Loop an output back to an input (CSID0 to XIO-P2 by default, the same
+# wiring as gptest.py), toggle the output and print the latency percentiles
+# of each stage of the event path from GPIO.get_event_stats()
+
+import CHIP_IO.GPIO as GPIO
+import argparse
+import threading
+import time
+
+parser = argparse.ArgumentParser(description="CHIP_IO edge to callback latency benchmark")
+parser.add_argument("--output", default="CSID0", help="output channel driving the loopback")
+parser.add_argument("--input", default="XIO-P2", help="input channel with edge detection")
+parser.add_argument("--count", type=int, default=1000, help="number of edges to generate")
+parser.add_argument("--period", type=float, default=0.002, help="seconds between edges")
+parser.add_argument("--rt", type=int, default=0, help="run the poll thread under SCHED_FIFO at this priority")
+parser.add_argument("--cpu", type=int, default=-1, help="pin the poll thread to this CPU")
+parser.add_argument("--lock", action="store_true", help="lock the process memory")
+args = parser.parse_args()
+
+num_callbacks = 0
+done = threading.Event()
+
+def edgecallback(channel):
+    global num_callbacks
+    num_callbacks += 1
+    if num_callbacks >= args.count:
+        done.set()
+
+def fmt_ns(ns):
+    if ns >= 1000000:
+        return "%8.2f ms" % (ns / 1000000.0)
+    if ns >= 1000:
+        return "%8.2f us" % (ns / 1000.0)
+    return "%8d ns" % ns
+
+print("CHIP_IO VERSION: %s" % GPIO.VERSION)
+print("LOOPBACK %s -> %s, %d EDGES, %.1f ms APART" % (args.output, args.input, args.count, args.period * 1000))
+
+GPIO.setup(args.input, GPIO.IN)
+GPIO.setup(args.output, GPIO.OUT, initial=GPIO.LOW)
+GPIO.add_event_detect(args.input, GPIO.BOTH, edgecallback)
+if args.rt or args.cpu >= 0 or args.lock:
+    policy = GPIO.SCHED_FIFO if args.rt else GPIO.SCHED_OTHER
+    info = GPIO.set_poll_thread(policy, args.rt, cpu=args.cpu, lock_memory=args.lock, name="chipio-poll")
+    if not info["honoured"]:
+        print(" POLL THREAD SETTINGS NOT HONOURED: %s" % info["error"])
+info = GPIO.get_poll_thread()
+print("POLL THREAD: POLICY %d PRIORITY %d CPU %d LOCKED %s" % (info["policy"], info["priority"], info["cpu"], info["lock_memory"]))
+GPIO.set_event_stats(True)
+GPIO.get_event_stats(args.input, reset=True)
+GPIO.get_dispatch_stats(reset=True)
+
+level = GPIO.LOW
+for i in range(args.count):
+    level = GPIO.HIGH if level == GPIO.LOW else GPIO.LOW
+    GPIO.output(args.output, level)
+    time.sleep(args.period)
+
+if not done.wait(5):
+    print(" ONLY %d OF %d CALLBACKS RAN, IS %s CONNECTED TO %s?" % (num_callbacks, args.count, args.output, args.input))
+
+stats = GPIO.get_event_stats(args.input)
+GPIO.set_event_stats(False)
+
+print("\n%-10s %8s %11s %11s %11s %11s %11s" % ("STAGE", "COUNT", "MEAN", "P50", "P99", "P999", "MAX"))
+for stage in ["capture", "read", "dispatch", "callback"]:
+    s = stats[stage]
+    print("%-10s %8d %s %s %s %s %s" % (stage, s["count"], fmt_ns(s["mean"]), fmt_ns(s["p50"]),
+                                        fmt_ns(s["p99"]), fmt_ns(s["p999"]), fmt_ns(s["max"])))
+print("\nPERCENTILES ARE BUCKET UPPER BOUNDS (POWERS OF 2 NS)")
+print("CAPTURE IS ONLY MEASURED ON THE CHARDEV BACKEND, SYSFS EDGES HAVE NO KERNEL TIMESTAMP")
+
+dstats = GPIO.get_dispatch_stats()
+print("DISPATCH: %d QUEUED, %d DROPPED, MAX DEPTH %d" % (dstats["queued"], dstats["dropped"], dstats["max_depth"]))
+
+GPIO.cleanup()
@@ -0,0 +1,71 @@
+import pytest
+import os
+
+import CHIP_IO.GPIO as GPIO
+
+has_gpio = os.path.exists('/sys/class/gpio/export')
+
+CSID = ["CSID%d" % i for i in range(8)]
+
+def teardown_module(module):
+    GPIO.cleanup()
+
+class TestGPIOBus:
+    def test_read_bus_invalid_channel(self):
+        with pytest.raises(ValueError):
+            GPIO.read_bus("NOT-A-PIN")
+        with pytest.raises(ValueError):
+            GPIO.read_bus(["CSID0", "NOT-A-PIN"])
+
+    def test_read_bus_invalid_width(self):
+        with pytest.raises(ValueError):
+            GPIO.read_bus("CSID0", 0)
+        with pytest.raises(ValueError):
+            GPIO.read_bus("CSID0", 33)
+        with pytest.raises(ValueError):
+            GPIO.read_bus([])
+
+    @pytest.mark.skipif(not has_gpio, reason="needs sysfs gpio")
+    def test_read_byte_needs_every_pin_setup(self):
+        GPIO.setup("CSID0", GPIO.IN)
+        with pytest.raises(RuntimeError):
+            GPIO.read_byte("CSID0")
+        GPIO.cleanup()
+
+    @pytest.mark.skipif(not has_gpio, reason="needs sysfs gpio")
+    def test_read_byte_matches_inputs(self):
+        for pin in CSID:
+            GPIO.setup(pin, GPIO.IN)
+        expected = 0
+        for i, pin in enumerate(CSID):
+            expected |= GPIO.input(pin) << i
+        assert GPIO.read_byte("CSID0") == expected
+        assert GPIO.read_bus(CSID) == expected
+        assert GPIO.read_bus(list(reversed(CSID))) == int('{:08b}'.format(expected)[::-1], 2)
+        GPIO.cleanup()
+
+    def test_write_bus_invalid_channel(self):
+        with pytest.raises(ValueError):
+            GPIO.write_byte("NOT-A-PIN", 0)
+        with pytest.raises(ValueError):
+            GPIO.write_mask(["CSID0", "NOT-A-PIN"], 0)
+
+    @pytest.mark.skipif(not has_gpio, reason="needs sysfs gpio")
+    def test_write_byte_needs_outputs(self):
+        for pin in CSID:
+            GPIO.setup(pin, GPIO.IN)
+        with pytest.raises(RuntimeError):
+            GPIO.write_byte("CSID0", 0x55)
+        GPIO.cleanup()
+
+    @pytest.mark.skipif(not has_gpio, reason="needs sysfs gpio")
+    def test_write_byte_and_mask(self):
+        for pin in CSID:
+            GPIO.setup(pin, GPIO.OUT)
+        GPIO.write_byte("CSID0", 0xA5)
+        for i, pin in enumerate(CSID):
+            value = open('/sys/class/gpio/gpio%d/value' % (132 + i)).read()
+            assert int(value) == (0xA5 >> i) & 1
+        GPIO.write_mask(CSID, 0x00, 0x0F)
+        assert GPIO.read_byte("CSID0") == 0xA0
+        GPIO.cleanup()
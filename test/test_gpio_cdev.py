@@ -0,0 +1,48 @@
+import pytest
+import os
+
+import CHIP_IO.GPIO as GPIO
+
+has_gpiochip = os.path.exists('/dev/gpiochip0')
+
+def teardown_module(module):
+    GPIO.set_backend(GPIO.BACKEND_SYSFS)
+    GPIO.cleanup()
+
+class TestGPIOCharacterDevice:
+    def test_selftest_cdev(self):
+        # runs against a stubbed ioctl layer, no hardware needed
+        GPIO.selftest_cdev()
+
+    def test_default_backend(self):
+        assert GPIO.get_backend() == GPIO.BACKEND_SYSFS
+
+    def test_set_backend_invalid(self):
+        with pytest.raises(ValueError):
+            GPIO.set_backend(7)
+
+    @pytest.mark.skipif(has_gpiochip, reason="gpiochip present")
+    def test_set_backend_without_gpiochip(self):
+        with pytest.raises(RuntimeError):
+            GPIO.set_backend(GPIO.BACKEND_CDEV)
+        assert GPIO.get_backend() == GPIO.BACKEND_SYSFS
+
+    @pytest.mark.skipif(not has_gpiochip, reason="no /dev/gpiochip0, kernel older than 4.8")
+    def test_output_no_sysfs_export(self):
+        GPIO.set_backend(GPIO.BACKEND_CDEV)
+        GPIO.setup("CSID6", GPIO.OUT, initial=GPIO.HIGH)
+        assert not os.path.exists('/sys/class/gpio/gpio138')
+        assert GPIO.input("CSID6") == GPIO.HIGH
+        GPIO.output("CSID6", GPIO.LOW)
+        assert GPIO.input("CSID6") == GPIO.LOW
+        assert GPIO.gpio_function("CSID6") == GPIO.OUT
+        GPIO.cleanup()
+        GPIO.set_backend(GPIO.BACKEND_SYSFS)
+
+    @pytest.mark.skipif(not has_gpiochip, reason="no /dev/gpiochip0, kernel older than 4.8")
+    def test_input_direction(self):
+        GPIO.set_backend(GPIO.BACKEND_CDEV)
+        GPIO.setup("CSID6", GPIO.IN)
+        assert GPIO.gpio_function("CSID6") == GPIO.IN
+        GPIO.cleanup()
+        GPIO.set_backend(GPIO.BACKEND_SYSFS)
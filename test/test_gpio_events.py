@@ -0,0 +1,222 @@
+import asyncio
+import pytest
+import select
+
+import CHIP_IO.GPIO as GPIO
+
+def teardown_module(module):
+    GPIO.cleanup()
+
+class TestGPIOEvents:
+    def test_selftest_events(self):
+        # runs against a temporary file, no hardware needed
+        GPIO.selftest_events()
+
+    def test_poll_stats(self):
+        stats = GPIO.get_poll_stats(reset=True)
+        assert set(stats.keys()) == set(["wakeups", "events", "last_batch", "max_batch"])
+        stats = GPIO.get_poll_stats()
+        assert stats["wakeups"] == 0
+        assert stats["max_batch"] == 0
+
+    def test_poll_thread(self):
+        with pytest.raises(ValueError):
+            GPIO.set_poll_thread(policy=42)
+        with pytest.raises(ValueError):
+            # real time policies need a priority
+            GPIO.set_poll_thread(policy=GPIO.SCHED_FIFO)
+        with pytest.raises(ValueError):
+            GPIO.set_poll_thread(name="a-name-that-is-too-long")
+        info = GPIO.set_poll_thread(cpu=0, name="chipio-poll")
+        assert info["honoured"] in (True, None)
+        assert info["error"] is None
+        assert info["name"] == "chipio-poll"
+        info = GPIO.get_poll_thread()
+        assert info["policy"] == GPIO.SCHED_OTHER
+        assert info["cpu"] == 0
+        assert GPIO.set_poll_thread()["cpu"] == -1
+
+    def test_read_events_empty(self):
+        assert GPIO.read_events() == []
+        assert GPIO.read_events("CSID0", max=10) == []
+        assert GPIO.get_event_overflows() >= 0
+
+    def test_read_events_invalid(self):
+        with pytest.raises(ValueError):
+            GPIO.read_events("NOT-A-PIN")
+        with pytest.raises(ValueError):
+            GPIO.read_events(max=-1)
+        with pytest.raises(ValueError):
+            GPIO.get_event_overflows("NOT-A-PIN")
+
+    def test_dispatch_policy(self):
+        assert GPIO.get_dispatch_policy() == GPIO.DISPATCH_QUEUE
+        GPIO.set_dispatch_policy(GPIO.DISPATCH_COALESCE)
+        assert GPIO.get_dispatch_policy() == GPIO.DISPATCH_COALESCE
+        GPIO.set_dispatch_policy(GPIO.DISPATCH_DROP_OLDEST)
+        assert GPIO.get_dispatch_policy() == GPIO.DISPATCH_DROP_OLDEST
+        with pytest.raises(ValueError):
+            GPIO.set_dispatch_policy(42)
+        GPIO.set_dispatch_policy(GPIO.DISPATCH_QUEUE)
+
+    def test_dispatch_stats(self):
+        stats = GPIO.get_dispatch_stats(reset=True)
+        assert set(stats.keys()) == set(["queued", "dispatched", "dropped", "coalesced", "batches", "max_depth"])
+        assert GPIO.get_dispatch_stats()["queued"] == 0
+
+    def test_debounce_settings(self):
+        GPIO.set_debounce("CSID0", bouncetime=20, stabletime=500)
+        info = GPIO.get_debounce("CSID0")
+        assert info["bouncetime"] == 20
+        assert info["stabletime"] == 500
+        assert info["bounced"] == 0
+        assert info["glitches"] == 0
+        GPIO.set_debounce("CSID0")
+        assert GPIO.get_debounce("CSID0")["bouncetime"] == 0
+
+    def test_debounce_invalid(self):
+        with pytest.raises(ValueError):
+            GPIO.set_debounce("NOT-A-PIN", 10)
+        with pytest.raises(ValueError):
+            GPIO.set_debounce("CSID0", -1)
+        with pytest.raises(ValueError):
+            GPIO.get_debounce("NOT-A-PIN")
+
+    def test_event_stats(self):
+        GPIO.set_event_stats(True)
+        stats = GPIO.get_event_stats("CSID0", reset=True)
+        assert set(stats.keys()) == set(["capture", "read", "dispatch", "callback"])
+        for stage in stats.values():
+            assert set(stage.keys()) == set(["count", "mean", "max", "p50", "p99", "p999", "buckets"])
+        assert GPIO.get_event_stats("CSID0")["read"]["count"] == 0
+        assert GPIO.get_event_stats("CSID0")["read"]["buckets"] == []
+        GPIO.set_event_stats(False)
+
+    def test_event_stats_invalid(self):
+        with pytest.raises(ValueError):
+            GPIO.get_event_stats("NOT-A-PIN")
+
+    def test_wait_for_edge_invalid(self):
+        with pytest.raises(ValueError):
+            GPIO.wait_for_edge("NOT-A-PIN", GPIO.RISING)
+        with pytest.raises(ValueError):
+            GPIO.wait_for_edge([], GPIO.RISING, timeout=10)
+        with pytest.raises(ValueError):
+            GPIO.wait_for_edge(["CSID0", 5], GPIO.RISING, timeout=10)
+        with pytest.raises(ValueError):
+            # not an edge capable pin
+            GPIO.wait_for_edge(["CSID0"], GPIO.BOTH, timeout=10)
+
+    def test_event_fileno(self):
+        fd = GPIO.event_fileno()
+        assert fd >= 0
+        assert GPIO.event_fileno() == fd
+        # nothing queued, so a full drain leaves it unreadable
+        GPIO.read_events()
+        assert select.select([fd], [], [], 0)[0] == []
+
+    def test_event_reader(self):
+        import CHIP_IO.GPIOAsync as GPIOAsync
+        loop = asyncio.new_event_loop()
+        seen = []
+        reader = GPIOAsync.add_event_reader(lambda *event: seen.append(event), loop)
+        events = GPIOAsync.EventQueue(loop)
+        loop.run_until_complete(asyncio.sleep(0.01))
+        reader.close()
+        events.close()
+        loop.close()
+        assert seen == []
+        with pytest.raises(asyncio.QueueEmpty):
+            events.get_nowait()
+
+    def test_measure_invalid(self):
+        with pytest.raises(ValueError):
+            GPIO.start_measure("NOT-A-PIN")
+        with pytest.raises(ValueError):
+            GPIO.start_measure("CSID0", window=0)
+        with pytest.raises(RuntimeError):
+            # no add_event_detect() on the channel
+            GPIO.start_measure("CSID0")
+        with pytest.raises(RuntimeError):
+            GPIO.read_measure("CSID0")
+        GPIO.stop_measure("CSID0")
+
+    def test_encoder_invalid(self):
+        assert (GPIO.X1, GPIO.X2, GPIO.X4) == (1, 2, 4)
+        with pytest.raises(ValueError):
+            GPIO.add_encoder("NOT-A-PIN", "CSID1")
+        with pytest.raises(ValueError):
+            # not edge capable
+            GPIO.add_encoder("CSID0", "CSID1", mode=GPIO.X2)
+        with pytest.raises(RuntimeError):
+            GPIO.read_encoder("CSID0")
+        with pytest.raises(RuntimeError):
+            GPIO.reset_encoder("CSID0", position=10)
+        GPIO.remove_encoder("CSID0")
+
+    def test_storm_limit(self):
+        assert GPIO.STORM_COALESCE != GPIO.STORM_DISARM
+        with pytest.raises(ValueError):
+            GPIO.set_storm_limit("NOT-A-PIN", 10)
+        with pytest.raises(ValueError):
+            GPIO.set_storm_limit("CSID0", -1)
+        with pytest.raises(ValueError):
+            GPIO.set_storm_limit("CSID0", 10, interval=0)
+        with pytest.raises(ValueError):
+            GPIO.set_storm_limit("CSID0", 10, action=42)
+        GPIO.set_storm_limit("CSID0", 10, interval=50, action=GPIO.STORM_DISARM, holdoff=200)
+        stats = GPIO.get_storm_stats("CSID0", reset=True)
+        assert stats["max_events"] == 10
+        assert stats["interval"] == 50
+        assert stats["action"] == GPIO.STORM_DISARM
+        assert stats["holdoff"] == 200
+        assert stats["storms"] == 0
+        assert stats["disarmed"] is False
+        GPIO.set_storm_limit("CSID0", 0)
+        assert GPIO.get_storm_stats("CSID0")["max_events"] == 0
+
+    def test_watchdog_invalid(self):
+        assert GPIO.WATCHDOG not in (GPIO.RISING, GPIO.FALLING, GPIO.BOTH)
+        with pytest.raises(ValueError):
+            GPIO.set_watchdog("NOT-A-PIN", 100)
+        with pytest.raises(ValueError):
+            GPIO.set_watchdog("CSID0", -1)
+        with pytest.raises(ValueError):
+            GPIO.set_watchdog("CSID0", 100, level=2)
+        with pytest.raises(TypeError):
+            GPIO.set_watchdog("CSID0", 100, callback=42)
+        with pytest.raises(RuntimeError):
+            # no add_event_detect() on the channel
+            GPIO.set_watchdog("CSID0", 100, level=GPIO.LOW)
+        GPIO.set_watchdog("CSID0", 0)
+        info = GPIO.get_watchdog("CSID0", reset=True)
+        assert info["timeout"] == 0
+        assert info["timeouts"] == 0
+        assert info["expired"] is False
+
+    def test_edge_counter_invalid(self):
+        with pytest.raises(ValueError):
+            GPIO.add_edge_counter("NOT-A-PIN")
+        with pytest.raises(ValueError):
+            # not edge capable
+            GPIO.add_edge_counter("CSID0", window=100)
+        with pytest.raises(RuntimeError):
+            GPIO.read_counter("CSID0")
+        with pytest.raises(RuntimeError):
+            GPIO.read_counter("CSID0", reset=True)
+        GPIO.remove_edge_counter("CSID0")
+
+    def test_rules_invalid(self):
+        assert GPIO.RULE_SET != GPIO.RULE_CLEAR
+        with pytest.raises(ValueError):
+            GPIO.add_rule("NOT-A-PIN", GPIO.FALLING, "CSID1", GPIO.RULE_CLEAR)
+        with pytest.raises(ValueError):
+            GPIO.add_rule("CSID0", GPIO.FALLING, "CSID1", 42)
+        with pytest.raises(ValueError):
+            GPIO.add_rule("CSID0", GPIO.FALLING, "CSID1", GPIO.RULE_PULSE)
+        with pytest.raises(RuntimeError):
+            # no add_event_detect() on the input
+            GPIO.add_rule("CSID0", GPIO.FALLING, "CSID1", GPIO.RULE_CLEAR)
+        with pytest.raises(ValueError):
+            GPIO.remove_rule(99)
+        assert GPIO.get_rule_fired(99) == 0
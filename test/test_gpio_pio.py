@@ -0,0 +1,43 @@
+import pytest
+import os
+
+import CHIP_IO.GPIO as GPIO
+
+has_devmem = os.path.exists('/dev/mem') and os.path.exists('/sys/class/gpio/export')
+
+def teardown_module(module):
+    if GPIO.get_pio_mode():
+        GPIO.set_pio_mode(False)
+    GPIO.cleanup()
+
+class TestGPIOPioMode:
+    def test_selftest_pio(self):
+        # runs against an anonymous buffer, no hardware needed
+        GPIO.selftest_pio()
+        assert not GPIO.get_pio_mode()
+
+    @pytest.mark.skipif(not has_devmem, reason="needs the R8 PIO registers")
+    def test_output_through_registers(self):
+        GPIO.set_pio_mode(True)
+        assert GPIO.get_pio_mode()
+        GPIO.setup("CSID6", GPIO.OUT)
+        GPIO.output("CSID6", GPIO.HIGH)
+        value = open('/sys/class/gpio/gpio138/value').read()
+        assert int(value) == GPIO.HIGH
+        assert GPIO.input("CSID6") == GPIO.HIGH
+        GPIO.output("CSID6", GPIO.LOW)
+        value = open('/sys/class/gpio/gpio138/value').read()
+        assert int(value) == GPIO.LOW
+        assert GPIO.gpio_function("CSID6") == GPIO.OUT
+        GPIO.cleanup()
+        GPIO.set_pio_mode(False)
+
+    @pytest.mark.skipif(not has_devmem, reason="needs the R8 PIO registers")
+    def test_direction_through_registers(self):
+        GPIO.set_pio_mode(True)
+        GPIO.setup("CSID6", GPIO.IN)
+        assert GPIO.gpio_function("CSID6") == GPIO.IN
+        GPIO.direction("CSID6", GPIO.OUT)
+        assert GPIO.gpio_function("CSID6") == GPIO.OUT
+        GPIO.cleanup()
+        GPIO.set_pio_mode(False)
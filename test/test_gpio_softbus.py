@@ -0,0 +1,99 @@
+import pytest
+import os
+
+import CHIP_IO.GPIO as GPIO
+
+has_gpio = os.path.exists('/sys/class/gpio/export')
+
+def teardown_module(module):
+    GPIO.cleanup()
+
+class TestGPIOSoftBus:
+    def test_selftest_buses(self):
+        # loops the buses back through an anonymous PIO buffer, no hardware needed
+        GPIO.selftest_buses()
+        assert not GPIO.get_pio_mode()
+
+    def test_spi_open_invalid_channel(self):
+        with pytest.raises(ValueError):
+            GPIO.spi_open("NOT-A-PIN", mosi="CSID1")
+        with pytest.raises(ValueError):
+            GPIO.spi_open("CSID0", mosi="NOT-A-PIN")
+
+    def test_spi_invalid_handle(self):
+        with pytest.raises(RuntimeError):
+            GPIO.spi_transfer(99, b"\x00")
+        with pytest.raises(ValueError):
+            GPIO.spi_close(99)
+
+    @pytest.mark.skipif(not has_gpio, reason="needs sysfs gpio")
+    def test_spi_open_invalid_mode(self):
+        with pytest.raises(ValueError):
+            GPIO.spi_open("CSID0", mosi="CSID1", mode=4)
+        with pytest.raises(ValueError):
+            GPIO.spi_open("CSID0", mosi="CSID0")
+
+
+    def test_i2c_open_invalid_channel(self):
+        with pytest.raises(ValueError):
+            GPIO.i2c_open("NOT-A-PIN", "CSID1")
+        with pytest.raises(ValueError):
+            GPIO.i2c_open("CSID0", "CSID1", timeout=0)
+
+    def test_i2c_invalid_handle(self):
+        with pytest.raises(IOError):
+            GPIO.i2c_transfer(99, 0x50, b"\x00")
+        with pytest.raises(ValueError):
+            GPIO.i2c_transfer(99, 0x50, read=-1)
+        with pytest.raises(ValueError):
+            GPIO.i2c_close(99)
+
+    def test_uart_open_invalid(self):
+        with pytest.raises(ValueError):
+            GPIO.uart_open(tx="NOT-A-PIN")
+        with pytest.raises(ValueError):
+            GPIO.uart_open(tx="CSID0", parity="X")
+        with pytest.raises(ValueError):
+            GPIO.uart_open(tx="CSID0", baudrate=0)
+        # edge detection is not available on CSID1
+        with pytest.raises(ValueError):
+            GPIO.uart_open(tx="CSID0", rx="CSID1")
+
+    def test_uart_invalid_handle(self):
+        with pytest.raises(RuntimeError):
+            GPIO.uart_write(99, b"\x00")
+        with pytest.raises(RuntimeError):
+            GPIO.uart_read(99)
+        with pytest.raises(ValueError):
+            GPIO.uart_in_waiting(99)
+        with pytest.raises(ValueError):
+            GPIO.uart_get_stats(99)
+        with pytest.raises(ValueError):
+            GPIO.uart_close(99)
+
+    def test_ow_open_invalid_channel(self):
+        with pytest.raises(ValueError):
+            GPIO.ow_open("NOT-A-PIN")
+
+    def test_ow_invalid_handle(self):
+        with pytest.raises(IOError):
+            GPIO.ow_reset(99)
+        with pytest.raises(IOError):
+            GPIO.ow_search(99)
+        with pytest.raises(IOError):
+            GPIO.ow_select(99, 0x28)
+        with pytest.raises(IOError):
+            GPIO.ow_read_temperatures(99)
+        with pytest.raises(ValueError):
+            GPIO.ow_read(99, -1)
+        with pytest.raises(ValueError):
+            GPIO.ow_close(99)
+
+    def test_dht_read_invalid(self):
+        with pytest.raises(ValueError):
+            GPIO.dht_read("NOT-A-PIN")
+        with pytest.raises(ValueError):
+            GPIO.dht_read("CSID0", sensor=12)
+        with pytest.raises(ValueError):
+            GPIO.dht_read("CSID0", retries=-1)
+        assert GPIO.AM2302 == GPIO.DHT22